@@ -36,12 +36,32 @@ attribute vec2 diffuse_tex;
 attribute vec2 specular_tex;
 attribute vec3 normal;
 
+// Where this instance of the mesh sits in the model (from the node graph). Per-instance when drawn
+// with instancing; otherwise set once per draw.
+attribute mat4 instance_transform;
+
+// Skinned meshes: up to four bones per vertex, indexing the bone palette, with weights summing to one.
+attribute vec4 bone_indices;
+attribute vec4 bone_weights;
+
 uniform mat4 LightModelViewMatrix;
 uniform mat4 ViewMatrix;
 uniform mat4 ModelViewMatrix;
 uniform mat3 NormalMatrix;
 uniform mat4 ModelViewProjectionMatrix;
 
+// Positions may be stored as normalized 16-bit values relative to the mesh entry's bounding box.
+// For unquantized meshes the offset is zero and the scale is one.
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+// If set, normal.xy holds an octahedrally encoded normal instead of xyz.
+uniform int octahedral_normals;
+
+// Bone palette for skinned meshes (MAX_BONES in mesh.h), and whether this mesh uses it.
+uniform mat4 bones[32];
+uniform int skinned;
+
 varying vec3 normal0;
 
 varying vec4  diffuse;
@@ -50,13 +70,39 @@ varying vec4  specular;
 varying vec3  half_vector;
 varying vec3  ec_pos;
 
+// See Cigolle et al. (2014); matches octahedral_encode() in vertex_format.h.
+vec3 octahedral_decode(vec2 e) {
+  vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0.0) {
+    vec2 s = vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    v.xy = (1.0 - abs(v.yx)) * s;
+  }
+  return normalize(v);
+}
+
 void main() {
   specular = vec4(1.0, 1.0, 1.0, 1.0);
 
-  normal0 = normalize(NormalMatrix * normal);
+  vec4 entry_pos    = vec4(position_offset + position_scale * position, 1.0);
+  vec3 entry_normal = octahedral_normals != 0 ? octahedral_decode(normal.xy) : normal;
+
+  if (skinned != 0) {
+    mat4 skin = bone_weights.x * bones[int(bone_indices.x)] +
+                bone_weights.y * bones[int(bone_indices.y)] +
+                bone_weights.z * bones[int(bone_indices.z)] +
+                bone_weights.w * bones[int(bone_indices.w)];
+    entry_pos    = skin * entry_pos;
+    entry_normal = mat3(skin) * entry_normal;
+  }
+
+  vec3 model_pos    = vec3(instance_transform * entry_pos);
+  // Exact for rotations and uniform scales, which is what node graphs nearly always hold.
+  vec3 model_normal = mat3(instance_transform) * entry_normal;
+
+  normal0 = normalize(NormalMatrix * model_normal);
 
   // Get coordinates in camera frame.
-  ec_pos = vec3(ModelViewMatrix * vec4(position, 1.0));
+  ec_pos = vec3(ModelViewMatrix * vec4(model_pos, 1.0));
   vec3 ec_light_dir = vec3(ViewMatrix * vec4(gl_LightSource[0].spotDirection, 0.0));
 
   // Normally in a shading model, we use the half_vector to deal with the difference between
@@ -71,5 +117,5 @@ void main() {
   specular = gl_FrontMaterial.specular * gl_LightSource[0].specular;
   ambient  = gl_FrontMaterial.ambient * gl_LightSource[0].ambient;
 
-  gl_Position = ModelViewProjectionMatrix * vec4(position, 1.0);
+  gl_Position = ModelViewProjectionMatrix * vec4(model_pos, 1.0);
 }
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef BACKPRESSURE_H
+# define BACKPRESSURE_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+
+/*
+ * Load shedding for when subscribers can't keep up (--backpressure). Rather than let clouds queue up (and
+ * latency grow) or be conflated away after they've been rendered, the render loop asks a
+ * BackpressureController before each frame it would publish whether to render it, and at what
+ * resolution. Pressure comes from how many clouds are still queued for subscribers, and, from subscribers
+ * that acknowledge what they've received (see send_acknowledgement()), how far behind the slowest is.
+ */
+
+enum BackpressurePolicy {
+  BACKPRESSURE_OFF,
+  BACKPRESSURE_DROP,       // skip frames
+  BACKPRESSURE_RESOLUTION, // render at half, then a quarter, of the resolution
+  BACKPRESSURE_ADAPTIVE    // lower the resolution first, then skip frames
+};
+
+const unsigned int MAX_RESOLUTION_DIVISOR         = 4;
+const size_t       BACKPRESSURE_HOLD_FRAMES       = 5;  // frames after a change before making another
+const size_t       BACKPRESSURE_RECOVERY_FRAMES   = 30; // frames without pressure before raising the resolution
+const double       ACKNOWLEDGEMENT_TIMEOUT        = 2.0; // seconds; subscribers silent this long are forgotten
+
+
+/** Parses a --backpressure argument (off, drop, resolution, or adaptive), or returns false. */
+inline bool parse_backpressure_policy(const std::string& name, BackpressurePolicy& policy) {
+  if      (name == "off")        policy = BACKPRESSURE_OFF;
+  else if (name == "drop")       policy = BACKPRESSURE_DROP;
+  else if (name == "resolution") policy = BACKPRESSURE_RESOLUTION;
+  else if (name == "adaptive")   policy = BACKPRESSURE_ADAPTIVE;
+  else return false;
+  return true;
+}
+
+
+/** Keeps track of which published frames each acknowledging subscriber has acknowledged. */
+class AcknowledgementTracker {
+public:
+  AcknowledgementTracker(size_t history_ = 1024) : history(history_) { }
+
+  /** Note a frame as sent. Frame ids must increase. */
+  void published(uint64_t frame_id) {
+    if (sent.size() == history) sent.pop_front();
+    sent.push_back(frame_id);
+  }
+
+  /** Note an acknowledgement.
+   *
+   * @param[in] the subscriber's id.
+   * @param[in] the newest frame it has received.
+   * @param[in] the time, in seconds.
+   */
+  void acknowledged(uint32_t subscriber, uint64_t frame_id, double now) {
+    Acknowledgement& a = subscribers[subscriber];
+    a.frame_id = std::max(a.frame_id, frame_id);
+    a.time     = now;
+  }
+
+  /** Frames sent after the newest one the slowest subscriber has acknowledged (0 if none acknowledge). */
+  size_t unacknowledged(double now) {
+    uint64_t slowest = 0;
+    bool any = false;
+    for (std::map<uint32_t, Acknowledgement>::iterator it = subscribers.begin(); it != subscribers.end(); ) {
+      if (now - it->second.time > ACKNOWLEDGEMENT_TIMEOUT) { // gone
+        subscribers.erase(it++);
+        continue;
+      }
+      slowest = any ? std::min(slowest, it->second.frame_id) : it->second.frame_id;
+      any = true;
+      ++it;
+    }
+    if (!any) return 0;
+    return sent.end() - std::upper_bound(sent.begin(), sent.end(), slowest);
+  }
+
+private:
+  struct Acknowledgement {
+    Acknowledgement() : frame_id(0), time(0.0) { }
+    uint64_t frame_id;
+    double time;
+  };
+
+  size_t history;
+  std::deque<uint64_t> sent;
+  std::map<uint32_t, Acknowledgement> subscribers;
+};
+
+
+/** Decides, frame by frame, how to shed load when subscribers fall behind.
+ *
+ * There's pressure when max_queued clouds are still queued for subscribers, or when the slowest
+ * acknowledging subscriber is more than max_unacknowledged behind. Under pressure, the resolution is
+ * halved (down to a quarter) or, if the policy doesn't allow that or it's already as low as it goes, the
+ * frame is skipped. Changes are spaced out by a few frames, so the queues have time to respond, and the
+ * resolution only comes back up once pressure has been off for a while.
+ */
+class BackpressureController {
+public:
+  /** Constructor.
+   *
+   * @param[in] policy.
+   * @param[in] clouds queued for subscribers at which to shed load.
+   * @param[in] unacknowledged clouds beyond which to shed load (0 to ignore acknowledgements).
+   */
+  BackpressureController(BackpressurePolicy policy_, size_t max_queued_, size_t max_unacknowledged_)
+  : policy(policy_), max_queued(std::max<size_t>(max_queued_, 1)), max_unacknowledged(max_unacknowledged_),
+    divisor_(1), since_change(BACKPRESSURE_HOLD_FRAMES), calm(0), skipped(0), skipped_total(0), reductions(0)
+  { }
+
+  bool enabled() const { return policy != BACKPRESSURE_OFF; }
+
+  /** Decide about the next frame to be published.
+   *
+   * @param[in] clouds still queued for subscribers.
+   * @param[in] clouds sent but not yet acknowledged (see AcknowledgementTracker).
+   *
+   * \returns false if the frame should be skipped; otherwise, render it at 1/divisor() resolution.
+   */
+  bool admit(size_t queued, size_t unacknowledged) {
+    if (!enabled()) return true;
+    ++since_change;
+
+    bool pressure = queued >= max_queued || (max_unacknowledged && unacknowledged > max_unacknowledged);
+    bool relieved = queued <= max_queued / 2 && (!max_unacknowledged || unacknowledged <= max_unacknowledged / 2);
+
+    if (pressure) {
+      calm = 0;
+      bool may_reduce = policy == BACKPRESSURE_RESOLUTION || policy == BACKPRESSURE_ADAPTIVE;
+      if (may_reduce && divisor_ < MAX_RESOLUTION_DIVISOR) {
+        if (since_change >= BACKPRESSURE_HOLD_FRAMES) {
+          divisor_ *= 2;
+          since_change = 0;
+          ++reductions;
+        }
+      } else if (policy != BACKPRESSURE_RESOLUTION) {
+        ++skipped;
+        ++skipped_total;
+        return false;
+      }
+    } else if (relieved && divisor_ > 1 && ++calm >= BACKPRESSURE_RECOVERY_FRAMES) {
+      divisor_ /= 2;
+      since_change = 0;
+      calm = 0;
+    } else if (!relieved) {
+      calm = 0;
+    }
+
+    return true;
+  }
+
+  /** How much to divide the width and height by. */
+  unsigned int divisor() const { return divisor_; }
+
+  /** Frames skipped since the last call (for the header of the next frame sent). */
+  uint32_t take_skipped() {
+    uint32_t s = skipped;
+    skipped = 0;
+    return s;
+  }
+
+  size_t total_skipped() const { return skipped_total; }
+  size_t total_reductions() const { return reductions; }
+
+private:
+  BackpressurePolicy policy;
+  size_t max_queued, max_unacknowledged;
+  unsigned int divisor_;
+  size_t since_change, calm;
+  uint32_t skipped;
+  size_t skipped_total, reductions;
+};
+
+
+#endif // BACKPRESSURE_H
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef CAPTURE_SCHEDULER_H
+# define CAPTURE_SCHEDULER_H
+
+#include <time.h>
+#include <stdint.h>
+#include <algorithm>
+
+
+/** Nanoseconds on a monotonic clock, which changes to the system time don't affect. */
+inline uint64_t monotonic_ns() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+
+/** Decides when the sensor captures a frame, at a fixed rate on the monotonic clock (rather than every so
+ *  many trips through the render loop, whose rate depends on vsync, the model, and the machine).
+ *
+ * Deadlines fall on a fixed grid, so a late capture doesn't push back the ones after it. If a capture is
+ * so late that the next deadline has passed too, the deadlines in between are counted as missed and
+ * skipped, rather than rendered in a burst to catch up.
+ */
+class CaptureScheduler {
+public:
+  /** Constructor.
+   *
+   * @param[in] captures per second (0 to disable scheduling).
+   */
+  CaptureScheduler(double rate)
+  : period(rate > 0.0 ? static_cast<uint64_t>(1e9 / rate + 0.5) : 0), next_deadline(0), captures(0), misses(0),
+    worst_lateness(0)
+  { }
+
+  bool enabled() const { return period > 0; }
+
+  /** Nanoseconds between captures (0 if disabled). */
+  uint64_t period_ns() const { return period; }
+
+  /** Nanoseconds until the next capture is due (0 if it's due now). */
+  uint64_t time_until_due(uint64_t now = monotonic_ns()) const {
+    return now < next_deadline ? next_deadline - now : 0;
+  }
+
+  /** Start a capture if one is due.
+   *
+   * @param[out] acquisition time of the capture, in nanoseconds on the monotonic clock.
+   *
+   * \returns true if a capture is due (and now counted as started).
+   */
+  bool begin_capture(uint64_t& acquisition_time) {
+    uint64_t now = monotonic_ns();
+    if (!next_deadline) next_deadline = now; // the first capture is due right away
+    if (now < next_deadline) return false;
+
+    uint64_t late = now - next_deadline;
+    if (late >= period) {
+      misses        += late / period;
+      next_deadline += (late / period) * period;
+      late          %= period;
+    }
+    worst_lateness = std::max(worst_lateness, late);
+
+    acquisition_time = now;
+    next_deadline   += period;
+    ++captures;
+    return true;
+  }
+
+  size_t captured() const { return captures; }
+
+  /** Deadlines that passed without a capture. */
+  size_t missed() const { return misses; }
+
+  /** Latest a capture has started after its deadline, in nanoseconds (not counting missed deadlines). */
+  uint64_t worst_lateness_ns() const { return worst_lateness; }
+
+private:
+  uint64_t period;
+  uint64_t next_deadline;
+  size_t captures, misses;
+  uint64_t worst_lateness;
+};
+
+
+#endif // CAPTURE_SCHEDULER_H
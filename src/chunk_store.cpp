@@ -0,0 +1,754 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "chunk_store.h"
+#include "model_loader.h"
+
+const char     CHUNK_STORE_MAGIC[8] = {'G','L','I','D','C','H','K','\0'};
+const uint32_t CHUNK_STORE_VERSION  = 1;
+
+
+/*
+ * Fixed-size header at the start of a .gchunks file. Geometry follows it; the material and chunk tables
+ * come last (at table_offset), since their size isn't known until every chunk has been written.
+ */
+struct ChunkFileHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t chunk_count;
+  uint32_t material_count;
+  uint32_t reserved;
+  uint64_t table_offset;
+  float    bounds_min[3];
+  float    bounds_max[3];
+  float    centroid[3];
+};
+
+
+/*
+ * One triangle waiting in a spill file. Vertex indices are ids within the source mesh (see TriangleSink),
+ * which (since keys separate instances) lets us weld the chunk back together exactly.
+ */
+struct SpillTriangle {
+  uint64_t key;       // placement (mesh instance) and grid cell
+  uint32_t index[3];
+  Vertex   vertex[3];
+
+  bool operator<(const SpillTriangle& rhs) const { return key < rhs.key; }
+};
+
+
+template <typename T>
+static void write_value(std::ostream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+/*
+ * Reads values out of the mapped file without running past its end.
+ */
+class MappedReader {
+public:
+  MappedReader(const char* data_, size_t size_, size_t pos_) : data(data_), size(size_), pos(pos_) { }
+
+  template <typename T>
+  bool read(T& value) {
+    if (pos + sizeof(T) > size) return false;
+    memcpy(&value, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+  }
+
+  bool read(std::string& value) {
+    uint32_t length;
+    if (!read(length) || pos + length > size) return false;
+    value.assign(data + pos, length);
+    pos += length;
+    return true;
+  }
+
+private:
+  const char* data;
+  size_t size;
+  size_t pos;
+};
+
+
+/*
+ * Write one level's vertices and indices and record where they went.
+ */
+static void write_chunk_level(std::ostream& out, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, float error,
+                              std::vector<float>& level_errors, std::vector<uint64_t>& level_offsets,
+                              std::vector<uint32_t>& level_vertex_counts, std::vector<uint32_t>& level_index_counts) {
+  level_offsets.push_back(static_cast<uint64_t>(out.tellp()));
+  level_vertex_counts.push_back(vertices.size());
+  level_index_counts.push_back(indices.size());
+  level_errors.push_back(error);
+
+  if (!vertices.empty()) out.write(reinterpret_cast<const char*>(&vertices[0]), sizeof(Vertex) * vertices.size());
+  if (!indices.empty())  out.write(reinterpret_cast<const char*>(&indices[0]), sizeof(unsigned int) * indices.size());
+}
+
+
+/*
+ * The grid for a model, and how many spill files to bin its triangles into.
+ */
+struct ChunkGrid {
+  ChunkGrid(const glm::vec3& bounds_min_, const glm::vec3& bounds_max_, size_t triangle_count, size_t triangles_per_chunk)
+  : bounds_min(bounds_min_)
+  {
+    // Models are surfaces, so the number of occupied cells grows with the square of the grid resolution.
+    size = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(triangle_count) / std::max<size_t>(triangles_per_chunk, 1))));
+    size = std::min(std::max<size_t>(size, 1), MAX_CHUNK_GRID);
+
+    cell_size = (bounds_max_ - bounds_min) / static_cast<float>(size);
+    for (size_t k = 0; k < 3; ++k)
+      if (cell_size[k] <= 0.0f) cell_size[k] = 1.0f;
+
+    bucket_count = std::min(triangle_count / CHUNK_SPILL_TRIANGLES + 1, MAX_CHUNK_SPILL_FILES);
+
+    std::cerr << "Chunking " << triangle_count << " triangles on a " << size << "^3 grid, using "
+              << bucket_count << " spill files" << std::endl;
+  }
+
+  glm::vec3 bounds_min, cell_size;
+  size_t size, bucket_count;
+};
+
+
+/*
+ * Pass 1 of build(): spill every triangle into a bucket according to its placement (mesh instance) and the
+ * cell containing its centroid.
+ */
+class ChunkSpiller : public TriangleSink {
+public:
+  ChunkSpiller(const ChunkGrid& grid_) : grid(grid_) { }
+
+  ~ChunkSpiller() {
+    for (size_t b = 0; b < buckets.size(); ++b)
+      if (buckets[b]) fclose(buckets[b]);
+  }
+
+  bool open() {
+    buckets.assign(grid.bucket_count, static_cast<FILE*>(NULL));
+    for (size_t b = 0; b < buckets.size(); ++b) {
+      buckets[b] = tmpfile();
+      if (!buckets[b]) {
+        std::cerr << "Error: Unable to create spill file for chunking" << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void triangle(size_t placement, const Vertex* corners, const uint32_t* ids) {
+    SpillTriangle triangle;
+    glm::vec3 center(0.0f);
+    for (size_t k = 0; k < 3; ++k) {
+      triangle.index[k]  = ids[k];
+      triangle.vertex[k] = corners[k];
+      center += corners[k].pos;
+    }
+    center /= 3.0f;
+
+    size_t n = grid.size;
+    glm::vec3 cell = glm::floor((center - grid.bounds_min) / grid.cell_size);
+    uint64_t cx = std::min(static_cast<size_t>(std::max(cell.x, 0.0f)), n - 1),
+             cy = std::min(static_cast<size_t>(std::max(cell.y, 0.0f)), n - 1),
+             cz = std::min(static_cast<size_t>(std::max(cell.z, 0.0f)), n - 1);
+    triangle.key = ((static_cast<uint64_t>(placement) * n + cz) * n + cy) * n + cx;
+
+    fwrite(&triangle, sizeof(SpillTriangle), 1, buckets[triangle.key % buckets.size()]);
+  }
+
+  std::vector<FILE*> buckets;
+
+private:
+  const ChunkGrid& grid;
+};
+
+
+/*
+ * Pass 2 of build(): one bucket at a time, group triangles by cell, weld them, simplify, and write the
+ * chunk file.
+ */
+static bool write_chunk_file(const std::string& chunk_filename, ChunkSpiller& spiller, const ChunkGrid& grid,
+                             const std::vector<std::vector<std::string> >& materials,
+                             const std::vector<unsigned int>& placement_materials,
+                             const glm::vec3& bounds_min, const glm::vec3& bounds_max, const glm::vec3& centroid) {
+  std::vector<FILE*>& buckets = spiller.buckets;
+
+  std::ofstream out(chunk_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Error: Unable to write chunk file '" << chunk_filename << "'" << std::endl;
+    return false;
+  }
+
+  ChunkFileHeader header;
+  memset(&header, 0, sizeof(ChunkFileHeader));
+  memcpy(header.magic, CHUNK_STORE_MAGIC, 8);
+  header.version        = CHUNK_STORE_VERSION;
+  header.material_count = materials.size();
+  for (size_t k = 0; k < 3; ++k) {
+    header.bounds_min[k] = bounds_min[k];
+    header.bounds_max[k] = bounds_max[k];
+    header.centroid[k]   = centroid[k];
+  }
+  write_value(out, header); // placeholder; rewritten once the table offset is known
+
+  // Chunk table, accumulated as chunks are written.
+  std::vector<glm::vec3> chunk_min, chunk_max;
+  std::vector<uint32_t>  chunk_material, chunk_level_count;
+  std::vector<float>     level_errors;
+  std::vector<uint64_t>  level_offsets;
+  std::vector<uint32_t>  level_vertex_counts, level_index_counts;
+
+  for (size_t b = 0; b < buckets.size(); ++b) {
+    long bytes = ftell(buckets[b]);
+    std::vector<SpillTriangle> triangles(bytes / sizeof(SpillTriangle));
+    rewind(buckets[b]);
+    if (!triangles.empty() && fread(&triangles[0], sizeof(SpillTriangle), triangles.size(), buckets[b]) != triangles.size()) {
+      std::cerr << "Error: Short read from spill file " << b << std::endl;
+      return false;
+    }
+    fclose(buckets[b]);
+    buckets[b] = NULL;
+
+    std::sort(triangles.begin(), triangles.end());
+
+    for (size_t begin = 0; begin < triangles.size(); ) {
+      size_t end = begin;
+      while (end < triangles.size() && triangles[end].key == triangles[begin].key) ++end;
+
+      std::vector<Vertex> vertices;
+      std::vector<unsigned int> indices;
+      std::map<uint32_t, unsigned int> welded;
+
+      glm::vec3 cmin(triangles[begin].vertex[0].pos), cmax(cmin);
+
+      for (size_t t = begin; t < end; ++t) {
+        for (size_t k = 0; k < 3; ++k) {
+          std::map<uint32_t, unsigned int>::iterator it = welded.find(triangles[t].index[k]);
+          if (it == welded.end()) {
+            it = welded.insert(std::make_pair(triangles[t].index[k], static_cast<unsigned int>(vertices.size()))).first;
+            vertices.push_back(triangles[t].vertex[k]);
+            cmin = glm::min(cmin, triangles[t].vertex[k].pos);
+            cmax = glm::max(cmax, triangles[t].vertex[k].pos);
+          }
+          indices.push_back(it->second);
+        }
+      }
+
+      lod_chain_t chain;
+      build_lod_chain(vertices, indices, chain);
+
+      chunk_min.push_back(cmin);
+      chunk_max.push_back(cmax);
+      chunk_material.push_back(placement_materials[triangles[begin].key / (grid.size * grid.size * grid.size)]);
+      chunk_level_count.push_back(chain.size() + 1);
+
+      write_chunk_level(out, vertices, indices, 0.0f, level_errors, level_offsets, level_vertex_counts, level_index_counts);
+      for (size_t l = 0; l < chain.size(); ++l)
+        write_chunk_level(out, chain[l].vertices, chain[l].indices, chain[l].error, level_errors, level_offsets, level_vertex_counts, level_index_counts);
+
+      begin = end;
+    }
+  }
+
+  // Tables.
+  header.table_offset = static_cast<uint64_t>(out.tellp());
+  header.chunk_count  = chunk_min.size();
+
+  for (size_t i = 0; i < materials.size(); ++i) {
+    write_value(out, static_cast<uint32_t>(materials[i].size()));
+    for (size_t j = 0; j < materials[i].size(); ++j) {
+      write_value(out, static_cast<uint32_t>(materials[i][j].size()));
+      out.write(materials[i][j].data(), materials[i][j].size());
+    }
+  }
+
+  for (size_t c = 0, l = 0; c < chunk_min.size(); ++c) {
+    write_value(out, chunk_min[c]);
+    write_value(out, chunk_max[c]);
+    write_value(out, chunk_material[c]);
+    write_value(out, chunk_level_count[c]);
+    for (size_t j = 0; j < chunk_level_count[c]; ++j, ++l) {
+      write_value(out, level_offsets[l]);
+      write_value(out, level_vertex_counts[l]);
+      write_value(out, level_index_counts[l]);
+      write_value(out, level_errors[l]);
+    }
+  }
+
+  out.seekp(0);
+  write_value(out, header);
+  out.close();
+
+  if (!out) {
+    std::cerr << "Error: Failed while writing chunk file '" << chunk_filename << "'" << std::endl;
+    return false;
+  }
+
+  std::cerr << "Wrote " << header.chunk_count << " chunks to " << chunk_filename << std::endl;
+  return true;
+}
+
+
+/*
+ * PLY, OBJ, and STL models are streamed a triangle at a time, so they're never in memory all at once.
+ */
+static bool build_from_stream(const NativeTriangleStream& stream, const std::string& chunk_filename, size_t triangles_per_chunk) {
+  ChunkGrid grid(stream.bounds_min(), stream.bounds_max(), stream.triangle_count(), triangles_per_chunk);
+  ChunkSpiller spiller(grid);
+  if (!spiller.open()) return false;
+  if (!stream.read(spiller)) {
+    std::cerr << "Error: Unable to read the model's triangles again" << std::endl;
+    return false;
+  }
+
+  std::vector<unsigned int> placement_materials(stream.mesh_count());
+  for (size_t m = 0; m < stream.mesh_count(); ++m)
+    placement_materials[m] = stream.mesh_material(m);
+
+  return write_chunk_file(chunk_filename, spiller, grid, stream.materials(), placement_materials,
+                          stream.bounds_min(), stream.bounds_max(), stream.centroid());
+}
+
+
+bool ChunkStore::build(const std::string& model_filename, const std::string& chunk_filename, size_t triangles_per_chunk) {
+  if (has_native_loader(model_filename)) {
+    NativeTriangleStream stream;
+    if (stream.open(model_filename))
+      return build_from_stream(stream, chunk_filename, triangles_per_chunk);
+    std::cerr << "WARNING: Falling back on ASSIMP, which holds the whole model in memory" << std::endl;
+  }
+
+  Assimp::Importer importer;
+  const aiScene* scene = importer.ReadFile(model_filename.c_str(), aiProcess_Triangulate | aiProcess_GenNormals);
+  if (!scene) {
+    std::cerr << "Error parsing '" << model_filename << "': " << importer.GetErrorString() << std::endl;
+    return false;
+  }
+
+  // Chunks are static geometry, so instances from the node graph are flattened into model coordinates.
+  std::vector<std::pair<unsigned int, aiMatrix4x4> > placements;
+  if (scene->mRootNode) Mesh::collect_placements(scene->mRootNode, aiMatrix4x4(), placements);
+
+  // Same placements Mesh::init_instances() draws: skinned meshes once as-is, unreferenced meshes as-is.
+  std::vector<std::pair<unsigned int, aiMatrix4x4> > kept;
+  std::vector<bool> placed(scene->mNumMeshes, false);
+  for (size_t p = 0; p < placements.size(); ++p) {
+    unsigned int index = placements[p].first;
+    if (index >= scene->mNumMeshes) continue;
+    if (scene->mMeshes[index]->mNumBones) continue;
+    kept.push_back(placements[p]);
+    placed[index] = true;
+  }
+  for (size_t m = 0; m < scene->mNumMeshes; ++m)
+    if (!placed[m]) kept.push_back(std::make_pair(static_cast<unsigned int>(m), aiMatrix4x4()));
+  placements.swap(kept);
+
+  std::vector<glm::mat4> transforms(placements.size());
+  std::vector<glm::mat3> normal_transforms(placements.size());
+  for (size_t p = 0; p < placements.size(); ++p) {
+    transforms[p]        = Mesh::to_mat4(placements[p].second);
+    normal_transforms[p] = glm::inverseTranspose(glm::mat3(transforms[p]));
+  }
+
+  // Bounds, centroid, and triangle count of the whole model.
+  glm::vec3 bounds_min( std::numeric_limits<float>::max()),
+            bounds_max(-std::numeric_limits<float>::max());
+  glm::dvec3 centroid_sum(0.0);
+  size_t vertex_count = 0, triangle_count = 0;
+
+  for (size_t p = 0; p < placements.size(); ++p) {
+    const aiMesh* mesh = scene->mMeshes[placements[p].first];
+    if (mesh->mNumBones)
+      std::cerr << "WARNING: Mesh " << placements[p].first << " has bones; chunks will use its bind pose." << std::endl;
+
+    for (size_t i = 0; i < mesh->mNumVertices; ++i) {
+      glm::vec3 v(transforms[p] * glm::vec4(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z, 1.0f));
+      bounds_min = glm::min(bounds_min, v);
+      bounds_max = glm::max(bounds_max, v);
+      centroid_sum += glm::dvec3(v);
+    }
+    vertex_count   += mesh->mNumVertices;
+    triangle_count += mesh->mNumFaces;
+  }
+
+  if (triangle_count == 0) {
+    std::cerr << "Error: '" << model_filename << "' has no triangles to chunk" << std::endl;
+    return false;
+  }
+
+  ChunkGrid grid(bounds_min, bounds_max, triangle_count, triangles_per_chunk);
+  ChunkSpiller spiller(grid);
+  if (!spiller.open()) return false;
+
+  const aiVector3D zero_3d(0.0, 0.0, 0.0);
+
+  for (size_t p = 0; p < placements.size(); ++p) {
+    const aiMesh* mesh = scene->mMeshes[placements[p].first];
+
+    for (size_t f = 0; f < mesh->mNumFaces; ++f) {
+      const aiFace& face = mesh->mFaces[f];
+      if (face.mNumIndices != 3) continue;
+
+      // Vertex indices are the originals within the ASSIMP mesh.
+      Vertex corners[3];
+      uint32_t ids[3];
+      for (size_t k = 0; k < 3; ++k) {
+        unsigned int i = face.mIndices[k];
+        const aiVector3D* pos    = &(mesh->mVertices[i]);
+        const aiVector3D* normal = mesh->HasNormals() ? &(mesh->mNormals[i]) : &zero_3d;
+        const aiVector3D* diffuse_texture_coord  = mesh->HasTextureCoords(0) ? &(mesh->mTextureCoords[0][i]) : &zero_3d;
+        const aiVector3D* specular_texture_coord = mesh->HasTextureCoords(1) ? &(mesh->mTextureCoords[1][i]) : &zero_3d;
+
+        ids[k]     = i;
+        corners[k] = Vertex(glm::vec3(transforms[p] * glm::vec4(pos->x, pos->y, pos->z, 1.0f)),
+                            glm::vec2(diffuse_texture_coord->x, diffuse_texture_coord->y),
+                            glm::vec2(specular_texture_coord->x, specular_texture_coord->y),
+                            glm::normalize(normal_transforms[p] * glm::vec3(normal->x, normal->y, normal->z)));
+      }
+      spiller.triangle(p, corners, ids);
+    }
+  }
+
+  // Remember texture filenames; the runtime never sees the aiScene.
+  std::string dir = Mesh::model_directory(model_filename);
+  std::vector<std::vector<std::string> > materials(scene->mNumMaterials);
+  for (size_t i = 0; i < scene->mNumMaterials; ++i)
+    materials[i] = Mesh::material_texture_filenames(scene->mMaterials[i], dir);
+
+  std::vector<unsigned int> placement_materials(placements.size());
+  for (size_t p = 0; p < placements.size(); ++p)
+    placement_materials[p] = scene->mMeshes[placements[p].first]->mMaterialIndex;
+
+  importer.FreeScene();
+
+  return write_chunk_file(chunk_filename, spiller, grid, materials, placement_materials,
+                          bounds_min, bounds_max, glm::vec3(centroid_sum / static_cast<double>(vertex_count)));
+}
+
+
+bool ChunkStore::open(const std::string& filename) {
+  close();
+
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Error: Unable to open chunk file '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ChunkFileHeader)) {
+    std::cerr << "Error: '" << filename << "' is too short to be a chunk file" << std::endl;
+    close();
+    return false;
+  }
+
+  mapping_size = st.st_size;
+  void* addr = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    std::cerr << "Error: Unable to map chunk file '" << filename << "'" << std::endl;
+    mapping_size = 0;
+    close();
+    return false;
+  }
+  mapping = static_cast<char*>(addr);
+
+  // Chunks are visited in spatial, not file, order; readahead would mostly fetch things we don't need.
+  madvise(mapping, mapping_size, MADV_RANDOM);
+
+  ChunkFileHeader header;
+  memcpy(&header, mapping, sizeof(ChunkFileHeader));
+  if (memcmp(header.magic, CHUNK_STORE_MAGIC, 8) != 0 || header.version != CHUNK_STORE_VERSION) {
+    std::cerr << "Error: '" << filename << "' is not a version " << CHUNK_STORE_VERSION << " chunk file" << std::endl;
+    close();
+    return false;
+  }
+
+  min_extremities = glm::vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+  max_extremities = glm::vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+  centroid_       = glm::vec3(header.centroid[0], header.centroid[1], header.centroid[2]);
+
+  MappedReader reader(mapping, mapping_size, header.table_offset);
+  bool ok = true;
+
+  textures.resize(header.material_count, NULL);
+  for (size_t i = 0; ok && i < header.material_count; ++i) {
+    uint32_t count;
+    ok = reader.read(count);
+    std::vector<std::string> texture_filenames(count);
+    for (size_t j = 0; ok && j < count; ++j)
+      ok = reader.read(texture_filenames[j]);
+
+    if (ok) {
+      std::cerr << "Loading material " << i+1 << " of " << header.material_count << std::endl;
+      textures[i] = new Texture(texture_filenames);
+      textures[i]->load();
+    }
+  }
+
+  chunks.resize(header.chunk_count);
+  for (size_t c = 0; ok && c < header.chunk_count; ++c) {
+    Chunk& chunk = chunks[c];
+    uint32_t level_count;
+    ok = reader.read(chunk.bounds_min) && reader.read(chunk.bounds_max) && reader.read(chunk.material_index) && reader.read(level_count);
+
+    chunk.levels.resize(ok ? level_count : 0);
+    for (size_t l = 0; ok && l < chunk.levels.size(); ++l) {
+      Level& level = chunk.levels[l];
+      ok = reader.read(level.offset) && reader.read(level.vertex_count) && reader.read(level.index_count) && reader.read(level.error)
+        && level.offset + sizeof(Vertex) * level.vertex_count + sizeof(unsigned int) * level.index_count <= mapping_size;
+    }
+    ok = ok && !chunk.levels.empty();
+  }
+
+  if (!ok) {
+    std::cerr << "Error: Chunk file '" << filename << "' is truncated or corrupt" << std::endl;
+    close();
+    return false;
+  }
+
+  std::cerr << "Mapped " << chunks.size() << " chunks from " << filename << " (" << mapping_size / (1024*1024) << " MiB)" << std::endl;
+  return true;
+}
+
+
+void ChunkStore::close() {
+  for (size_t c = 0; c < chunks.size(); ++c)
+    evict(chunks[c]);
+  chunks.clear();
+
+  for (size_t i = 0; i < textures.size(); ++i)
+    delete textures[i];
+  textures.clear();
+
+  if (mapping) munmap(mapping, mapping_size);
+  mapping = NULL;
+  mapping_size = 0;
+
+  if (fd >= 0) ::close(fd);
+  fd = -1;
+}
+
+
+size_t ChunkStore::cull(const glm::mat4& model_view, float fov, float aspect, float& near_bound, float& far_bound) {
+  ++frame;
+
+  float tan_y = std::tan(fov * 0.5f),
+        tan_x = tan_y * aspect;
+
+  near_bound = std::numeric_limits<float>::max();
+  far_bound  = 0.0f;
+  size_t visible_count = 0;
+
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    Chunk& chunk = chunks[c];
+
+    float min_depth, max_depth;
+    chunk.visible = Mesh::box_in_frustum(model_view, chunk.bounds_min, chunk.bounds_max, tan_x, tan_y, min_depth, max_depth);
+    if (!chunk.visible) continue;
+
+    chunk.last_visible = frame;
+    ++visible_count;
+    near_bound = std::min(near_bound, min_depth);
+    far_bound  = std::max(far_bound, max_depth);
+  }
+
+  if (visible_count == 0) {
+    near_bound = MIN_NEAR_PLANE;
+    far_bound  = MIN_NEAR_PLANE * 2.0f;
+  } else if (near_bound < MIN_NEAR_PLANE) {
+    near_bound = MIN_NEAR_PLANE;
+  }
+
+  return visible_count;
+}
+
+
+float ChunkStore::page(const glm::vec4& camera_pos, float scale, float pixel_angle, float tolerance) {
+  glm::vec3 camera(camera_pos);
+
+  // Page in nearest chunks first, so if the budget runs out it's the distant ones that go missing.
+  std::vector<std::pair<float, size_t> > order;
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    Chunk& chunk = chunks[c];
+    if (!chunk.visible) continue;
+
+    glm::vec3 closest = glm::clamp(camera, chunk.bounds_min, chunk.bounds_max);
+    chunk.distance = glm::length(camera - closest) * scale;
+    order.push_back(std::make_pair(chunk.distance, c));
+  }
+  std::sort(order.begin(), order.end());
+
+  float max_error = 0.0f;
+  size_t missing = 0;
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    Chunk& chunk = chunks[order[i].second];
+
+    // Same rule as Mesh::select_lods().
+    float allowed = std::min(chunk.distance * pixel_angle, tolerance);
+    size_t wanted = 0;
+    for (size_t l = 1; l < chunk.levels.size(); ++l) {
+      if (chunk.levels[l].error * scale > allowed) break;
+      wanted = l;
+    }
+
+    if (!chunk.entry || chunk.resident_level != wanted) {
+      for (size_t l = wanted; l < chunk.levels.size(); ++l) {
+        if (chunk.entry && chunk.resident_level == l) break; // what we have is as good as what fits
+
+        size_t bytes = level_bytes(chunk.levels[l]);
+        if (make_room(bytes > chunk.resident_bytes ? bytes - chunk.resident_bytes : 0)) {
+          evict(chunk);
+          upload(chunk, l);
+          break;
+        }
+      }
+    }
+
+    if (chunk.entry) max_error = std::max(max_error, chunk.levels[chunk.resident_level].error * scale);
+    else             ++missing;
+  }
+
+  if (missing)
+    std::cerr << "WARNING: GPU budget of " << gpu_budget << " bytes is too small; " << missing << " visible chunks were not drawn" << std::endl;
+
+  return max_error;
+}
+
+
+void ChunkStore::render(Shader* shader_program) {
+  shader_program->bind();
+
+  check_gl_error();
+
+  Mesh::ShaderBindings bindings(shader_program);
+  bindings.enable();
+
+  check_gl_error();
+
+  // Node transforms were applied when the chunks were built.
+  const glm::mat4 identity(1.0f);
+
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    if (chunks[c].visible && chunks[c].entry)
+      Mesh::draw_entry(shader_program, bindings, textures, *(chunks[c].entry), &identity, 1);
+  }
+
+  check_gl_error();
+
+  bindings.disable();
+
+  check_gl_error();
+
+  shader_program->unbind();
+}
+
+
+size_t ChunkStore::level_bytes(const Level& level) const {
+  size_t position_size  = quantize ? sizeof(PackedPosition) : sizeof(glm::vec3);
+  size_t attribute_size = quantize && GLEW_ARB_half_float_vertex ? sizeof(PackedAttributes) : sizeof(FloatAttributes);
+  return level.vertex_count * (position_size + attribute_size) + level.index_count * sizeof(unsigned int);
+}
+
+
+bool ChunkStore::make_room(size_t bytes) {
+  while (gpu_bytes + bytes > gpu_budget) {
+    // Least recently visible resident chunk that isn't needed this frame.
+    Chunk* victim = NULL;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      Chunk& chunk = chunks[c];
+      if (chunk.entry && chunk.last_visible != frame && (!victim || chunk.last_visible < victim->last_visible))
+        victim = &chunk;
+    }
+
+    if (!victim) return false;
+    evict(*victim);
+  }
+
+  return true;
+}
+
+
+void ChunkStore::upload(Chunk& chunk, size_t l) {
+  const Level& level = chunk.levels[l];
+  const char* data = mapping + level.offset;
+
+  std::vector<Vertex> vertices(level.vertex_count);
+  std::vector<unsigned int> indices(level.index_count);
+  if (!vertices.empty()) memcpy(&vertices[0], data, sizeof(Vertex) * vertices.size());
+  if (!indices.empty())  memcpy(&indices[0], data + sizeof(Vertex) * vertices.size(), sizeof(unsigned int) * indices.size());
+
+  chunk.entry = new Mesh::MeshEntry();
+  chunk.entry->material_index = chunk.material_index;
+  chunk.entry->init(vertices, indices, quantize, false);
+
+  chunk.resident_level = l;
+  chunk.resident_bytes = level_bytes(level);
+  gpu_bytes += chunk.resident_bytes;
+
+  // The GPU has it now; let the kernel drop the file pages instead of keeping them charged to us.
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t begin     = level.offset / page_size * page_size;
+  size_t end       = level.offset + sizeof(Vertex) * vertices.size() + sizeof(unsigned int) * indices.size();
+  madvise(mapping + begin, end - begin, MADV_DONTNEED);
+}
+
+
+void ChunkStore::evict(Chunk& chunk) {
+  if (!chunk.entry) return;
+
+  delete chunk.entry;
+  chunk.entry = NULL;
+
+  gpu_bytes -= chunk.resident_bytes;
+  chunk.resident_bytes = 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef CHUNK_STORE_H
+# define CHUNK_STORE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "mesh.h"
+
+const size_t DEFAULT_CHUNK_TRIANGLES = 65536;
+const size_t DEFAULT_GPU_BUDGET      = 512 * 1024 * 1024; // bytes
+const size_t MAX_CHUNK_SPILL_FILES   = 256;
+const size_t CHUNK_SPILL_TRIANGLES   = 1 << 20; // triangles per spill bucket, roughly
+const size_t MAX_CHUNK_GRID          = 1024;    // cells per axis
+
+
+/** Spatially partitioned, out-of-core version of a model.
+ *
+ * A model is converted once (build()) into a .gchunks file: the triangles of each mesh are binned on a
+ * uniform grid, and each occupied cell becomes a chunk with its own bounding box and levels of detail
+ * (see simplify.h). At runtime the file is memory-mapped; every frame, cull() frustum-culls the chunks
+ * and page() picks a level for each visible one and uploads it to the GPU if it isn't already there.
+ * When the GPU budget is exceeded, the chunks that have gone longest without being visible are evicted
+ * first.
+ *
+ * Nothing is kept on the heap for a chunk beyond its table entry; after a level is uploaded its pages
+ * of the mapped file are released, so the host only holds what the kernel chooses to cache.
+ */
+class ChunkStore {
+public:
+  /** Constructor.
+   *
+   * @param[in] whether to quantize vertex data on the GPU (see vertex_format.h).
+   * @param[in] how many bytes of vertex and index buffers may be resident on the GPU at once.
+   */
+  ChunkStore(bool quantize_ = false, size_t gpu_budget_ = DEFAULT_GPU_BUDGET)
+  : quantize(quantize_),
+    gpu_budget(gpu_budget_),
+    gpu_bytes(0),
+    frame(0),
+    fd(-1),
+    mapping(NULL),
+    mapping_size(0),
+    min_extremities(0.0f), max_extremities(0.0f), centroid_(0.0f)
+  { }
+
+  ~ChunkStore() {
+    close();
+  }
+
+
+  /** Convert a model into a chunk file.
+   *
+   * Triangles are spilled to temporary files by grid cell so that only one bucket of chunks needs to be
+   * held while the chunks and their levels of detail are built. PLY, OBJ, and STL models are read a
+   * triangle at a time (see NativeTriangleStream), so they needn't fit in memory. Anything else is read
+   * with ASSIMP, which holds the whole model in memory until it has been spilled.
+   *
+   * @param[in] model filename.
+   * @param[in] chunk filename to write (conventionally ending in .gchunks).
+   * @param[in] approximate number of triangles per chunk.
+   *
+   * \returns true if the chunk file was written.
+   */
+  static bool build(const std::string& model_filename, const std::string& chunk_filename, size_t triangles_per_chunk = DEFAULT_CHUNK_TRIANGLES);
+
+
+  /** Does this filename look like a chunk file? */
+  static bool is_chunk_file(const std::string& filename) {
+    const std::string extension(".gchunks");
+    return filename.size() > extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+  }
+
+
+  /** Map a chunk file and load its materials. No geometry is read until page().
+   *
+   * @param[in] chunk filename.
+   *
+   * \returns true if the file was valid.
+   */
+  bool open(const std::string& filename);
+
+
+  /** Release all GPU buffers and textures, and unmap the file. */
+  void close();
+
+
+  glm::vec3 dimensions() const {
+    return max_extremities - min_extremities;
+  }
+
+  glm::vec3 centroid() const {
+    return centroid_;
+  }
+
+
+  /** Decide which chunks are visible and where they lie in range.
+   *
+   * Only the sides of the frustum are used for culling, since the near and far planes are computed from
+   * whatever survives.
+   *
+   * @param[in] model-view matrix (model coordinates to camera coordinates, in world units).
+   * @param[in] vertical field of view (radians).
+   * @param[in] aspect ratio (width / height).
+   * @param[out] distance to the nearest point of any visible chunk's bounding box (at least MIN_NEAR_PLANE).
+   * @param[out] distance to the farthest point of any visible chunk's bounding box.
+   *
+   * \returns The number of visible chunks.
+   */
+  size_t cull(const glm::mat4& model_view, float fov, float aspect, float& near_bound, float& far_bound);
+
+
+  /** Choose a level of detail for each visible chunk, and page levels in and out of GPU memory.
+   *
+   * Levels are uploaded synchronously, so every visible chunk is drawn in the frame that needs it. If the
+   * budget can't hold a chunk's chosen level even after evicting everything that isn't visible, coarser
+   * levels are tried.
+   *
+   * @param[in] camera position in model coordinates.
+   * @param[in] model scale factor (model units to world units).
+   * @param[in] angle subtended by one sensor pixel (radians).
+   * @param[in] largest acceptable error in world units (e.g. one range bin).
+   *
+   * \returns The largest error among the levels that will be drawn, in world units.
+   */
+  float page(const glm::vec4& camera_pos, float scale, float pixel_angle, float tolerance);
+
+
+  /** Draw every visible, resident chunk.
+   *
+   * @param[in] the GLSL shader program.
+   */
+  void render(Shader* shader_program);
+
+
+  size_t resident_bytes() const { return gpu_bytes; }
+
+private:
+  /** Table entry for one level of one chunk, pointing into the mapped file. */
+  struct Level {
+    uint64_t offset; // vertices, followed immediately by indices
+    uint32_t vertex_count;
+    uint32_t index_count;
+    float    error;
+  };
+
+  struct Chunk {
+    glm::vec3 bounds_min, bounds_max;
+    uint32_t  material_index;
+    std::vector<Level> levels; // levels[0] is full resolution
+
+    Mesh::MeshEntry* entry;   // NULL unless resident
+    size_t resident_level;
+    size_t resident_bytes;
+    size_t last_visible;      // frame number
+    bool   visible;
+    float  distance;          // from the camera, world units
+
+    Chunk() : material_index(0), entry(NULL), resident_level(0), resident_bytes(0), last_visible(0), visible(false), distance(0.0f) { }
+  };
+
+  size_t level_bytes(const Level& level) const;
+  bool   make_room(size_t bytes);
+  void   upload(Chunk& chunk, size_t level);
+  void   evict(Chunk& chunk);
+
+  bool quantize;
+  size_t gpu_budget;
+  size_t gpu_bytes;
+  size_t frame;
+
+  int fd;
+  char* mapping;
+  size_t mapping_size;
+
+  std::vector<Chunk> chunks;
+  std::vector<Texture*> textures;
+  glm::vec3 min_extremities, max_extremities, centroid_;
+};
+
+#endif // CHUNK_STORE_H
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frame_archive.h"
+
+const char     FRAME_ARCHIVE_MAGIC[8] = {'G','L','I','D','A','R','C','\0'};
+const char     FRAME_INDEX_MAGIC[8]   = {'G','L','I','D','I','D','X','\0'};
+const uint32_t FRAME_ARCHIVE_VERSION  = 1;
+
+
+/*
+ * Start of the file; the metadata string follows, padded to 8 bytes.
+ */
+struct ArchiveHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t metadata_length;
+};
+
+
+/*
+ * Start of each frame record; count floats of point data follow. Every field is 8-byte aligned, and so
+ * is the point data, so views can point straight into the mapping.
+ */
+struct FrameRecord {
+  uint64_t timestamp;
+  uint64_t count;
+  uint32_t width, height;
+  uint32_t layout;
+  float    near_plane, far_plane;
+  float    fx, fy;
+  uint32_t reserved;
+  double   pose[16];
+};
+
+
+/*
+ * End of the file; the index (frame_count record offsets) is at index_offset.
+ */
+struct ArchiveTrailer {
+  uint64_t index_offset;
+  uint64_t frame_count;
+  char     magic[8];
+};
+
+
+static size_t padding(size_t length) {
+  return (8 - length % 8) % 8;
+}
+
+
+bool FrameArchiveWriter::open(const std::string& filename, const std::string& metadata) {
+  close();
+
+  out.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::cerr << "Error: Unable to create frame archive '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  ArchiveHeader header;
+  memcpy(header.magic, FRAME_ARCHIVE_MAGIC, 8);
+  header.version         = FRAME_ARCHIVE_VERSION;
+  header.metadata_length = metadata.size();
+
+  const char zeros[8] = {0};
+  out.write(reinterpret_cast<const char*>(&header), sizeof(ArchiveHeader));
+  out.write(metadata.data(), metadata.size());
+  out.write(zeros, padding(metadata.size()));
+
+  offsets.clear();
+  frames = 0;
+  return !out.fail();
+}
+
+
+bool FrameArchiveWriter::append(const FrameBuffer& frame, const double pose[16], uint64_t timestamp) {
+  FrameRecord record;
+  memset(&record, 0, sizeof(FrameRecord));
+  record.timestamp  = timestamp;
+  record.count      = frame.count;
+  record.width      = frame.width;
+  record.height     = frame.height;
+  record.layout     = frame.layout;
+  record.near_plane = frame.near_plane;
+  record.far_plane  = frame.far_plane;
+  record.fx         = frame.fx;
+  record.fy         = frame.fy;
+  memcpy(record.pose, pose, sizeof(record.pose));
+
+  const char zeros[8] = {0};
+  offsets.push_back(static_cast<uint64_t>(out.tellp()));
+  out.write(reinterpret_cast<const char*>(&record), sizeof(FrameRecord));
+  if (frame.count) out.write(reinterpret_cast<const char*>(&(frame.data[0])), sizeof(float) * frame.count);
+  out.write(zeros, padding(sizeof(float) * frame.count));
+  ++frames;
+
+  return !out.fail();
+}
+
+
+void FrameArchiveWriter::close() {
+  if (!out.is_open()) return;
+
+  ArchiveTrailer trailer;
+  trailer.index_offset = static_cast<uint64_t>(out.tellp());
+  trailer.frame_count  = offsets.size();
+  memcpy(trailer.magic, FRAME_INDEX_MAGIC, 8);
+
+  if (!offsets.empty()) out.write(reinterpret_cast<const char*>(&offsets[0]), sizeof(uint64_t) * offsets.size());
+  out.write(reinterpret_cast<const char*>(&trailer), sizeof(ArchiveTrailer));
+  out.close();
+
+  std::cerr << "Archived " << frames << " frames" << std::endl;
+}
+
+
+bool FrameArchive::open(const std::string& filename) {
+  close();
+
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Error: Unable to open frame archive '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ArchiveHeader)) {
+    std::cerr << "Error: '" << filename << "' is too short to be a frame archive" << std::endl;
+    close();
+    return false;
+  }
+
+  mapping_size = st.st_size;
+  void* addr = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    std::cerr << "Error: Unable to map frame archive '" << filename << "'" << std::endl;
+    mapping_size = 0;
+    close();
+    return false;
+  }
+  mapping = static_cast<const char*>(addr);
+
+  // Frames are usually read in random order (e.g. shuffled for training).
+  madvise(const_cast<char*>(mapping), mapping_size, MADV_RANDOM);
+
+  ArchiveHeader header;
+  memcpy(&header, mapping, sizeof(ArchiveHeader));
+  if (memcmp(header.magic, FRAME_ARCHIVE_MAGIC, 8) != 0 || header.version != FRAME_ARCHIVE_VERSION ||
+      sizeof(ArchiveHeader) + header.metadata_length > mapping_size) {
+    std::cerr << "Error: '" << filename << "' is not a version " << FRAME_ARCHIVE_VERSION << " frame archive" << std::endl;
+    close();
+    return false;
+  }
+
+  metadata_.assign(mapping + sizeof(ArchiveHeader), header.metadata_length);
+  records_start = sizeof(ArchiveHeader) + header.metadata_length + padding(header.metadata_length);
+
+  if (!read_index()) {
+    std::cerr << "WARNING: '" << filename << "' has no index (was it closed?); recovering frames from the records." << std::endl;
+    scan_records(records_start);
+  }
+
+  return true;
+}
+
+
+void FrameArchive::close() {
+  if (mapping) munmap(const_cast<char*>(mapping), mapping_size);
+  if (fd >= 0) ::close(fd);
+  mapping      = NULL;
+  mapping_size = 0;
+  fd           = -1;
+  offsets.clear();
+  metadata_.clear();
+}
+
+
+bool FrameArchive::read_index() {
+  if (mapping_size < records_start + sizeof(ArchiveTrailer)) return false;
+
+  ArchiveTrailer trailer;
+  memcpy(&trailer, mapping + mapping_size - sizeof(ArchiveTrailer), sizeof(ArchiveTrailer));
+  if (memcmp(trailer.magic, FRAME_INDEX_MAGIC, 8) != 0) return false;
+  if (trailer.index_offset + trailer.frame_count * sizeof(uint64_t) + sizeof(ArchiveTrailer) != mapping_size) return false;
+
+  offsets.resize(trailer.frame_count);
+  if (trailer.frame_count)
+    memcpy(&offsets[0], mapping + trailer.index_offset, sizeof(uint64_t) * trailer.frame_count);
+
+  for (size_t i = 0; i < offsets.size(); ++i)
+    if (offsets[i] < records_start || offsets[i] + sizeof(FrameRecord) > trailer.index_offset) return false;
+
+  return true;
+}
+
+
+void FrameArchive::scan_records(uint64_t pos) {
+  offsets.clear();
+
+  while (pos + sizeof(FrameRecord) <= mapping_size) {
+    const FrameRecord* record = reinterpret_cast<const FrameRecord*>(mapping + pos);
+    uint64_t bytes = sizeof(float) * record->count;
+    uint64_t next  = pos + sizeof(FrameRecord) + bytes + padding(bytes);
+    if (record->layout > CLOUD_ORGANIZED || next > mapping_size) break; // torn write at the end
+
+    offsets.push_back(pos);
+    pos = next;
+  }
+}
+
+
+FrameView FrameArchive::frame(size_t index) const {
+  const FrameRecord* record = reinterpret_cast<const FrameRecord*>(mapping + offsets.at(index));
+
+  FrameView view;
+  view.timestamp  = record->timestamp;
+  view.width      = record->width;
+  view.height     = record->height;
+  view.layout     = static_cast<CloudLayout>(record->layout);
+  view.near_plane = record->near_plane;
+  view.far_plane  = record->far_plane;
+  view.fx         = record->fx;
+  view.fy         = record->fy;
+  view.pose       = record->pose;
+  view.data       = reinterpret_cast<const float*>(record + 1);
+  view.count      = record->count;
+  return view;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef FRAME_ARCHIVE_H
+# define FRAME_ARCHIVE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+
+#include "frame_pool.h"
+
+
+/** A frame in a mapped archive. Pointers are into the mapping, so they're only good while the archive is
+ *  open; nothing is copied.
+ */
+struct FrameView {
+  uint64_t     timestamp;
+  unsigned int width, height;  // image size; an unorganized cloud is still width x height pixels
+  CloudLayout  layout;
+  float        near_plane, far_plane;
+  float        fx, fy;         // focal lengths in pixels; the principal point is the image center
+  const double* pose;          // 4x4 model-view matrix without scaling, column-major (as in .transform files, transposed)
+  const float* data;           // points (see CloudLayout)
+  size_t       count;          // number of floats at data
+
+  size_t point_count() const { return count / cloud_point_size(layout); }
+};
+
+
+/** Appends frames to a single archive file.
+ *
+ * Layout: a header (magic, version, and a free-form metadata string such as the command line), then one
+ * record per frame (fixed-size record header, then the points), then an index of record offsets and a
+ * trailer pointing at it. The index is written by close(); if that never happens, FrameArchive can still
+ * recover the frames by walking the records.
+ */
+class FrameArchiveWriter {
+public:
+  FrameArchiveWriter() : frames(0) { }
+  ~FrameArchiveWriter() { close(); }
+
+  /** Create (or overwrite) an archive.
+   *
+   * @param[in] filename.
+   * @param[in] metadata stored once in the header (e.g. the generation parameters).
+   *
+   * \returns false if the file couldn't be created.
+   */
+  bool open(const std::string& filename, const std::string& metadata = "");
+
+  /** Append one frame.
+   *
+   * @param[in] the frame's points and sensor model.
+   * @param[in] pose (model-view matrix without scaling), column-major.
+   * @param[in] timestamp.
+   *
+   * \returns false if the write failed.
+   */
+  bool append(const FrameBuffer& frame, const double pose[16], uint64_t timestamp);
+
+  /** Write the index and close the file. */
+  void close();
+
+  bool is_open() const { return out.is_open(); }
+
+private:
+  std::ofstream out;
+  std::vector<uint64_t> offsets;
+  size_t frames;
+};
+
+
+/** Memory-mapped, read-only view of an archive written by FrameArchiveWriter. */
+class FrameArchive {
+public:
+  FrameArchive() : fd(-1), mapping(NULL), mapping_size(0) { }
+  ~FrameArchive() { close(); }
+
+  /** Map an archive and read its index.
+   *
+   * @param[in] filename.
+   *
+   * \returns false if the file isn't an archive.
+   */
+  bool open(const std::string& filename);
+  void close();
+
+  /** Number of frames. */
+  size_t size() const { return offsets.size(); }
+
+  /** Get a frame by index, without copying it. */
+  FrameView frame(size_t index) const;
+
+  /** The metadata string given when the archive was created. */
+  const std::string& metadata() const { return metadata_; }
+
+private:
+  bool read_index();
+  void scan_records(uint64_t start);
+
+  int fd;
+  const char* mapping;
+  size_t mapping_size;
+  uint64_t records_start;
+  std::vector<uint64_t> offsets;
+  std::string metadata_;
+};
+
+
+#endif // FRAME_ARCHIVE_H
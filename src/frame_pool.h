@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef FRAME_POOL_H
+# define FRAME_POOL_H
+
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <stdint.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+
+/** How a frame's points are laid out (see Scene::write_point_cloud()). */
+enum CloudLayout {
+  CLOUD_UNORGANIZED,  // x, y, z, intensity for each pixel with a return
+  CLOUD_INDEXED,      // the same, plus the pixel index (a uint32 in the fifth float's bits)
+  CLOUD_ORGANIZED     // x, y, z, intensity for every pixel, top row first; NaN where there's no return
+};
+
+/** Floats per point in a layout. */
+inline size_t cloud_point_size(CloudLayout layout) {
+  return layout == CLOUD_INDEXED ? 5 : 4;
+}
+
+
+/** What it takes to turn a frame read back from the color buffer into points, without the GL context
+ *  (so it can happen on another thread).
+ */
+struct SensorModel {
+  float projection_x, projection_y; // projection[0][0] and [1][1]
+  float near_plane, far_plane;
+};
+
+
+/** Turn pixels from Scene::read_pixels() into points, as Scene::write_point_cloud() does. Needs no GL context.
+ *
+ * @param[in] RGBA pixels, bottom row first.
+ * @param[in] width of the sensor viewport
+ * @param[in] height of the sensor viewport
+ * @param[in] sensor model the frame was rendered with.
+ * @param[out] the data buffer (see Scene::write_point_cloud()).
+ * @param[in] how to lay out the points.
+ *
+ * \returns The total number of entries written to data.
+ */
+inline size_t unproject_pixels(const unsigned char* rgba, unsigned int width, unsigned int height, const SensorModel& sensor,
+                               float* data, CloudLayout layout = CLOUD_UNORGANIZED) {
+  size_t data_count = 0;
+
+  // The colors hold depth along the optical axis, so each pixel's x and y are its ray's slope times
+  // the depth. The slopes only depend on the column or the row; work them out once.
+  std::vector<float> slope_x(width), slope_y(height);
+  for (size_t x = 0; x < width; ++x)
+    slope_x[x] = (2.0f * (x + 0.5f) / width - 1.0f) / sensor.projection_x;
+  for (size_t y = 0; y < height; ++y)
+    slope_y[y] = (2.0f * (y + 0.5f) / height - 1.0f) / sensor.projection_y;
+
+  const float no_return = std::numeric_limits<float>::quiet_NaN();
+
+  for (size_t row = 0; row < height; ++row) {
+    size_t y = height - 1 - row; // glReadPixels starts at the bottom row
+    const unsigned char* pixel = &rgba[4*y*width];
+
+    for (size_t x = 0; x < width; ++x, pixel += 4) {
+      int gb = pixel[1] * 255 + pixel[2];
+
+      if (gb == 0) {
+        if (layout == CLOUD_ORGANIZED) {
+          data[data_count] = data[data_count+1] = data[data_count+2] = no_return;
+          data[data_count+3] = 0.0f;
+          data_count += 4;
+        }
+        continue;
+      }
+
+      double t = gb / 65536.0;
+      double d = t * (sensor.far_plane - sensor.near_plane) + sensor.near_plane;
+
+      // Camera coordinates, flipped about y so the sensor looks down +z.
+      data[data_count]   = -slope_x[x] * d;
+      data[data_count+1] =  slope_y[y] * d;
+      data[data_count+2] =  d;
+      data[data_count+3] =  pixel[0] / 256.0;
+      data_count += 4;
+
+      if (layout == CLOUD_INDEXED) {
+        uint32_t index = row * width + x;
+        memcpy(&data[data_count], &index, sizeof(uint32_t));
+        ++data_count;
+      }
+    }
+  }
+
+  return data_count;    
+}
+
+
+/** A reusable buffer for one frame's point cloud. */
+struct FrameBuffer {
+  std::vector<float> data;
+  size_t count; // number of floats in use
+  unsigned int width, height;
+  CloudLayout layout;
+
+  // Enough of the sensor model to turn a range image back into points.
+  float near_plane, far_plane; // range encoding limits
+  float fx, fy;                // focal lengths in pixels; the principal point is the image center
+
+  // Where the frame was taken from, for archives.
+  double pose[16];             // model-view matrix without scaling, column-major
+  uint64_t timestamp;
+
+  FrameBuffer(size_t capacity)
+  : data(capacity), count(0), width(0), height(0), layout(CLOUD_UNORGANIZED),
+    near_plane(0.0f), far_plane(0.0f), fx(0.0f), fy(0.0f), timestamp(0)
+  {
+    for (size_t i = 0; i < 16; ++i)
+      pose[i] = i % 5 == 0 ? 1.0 : 0.0;
+  }
+};
+
+
+/** A fixed set of frame buffers, handed from the render thread to a consumer (e.g. a writer thread) and
+ *  back, so no frame allocates.
+ *
+ * When every buffer is out, acquire() blocks until one is released: that is the backpressure that keeps
+ * the renderer from running ahead of the consumer.
+ */
+class FramePool {
+public:
+  /** Constructor.
+   *
+   * @param[in] number of buffers.
+   * @param[in] floats in each buffer.
+   */
+  FramePool(size_t count, size_t capacity)
+  : stalls(0)
+  {
+    for (size_t i = 0; i < count; ++i) {
+      buffers.push_back(new FrameBuffer(capacity));
+      free_list.push_back(buffers.back());
+    }
+  }
+
+  ~FramePool() {
+    for (size_t i = 0; i < buffers.size(); ++i)
+      delete buffers[i];
+  }
+
+  /** Take a buffer from the pool.
+   *
+   * @param[in] whether to wait for one if none are free.
+   *
+   * \returns A buffer, or NULL if none was free and wait was false.
+   */
+  FrameBuffer* acquire(bool wait = true) {
+    boost::mutex::scoped_lock lock(mutex);
+    if (free_list.empty()) {
+      if (!wait) return NULL;
+      ++stalls;
+      while (free_list.empty()) released.wait(lock);
+    }
+
+    FrameBuffer* buffer = free_list.back();
+    free_list.pop_back();
+    buffer->count = 0;
+    return buffer;
+  }
+
+  /** Return a buffer to the pool. */
+  void release(FrameBuffer* buffer) {
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      free_list.push_back(buffer);
+    }
+    released.notify_one();
+  }
+
+  /** Number of buffers in the pool. */
+  size_t size() const { return buffers.size(); }
+
+  /** Number of times acquire() had to wait for a buffer. */
+  size_t stall_count() {
+    boost::mutex::scoped_lock lock(mutex);
+    return stalls;
+  }
+
+private:
+  std::vector<FrameBuffer*> buffers;
+  std::vector<FrameBuffer*> free_list;
+  size_t stalls;
+
+  boost::mutex mutex;
+  boost::condition_variable released;
+};
+
+
+#endif // FRAME_POOL_H
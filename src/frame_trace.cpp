@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "frame_trace.h"
+
+static const char* TRACE_STAGE_NAMES[TRACE_STAGES] = {
+  "pose_received", "render_submitted", "gpu_done", "readback_done", "published"
+};
+
+// What each interval ending at a stage is called in reports and Chrome traces.
+static const char* TRACE_INTERVAL_NAMES[TRACE_STAGES] = {
+  "total", "pose wait", "gpu", "readback", "publish"
+};
+
+
+uint64_t LatencyStats::percentile(double p) {
+  if (samples.empty()) return 0;
+  size_t n = std::min(samples.size() - 1, static_cast<size_t>(p / 100.0 * samples.size()));
+  std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+  return samples[n];
+}
+
+
+TraceLog::TraceLog(const std::string& filename, double report_interval)
+: json(false), report_period(report_interval > 0.0 ? static_cast<uint64_t>(report_interval * 1e9) : 0),
+  last_report(monotonic_ns()), frames(0), frames_since_report(0)
+{
+  if (filename.empty()) return;
+
+  json = filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0;
+  file.open(filename.c_str());
+  if (!file) {
+    std::cerr << "Error: unable to open trace file '" << filename << "'" << std::endl;
+    return;
+  }
+
+  if (json) {
+    file << "[\n";
+  } else {
+    file << "frame_id";
+    for (size_t i = 0; i < TRACE_STAGES; ++i) file << ',' << TRACE_STAGE_NAMES[i];
+    file << '\n';
+  }
+  std::cerr << "Writing frame traces to " << filename << std::endl;
+}
+
+
+TraceLog::~TraceLog() {
+  boost::mutex::scoped_lock lock(mutex);
+  if (frames_since_report) report();
+  if (file.is_open() && json) file << "{}]\n"; // the empty event saves tracking the last comma
+}
+
+
+void TraceLog::record(const FrameTrace& trace) {
+  boost::mutex::scoped_lock lock(mutex);
+
+  // Each interval runs from the last stage before it that was recorded.
+  uint64_t first = 0, previous = 0;
+  for (size_t i = 0; i < TRACE_STAGES; ++i) {
+    if (!trace.stamp[i]) continue;
+    if (previous && trace.stamp[i] >= previous) stages[i].add(trace.stamp[i] - previous);
+    if (!first) first = trace.stamp[i];
+    previous = trace.stamp[i];
+  }
+  if (trace.stamp[TRACE_PUBLISHED] && first) stages[0].add(trace.stamp[TRACE_PUBLISHED] - first);
+
+  if (file.is_open()) write(trace);
+  ++frames;
+  ++frames_since_report;
+
+  if (report_period && monotonic_ns() - last_report >= report_period) report();
+}
+
+
+void TraceLog::write(const FrameTrace& trace) {
+  if (!json) {
+    file << trace.frame_id;
+    for (size_t i = 0; i < TRACE_STAGES; ++i) file << ',' << trace.stamp[i];
+    file << '\n';
+    return;
+  }
+
+  // A complete ("X") event per interval, one row (tid) per stage, in microseconds.
+  uint64_t previous = 0;
+  for (size_t i = 0; i < TRACE_STAGES; ++i) {
+    if (!trace.stamp[i]) continue;
+    if (previous && trace.stamp[i] >= previous)
+      file << "{\"name\":\"" << TRACE_INTERVAL_NAMES[i] << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << i
+           << ",\"ts\":" << std::fixed << std::setprecision(3) << previous / 1e3
+           << ",\"dur\":" << (trace.stamp[i] - previous) / 1e3
+           << ",\"args\":{\"frame\":" << trace.frame_id << "}},\n";
+    previous = trace.stamp[i];
+  }
+}
+
+
+void TraceLog::report() {
+  std::cerr << "Latency over " << frames_since_report << " frames (p50/p99 ms):";
+  for (size_t i = 0; i < TRACE_STAGES; ++i) {
+    size_t stage = (i + 1) % TRACE_STAGES; // the stages in order, then the total
+    if (!stages[stage].count()) continue;
+    std::cerr << ' ' << TRACE_INTERVAL_NAMES[stage] << ' ' << stages[stage].percentile(50.0) / 1e6 << '/'
+              << stages[stage].percentile(99.0) / 1e6;
+    stages[stage].clear();
+  }
+  std::cerr << std::endl;
+
+  frames_since_report = 0;
+  last_report = monotonic_ns();
+}
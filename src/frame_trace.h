@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef FRAME_TRACE_H
+# define FRAME_TRACE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+#include <boost/thread/mutex.hpp>
+
+#include "capture_scheduler.h"
+
+
+/** Points in a frame's life, from the pose it was rendered at to its cloud leaving for subscribers. */
+enum TraceStage {
+  TRACE_POSE_RECEIVED,    // the pose came off the physics socket
+  TRACE_RENDER_SUBMITTED, // draw calls issued
+  TRACE_GPU_DONE,         // the GPU finished drawing (a GL_TIMESTAMP query, where supported)
+  TRACE_READBACK_DONE,    // pixels read back to the CPU
+  TRACE_PUBLISHED,        // the cloud was handed to ZeroMQ (or the shared memory ring)
+  TRACE_STAGES
+};
+
+
+/** When a frame reached each stage, in nanoseconds on the monotonic clock (see monotonic_ns()); 0 for
+ *  stages that weren't recorded. Plain data, so it can ride along in lock-free queues.
+ */
+struct FrameTrace {
+  uint64_t frame_id;
+  uint64_t stamp[TRACE_STAGES];
+
+  void clear(uint64_t frame_id_ = 0) {
+    frame_id = frame_id_;
+    for (size_t i = 0; i < TRACE_STAGES; ++i) stamp[i] = 0;
+  }
+
+  void mark(TraceStage stage, uint64_t when = monotonic_ns()) { stamp[stage] = when; }
+};
+
+
+/** Latencies collected over a reporting interval, for percentiles. */
+class LatencyStats {
+public:
+  void add(uint64_t ns) { samples.push_back(ns); }
+  size_t count() const { return samples.size(); }
+  void clear() { samples.clear(); }
+
+  /** The pth percentile (0-100) of the samples, in nanoseconds (0 if there are none). Reorders them. */
+  uint64_t percentile(double p);
+
+private:
+  std::vector<uint64_t> samples;
+};
+
+
+/** Collects frame traces from whichever threads finish frames: writes each to a file, if one was given
+ *  (Chrome trace JSON if its name ends in .json, for chrome://tracing or Perfetto; otherwise CSV), and
+ *  every so often prints the median and 99th percentile latency of each stage to stderr.
+ */
+class TraceLog {
+public:
+  /** Constructor.
+   *
+   * @param[in] file to write traces to (empty for none).
+   * @param[in] seconds between latency reports (0 for just one, at exit).
+   */
+  TraceLog(const std::string& filename, double report_interval);
+
+  /** Prints a final report and finishes the file. */
+  ~TraceLog();
+
+  /** Record a finished frame (any thread). */
+  void record(const FrameTrace& trace);
+
+  /** Frames recorded so far. */
+  size_t size() const { return frames; }
+
+private:
+  void write(const FrameTrace& trace);
+  void report();
+
+  boost::mutex mutex;
+  std::ofstream file;
+  bool json;
+  uint64_t report_period, last_report;
+  size_t frames, frames_since_report;
+  LatencyStats stages[TRACE_STAGES]; // [i]: from the stage before i to i; [0]: end to end
+};
+
+
+#endif // FRAME_TRACE_H
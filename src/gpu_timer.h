@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef GPU_TIMER_H
+# define GPU_TIMER_H
+
+#include <GL/glew.h>
+#include <stdint.h>
+
+#include "capture_scheduler.h"
+
+
+/** Finds out when the GPU finished the commands issued before mark(), using a GL_TIMESTAMP query
+ *  (ARB_timer_query), so the render loop doesn't have to call glFinish() to know.
+ *
+ * GPU timestamps are on the GPU's own clock; each result is mapped onto monotonic_ns() by reading both
+ * clocks together, which is good to a few microseconds. The GPU clock is read with glGetInteger64v() where
+ * the context has it (GL 3.2 or ARB_sync), and otherwise with a second timestamp query. Where the extension
+ * is missing, results are 0.
+ */
+class GpuTimer {
+public:
+  /** Constructor. Needs a current GL context. */
+  GpuTimer() : query(0), now_query(0), pending(false) {
+    // GLEW may report the extension while leaving entry points it doesn't cover NULL (e.g. on a GL 2.1 context).
+    available = GLEW_ARB_timer_query && glGenQueries && glDeleteQueries && glQueryCounter && glGetQueryObjectui64v;
+    read_clock = available && glGetInteger64v;
+    if (available) {
+      glGenQueries(1, &query);
+      if (!read_clock) glGenQueries(1, &now_query);
+    }
+  }
+
+  ~GpuTimer() {
+    if (!available) return;
+    glDeleteQueries(1, &query);
+    if (!read_clock) glDeleteQueries(1, &now_query);
+  }
+
+  bool enabled() const { return available; }
+
+  /** Stamp the point in the command stream we want the completion time of. */
+  void mark() {
+    if (!available) return;
+    glQueryCounter(query, GL_TIMESTAMP);
+    pending = true;
+  }
+
+  /** When the GPU reached the last mark(), in monotonic_ns() time (0 if unknown). Waits for it, so call
+   *  this after something that waits anyway, like glReadPixels().
+   */
+  uint64_t result() {
+    if (!available || !pending) return 0;
+    pending = false;
+
+    GLuint64 done = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &done);
+
+    uint64_t gpu_now = 0;
+    if (read_clock) {
+      GLint64 clock = 0;
+      glGetInteger64v(GL_TIMESTAMP, &clock);
+      gpu_now = static_cast<uint64_t>(clock);
+    } else { // the pipeline is idle up to the first query, so this one comes back right away
+      GLuint64 clock = 0;
+      glQueryCounter(now_query, GL_TIMESTAMP);
+      glGetQueryObjectui64v(now_query, GL_QUERY_RESULT, &clock);
+      gpu_now = clock;
+    }
+    uint64_t now = monotonic_ns();
+    return gpu_now >= done ? now - (gpu_now - done) : now;
+  }
+
+private:
+  bool available;
+  bool read_clock; // glGetInteger64v() is there to read the GPU clock directly
+  GLuint query;
+  GLuint now_query;
+  bool pending;
+};
+
+
+#endif // GPU_TIMER_H
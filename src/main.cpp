@@ -32,11 +32,20 @@
 #include <iostream>
 #include <sstream>
 #include <csignal>
+#include <list>
 
 #include <pcl/console/parse.h>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "service/publish.h"
 #include "service/subscribe.h"
+#include "service/render_service.h"
+#include "pipeline.h"
+#include "capture_scheduler.h"
+#include "gpu_timer.h"
+#include "backpressure.h"
 #include "scene.h"
 #include "mesh.h"
 #include "pcl.h"
@@ -67,14 +76,73 @@ static void s_catch_signals(void) {
 }
 
 
-/** Calls receive_vector in order to obtain a timestamp and 11 floating-point values (the client 
- *  rotation, the translation, and the sensor rotation).
+/** Unpacks a pose vector: 11 floating-point values (the client rotation, the translation, and the sensor
+ *  rotation), followed by 7 more for each additional object in the scene (its rotation, then its position
+ *  relative to the client), and finally one angle for each joint.
+ *
+ * @param[in] the values.
+ * @param[in] number of values.
+ * @param[out] rotation of the client object (the object you're viewing).
+ * @param[out] translation between the sensor and the client.
+ * @param[out] rotation of the sensor (through which you're viewing).
+ * @param[out] rotations of any additional objects (resized to fit what was received).
+ * @param[out] positions of any additional objects relative to the client.
+ * @param[in] number of joint angles to expect at the end of the vector.
+ * @param[out] joint angles.
+ * \returns false (with a warning) if the vector is the wrong length.
+ */
+bool parse_pose_components(const double* v,
+                           size_t size,
+                           glm::dquat& object,
+                           glm::dvec3& translation,
+                           glm::dquat& sensor,
+                           std::vector<glm::dquat>& other_objects,
+                           std::vector<glm::dvec3>& other_offsets,
+                           size_t joint_count,
+                           std::vector<double>& joint_angles) {
+  if (size < 11 + joint_count || (size - 11 - joint_count) % 7 != 0) {
+    std::cerr << "WARNING: Ignoring pose vector of length " << size << " (expected 11 + 7 per additional object + "
+              << joint_count << " joint angles)" << std::endl;
+    return false;
+  }
+
+  object.w = v[0];
+  object.x = v[1];
+  object.y = v[2];
+  object.z = v[3];
+  translation.x = v[4];
+  translation.y = v[5];
+  translation.z = v[6];
+  sensor.w = v[7];
+  sensor.x = v[8];
+  sensor.y = v[9];
+  sensor.z = v[10];
+
+  size_t count = (size - 11 - joint_count) / 7;
+  other_objects.resize(count);
+  other_offsets.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const double* p = &v[11 + 7*i];
+    other_objects[i] = glm::dquat(p[0], p[1], p[2], p[3]);
+    other_offsets[i] = glm::dvec3(p[4], p[5], p[6]);
+  }
+
+  joint_angles.assign(v + size - joint_count, v + size);
+  return true;
+}
+
+
+/** Calls receive_vector in order to obtain a timestamp and a pose vector (see parse_pose_components).
  *
  * @param[in] a subscription socket.
  * @param[out] a timestamp.
  * @param[out] rotation of the client object (the object you're viewing).
  * @param[out] translation between the sensor and the client.
  * @param[out] rotation of the sensor (through which you're viewing).
+ * @param[out] rotations of any additional objects (resized to fit what was received).
+ * @param[out] positions of any additional objects relative to the client.
+ * @param[in] number of joint angles to expect at the end of the vector.
+ * @param[out] joint angles.
  * @param[in] flags to pass to the socket (generally 0, which is the default; or ZMQ_NOBLOCK if you want real-time)
  * \returns An enumerator from receive_vector indicating whether a shutdown is in order, there was success, etc.
  */
@@ -83,27 +151,103 @@ recv_result_t receive_pose_components(zmq::socket_t& subscriber,
 				      glm::dquat& object,
 				      glm::dvec3& translation,
 				      glm::dquat& sensor,
+				      std::vector<glm::dquat>& other_objects,
+				      std::vector<glm::dvec3>& other_offsets,
+				      size_t joint_count,
+				      std::vector<double>& joint_angles,
 				      int flags = 0) {
   std::vector<double> v;
   recv_result_t r = receive_vector(subscriber, timestamp, v, flags);
-  if (r == RECV_SUCCESS) {
-    object.w = v[0];
-    object.x = v[1];
-    object.y = v[2];
-    object.z = v[3];
-    translation.x = v[4];
-    translation.y = v[5];
-    translation.z = v[6];
-    sensor.w = v[7];
-    sensor.x = v[8];
-    sensor.y = v[9];
-    sensor.z = v[10];
-  }
+  if (r == RECV_SUCCESS && !parse_pose_components(v.empty() ? NULL : &v[0], v.size(), object, translation, sensor,
+                                                  other_objects, other_offsets, joint_count, joint_angles))
+    return RECV_FAILURE;
 
   return r;
 }
 
 
+/** Receives a pose message into a PoseUpdate (for the pose ingest thread; see receive_pose_components).
+ *
+ * @param[in] a subscription socket.
+ * @param[in] number of joint angles to expect.
+ * @param[out] the pose.
+ * @param[in] ZeroMQ flags, e.g. ZMQ_NOBLOCK.
+ * \returns An enumerator from receive_vector.
+ */
+recv_result_t receive_pose_update(zmq::socket_t& subscriber, size_t joint_count, PoseUpdate& update, int flags = 0) {
+  recv_result_t result = receive_pose_components(subscriber, update.timestamp, update.object, update.translation, update.sensor,
+                                                 update.other_objects, update.other_offsets, joint_count, update.joint_angles, flags);
+  update.received = monotonic_ns();
+  return result;
+}
+
+
+/** Takes the next pose that has already arrived, without waiting for one, either from the pose ingest
+ *  thread (if there is one) or straight from the socket.
+ *
+ * @param[in] the pose ingest thread, or NULL.
+ * @param[in] a subscription socket.
+ * @param[in] number of joint angles to expect.
+ * @param[out] the pose.
+ * \returns RECV_NOUPDATE if there were no more poses waiting, or else an enumerator from receive_vector.
+ */
+recv_result_t poll_pose_update(PoseIngest* ingest, zmq::socket_t& subscriber, size_t joint_count, PoseUpdate& update) {
+  if (!ingest) return receive_pose_update(subscriber, joint_count, update, ZMQ_NOBLOCK);
+
+  PoseUpdate* next = ingest->next(false, 0);
+  if (!next) return RECV_NOUPDATE;
+  update = *next;
+  ingest->release(next);
+  return update.shutdown ? RECV_SHUTDOWN : RECV_SUCCESS;
+}
+
+
+/** Keeps the window responsive while there's nothing to render, and notices if the user asks to quit.
+ *
+ * @param[in] the window.
+ */
+void idle_window(GLFWwindow* window) {
+  glfwPollEvents();
+  if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS || glfwWindowShouldClose(window)) s_interrupted = 1;
+}
+
+
+/** The message type for clouds of a layout: 'c' for unorganized, 'i' for unorganized with pixel indices,
+ * 'o' for organized, so subscribers can still filter on it.
+ */
+char cloud_type(CloudLayout cloud_layout) {
+  return cloud_layout == CLOUD_ORGANIZED ? 'o' : (cloud_layout == CLOUD_INDEXED ? 'i' : 'c');
+}
+
+
+/** Fills in the header for a point cloud of the current render (all but the point count).
+ *
+ * @param[in] the scene, as last rendered.
+ * @param[in] layout of the cloud.
+ * @param[in] width of the render.
+ * @param[in] height of the render.
+ * @param[in] frame id (the timestamp).
+ * @param[in] rotation of the client object.
+ * @param[in] translation between the sensor and the client.
+ * @param[in] rotation of the sensor.
+ * \returns The header.
+ */
+wire_header_t cloud_header(Scene& scene, CloudLayout cloud_layout, unsigned int width, unsigned int height, timestamp_t frame_id,
+                           const glm::dquat& object, const glm::dvec3& translation, const glm::dquat& sensor) {
+  wire_header_t header(cloud_type(cloud_layout),
+                       WIRE_XYZ | WIRE_INTENSITY | (cloud_layout == CLOUD_INDEXED ? WIRE_INDEX : 0));
+  header.width       = width;
+  header.height      = height;
+  header.flags       = cloud_layout == CLOUD_ORGANIZED ? WIRE_ORGANIZED : 0;
+  header.frame_id    = frame_id;
+  header.near_plane  = scene.get_near_plane();
+  header.far_plane   = scene.get_far_plane();
+  glm::dmat4 pose    = scene.get_model_view_matrix_without_scaling(object, translation, sensor);
+  std::copy(glm::value_ptr(pose), glm::value_ptr(pose) + 16, header.pose);
+  return header;
+}
+
+
 /** Main.
  *
  * Sets everything up and then loops --- pretty standard OpenGL --- to intercept keypresses, mouseclicks, to modify the scene,
@@ -154,6 +298,27 @@ int main(int argc, char** argv) {
   pcl::console::parse(argc, argv, "--fov", fov);
   pcl::console::parse(argc, argv, "--pcd", pcd_filename);
 
+  // Save every frame (as basename_timestamp.pcd) instead of one, through a writer thread.
+  bool pcd_sequence = pcl::console::find_switch(argc, argv, "--pcd-sequence");
+  unsigned int pcd_queue_length = DEFAULT_PCD_QUEUE_LENGTH;
+  pcl::console::parse(argc, argv, "--pcd-queue", pcd_queue_length);
+
+  // Point cloud layout, for PCD files and for publishing.
+  CloudLayout cloud_layout = CLOUD_UNORGANIZED;
+  if (pcl::console::find_switch(argc, argv, "--pixel-index")) cloud_layout = CLOUD_INDEXED;
+  if (pcl::console::find_switch(argc, argv, "--organized"))   cloud_layout = CLOUD_ORGANIZED;
+
+  // File format for saved frames. Range images are always organized.
+  FrameFormat frame_format = FRAME_PCD_BINARY;
+  if (pcl::console::find_switch(argc, argv, "--pcd-compressed")) frame_format = FRAME_PCD_COMPRESSED;
+  if (pcl::console::find_switch(argc, argv, "--range-image"))    frame_format = FRAME_RANGE_IMAGE;
+  CloudLayout save_layout = frame_format == FRAME_RANGE_IMAGE ? CLOUD_ORGANIZED : cloud_layout;
+
+  // Append saved frames, with their poses, to one archive file instead of writing a file (or two) per frame.
+  std::string archive_filename;
+  pcl::console::parse(argc, argv, "--archive", archive_filename);
+  if (!archive_filename.empty()) frame_format = FRAME_ARCHIVE;
+
   pcl::console::parse(argc, argv, "--width", width);
   pcl::console::parse(argc, argv, "-w", width);
   pcl::console::parse(argc, argv, "--height", height);
@@ -163,6 +328,39 @@ int main(int argc, char** argv) {
   pcl::console::parse(argc, argv, "--noise", noise_coefficient);
   pcl::console::parse(argc, argv, "--seed", noise_seed);
 
+  bool quantize = pcl::console::find_switch(argc, argv, "--quantize");
+  bool lod      = pcl::console::find_switch(argc, argv, "--lod");
+  float lod_tolerance = 1.0f, range_resolution = 0.0f;
+  pcl::console::parse(argc, argv, "--lod-tolerance", lod_tolerance);
+  pcl::console::parse(argc, argv, "--range-resolution", range_resolution);
+
+  // Additional objects, each posed independently (from the physics stream, or --object-offset without one).
+  std::vector<std::string> object_filenames;
+  std::vector<float> object_scales;
+  std::vector<double> object_offset_x, object_offset_y, object_offset_z;
+  pcl::console::parse_multiple_arguments(argc, argv, "--object", object_filenames);
+  pcl::console::parse_multiple_arguments(argc, argv, "--object-scale", object_scales);
+  pcl::console::parse_multiple_3x_arguments(argc, argv, "--object-offset", object_offset_x, object_offset_y, object_offset_z);
+  std::vector<glm::dquat> other_objects;
+  std::vector<glm::dvec3> other_offsets;
+
+  // Joints of skinned models, given as node names; their angles (radians) follow the poses from physics.
+  std::vector<std::string> joint_names;
+  std::vector<double> joint_axis_x, joint_axis_y, joint_axis_z, joint_angles;
+  pcl::console::parse_multiple_arguments(argc, argv, "--joint", joint_names);
+  pcl::console::parse_multiple_3x_arguments(argc, argv, "--joint-axis", joint_axis_x, joint_axis_y, joint_axis_z);
+  pcl::console::parse_multiple_arguments(argc, argv, "--joint-angle", joint_angles);
+
+  // Out-of-core models: convert with --build-chunks, then pass the .gchunks file in place of the model.
+  std::string chunk_filename;
+  unsigned int chunk_triangles = DEFAULT_CHUNK_TRIANGLES, gpu_budget_mb = DEFAULT_GPU_BUDGET / (1024*1024);
+  pcl::console::parse(argc, argv, "--build-chunks", chunk_filename);
+  pcl::console::parse(argc, argv, "--chunk-triangles", chunk_triangles);
+  pcl::console::parse(argc, argv, "--gpu-budget", gpu_budget_mb);
+
+  if (!chunk_filename.empty())
+    return ChunkStore::build(model_filename, chunk_filename, chunk_triangles) ? 0 : -1;
+
   /*
    * 2. If ZeroQ is included, let's allow GLIDAR to be connected to a loop and send and receive data. Read those command line arguments.
    */
@@ -178,23 +376,144 @@ int main(int argc, char** argv) {
   pcl::console::parse(argc, argv, "--pub-rate", frequency);
   pcl::console::parse(argc, argv, "--hwm", highwater_mark);
   pcl::console::parse(argc, argv, "--pub-conflate", conflate);
+  // Lazy publishing: instead of waiting for --subscribers once and then publishing forever, let subscribers
+  // come and go, and only render and read back clouds while someone is subscribed to them.
+  bool lazy = pcl::console::find_switch(argc, argv, "--lazy");
+
+  // Publish buffers are recycled rather than allocated per message. The pool is declared before the
+  // context so that it outlives any messages the context is still sending at exit.
+  unsigned int publish_buffers = DEFAULT_MESSAGE_POOL_SIZE;
+  pcl::console::parse(argc, argv, "--pub-buffers", publish_buffers);
+  // Optional stream encodings, to save bandwidth: 16-bit coordinates (and 16- or 8-bit intensities), and
+  // LZF compression. They're applied on a worker thread.
+  uint32_t publish_encoding = 0;
+  if (pcl::console::find_switch(argc, argv, "--pub-quantize"))   publish_encoding |= WIRE_QUANTIZED;
+  if (pcl::console::find_switch(argc, argv, "--pub-intensity8")) publish_encoding |= WIRE_QUANTIZED | WIRE_INTENSITY_8;
+  if (pcl::console::find_switch(argc, argv, "--pub-compress"))   publish_encoding |= WIRE_COMPRESSED;
+
+  // Pipelined rendering: receive poses, render, unproject, and publish on separate threads.
+  bool pipeline = pcl::console::find_switch(argc, argv, "--pipeline");
+  bool pipeline_latest = pcl::console::find_switch(argc, argv, "--pipeline-latest"); // skip stale poses
+  bool pipeline_block  = pcl::console::find_switch(argc, argv, "--pipeline-block");  // wait for workers, don't drop
+  unsigned int pipeline_depth = DEFAULT_PIPELINE_DEPTH, pipeline_workers = DEFAULT_PIPELINE_WORKERS;
+  pcl::console::parse(argc, argv, "--pipeline-depth", pipeline_depth);
+  pcl::console::parse(argc, argv, "--pipeline-workers", pipeline_workers);
+
+  // Decoupling the sensor from physics: keep a history of poses, and render at the sensor's own rate (in
+  // physics time), interpolating between poses and extrapolating a little past the newest.
+  double sensor_rate = 0.0, timestamp_rate = DEFAULT_TIMESTAMP_RATE, max_extrapolation = 0.0;
+  unsigned int pose_history_length = DEFAULT_POSE_HISTORY;
+  pcl::console::parse(argc, argv, "--sensor-rate", sensor_rate);
+  pcl::console::parse(argc, argv, "--timestamp-rate", timestamp_rate);
+  pcl::console::parse(argc, argv, "--max-extrapolation", max_extrapolation);
+  pcl::console::parse(argc, argv, "--pose-history", pose_history_length);
+  PoseHistory pose_history(pose_history_length, pcl::console::find_switch(argc, argv, "--pose-cubic") ? POSE_CUBIC : POSE_LINEAR,
+                           max_extrapolation * timestamp_rate);
+  if (sensor_rate > 0.0) frequency = 1; // every frame rendered is a sensor frame
+
+  // Or capture at a fixed rate on the wall clock, rendering only the frames that are captured.
+  double capture_rate = 0.0;
+  pcl::console::parse(argc, argv, "--capture-rate", capture_rate);
+  if (capture_rate > 0.0 && sensor_rate > 0.0) {
+    std::cerr << "WARNING: --capture-rate is ignored with --sensor-rate" << std::endl;
+    capture_rate = 0.0;
+  }
+
+  // Render service: render poses that clients ask for (see service/render_service.h), instead of following
+  // physics or publishing. Up to --serve-batch poses, from all the queued requests, are rendered each loop.
+  int serve_port = 0;
+  unsigned int serve_batch = DEFAULT_RENDER_BATCH;
+  std::string serve_transport = "tcp";
+  pcl::console::parse(argc, argv, "--serve", serve_port);
+  pcl::console::parse(argc, argv, "--serve-batch", serve_batch);
+  pcl::console::parse(argc, argv, "--serve-transport", serve_transport);
+  if (serve_port && (port || physics_port || pipeline || capture_rate > 0.0 || sensor_rate > 0.0)) {
+    std::cerr << "WARNING: --serve ignores --port, --physics-port, --pipeline, --capture-rate, and --sensor-rate" << std::endl;
+    port = physics_port = 0;
+    pipeline = false;
+    sensor_rate = capture_rate = 0.0;
+  }
+
+  // Subscriptions are read from the publisher, so the main thread has to be the only one sending on it.
+  if (lazy && (pipeline || publish_encoding)) {
+    std::cerr << "WARNING: --lazy is ignored with --pipeline and the publish encodings, which publish from other threads" << std::endl;
+    lazy = false;
+  }
+  lazy = lazy && port;
+
+  CaptureScheduler scheduler(capture_rate);
+
+  // Load shedding when subscribers fall behind: skip frames, or render them at lower resolution, rather
+  // than let clouds queue up. Pressure is clouds still queued for subscribers (--max-queued, by default all
+  // but one of the publish buffers) and, for subscribers that acknowledge clouds, how many they're behind.
+  std::string backpressure_name = "off";
+  unsigned int max_queued = std::max(1u, publish_buffers) - 1, max_unacknowledged = 0;
+  pcl::console::parse(argc, argv, "--backpressure", backpressure_name);
+  pcl::console::parse(argc, argv, "--max-queued", max_queued);
+  pcl::console::parse(argc, argv, "--max-unacknowledged", max_unacknowledged);
+  BackpressurePolicy backpressure_policy = BACKPRESSURE_OFF;
+  if (!parse_backpressure_policy(backpressure_name, backpressure_policy)) {
+    std::cerr << "Error: unknown --backpressure policy '" << backpressure_name << "' (expected off, drop, resolution, or adaptive)" << std::endl;
+    return -1;
+  }
+  if (backpressure_policy != BACKPRESSURE_OFF && pcd_sequence) {
+    std::cerr << "WARNING: --backpressure is ignored with --pcd-sequence, which saves every frame" << std::endl;
+    backpressure_policy = BACKPRESSURE_OFF;
+  }
+  BackpressureController backpressure(port ? backpressure_policy : BACKPRESSURE_OFF, max_queued, max_unacknowledged);
+  AcknowledgementTracker acknowledgement_tracker;
+
+  // Latency tracing: when each published frame's pose arrived, and when it was rendered, drawn by the GPU,
+  // read back, and published. Traces go to a file (Chrome trace JSON if it ends in .json, or else CSV),
+  // and percentiles to stderr every --latency-report seconds and at exit.
+  std::string trace_filename;
+  double latency_report = 0.0;
+  pcl::console::parse(argc, argv, "--trace", trace_filename);
+  pcl::console::parse(argc, argv, "--latency-report", latency_report);
+  boost::scoped_ptr<TraceLog> trace_log;
+  if (!trace_filename.empty() || latency_report > 0.0)
+    trace_log.reset(new TraceLog(trace_filename, latency_report));
+
+  // (The render service takes its reply buffers from the same pool, enough for a batch.)
+  MessagePool publish_pool(port ? std::max(1u, publish_buffers) : (serve_port ? std::max(1u, serve_batch) : 0),
+                           sizeof(wire_header_t) + width*height*sizeof(float)*cloud_point_size(cloud_layout));
+
+  // Transports: tcp, or on one host ipc (or inproc), or shm, which puts clouds in a shared memory ring and
+  // leaves ZeroMQ (over ipc) with just synchronization and shutdown.
+  std::string publish_transport = "tcp", physics_transport = "tcp";
+  unsigned int shm_slots = DEFAULT_SHM_RING_SLOTS;
+  pcl::console::parse(argc, argv, "--pub-transport", publish_transport);
+  pcl::console::parse(argc, argv, "--physics-transport", physics_transport);
+  pcl::console::parse(argc, argv, "--shm-slots", shm_slots);
+  boost::scoped_ptr<ShmRingWriter> shm_ring;
+  if (port && publish_transport == "shm")
+    shm_ring.reset(new ShmRingWriter(shm_ring_name(port), shm_slots, publish_pool.buffer_size()));
 
   zmq::context_t context(1);
-  zmq::socket_t publisher(context, ZMQ_PUB);
+  zmq::socket_t publisher(context, lazy ? ZMQ_XPUB : ZMQ_PUB);
   zmq::socket_t subscriber(context, ZMQ_SUB);
   zmq::socket_t truth_publisher(context, ZMQ_PUB);
   zmq::socket_t sync_service(context, ZMQ_REP);
   zmq::socket_t sync_client(context, ZMQ_REQ);
+  zmq::socket_t render_service(context, ZMQ_ROUTER);
+  zmq::socket_t acknowledgements(context, ZMQ_PULL);
+  EncodingPublisher cloud_publisher(publisher, publish_pool, port && !pipeline ? publish_encoding : 0, shm_ring.get());
   //PoseLogger logger("sensor.pose");
 
   /*
    * 3. Use ZeroMQ to publish and subscribe, both functions waiting for synchronization before allowing us to proceed forward.
    */
   if (port)
-    sync_publish(publisher, sync_service, port, subscribers, conflate);
+    sync_publish(publisher, sync_service, port, lazy ? 0 : subscribers, conflate, publish_transport);
+
+  if (backpressure.enabled())
+    bind_acknowledgements(acknowledgements, port, publish_transport);
+
+  if (serve_port)
+    bind_render_service(render_service, serve_port, serve_transport);
 
   if (physics_port)
-    sync_subscribe(subscriber, sync_client, physics_port, highwater_mark, 'v');
+    sync_subscribe(subscriber, sync_client, physics_port, highwater_mark, 'v', physics_transport);
 
   /* This is where we start to catch signals. */
   s_catch_signals ();
@@ -237,15 +556,41 @@ int main(int argc, char** argv) {
   // Ensure we can capture keypresses.
   glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 
-  Scene scene(model_filename, model_scale_factor, -translation[2], noise_model_id, noise_coefficient, noise_seed);
+  Scene scene(model_filename, model_scale_factor, -translation[2], noise_model_id, noise_coefficient, noise_seed, quantize, lod, static_cast<size_t>(gpu_budget_mb) * 1024 * 1024);
+  scene.set_lod_tolerance(lod_tolerance, range_resolution);
+
+  for (size_t i = 0; i < object_filenames.size(); ++i) {
+    std::cerr << "Loading object "   << object_filenames[i] << std::endl;
+    glm::dvec3 offset(0.0);
+    if (i < object_offset_x.size()) offset = glm::dvec3(object_offset_x[i], object_offset_y[i], object_offset_z[i]);
+    scene.add_object(object_filenames[i], i < object_scales.size() ? object_scales[i] : model_scale_factor, offset);
+  }
+
+  for (size_t i = 0; i < joint_names.size(); ++i) {
+    glm::vec3 axis(0.0f, 0.0f, 1.0f);
+    if (i < joint_axis_x.size()) axis = glm::vec3(joint_axis_x[i], joint_axis_y[i], joint_axis_z[i]);
+    if (!scene.add_joint(joint_names[i], axis)) return -1;
+  }
+  if (!joint_angles.empty()) scene.set_joint_angles(joint_angles);
 
 
   double last_time = 0,
          current_time = glfwGetTime();
   float delta_time = current_time - last_time;
+  double rotated_time = current_time; // when --model-dr and --camera-dr were last applied
 
   Shader shader_program("shaders/spotv.glsl", "shaders/lidarf.glsl");
 
+  GpuTimer gpu_timer;
+  FrameTrace frame_trace;
+  uint64_t pose_received = 0;           // when the pose being rendered arrived
+  std::vector<unsigned char> readback;  // pixels, for publishing without the pipeline
+
+  // Rendered size, reduced by --backpressure.
+  unsigned int viewport_divisor = 1, render_width = width, render_height = height;
+  if (trace_log && !gpu_timer.enabled())
+    std::cerr << "WARNING: No GL_TIMESTAMP queries (ARB_timer_query); traces won't say when the GPU finished" << std::endl;
+
   bool s_key_pressed = false;
 
   bool save_and_quit = false;
@@ -255,14 +600,58 @@ int main(int argc, char** argv) {
   size_t loopcount = 0;
   unsigned short backspaces = 0;
   timestamp_t last_timestamp_sent = 0;
+
+  // With --sensor-rate, when the next sensor frame is due, in physics time.
+  double next_frame_time = -1.0, frame_period = sensor_rate > 0.0 ? timestamp_rate / sensor_rate : 0.0;
+  double newest_pose_arrival = 0.0; // wall clock time the newest pose came in
+  size_t skipped_frames = 0;
  
-  std::cerr << "Maximum buffer size: " << width * height * 4 * sizeof(float) << std::endl;
+  std::cerr << "Maximum buffer size: " << width * height * cloud_point_size(cloud_layout) * sizeof(float) << std::endl;
+
+  PcdWriter pcd_writer(std::max(1u, pcd_queue_length), cloud_point_size(save_layout)*width*height + 4);
+  size_t pcd_frame = 0;
+
+  if (!archive_filename.empty()) {
+    std::ostringstream generation; // the command line, so the archive says how it was made
+    for (int i = 0; i < argc; ++i)
+      generation << (i ? " " : "") << argv[i];
+    if (!pcd_writer.open_archive(archive_filename, generation.str())) return 1;
+  }
+
+  // The pipeline's threads own the subscriber and (between flushes) the publisher from here on.
+  boost::scoped_ptr<PoseIngest> pose_ingest;
+  boost::scoped_ptr<CloudPipeline> cloud_pipeline;
+  if (pipeline && physics_port) {
+    int receive_timeout = 100; // ms; lets the ingest thread notice when it's time to stop
+    subscriber.setsockopt(ZMQ_RCVTIMEO, &receive_timeout, sizeof(int));
+    pose_ingest.reset(new PoseIngest(boost::bind(receive_pose_update, boost::ref(subscriber), scene.joint_count(), _1, 0),
+                                     std::max(1u, pipeline_depth)));
+  }
+  if (pipeline && port)
+    cloud_pipeline.reset(new CloudPipeline(publisher, publish_pool, publish_encoding, cloud_layout,
+                                           std::max(1u, pipeline_workers), std::max(1u, pipeline_depth), shm_ring.get(),
+                                           trace_log.get()));
+
+  // Render requests with poses still to render, taken in turn a pose at a time so no client waits on
+  // another's long request.
+  std::list<RenderRequest> render_requests;
+  size_t served_poses = 0;
+
+  // With --lazy, what subscribers currently want, and how many frames went unrendered for want of them.
+  SubscriptionTracker subscriptions;
+  bool clouds_wanted = !lazy;
+  size_t unwanted_frames = 0;
 
   /*
    * 5. Main event loop.
    */
   do {
 
+    // update timers so we can do camera motion (non-physics simulator version), even on loops that skip rendering
+    last_time = current_time;
+    current_time = glfwGetTime();
+    delta_time = current_time - last_time;
+
     /*
      * If we're not using a physics simulator, we have limited options.
      *
@@ -289,15 +678,166 @@ int main(int argc, char** argv) {
       s_key_pressed = true;
     }
 
+    /*
+     * If we're serving render requests, take whatever new ones have arrived, render as many of the queued
+     * poses as make a batch, reply to each with its cloud, and skip the rest of the loop.
+     */
+    if (serve_port) {
+      if (s_interrupted) break; // a render server has no subscribers to tell
+      RenderRequest request;
+      recv_result_t r;
+      while ((r = receive_render_request(render_service, request, ZMQ_NOBLOCK)) != RECV_NOUPDATE) {
+        if (r != RECV_SUCCESS) continue; // already answered, if it could be
+        size_t pose_size = request.header.pose_size, extra = scene.object_count() - 1;
+        if (pose_size != 11 + 7*extra + scene.joint_count()) {
+          std::cerr << "Error: render request " << request.header.request_id << " has poses of " << pose_size << " values; expected "
+                    << 11 + 7*extra + scene.joint_count() << std::endl;
+          send_render_error(render_service, request.client, request.header, 0, RENDER_BAD_REQUEST);
+        } else if (!request.header.pose_count) {
+          send_render_error(render_service, request.client, request.header, 0, RENDER_OK); // nothing to render
+        } else {
+          render_requests.push_back(RenderRequest());
+          std::swap(render_requests.back().client, request.client);
+          std::swap(render_requests.back().poses, request.poses);
+          render_requests.back().header    = request.header;
+          render_requests.back().next_pose = 0;
+        }
+      }
+
+      size_t rendered = 0;
+      while (rendered < serve_batch && !render_requests.empty()) {
+        char* send_buffer = publish_pool.acquire();
+        if (!send_buffer) break; // ZeroMQ still holds every buffer; finish this batch next loop
+
+        RenderRequest& next = render_requests.front();
+        uint32_t index = next.next_pose++;
+        const double* v = &next.poses[static_cast<size_t>(index) * next.header.pose_size];
+        parse_pose_components(v, next.header.pose_size, object, translation, sensor, other_objects, other_offsets,
+                              scene.joint_count(), joint_angles);
+        for (size_t i = 0; i < other_objects.size(); ++i)
+          scene.set_object_pose(i + 1, other_objects[i], other_offsets[i]);
+        if (!joint_angles.empty()) scene.set_joint_angles(joint_angles);
+
+        scene.render(&shader_program, fov, object, translation, sensor);
+
+        wire_header_t header = cloud_header(scene, cloud_layout, width, height, next.header.request_id, object, translation, sensor);
+        header.acquisition_time = monotonic_ns();
+        size_t cloud_size = scene.write_point_cloud(reinterpret_cast<float*>(send_buffer + sizeof(wire_header_t)), width, height, cloud_layout);
+        header.point_count = cloud_size / cloud_point_size(cloud_layout);
+        memcpy(send_buffer, &header, sizeof(wire_header_t));
+
+        if (!send_render_reply(render_service, publish_pool, next, index, send_buffer)) {
+          std::cerr << "Error: unable to send pose " << index << " of render request " << next.header.request_id << std::endl;
+          send_render_error(render_service, next.client, next.header, index, RENDER_FAILED);
+        }
+        ++rendered;
+
+        // Done with this request, or on to the next client's.
+        if (next.next_pose == next.header.pose_count) render_requests.pop_front();
+        else render_requests.splice(render_requests.end(), render_requests, render_requests.begin());
+      }
+      served_poses += rendered;
+
+      idle_window(window);
+      if (!rendered) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      continue;
+    }
+
     /*
      * If we are using a physics simulator, we want to receive updated pose information from it each time
      * we iterate through the loop. It might also provide us with a shutdown message, so we need to process
      * that as well.
      */
-    recv_result_t receive_result;
+    recv_result_t receive_result = RECV_NOUPDATE;
+    if (physics_port && frame_period > 0.0) {
+      // Queue up whatever poses have come in. Render the next sensor frame once they cover it, or, if
+      // physics is running late, once it's due by the wall clock (extrapolating, within limits).
+      PoseUpdate update;
+      recv_result_t r;
+      while ((r = poll_pose_update(pose_ingest.get(), subscriber, scene.joint_count(), update)) != RECV_NOUPDATE) {
+        if (r == RECV_SHUTDOWN) {
+          receive_result = RECV_SHUTDOWN;
+          break;
+        }
+        if (r == RECV_SUCCESS && pose_history.add(update)) newest_pose_arrival = glfwGetTime();
+      }
+
+      bool due = false;
+      if (receive_result != RECV_SHUTDOWN && !pose_history.empty()) {
+        if (next_frame_time < 0.0) next_frame_time = pose_history.oldest();
+
+        // Physics got ahead of the history, so some frames can't be rendered any more.
+        if (next_frame_time < pose_history.oldest()) {
+          double behind = std::ceil((pose_history.oldest() - next_frame_time) / frame_period);
+          skipped_frames  += static_cast<size_t>(behind);
+          next_frame_time += behind * frame_period;
+        }
+
+        double ahead = next_frame_time - pose_history.newest(); // of the newest pose, in physics time
+        due = ahead <= 0.0 || (glfwGetTime() - newest_pose_arrival) * timestamp_rate >= ahead;
+      }
+
+      if (due && pose_history.sample(next_frame_time, update)) {
+        receive_result = RECV_SUCCESS;
+        timestamp     = update.timestamp;
+        object        = update.object;
+        translation   = update.translation;
+        sensor        = update.sensor;
+        other_objects = update.other_objects;
+        other_offsets = update.other_offsets;
+        joint_angles  = update.joint_angles;
+        pose_received = monotonic_ns(); // the newest pose it's sampled from may be much older
+
+        next_frame_time += frame_period;
+        pose_history.discard_before(next_frame_time);
+      } else if (receive_result != RECV_SHUTDOWN && !s_interrupted) {
+        // Nothing to render yet; keep the window responsive without spinning.
+        idle_window(window);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        continue;
+      }
+    } else if (pose_ingest) {
+      PoseUpdate* update = pose_ingest->next(pipeline_latest, 10);
+      if (update) {
+        receive_result = update->shutdown ? RECV_SHUTDOWN : RECV_SUCCESS;
+        timestamp     = update->timestamp;
+        object        = update->object;
+        translation   = update->translation;
+        sensor        = update->sensor;
+        other_objects = update->other_objects;
+        other_offsets = update->other_offsets;
+        joint_angles  = update->joint_angles;
+        pose_received = update->received;
+        pose_ingest->release(update);
+      } else if (!s_interrupted) {
+        // Nothing new to render; just keep the window responsive.
+        idle_window(window);
+        continue;
+      }
+    } else if (physics_port) {
+      receive_result = receive_pose_components(subscriber, timestamp, object, translation, sensor, other_objects, other_offsets,
+                                               scene.joint_count(), joint_angles);
+      pose_received = monotonic_ns();
+    }
     if (physics_port) {
-      receive_result = receive_pose_components(subscriber, timestamp, object, translation, sensor);
       if (receive_result == RECV_SHUTDOWN) s_interrupted = true;
+      else if (receive_result == RECV_SUCCESS) {
+        if (other_objects.size() != scene.object_count() - 1)
+          std::cerr << "WARNING: Received poses for " << other_objects.size() + 1 << " objects, but the scene has " << scene.object_count() << std::endl;
+        for (size_t i = 0; i < other_objects.size() && i + 1 < scene.object_count(); ++i)
+          scene.set_object_pose(i + 1, other_objects[i], other_offsets[i]);
+        if (!joint_angles.empty()) scene.set_joint_angles(joint_angles);
+      }
+    }
+
+    // With --capture-rate, skip rendering until the next capture is due (unless a frame needs saving).
+    uint64_t acquisition_time = monotonic_ns();
+    if (scheduler.enabled() && !s_interrupted && !save_and_quit && !s_key_pressed &&
+        !scheduler.begin_capture(acquisition_time)) {
+      idle_window(window);
+      if (!physics_port) // otherwise, waiting for the next pose paces the loop
+        boost::this_thread::sleep(boost::posix_time::microseconds(std::min<uint64_t>(scheduler.time_until_due() / 1000, 10000)));
+      continue;
     }
 
     /*
@@ -310,9 +850,13 @@ int main(int argc, char** argv) {
       // I think this is for the case where you might want to use your physics simulator to run a Monte Carlo, as
       // it appears to quit after rendering.
 
+      if (viewport_divisor != 1) glViewport(0, 0, width, height); // saved at full resolution regardless
       scene.render(&shader_program, fov, object, translation, sensor);
-      scene.save_point_cloud(save_and_quit ? pcd_filename : "buffer", width, height);
-      scene.save_transformation_metadata(save_and_quit ? pcd_filename : "buffer", object, translation, sensor);
+      scene.save_point_cloud(save_and_quit ? pcd_filename : "buffer", width, height, pcd_writer, save_layout, frame_format,
+                             scene.get_model_view_matrix_without_scaling(object, translation, sensor), timestamp);
+      if (viewport_divisor != 1) glViewport(0, 0, render_width, render_height);
+      if (frame_format != FRAME_ARCHIVE)
+        scene.save_transformation_metadata(save_and_quit ? pcd_filename : "buffer", object, translation, sensor);
 
       s_key_pressed = false;
 
@@ -322,8 +866,10 @@ int main(int argc, char** argv) {
     // No Physics simulator: alter scene according to command line arguments.
     if (!physics_port) {
       
-      object = quaternion_change(object, object_rotate, delta_time);
-      sensor = quaternion_change(sensor, sensor_rotate, delta_time);
+      // Rotate by the time since the last rendered frame, which may span loops skipped by --capture-rate.
+      object = quaternion_change(object, object_rotate, current_time - rotated_time);
+      sensor = quaternion_change(sensor, sensor_rotate, current_time - rotated_time);
+      rotated_time = current_time;
 	
       std::cerr << "Command line instructing a render with the following:\n";
       std::cerr << "  object:\t" << to_string(object) << std::endl;
@@ -333,8 +879,74 @@ int main(int argc, char** argv) {
     // If physics simulator is given, we'll just alter based on what we get from physics.
 
 
-    // Render regardless.
-    scene.render(&shader_program, fov, object, translation, sensor);
+    /*
+     * With --lazy, let new subscribers synchronize, and don't render at all unless someone wants clouds (or
+     * they're being saved).
+     */
+    if (lazy) {
+      answer_sync_requests(sync_service);
+      if (receive_subscriptions(publisher, subscriptions) && subscriptions.wants(cloud_type(cloud_layout)) != clouds_wanted) {
+        clouds_wanted = !clouds_wanted;
+        std::cerr << (clouds_wanted ? "Subscribed to; rendering" : "No one is subscribed; idling") << std::endl;
+      }
+    }
+
+    /*
+     * With --backpressure, if this frame is to be published, first ask whether subscribers can take it, and
+     * at what resolution.
+     */
+    bool publish_due = (scheduler.enabled() || loopcount == frequency) && port && clouds_wanted;
+    bool skip_render = !clouds_wanted && !pcd_sequence;
+    if (!clouds_wanted) {
+      ++unwanted_frames;
+      loopcount = frequency - 1; // publish as soon as someone subscribes
+    }
+    size_t unacknowledged = 0;
+    if (publish_due && backpressure.enabled()) {
+      uint32_t subscriber_id;
+      uint64_t acknowledged_frame;
+      recv_result_t r;
+      while ((r = receive_acknowledgement(acknowledgements, subscriber_id, acknowledged_frame)) != RECV_NOUPDATE)
+        if (r == RECV_SUCCESS) acknowledgement_tracker.acknowledged(subscriber_id, acknowledged_frame, glfwGetTime());
+      unacknowledged = acknowledgement_tracker.unacknowledged(glfwGetTime());
+
+      if (!backpressure.admit(publish_pool.in_use(), unacknowledged)) {
+        publish_due = false;
+        skip_render = true;
+        loopcount   = 0;
+      } else if (backpressure.divisor() != viewport_divisor) {
+        viewport_divisor = backpressure.divisor();
+        render_width     = std::max(1u, width / viewport_divisor);
+        render_height    = std::max(1u, height / viewport_divisor);
+        glViewport(0, 0, render_width, render_height);
+        std::cerr << "Subscribers are " << (viewport_divisor > 1 ? "behind; rendering at " : "caught up; rendering at ")
+                  << render_width << "x" << render_height << std::endl;
+      }
+    }
+
+    // Render regardless (unless skipping the frame for subscribers).
+    if (!skip_render) {
+      if (trace_log) {
+        frame_trace.clear();
+        if (physics_port) frame_trace.mark(TRACE_POSE_RECEIVED, pose_received);
+        frame_trace.mark(TRACE_RENDER_SUBMITTED);
+      }
+      scene.render(&shader_program, fov, object, translation, sensor);
+      if (trace_log) gpu_timer.mark();
+    }
+
+    // Batch generation: queue each new frame for the writer thread, so the disk doesn't hold up rendering.
+    if (pcd_sequence && (!pcd_filename.empty() || frame_format == FRAME_ARCHIVE) &&
+        (!physics_port || receive_result == RECV_SUCCESS)) {
+      std::ostringstream basename;
+      basename << pcd_filename << '_' << (physics_port ? timestamp : pcd_frame);
+      scene.save_point_cloud(basename.str(), width, height, pcd_writer, save_layout, frame_format,
+                             scene.get_model_view_matrix_without_scaling(object, translation, sensor),
+                             physics_port ? timestamp : pcd_frame);
+      if (frame_format != FRAME_ARCHIVE)
+        scene.save_transformation_metadata(basename.str(), object, translation, sensor);
+      ++pcd_frame;
+    }
 
 
     /*
@@ -342,40 +954,86 @@ int main(int argc, char** argv) {
      *
      * TODO: Point cloud publishing code needs to go in its own function, as this is cluttery.
      */
-    if (loopcount == frequency && port) {
-      if (!physics_port) ++timestamp; // Need a timestamp for when we're not getting one from physics.
+    if (publish_due) {
+      // Need a timestamp for when we're not getting one from physics: the acquisition time if captures are
+      // scheduled, or else a frame count.
+      if (!physics_port) timestamp = scheduler.enabled() ? acquisition_time : timestamp + 1;
 
       // Make sure we don't send data, even slightly different data, with the same timestamp. Each timestamp should have
       // one unique point cloud.
       if (timestamp != last_timestamp_sent) {
-	// Now indicate that we're sending a point cloud
-	const char TYPE = 'c';
-
-	void* send_buffer = malloc(sizeof(char) + sizeof(unsigned long) + width*height*sizeof(float)*4);
-	void* timestamp_buffer = static_cast<float*>(static_cast<void*>(static_cast<char*>(send_buffer) + sizeof(char)));
-	float* cloud_buffer = static_cast<float*>(static_cast<void*>(static_cast<char*>(send_buffer) + sizeof(unsigned long) + sizeof(char)));
-
-	size_t cloud_size = scene.write_point_cloud(cloud_buffer, width, height);
-      
-	size_t send_buffer_size = sizeof(unsigned long) + sizeof(char) +
-	  cloud_size * sizeof(float);
-	memcpy(send_buffer, &TYPE, sizeof(char));
-	memcpy(timestamp_buffer, &timestamp, sizeof(unsigned long));
-	zmq::message_t message(send_buffer, send_buffer_size, c_message_free, NULL);
-	publisher.send(message);
-	last_timestamp_sent = timestamp;
-
-	std::ostringstream length_stream;
-	length_stream << send_buffer_size;
-	std::string length = length_stream.str();
-
-	// Delete the old length
-	for (unsigned short b = 0; b < backspaces; ++b)
-	  std::cerr << '\b';
-	std::cerr << length;
-
-	loopcount = 0;
-	backspaces = length.size();
+	// Each cloud goes out as a wire_header_t and then the points.
+	wire_header_t header = cloud_header(scene, cloud_layout, render_width, render_height, timestamp, object, translation, sensor);
+	header.acquisition_time   = acquisition_time;
+	header.capture_period     = scheduler.period_ns();
+	header.frames_skipped     = backpressure.take_skipped();
+	header.resolution_divisor = viewport_divisor;
+	header.queued_frames      = publish_pool.in_use();
+	header.unacknowledged     = unacknowledged;
+	if (backpressure.enabled()) acknowledgement_tracker.published(timestamp);
+
+	char* send_buffer = NULL;
+	bool in_ring = shm_ring && !publish_encoding; // then the cloud is unprojected straight into the ring's next slot
+	if (cloud_pipeline) {
+	  // Only the readback happens here; unprojection, encoding, and publishing are on other threads.
+	  ReadbackFrame* frame = cloud_pipeline->acquire(pipeline_block);
+	  if (frame) {
+	    SensorModel model = scene.sensor_model();
+	    frame->width        = render_width;
+	    frame->height       = render_height;
+	    frame->projection_x = model.projection_x;
+	    frame->projection_y = model.projection_y;
+	    frame->header       = header;
+	    scene.read_pixels(frame->rgba, render_width, render_height);
+	    if (trace_log) {
+	      frame_trace.frame_id = timestamp;
+	      frame_trace.mark(TRACE_GPU_DONE, gpu_timer.result());
+	      frame_trace.mark(TRACE_READBACK_DONE);
+	      frame->trace = frame_trace;
+	    }
+	    cloud_pipeline->submit(frame);
+	  }
+	  last_timestamp_sent = timestamp;
+	  loopcount = 0;
+	} else if (!(send_buffer = in_ring ? shm_ring->begin_write() : publish_pool.acquire())) {
+	  // Every buffer is still queued for a slow subscriber. Drop this cloud (as PUB would) and try again
+	  // next frame.
+	  loopcount = frequency - 1;
+	} else {
+	  float* cloud_buffer = reinterpret_cast<float*>(send_buffer + sizeof(wire_header_t));
+
+	  scene.read_pixels(readback, render_width, render_height);
+	  if (trace_log) {
+	    frame_trace.frame_id = timestamp;
+	    frame_trace.mark(TRACE_GPU_DONE, gpu_timer.result());
+	    frame_trace.mark(TRACE_READBACK_DONE);
+	  }
+	  size_t cloud_size = unproject_pixels(&readback[0], render_width, render_height, scene.sensor_model(), cloud_buffer, cloud_layout);
+
+	  header.point_count = cloud_size / cloud_point_size(cloud_layout);
+	  memcpy(send_buffer, &header, sizeof(wire_header_t));
+
+	  size_t send_buffer_size = sizeof(wire_header_t) + cloud_size * sizeof(float);
+	  if (in_ring) shm_ring->end_write(send_buffer_size);
+	  else         cloud_publisher.send(send_buffer);
+	  last_timestamp_sent = timestamp;
+	  if (trace_log) { // (with encodings, when it's handed to the encoding thread)
+	    frame_trace.mark(TRACE_PUBLISHED);
+	    trace_log->record(frame_trace);
+	  }
+
+	  std::ostringstream length_stream;
+	  length_stream << send_buffer_size;
+	  std::string length = length_stream.str();
+
+	  // Delete the old length
+	  for (unsigned short b = 0; b < backspaces; ++b)
+	    std::cerr << '\b';
+	  std::cerr << length;
+
+	  loopcount = 0;
+	  backspaces = length.size();
+	}
       }
     }
 
@@ -386,20 +1044,22 @@ int main(int argc, char** argv) {
     if (s_interrupted || glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS || glfwWindowShouldClose(window)) {
       if (port > 0) {
 	std::cerr << "Interrupt received, sending shutdown signal..." << std::flush;
+	cloud_publisher.flush();
+	if (cloud_pipeline) cloud_pipeline->flush();
 	send_shutdown(publisher);
+	if (shm_ring) shm_ring->shutdown();
 	std::cerr << "Done." << std::endl;
       }
       saved_now_quit = true;
     }
 
+    if (skip_render && !clouds_wanted && !physics_port && !saved_now_quit) // otherwise, waiting for poses paces the loop
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
     glfwSwapBuffers(window);
     glfwPollEvents();
 
-    // update timers so we can do camera motion (non-physics simulator version)
-    last_time = current_time;
-    current_time = glfwGetTime();
-
-    save_and_quit = pcd_filename.size() > 0;
+    save_and_quit = pcd_filename.size() > 0 && !pcd_sequence;
 
     ++loopcount;
   
@@ -408,6 +1068,21 @@ int main(int argc, char** argv) {
   // Close the window.
   glfwTerminate();
 
+  if (backpressure.enabled())
+    std::cerr << "Skipped " << backpressure.total_skipped() << " frames and lowered the resolution " << backpressure.total_reductions()
+              << " times for slow subscribers" << std::endl;
+  if (publish_pool.drop_count())
+    std::cerr << "Dropped " << publish_pool.drop_count() << " point clouds waiting on slow subscribers" << std::endl;
+  if (scheduler.enabled())
+    std::cerr << "Captured " << scheduler.captured() << " frames at " << capture_rate << " Hz; missed " << scheduler.missed()
+              << " deadlines (worst lateness otherwise " << scheduler.worst_lateness_ns() / 1e6 << " ms)" << std::endl;
+  if (unwanted_frames)
+    std::cerr << "Left " << unwanted_frames << " frames unrendered with no one subscribed" << std::endl;
+  if (serve_port)
+    std::cerr << "Rendered " << served_poses << " poses on request" << std::endl;
+  if (skipped_frames)
+    std::cerr << "Skipped " << skipped_frames << " sensor frames whose poses had already left the history" << std::endl;
+
   // Success!
   return 0;
 }
@@ -29,6 +29,8 @@
  * either expressed or implied, of the FreeBSD Project.
  */
 
+#include <glm/gtc/quaternion.hpp>
+
 #include "mesh.h"
 
 
@@ -58,6 +60,10 @@ void Mesh::init_mesh(const aiScene* scene, const aiMesh* mesh, size_t index) {
 
   const aiVector3D zero_3d(0.0, 0.0, 0.0);
 
+  // Skinned on the GPU: upload the modeled vertices, and pose them in the shader. The CPU skinning below
+  // still runs to find the centroid of the posed mesh.
+  bool gpu_skinning = mesh->mNumBones && mesh->mNumBones <= MAX_BONES && !skeleton.empty();
+
 
   if (mesh->mNumBones) {
     std::vector<aiMatrix4x4> bone_matrices(mesh->mNumBones);
@@ -129,10 +135,13 @@ void Mesh::init_mesh(const aiScene* scene, const aiMesh* mesh, size_t index) {
       else if (final_pos[i].z > max_extremities.z) max_extremities.z = final_pos[i].z;
 
 
-      Vertex vertex(glm::vec3(final_pos[i].x, final_pos[i].y, final_pos[i].z),
+      const aiVector3D& pos    = gpu_skinning ? mesh->mVertices[i] : final_pos[i];
+      const aiVector3D& normal = gpu_skinning ? mesh->mNormals[i]  : final_normal[i];
+
+      Vertex vertex(glm::vec3(pos.x, pos.y, pos.z),
           glm::vec2(diffuse_texture_coord->x, diffuse_texture_coord->y),
           glm::vec2(specular_texture_coord->x, specular_texture_coord->y),
-          glm::vec3(final_normal[i].x, final_normal[i].y, final_normal[i].z));
+          glm::vec3(normal.x, normal.y, normal.z));
 
       std::cout << "Adding vertex " << i << ": " << final_pos[i].x << "," << final_pos[i].y << "," << final_pos[i].z;
       std::cout << "\t" << final_normal[i].x << "," << final_normal[i].y << "," << final_normal[i].z << std::endl;
@@ -140,7 +149,7 @@ void Mesh::init_mesh(const aiScene* scene, const aiMesh* mesh, size_t index) {
       std::cout << mesh->mNormals[i].x << "," << mesh->mNormals[i].y << "," << mesh->mNormals[i].z << std::endl;
 
       // Accumulate the centroid_ of the object.
-      centroid_ += vertex.pos;
+      centroid_ += glm::vec3(final_pos[i].x, final_pos[i].y, final_pos[i].z);
 
       vertices.push_back(vertex);
     }
@@ -189,58 +198,352 @@ void Mesh::init_mesh(const aiScene* scene, const aiMesh* mesh, size_t index) {
   }
 
 
-  // Create index buffer.
-  entries[index].init(vertices, indices);
+  init_entry(index, vertices, indices, gpu_skinning);
+  if (gpu_skinning) init_skin(mesh, index);
 }
 
 
-bool Mesh::init_materials(const aiScene* scene, const std::string& filename) {
-  // Extract the directory part from the file name
-  std::string::size_type slash_index = filename.find_first_of("/");
-  std::string dir;
+void Mesh::init_entry(size_t index, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, bool skinned) {
+  // Create index buffer. Skinned entries move, so a k-D tree of their modeled pose would be no use, and
+  // neither would levels of detail simplified without regard to their bones.
+  entries[index].init(vertices, indices, quantize, !skinned);
 
-  if (slash_index == std::string::npos)   dir = ".";
-  else if (slash_index == 0)              dir = "/";
-  else                                    dir = filename.substr(0, slash_index);
-  bool ret = true;
+  if (lod && !skinned) {
+    lod_chain_t& chain = lod_chains[index];
+    if (chain.empty()) build_lod_chain(vertices, indices, chain);
 
-  if (scene->HasTextures())
-    std::cerr << "Scene has textures!" << std::endl;
+    for (size_t i = 0; i < chain.size(); ++i)
+      entries[index].add_level(chain[i].vertices, chain[i].indices, chain[i].error);
 
-  for (size_t i = 0; i < scene->mNumMaterials; ++i) {
-    textures[i] = NULL;
-    std::cerr << "Loading material " << i+1 << " of " << scene->mNumMaterials << std::endl;
-    const aiMaterial* material = scene->mMaterials[i];
+    std::cerr << "Mesh has " << chain.size() << " simplified levels of detail" << std::endl;
+  }
+}
+
+
+void Mesh::collect_placements(const aiNode* node, const aiMatrix4x4& parent, std::vector<std::pair<unsigned int, aiMatrix4x4> >& placements) {
+  aiMatrix4x4 transform = parent * node->mTransformation;
+
+  for (size_t i = 0; i < node->mNumMeshes; ++i)
+    placements.push_back(std::make_pair(node->mMeshes[i], transform));
+
+  for (size_t i = 0; i < node->mNumChildren; ++i)
+    collect_placements(node->mChildren[i], transform, placements);
+}
+
+
+glm::mat4 Mesh::to_mat4(const aiMatrix4x4& m) {
+  // ASSIMP matrices are row-major; GLM's are column-major.
+  return glm::transpose(glm::make_mat4(&m.a1));
+}
+
+
+void Mesh::init_instances(const aiScene* scene) {
+  entry_instances.assign(entries.size(), std::vector<size_t>());
+  instances.clear();
+
+  std::vector<std::pair<unsigned int, aiMatrix4x4> > placements;
+  if (scene->mRootNode) collect_placements(scene->mRootNode, aiMatrix4x4(), placements);
+
+  for (size_t i = 0; i < placements.size(); ++i) {
+    unsigned int index = placements[i].first;
+    if (index >= entries.size()) continue;
+
+    // init_mesh() already moved skinned vertices through the node graph.
+    if (scene->mMeshes[index]->mNumBones) {
+      if (entry_instances[index].empty()) add_instance(index, glm::mat4(1.0f));
+      continue;
+    }
+
+    add_instance(index, to_mat4(placements[i].second));
+  }
+
+  // Meshes no node refers to were drawn as-is before the node graph was used; keep drawing them.
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (entry_instances[i].empty()) add_instance(i, glm::mat4(1.0f));
+
+  update_extremities();
+
+  std::cout << "Placed " << instances.size() << " instances of " << entries.size() << " meshes" << std::endl;
+}
+
+
+void Mesh::add_instance(size_t entry, const glm::mat4& transform) {
+  Instance instance;
+  instance.entry     = entry;
+  instance.transform = transform;
+  instance.inverse   = glm::inverse(transform);
+  instance.visible   = true;
+  instance.scale     = std::max(glm::length(glm::vec3(transform[0])),
+                                std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+  set_instance_bounds(instance, entries[entry].bounds_min, entries[entry].bounds_max);
+
+  entry_instances[entry].push_back(instances.size());
+  instances.push_back(instance);
+}
+
+
+void Mesh::set_instance_bounds(Instance& instance, const glm::vec3& lo, const glm::vec3& hi) const {
+  for (size_t k = 0; k < 8; ++k) {
+    glm::vec3 corner(instance.transform * glm::vec4(k & 1 ? hi.x : lo.x, k & 2 ? hi.y : lo.y, k & 4 ? hi.z : lo.z, 1.0f));
+    instance.bounds_min = k == 0 ? corner : glm::min(instance.bounds_min, corner);
+    instance.bounds_max = k == 0 ? corner : glm::max(instance.bounds_max, corner);
+  }
+}
+
+
+void Mesh::update_extremities() {
+  for (size_t i = 0; i < instances.size(); ++i) {
+    min_extremities = i == 0 ? instances[i].bounds_min : glm::min(min_extremities, instances[i].bounds_min);
+    max_extremities = i == 0 ? instances[i].bounds_max : glm::max(max_extremities, instances[i].bounds_max);
+  }
+}
+
+
+void Mesh::init_skeleton(const aiScene* scene) {
+  skeleton.clear();
+
+  bool skinned = false;
+  for (size_t i = 0; i < scene->mNumMeshes; ++i)
+    if (scene->mMeshes[i]->mNumBones && scene->mMeshes[i]->mNumBones <= MAX_BONES) skinned = true;
+  if (!skinned || !scene->mRootNode) return;
+
+  // Flatten the node graph depth-first, so parents come before their children.
+  std::vector<std::pair<const aiNode*, int> > stack(1, std::make_pair(scene->mRootNode, -1));
+  while (!stack.empty()) {
+    const aiNode* node = stack.back().first;
+    int parent         = stack.back().second;
+    stack.pop_back();
+
+    SkeletonNode joint;
+    joint.name   = node->mName.C_Str();
+    joint.parent = parent;
+    joint.local  = to_mat4(node->mTransformation);
+    skeleton.push_back(joint);
+
+    for (size_t i = node->mNumChildren; i > 0; --i)
+      stack.push_back(std::make_pair(node->mChildren[i-1], static_cast<int>(skeleton.size() - 1)));
+  }
+
+  std::cout << "Skeleton has " << skeleton.size() << " joints" << std::endl;
+}
+
+
+void Mesh::init_skin(const aiMesh* mesh, size_t index) {
+  MeshEntry& entry = entries[index];
+  if (!mesh->mNumVertices) return;
+
+  std::vector<SkinWeights> skin(mesh->mNumVertices);
+  std::vector<float> weights(mesh->mNumVertices * MAX_BONE_INFLUENCES, 0.0f);
+  memset(&skin[0], 0, sizeof(SkinWeights) * skin.size());
+
+  std::vector<size_t> nodes(mesh->mNumBones);
+  std::vector<glm::mat4> offsets(mesh->mNumBones);
+  entry.bone_bounds_min.assign(mesh->mNumBones, glm::vec3( std::numeric_limits<float>::max()));
+  entry.bone_bounds_max.assign(mesh->mNumBones, glm::vec3(-std::numeric_limits<float>::max()));
+
+  for (size_t b = 0; b < mesh->mNumBones; ++b) {
+    const aiBone* bone = mesh->mBones[b];
+    int node = joint_index(bone->mName.C_Str());
+    if (node < 0) std::cerr << "WARNING: No node for bone '" << bone->mName.C_Str() << "'; it will stay at the root." << std::endl;
+    nodes[b]   = node < 0 ? 0 : node;
+    offsets[b] = to_mat4(bone->mOffsetMatrix);
+
+    for (size_t j = 0; j < bone->mNumWeights; ++j) {
+      size_t v = bone->mWeights[j].mVertexId;
+      float  w = bone->mWeights[j].mWeight;
+      if (v >= mesh->mNumVertices || w <= 0.0f) continue;
+
+      // Keep the strongest influences: replace the weakest slot if this weight beats it.
+      float* slot = &weights[v * MAX_BONE_INFLUENCES];
+      size_t weakest = 0;
+      for (size_t k = 1; k < MAX_BONE_INFLUENCES; ++k)
+        if (slot[k] < slot[weakest]) weakest = k;
+      if (w > slot[weakest]) {
+        slot[weakest] = w;
+        skin[v].bones[weakest] = static_cast<GLubyte>(b);
+      }
+
+      glm::vec3 pos(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z);
+      entry.bone_bounds_min[b] = glm::min(entry.bone_bounds_min[b], pos);
+      entry.bone_bounds_max[b] = glm::max(entry.bone_bounds_max[b], pos);
+    }
+  }
+
+  // Renormalize what's left, so dropped influences don't shrink the vertex towards the origin.
+  for (size_t v = 0; v < skin.size(); ++v) {
+    const float* slot = &weights[v * MAX_BONE_INFLUENCES];
+    float total = 0.0f;
+    for (size_t k = 0; k < MAX_BONE_INFLUENCES; ++k) total += slot[k];
+    if (total <= 0.0f) continue;
+
+    unsigned int sum = 0;
+    for (size_t k = 0; k < MAX_BONE_INFLUENCES; ++k) {
+      skin[v].weights[k] = static_cast<GLubyte>(slot[k] / total * 255.0f + 0.5f);
+      sum += skin[v].weights[k];
+    }
+
+    // Put any rounding error on the strongest influence.
+    size_t strongest = 0;
+    for (size_t k = 1; k < MAX_BONE_INFLUENCES; ++k)
+      if (slot[k] > slot[strongest]) strongest = k;
+    skin[v].weights[strongest] = static_cast<GLubyte>(static_cast<int>(skin[v].weights[strongest]) + 255 - static_cast<int>(sum));
+  }
+
+  entry.init_skin(skin, nodes, offsets);
+
+  std::cout << "Mesh is skinned on the GPU with " << mesh->mNumBones << " bones" << std::endl;
+}
 
 
-    std::vector<std::string> texture_filenames(2);
-    texture_filenames[0] = "./resources/white.png";
-    texture_filenames[1] = "./resources/black.png";
+void Mesh::update_skeleton() {
+  if (skeleton.empty()) return;
 
-    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-      std::cerr << "Diffuse texture count = " << material->GetTextureCount(aiTextureType_DIFFUSE) << std::endl;
-      aiString path;
+  for (size_t i = 0; i < skeleton.size(); ++i) {
+    SkeletonNode& joint = skeleton[i];
+    glm::mat4 local = joint.local;
+    if (joint.angle != 0.0f) {
+      float half = joint.angle * 0.5f;
+      local = local * glm::mat4_cast(glm::quat(std::cos(half), glm::normalize(joint.axis) * std::sin(half)));
+    }
+    joint.global = joint.parent < 0 ? local : skeleton[joint.parent].global * local;
+  }
+
+  for (size_t e = 0; e < entries.size(); ++e) {
+    MeshEntry& entry = entries[e];
+    if (!entry.skinned()) continue;
+
+    glm::vec3 lo( std::numeric_limits<float>::max()),
+              hi(-std::numeric_limits<float>::max());
 
-      if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
-        std::string full_path = dir + "/" + path.data;
-        std::cerr << "Registering diffuse texture from " << full_path.c_str() << std::endl;
+    for (size_t b = 0; b < entry.bone_nodes.size(); ++b) {
+      entry.bone_palette[b] = skeleton[entry.bone_nodes[b]].global * entry.bone_offsets[b];
 
-        texture_filenames[0] = std::string(full_path.c_str());
+      // A blend of bone transforms lies within the union of what each bone would do alone.
+      const glm::vec3& bmin = entry.bone_bounds_min[b];
+      const glm::vec3& bmax = entry.bone_bounds_max[b];
+      if (bmin.x > bmax.x) continue; // no vertices
+
+      for (size_t k = 0; k < 8; ++k) {
+        glm::vec3 corner(entry.bone_palette[b] * glm::vec4(k & 1 ? bmax.x : bmin.x, k & 2 ? bmax.y : bmin.y, k & 4 ? bmax.z : bmin.z, 1.0f));
+        lo = glm::min(lo, corner);
+        hi = glm::max(hi, corner);
       }
     }
 
+    if (lo.x > hi.x) lo = hi = glm::vec3(0.0f);
+
+    for (size_t j = 0; j < entry_instances[e].size(); ++j)
+      set_instance_bounds(instances[entry_instances[e][j]], lo, hi);
+  }
+
+  update_extremities();
+}
+
 
-    if (material->GetTextureCount(aiTextureType_SPECULAR) > 0) {
-      std::cerr << "Specular texture count = " << material->GetTextureCount(aiTextureType_DIFFUSE) << std::endl;
-      aiString path;
+bool Mesh::init_from_native(const NativeModel& model) {
+  entries.resize(model.meshes.size());
+  textures.resize(model.materials.size());
 
-      if (material->GetTexture(aiTextureType_SPECULAR, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
-        std::string full_path = dir + "/" + path.data;
-        std::cerr << "Registering specular texture from " << full_path.c_str() << std::endl;
+  std::cout << "Reading " << entries.size() << " meshes" << std::endl;
 
-        texture_filenames[1] = std::string(full_path.c_str());
+  // Extremities and centroid over the whole model.
+  size_t vertex_count = 0;
+  bool first = true;
+  centroid_ = glm::vec3(0.0f);
+
+  for (size_t i = 0; i < model.meshes.size(); ++i) {
+    const std::vector<Vertex>& vertices = model.meshes[i].vertices;
+    for (size_t j = 0; j < vertices.size(); ++j) {
+      if (first) {
+        min_extremities = max_extremities = vertices[j].pos;
+        first = false;
       }
+      min_extremities = glm::min(min_extremities, vertices[j].pos);
+      max_extremities = glm::max(max_extremities, vertices[j].pos);
+      centroid_ += vertices[j].pos;
     }
+    vertex_count += vertices.size();
+  }
+  if (vertex_count) centroid_ /= static_cast<float>(vertex_count);
+
+  entry_instances.assign(entries.size(), std::vector<size_t>());
+  instances.clear();
+
+  for (size_t i = 0; i < model.meshes.size(); ++i) {
+    entries[i].material_index = model.meshes[i].material_index;
+    init_entry(i, model.meshes[i].vertices, model.meshes[i].indices);
+    add_instance(i, glm::mat4(1.0f));
+  }
+
+  for (size_t i = 0; i < model.materials.size(); ++i) {
+    std::cerr << "Loading material " << i+1 << " of " << model.materials.size() << std::endl;
+    textures[i] = new Texture(model.materials[i]);
+    textures[i]->load();
+  }
+
+  return true;
+}
+
+
+std::string Mesh::model_directory(const std::string& filename) {
+  // Extract the directory part from the file name
+  std::string::size_type slash_index = filename.find_first_of("/");
+
+  if (slash_index == std::string::npos)   return ".";
+  else if (slash_index == 0)              return "/";
+  else                                    return filename.substr(0, slash_index);
+}
+
+
+std::vector<std::string> Mesh::material_texture_filenames(const aiMaterial* material, const std::string& dir) {
+  std::vector<std::string> texture_filenames(2);
+  texture_filenames[0] = "./resources/white.png";
+  texture_filenames[1] = "./resources/black.png";
+
+  if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
+    std::cerr << "Diffuse texture count = " << material->GetTextureCount(aiTextureType_DIFFUSE) << std::endl;
+    aiString path;
+
+    if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
+      std::string full_path = dir + "/" + path.data;
+      std::cerr << "Registering diffuse texture from " << full_path.c_str() << std::endl;
+
+      texture_filenames[0] = std::string(full_path.c_str());
+    }
+  }
+
+
+  if (material->GetTextureCount(aiTextureType_SPECULAR) > 0) {
+    std::cerr << "Specular texture count = " << material->GetTextureCount(aiTextureType_DIFFUSE) << std::endl;
+    aiString path;
+
+    if (material->GetTexture(aiTextureType_SPECULAR, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
+      std::string full_path = dir + "/" + path.data;
+      std::cerr << "Registering specular texture from " << full_path.c_str() << std::endl;
+
+      texture_filenames[1] = std::string(full_path.c_str());
+    }
+  }
+
+  return texture_filenames;
+}
+
+
+bool Mesh::init_materials(const aiScene* scene, const std::string& filename) {
+  std::string dir = model_directory(filename);
+  bool ret = true;
+
+  if (scene->HasTextures())
+    std::cerr << "Scene has textures!" << std::endl;
+
+  for (size_t i = 0; i < scene->mNumMaterials; ++i) {
+    textures[i] = NULL;
+    std::cerr << "Loading material " << i+1 << " of " << scene->mNumMaterials << std::endl;
+    const aiMaterial* material = scene->mMaterials[i];
+
+
+    std::vector<std::string> texture_filenames = material_texture_filenames(material, dir);
 
 
     if (material->GetTextureCount(aiTextureType_AMBIENT) > 0) {
@@ -38,6 +38,7 @@
 
 #include <vector>
 #include <iostream>
+#include <limits>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp> // glm::value_ptr
 #include <glm/gtx/projection.hpp> // glm::proj
@@ -53,31 +54,15 @@
 //#define AI_CONFIG_PP_RVC_FLAGS  aiComponent_NORMALS
 
 #include "texture.h"
+#include "vertex_format.h"
+#include "simplify.h"
+#include "model_loader.h"
 
 const size_t MAX_LEAF_SIZE = 16;
+const size_t MAX_BONES = 32; // size of the bone palette in spotv.glsl; meshes with more bones are skinned once, on the CPU
 const float MIN_NEAR_PLANE = 0.01; // typically meters, but whatever kind of distance units you're using for your world.
 
 
-// Use this struct to represent vertex coordinates, texture coordinates, and the normal coordinates for this vertex.
-struct Vertex
-{
-  glm::vec3 pos;
-  glm::vec2 diffuse_tex;
-  glm::vec2 specular_tex;
-  glm::vec3 normal;
-
-  Vertex() {}
-
-  Vertex(const glm::vec3& pos_, const glm::vec2& dtex_, const glm::vec2& stex_, const glm::vec3& normal_)
-  : pos(pos_), diffuse_tex(dtex_), specular_tex(stex_), normal(normal_)
-  {  }
-
-  float x() const { return pos.x; }
-  float y() const { return pos.y; }
-  float z() const { return pos.z; }
-};
-
-
 // Ganked from: http://ogldev.atspace.co.uk/www/tutorial22/tutorial22.html
 class Mesh {
 public:
@@ -89,7 +74,13 @@ public:
   };
 
 
-  Mesh() : min_extremities(0.0f,0.0f,0.0f), max_extremities(0.0f,0.0f,0.0f) { }
+  /** Constructor.
+   *
+   * @param[in] whether to quantize vertex data on the GPU (see vertex_format.h).
+   * @param[in] whether to generate (or load from cache) simplified levels of detail at import.
+   */
+  Mesh(bool quantize_ = false, bool lod_ = false)
+  : quantize(quantize_), lod(lod_), min_extremities(0.0f,0.0f,0.0f), max_extremities(0.0f,0.0f,0.0f) { }
 
   
   ~Mesh() {
@@ -102,73 +93,228 @@ public:
   }
 
 
+  /** Load a model, using a native loader for PLY, OBJ and STL files (see model_loader.h) and ASSIMP for
+   *  everything else, or if the native loader can't read the file.
+   *
+   * @param[in] model filename.
+   *
+   * \returns true if the model was loaded.
+   */
   bool load_mesh(const std::string& filename) {
     // release the previously loaded mesh if it exists
     clear();
 
     bool ret = false;
+
+    if (has_native_loader(filename)) {
+      NativeModel model;
+      if (load_native_model(filename, model)) {
+        bool lod_cached = begin_lod(filename, model.meshes.size());
+        ret = init_from_native(model);
+        end_lod(filename, lod_cached);
+        return ret;
+      }
+      std::cerr << "Falling back on ASSIMP for '" << filename << "'" << std::endl;
+    }
+
     Assimp::Importer importer;
 
     const aiScene* scene = importer.ReadFile(filename.c_str(), aiProcess_Triangulate | aiProcess_GenNormals );
 
-    if (scene)    ret = init_from_scene(scene, filename);
-    else std::cerr << "Error parsing '" << filename << "': " << importer.GetErrorString() << std::endl;
+    if (scene) {
+      bool lod_cached = begin_lod(filename, scene->mNumMeshes);
+      ret = init_from_scene(scene, filename);
+      end_lod(filename, lod_cached);
+    } else std::cerr << "Error parsing '" << filename << "': " << importer.GetErrorString() << std::endl;
 
     return ret;
   }
 
+
+  /** Find a node of the model's skeleton (from the ASSIMP node graph) by name.
+   *
+   * @param[in] node name.
+   *
+   * \returns The joint's index, or -1 if there's no such node (or the model has no skinned meshes).
+   */
+  int joint_index(const std::string& name) const {
+    for (size_t i = 0; i < skeleton.size(); ++i)
+      if (skeleton[i].name == name) return static_cast<int>(i);
+    return -1;
+  }
+
+
+  /** Rotate a joint away from its modeled pose. Takes effect at the next update_skeleton().
+   *
+   * @param[in] joint index from joint_index().
+   * @param[in] rotation axis, in the joint's own frame.
+   * @param[in] rotation angle (radians).
+   */
+  void set_joint(size_t joint, const glm::vec3& axis, float angle) {
+    skeleton[joint].axis  = axis;
+    skeleton[joint].angle = angle;
+  }
+
+
+  /** Recompute the bone palettes of skinned entries, and their bounds, from the current joint angles.
+   *  Nothing is uploaded here; the palettes go to the GPU as uniforms when the entries are drawn.
+   */
+  void update_skeleton();
+
+
+  /** Decide which instances are inside the sides of the frustum. Instances outside aren't drawn.
+   *
+   * @param[in] model-view matrix (model coordinates to camera coordinates).
+   * @param[in] vertical field of view (radians).
+   * @param[in] aspect ratio (width / height).
+   *
+   * \returns The number of visible instances.
+   */
+  size_t cull(const glm::mat4& model_view, float fov, float aspect) {
+    float tan_y = std::tan(fov * 0.5f),
+          tan_x = tan_y * aspect;
+    size_t visible_count = 0;
+
+    for (size_t i = 0; i < instances.size(); ++i) {
+      float min_depth, max_depth;
+      instances[i].visible = box_in_frustum(model_view, instances[i].bounds_min, instances[i].bounds_max, tan_x, tan_y, min_depth, max_depth);
+      if (instances[i].visible) ++visible_count;
+    }
+
+    return visible_count;
+  }
+
+
+  /** Choose a level of detail for each entry.
+   *
+   * All instances of an entry are drawn at the same level, so it's chosen for the visible instance that
+   * needs the most detail.
+   *
+   * @param[in] camera position in model coordinates.
+   * @param[in] model scale factor (model units to world units).
+   * @param[in] angle subtended by one sensor pixel (radians).
+   * @param[in] largest acceptable error in world units (e.g. one range bin).
+   *
+   * \returns The largest error among the selected levels, in world units.
+   */
+  float select_lods(const glm::vec4& camera_pos, float scale, float pixel_angle, float tolerance) {
+    glm::vec3 camera(camera_pos);
+    float max_error = 0.0f;
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const std::vector<size_t>& placed = entry_instances[i];
+
+      // Allowed error in the entry's own units.
+      float allowed = std::numeric_limits<float>::max();
+      for (size_t j = 0; j < placed.size(); ++j) {
+        const Instance& instance = instances[placed[j]];
+        if (!instance.visible) continue;
+
+        // An error smaller than the footprint of a pixel can't be seen laterally, and one smaller than the
+        // tolerance can't be seen in range.
+        glm::vec3 closest = glm::clamp(camera, instance.bounds_min, instance.bounds_max);
+        float distance = glm::length(camera - closest) * scale;
+        allowed = std::min(allowed, std::min(distance * pixel_angle, tolerance) / (scale * instance.scale));
+      }
+
+      float error = entries[i].select_level(allowed);
+
+      for (size_t j = 0; j < placed.size(); ++j)
+        if (instances[placed[j]].visible)
+          max_error = std::max(max_error, error * scale * instances[placed[j]].scale);
+    }
+
+    return max_error;
+  }
+
+
+  /** Attribute and uniform locations a shader uses for mesh entries. */
+  struct ShaderBindings {
+    GLint position_loc;
+    GLint diffuse_tex_loc;
+    GLint specular_tex_loc;
+    GLint normal_loc;
+    GLint instance_transform_loc; // a mat4, so this and the next three locations
+    GLint bone_indices_loc;
+    GLint bone_weights_loc;
+
+    GLint position_offset_id;
+    GLint position_scale_id;
+    GLint octahedral_normals_id;
+    GLint bones_id;
+    GLint skinned_id;
+
+    bool use_attributes;
+
+    ShaderBindings(Shader* shader_program)
+    : position_loc(glGetAttribLocation(shader_program->id(), "position")),
+      diffuse_tex_loc(glGetAttribLocation(shader_program->id(), "diffuse_tex")),
+      specular_tex_loc(glGetAttribLocation(shader_program->id(), "specular_tex")),
+      normal_loc(glGetAttribLocation(shader_program->id(), "normal")),
+      instance_transform_loc(glGetAttribLocation(shader_program->id(), "instance_transform")),
+      bone_indices_loc(glGetAttribLocation(shader_program->id(), "bone_indices")),
+      bone_weights_loc(glGetAttribLocation(shader_program->id(), "bone_weights")),
+      position_offset_id(glGetUniformLocation(shader_program->id(), "position_offset")),
+      position_scale_id(glGetUniformLocation(shader_program->id(), "position_scale")),
+      octahedral_normals_id(glGetUniformLocation(shader_program->id(), "octahedral_normals")),
+      bones_id(glGetUniformLocation(shader_program->id(), "bones")),
+      skinned_id(glGetUniformLocation(shader_program->id(), "skinned"))
+    {
+      use_attributes = diffuse_tex_loc >= 0 || specular_tex_loc >= 0 || normal_loc >= 0;
+    }
+
+    void enable() const {
+      if (position_loc >= 0)     glEnableVertexAttribArray(position_loc);
+      if (diffuse_tex_loc >= 0)  glEnableVertexAttribArray(diffuse_tex_loc);
+      if (specular_tex_loc >= 0) glEnableVertexAttribArray(specular_tex_loc);
+      if (normal_loc >= 0)       glEnableVertexAttribArray(normal_loc);
+    }
+
+    void disable() const {
+      if (position_loc >= 0)     glDisableVertexAttribArray(position_loc);
+      if (diffuse_tex_loc >= 0)  glDisableVertexAttribArray(diffuse_tex_loc);
+      if (specular_tex_loc >= 0) glDisableVertexAttribArray(specular_tex_loc);
+      if (normal_loc >= 0)       glDisableVertexAttribArray(normal_loc);
+    }
+  };
+
   
+  /** Draw every entry in the mesh.
+   *
+   * The position stream is always bound. The attribute stream (texture coordinates and normals) is only
+   * bound if the shader actually uses one of those attributes, as the lidar shader does.
+   *
+   * @param[in] the GLSL shader program.
+   */
   void render(Shader* shader_program) {
 
     shader_program->bind();
 
     check_gl_error();
 
-    GLuint position_loc     = glGetAttribLocation(shader_program->id(), "position");
-    GLuint diffuse_tex_loc  = glGetAttribLocation(shader_program->id(), "diffuse_tex");
-    GLuint specular_tex_loc = glGetAttribLocation(shader_program->id(), "specular_tex");
-    GLuint normal_loc       = glGetAttribLocation(shader_program->id(), "normal");
+    ShaderBindings bindings(shader_program);
 
     check_gl_error();
 
-    glEnableVertexAttribArray(position_loc);
-    check_gl_error();
-    glEnableVertexAttribArray(diffuse_tex_loc);
-    check_gl_error();
-    glEnableVertexAttribArray(specular_tex_loc);
-    check_gl_error();
-    glEnableVertexAttribArray(normal_loc);
+    bindings.enable();
 
     check_gl_error();
 
+    std::vector<glm::mat4> transforms;
     for (size_t i = 0; i < entries.size(); ++i) {
-      glBindBuffer(GL_ARRAY_BUFFER, entries[i].vb);
-
-      // I think this tells it where to look for the vertex information we've loaded.
-      glVertexAttribPointer(position_loc,           3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-      glVertexAttribPointer(diffuse_tex_loc,  2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)12); // starts at 12 because 3 floats for position before 2 floats for normal
-      glVertexAttribPointer(specular_tex_loc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)20);
-      glVertexAttribPointer(normal_loc,             3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)28); // makes room for 7 floats
-
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, entries[i].ib);
-
-      const size_t material_index = entries[i].material_index;
-
-
-      if (material_index < textures.size() && textures[material_index]) {
-        textures[material_index]->bind(shader_program);
+      transforms.clear();
+      for (size_t j = 0; j < entry_instances[i].size(); ++j) {
+        const Instance& instance = instances[entry_instances[i][j]];
+        if (instance.visible) transforms.push_back(instance.transform);
       }
 
-      //glColor4f(1.0, 1.0, 1.0, 1.0);
-      glDrawElements(GL_TRIANGLES, entries[i].num_indices, GL_UNSIGNED_INT, 0);
+      if (!transforms.empty())
+        draw_entry(shader_program, bindings, textures, entries[i], &transforms[0], transforms.size());
     }
 
     check_gl_error();
 
-    glDisableVertexAttribArray(position_loc);
-    glDisableVertexAttribArray(diffuse_tex_loc);
-    glDisableVertexAttribArray(specular_tex_loc);
-    glDisableVertexAttribArray(normal_loc);
+    bindings.disable();
 
     check_gl_error();
 
@@ -182,21 +328,34 @@ public:
     return centroid_;
   }
 
-  /** Find the nearest point among all the meshes to some point p.
+  /** Find the nearest point among all the mesh instances to some point p.
    *
    * @param[in] query point.
    * @param[out] result point.
    *
-   * \returns a distance.
+   * \returns a squared distance.
    */
   float nearest_point(const glm::vec4& p, glm::vec4& result) const {
-    float d = entries[0].nearest_point(p, result);
+    glm::vec4 query(p.x, p.y, p.z, 1.0f);
+    float d = std::numeric_limits<float>::max();
 
-    for (size_t i = 1; i < entries.size(); ++i) {
+    for (size_t i = 0; i < instances.size(); ++i) {
+      const Instance& instance = instances[i];
       glm::vec4 tmp_result;
-      float tmp_distance;
 
-      tmp_distance = entries[i].nearest_point(p, tmp_result);
+      if (entries[instance.entry].kdtree) {
+        // Search in the entry's own coordinates, then bring the answer back.
+        entries[instance.entry].nearest_point(instance.inverse * query, tmp_result);
+        tmp_result.w = 1.0f;
+        tmp_result = instance.transform * tmp_result;
+      } else {
+        // Skinned entries move, so they have no k-D tree; the nearest point of their bounds is conservative.
+        tmp_result = glm::vec4(glm::clamp(glm::vec3(query), instance.bounds_min, instance.bounds_max), 1.0f);
+      }
+      tmp_result.w = 0.0f;
+
+      glm::vec3 difference = glm::vec3(query) - glm::vec3(tmp_result);
+      float tmp_distance = glm::dot(difference, difference);
 
       if (tmp_distance < d) {
 	d = tmp_distance;
@@ -251,8 +410,100 @@ public:
   }
 
 private:
+  friend class ChunkStore;
+
+  /** One placement of an entry in the model, from the ASSIMP node graph. */
+  struct Instance {
+    size_t    entry;
+    glm::mat4 transform; // entry coordinates to model coordinates
+    glm::mat4 inverse;
+    float     scale;     // largest scale factor along any axis of transform
+    glm::vec3 bounds_min, bounds_max; // model coordinates
+    bool      visible;
+  };
+
+  /** A node of the ASSIMP node graph that bones hang from. Parents come before their children. */
+  struct SkeletonNode {
+    std::string name;
+    int         parent;    // -1 for the root
+    glm::mat4   local;     // modeled transform relative to the parent
+    glm::vec3   axis;      // joint rotation, applied after local
+    float       angle;
+    glm::mat4   global;    // current transform relative to the root
+
+    SkeletonNode() : parent(-1), local(1.0f), axis(0.0f, 0.0f, 1.0f), angle(0.0f), global(1.0f) { }
+  };
+
   void init_mesh(const aiScene* scene, const aiMesh* mesh, size_t index);
+  void init_entry(size_t index, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, bool skinned = false);
   bool init_materials(const aiScene* scene, const std::string& filename);
+  bool init_from_native(const NativeModel& model);
+
+  /** Read cached levels of detail, if we're using them. Returns true if they were cached. */
+  bool begin_lod(const std::string& filename, size_t entry_count) {
+    bool lod_cached = lod && load_lod_cache(filename, entry_count, lod_chains);
+    if (lod && !lod_cached) lod_chains.assign(entry_count, lod_chain_t());
+    return lod_cached;
+  }
+
+  /** Cache newly generated levels of detail, and drop the CPU copies. */
+  void end_lod(const std::string& filename, bool lod_cached) {
+    if (lod && !lod_cached) save_lod_cache(filename, lod_chains);
+    lod_chains.clear();
+  }
+
+  void init_instances(const aiScene* scene);
+  void add_instance(size_t entry, const glm::mat4& transform);
+  void set_instance_bounds(Instance& instance, const glm::vec3& bounds_min, const glm::vec3& bounds_max) const;
+  void update_extremities();
+
+  void init_skeleton(const aiScene* scene);
+  void init_skin(const aiMesh* mesh, size_t index);
+
+  static void collect_placements(const aiNode* node, const aiMatrix4x4& parent, std::vector<std::pair<unsigned int, aiMatrix4x4> >& placements);
+  static glm::mat4 to_mat4(const aiMatrix4x4& m);
+
+  /** Test a box against the sides of a frustum (the near and far planes are ours to choose).
+   *
+   * @param[in] model-view matrix; the camera looks down -z.
+   * @param[in] box minimum, in model coordinates.
+   * @param[in] box maximum, in model coordinates.
+   * @param[in] tangent of half the horizontal field of view.
+   * @param[in] tangent of half the vertical field of view.
+   * @param[out] smallest depth of any corner.
+   * @param[out] largest depth of any corner.
+   *
+   * \returns false if the box is entirely outside one of the planes.
+   */
+  static bool box_in_frustum(const glm::mat4& model_view, const glm::vec3& bounds_min, const glm::vec3& bounds_max, float tan_x, float tan_y,
+                             float& min_depth, float& max_depth) {
+    size_t behind = 0, left = 0, right = 0, below = 0, above = 0;
+    min_depth = std::numeric_limits<float>::max();
+    max_depth = -std::numeric_limits<float>::max();
+
+    for (size_t k = 0; k < 8; ++k) {
+      glm::vec4 corner(k & 1 ? bounds_max.x : bounds_min.x,
+                       k & 2 ? bounds_max.y : bounds_min.y,
+                       k & 4 ? bounds_max.z : bounds_min.z,
+                       1.0f);
+      glm::vec4 p = model_view * corner;
+      float depth = -p.z;
+
+      if (depth <= 0.0f)         ++behind;
+      if (p.x < -depth * tan_x)  ++left;
+      if (p.x >  depth * tan_x)  ++right;
+      if (p.y < -depth * tan_y)  ++below;
+      if (p.y >  depth * tan_y)  ++above;
+
+      min_depth = std::min(min_depth, depth);
+      max_depth = std::max(max_depth, depth);
+    }
+
+    return behind < 8 && left < 8 && right < 8 && below < 8 && above < 8;
+  }
+
+  static std::string model_directory(const std::string& filename);
+  static std::vector<std::string> material_texture_filenames(const aiMaterial* material, const std::string& dir);
 
   bool init_from_scene(const aiScene* scene, const std::string& filename) {
     entries.resize(scene->mNumMeshes);
@@ -260,12 +511,17 @@ private:
 
     std::cout << "Reading " << entries.size() << " meshes" << std::endl;
 
+    init_skeleton(scene);
+
     // Initialize the meshes in the scene one by one
     for (size_t i = 0; i < entries.size(); ++i) {
       const aiMesh* mesh = scene->mMeshes[i];
       init_mesh(scene, mesh, i);
     }
 
+    init_instances(scene);
+    update_skeleton();
+
     return init_materials(scene, filename);
   }
 
@@ -280,11 +536,28 @@ private:
 
   class MeshEntry {
   public:
+    /** GPU buffers for one level of detail. Level 0 is the full-resolution mesh. */
+    struct Level {
+      GLuint vb; // position stream
+      GLuint ab; // attribute stream
+      GLuint ib;
+      size_t num_indices;
+      float  error; // bound on the distance from the full-resolution surface, in model units
+
+      Level() : vb(INVALID_OGL_VALUE), ab(INVALID_OGL_VALUE), ib(INVALID_OGL_VALUE), num_indices(0), error(0.0f) { }
+    };
+
     MeshEntry()
-      : vb(INVALID_OGL_VALUE), 
-        ib(INVALID_OGL_VALUE), 
-        num_indices(0),
+      : tb(INVALID_OGL_VALUE),
+        sb(INVALID_OGL_VALUE),
         material_index(INVALID_MATERIAL),
+        current_level(0),
+        quantized_positions(false),
+        packed_attributes(false),
+        bounds_min(0.0f, 0.0f, 0.0f),
+        bounds_max(0.0f, 0.0f, 0.0f),
+        position_offset(0.0f, 0.0f, 0.0f),
+        position_scale(1.0f, 1.0f, 1.0f),
         xyz_data(NULL),
         xyz(NULL),
         kdtree(NULL),
@@ -294,8 +567,13 @@ private:
     { }
 
     ~MeshEntry() {
-      if (vb != INVALID_OGL_VALUE) glDeleteBuffers(1, &vb);
-      if (ib != INVALID_OGL_VALUE) glDeleteBuffers(1, &ib);
+      for (size_t i = 0; i < levels.size(); ++i) {
+        if (levels[i].vb != INVALID_OGL_VALUE) glDeleteBuffers(1, &(levels[i].vb));
+        if (levels[i].ab != INVALID_OGL_VALUE) glDeleteBuffers(1, &(levels[i].ab));
+        if (levels[i].ib != INVALID_OGL_VALUE) glDeleteBuffers(1, &(levels[i].ib));
+      }
+      if (tb != INVALID_OGL_VALUE) glDeleteBuffers(1, &tb);
+      if (sb != INVALID_OGL_VALUE) glDeleteBuffers(1, &sb);
 
       // Delete the space allocated within xyz, then delete xyz container, then delete the kdtree.
       delete [] xyz_data;
@@ -303,16 +581,35 @@ private:
       delete kdtree;
     }
 
-    void init(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices) {
-      num_indices = indices.size();
+    /** Upload vertices and indices to the GPU and build the k-D tree used for the near plane.
+     *
+     * @param[in] vertices, as read from the model.
+     * @param[in] triangle indices.
+     * @param[in] whether to quantize positions (and, if the driver allows it, attributes).
+     * @param[in] whether to keep a CPU copy of the positions in a k-D tree (needed for nearest_point()).
+     */
+    void init(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, bool quantize = false, bool build_kdtree = true) {
+      bounds_min = bounds_max = vertices.empty() ? glm::vec3(0.0f) : vertices[0].pos;
+      for (size_t i = 1; i < vertices.size(); ++i) {
+        bounds_min = glm::min(bounds_min, vertices[i].pos);
+        bounds_max = glm::max(bounds_max, vertices[i].pos);
+      }
+
+      quantized_positions = quantize;
+      packed_attributes   = quantize && GLEW_ARB_half_float_vertex;
+
+      if (quantize) {
+        position_offset = bounds_min;
+        position_scale  = bounds_max - bounds_min;
+        // Flat entries would otherwise divide by zero.
+        for (size_t k = 0; k < 3; ++k)
+          if (position_scale[k] <= 0.0f) position_scale[k] = 1.0f;
+      }
 
-      glGenBuffers(1, &vb);
-      glBindBuffer(GL_ARRAY_BUFFER, vb);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+      levels.clear();
+      add_level(vertices, indices, 0.0f);
 
-      glGenBuffers(1, &ib);
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib);
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * num_indices, &indices[0], GL_STATIC_DRAW);
+      if (!build_kdtree) return;
 
       // Copy the xyz coordinates from vertices into the xyz array.
       xyz_data = new float[vertices.size() * 3];
@@ -329,6 +626,120 @@ private:
       kdtree->buildIndex();
     }
 
+    /** Upload a coarser level of detail. Must be called after init(), from finest to coarsest.
+     *
+     * @param[in] simplified vertices (which must lie within the bounds of the full-resolution mesh).
+     * @param[in] simplified triangle indices.
+     * @param[in] the simplification error bound in model units.
+     */
+    void add_level(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, float error) {
+      levels.push_back(Level());
+      Level& level = levels.back();
+      level.num_indices = indices.size();
+      level.error       = error;
+
+      init_positions(level, vertices);
+      init_attributes(level, vertices);
+
+      glGenBuffers(1, &(level.ib));
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, level.ib);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * level.num_indices, &indices[0], GL_STATIC_DRAW);
+    }
+
+    /** Upload the position stream, either as floats or as 16-bit values relative to the entry's bounding box.
+     *
+     * @param[in,out] level to which the buffer belongs.
+     * @param[in] vertices.
+     */
+    void init_positions(Level& level, const std::vector<Vertex>& vertices) {
+      glGenBuffers(1, &(level.vb));
+      glBindBuffer(GL_ARRAY_BUFFER, level.vb);
+
+      if (!quantized_positions) {
+        std::vector<glm::vec3> positions(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i)
+          positions[i] = vertices[i].pos;
+
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * positions.size(), &positions[0], GL_STATIC_DRAW);
+        return;
+      }
+
+      std::vector<PackedPosition> positions(vertices.size());
+      for (size_t i = 0; i < vertices.size(); ++i) {
+        glm::vec3 t = (vertices[i].pos - position_offset) / position_scale;
+        positions[i].x   = float_to_unorm16(t.x);
+        positions[i].y   = float_to_unorm16(t.y);
+        positions[i].z   = float_to_unorm16(t.z);
+        positions[i].pad = 0;
+      }
+
+      glBufferData(GL_ARRAY_BUFFER, sizeof(PackedPosition) * positions.size(), &positions[0], GL_STATIC_DRAW);
+    }
+
+    /** Upload the attribute stream (texture coordinates and normals).
+     *
+     * @param[in,out] level to which the buffer belongs.
+     * @param[in] vertices.
+     */
+    void init_attributes(Level& level, const std::vector<Vertex>& vertices) {
+      glGenBuffers(1, &(level.ab));
+      glBindBuffer(GL_ARRAY_BUFFER, level.ab);
+
+      if (packed_attributes) {
+        std::vector<PackedAttributes> attributes(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i) {
+          attributes[i].diffuse_tex[0]  = float_to_half(vertices[i].diffuse_tex.x);
+          attributes[i].diffuse_tex[1]  = float_to_half(vertices[i].diffuse_tex.y);
+          attributes[i].specular_tex[0] = float_to_half(vertices[i].specular_tex.x);
+          attributes[i].specular_tex[1] = float_to_half(vertices[i].specular_tex.y);
+          octahedral_encode(vertices[i].normal, attributes[i].normal);
+        }
+        glBufferData(GL_ARRAY_BUFFER, sizeof(PackedAttributes) * attributes.size(), &attributes[0], GL_STATIC_DRAW);
+      } else {
+        std::vector<FloatAttributes> attributes(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i) {
+          attributes[i].diffuse_tex  = vertices[i].diffuse_tex;
+          attributes[i].specular_tex = vertices[i].specular_tex;
+          attributes[i].normal       = vertices[i].normal;
+        }
+        glBufferData(GL_ARRAY_BUFFER, sizeof(FloatAttributes) * attributes.size(), &attributes[0], GL_STATIC_DRAW);
+      }
+    }
+
+    /** Upload bone influences, making this a skinned entry. Skinned entries only have level 0.
+     *
+     * @param[in] influences for each vertex.
+     * @param[in] skeleton node for each bone in the palette.
+     * @param[in] offset matrix (entry coordinates to bone coordinates, in the modeled pose) for each bone.
+     */
+    void init_skin(const std::vector<SkinWeights>& skin, const std::vector<size_t>& nodes, const std::vector<glm::mat4>& offsets) {
+      bone_nodes   = nodes;
+      bone_offsets = offsets;
+      bone_palette.assign(nodes.size(), glm::mat4(1.0f));
+
+      glGenBuffers(1, &sb);
+      glBindBuffer(GL_ARRAY_BUFFER, sb);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(SkinWeights) * skin.size(), &skin[0], GL_STATIC_DRAW);
+    }
+
+    bool skinned() const { return !bone_nodes.empty(); }
+
+    /** Pick the coarsest level whose error is within some bound.
+     *
+     * @param[in] largest acceptable error, in the entry's own units.
+     *
+     * \returns The error of the selected level, in the entry's own units.
+     */
+    float select_level(float allowed) {
+      current_level = 0;
+      for (size_t i = 1; i < levels.size(); ++i) {
+        if (levels[i].error > allowed) break;
+        current_level = i;
+      }
+
+      return levels.empty() ? 0.0f : levels[current_level].error;
+    }
+
     /** Returns the nearest point in model coordinates to a given point.
      *
      * @param[in] The query point.
@@ -361,10 +772,22 @@ private:
       return distance;
     }
 
-    GLuint vb;
-    GLuint ib;
-    size_t num_indices;
+    std::vector<Level> levels;
+    GLuint tb; // per-instance transforms, streamed each frame for instanced draws
+    GLuint sb; // bone influences, for skinned entries
     size_t material_index;
+    size_t current_level;
+
+    bool quantized_positions;
+    bool packed_attributes;
+    glm::vec3 bounds_min, bounds_max;
+    glm::vec3 position_offset; // position = position_offset + position_scale * stored position
+    glm::vec3 position_scale;
+
+    std::vector<size_t>    bone_nodes;   // skeleton node of each bone; empty unless skinned
+    std::vector<glm::mat4> bone_offsets;
+    std::vector<glm::mat4> bone_palette; // entry coordinates in the modeled pose to entry coordinates now
+    std::vector<glm::vec3> bone_bounds_min, bone_bounds_max; // modeled-pose bounds of each bone's vertices
 
     float* xyz_data;
     flann::Matrix<float>* xyz;
@@ -375,7 +798,112 @@ private:
   };
 
 
+  /** Draw the current level of one entry, once per transform. Attribute arrays must already be enabled.
+   *
+   * Several transforms are drawn with a single instanced draw if the driver supports it; otherwise (or if
+   * there's only one) the transform is set as a constant attribute before each draw.
+   *
+   * @param[in] the GLSL shader program.
+   * @param[in] the program's attribute and uniform locations.
+   * @param[in] textures, indexed by material.
+   * @param[in] the entry to draw.
+   * @param[in] instance transforms (entry coordinates to model coordinates).
+   * @param[in] number of transforms.
+   */
+  static void draw_entry(Shader* shader_program, const ShaderBindings& bindings, const std::vector<Texture*>& textures, MeshEntry& entry,
+                         const glm::mat4* transforms, size_t count) {
+    const MeshEntry::Level& level = entry.levels[entry.current_level];
+
+    glUniform3fv(bindings.position_offset_id, 1, glm::value_ptr(entry.position_offset));
+    glUniform3fv(bindings.position_scale_id, 1, glm::value_ptr(entry.position_scale));
+    glUniform1i(bindings.octahedral_normals_id, entry.packed_attributes ? 1 : 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, level.vb);
+    if (bindings.position_loc >= 0) {
+      if (entry.quantized_positions)
+        glVertexAttribPointer(bindings.position_loc, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedPosition), 0);
+      else
+        glVertexAttribPointer(bindings.position_loc, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+    }
+
+    if (bindings.use_attributes) {
+      glBindBuffer(GL_ARRAY_BUFFER, level.ab);
+
+      if (entry.packed_attributes) {
+        if (bindings.diffuse_tex_loc >= 0)  glVertexAttribPointer(bindings.diffuse_tex_loc,  2, GL_HALF_FLOAT_ARB, GL_FALSE, sizeof(PackedAttributes), (const GLvoid*)offsetof(PackedAttributes, diffuse_tex));
+        if (bindings.specular_tex_loc >= 0) glVertexAttribPointer(bindings.specular_tex_loc, 2, GL_HALF_FLOAT_ARB, GL_FALSE, sizeof(PackedAttributes), (const GLvoid*)offsetof(PackedAttributes, specular_tex));
+        if (bindings.normal_loc >= 0)       glVertexAttribPointer(bindings.normal_loc,       2, GL_SHORT,          GL_TRUE,  sizeof(PackedAttributes), (const GLvoid*)offsetof(PackedAttributes, normal));
+      } else {
+        if (bindings.diffuse_tex_loc >= 0)  glVertexAttribPointer(bindings.diffuse_tex_loc,  2, GL_FLOAT, GL_FALSE, sizeof(FloatAttributes), (const GLvoid*)offsetof(FloatAttributes, diffuse_tex));
+        if (bindings.specular_tex_loc >= 0) glVertexAttribPointer(bindings.specular_tex_loc, 2, GL_FLOAT, GL_FALSE, sizeof(FloatAttributes), (const GLvoid*)offsetof(FloatAttributes, specular_tex));
+        if (bindings.normal_loc >= 0)       glVertexAttribPointer(bindings.normal_loc,       3, GL_FLOAT, GL_FALSE, sizeof(FloatAttributes), (const GLvoid*)offsetof(FloatAttributes, normal));
+      }
+    }
+
+    bool skin = entry.skinned() && bindings.bone_indices_loc >= 0 && bindings.bone_weights_loc >= 0;
+    glUniform1i(bindings.skinned_id, skin ? 1 : 0);
+    if (skin) {
+      glUniformMatrix4fv(bindings.bones_id, entry.bone_palette.size(), GL_FALSE, glm::value_ptr(entry.bone_palette[0]));
+
+      glBindBuffer(GL_ARRAY_BUFFER, entry.sb);
+      glEnableVertexAttribArray(bindings.bone_indices_loc);
+      glEnableVertexAttribArray(bindings.bone_weights_loc);
+      glVertexAttribPointer(bindings.bone_indices_loc, MAX_BONE_INFLUENCES, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(SkinWeights), (const GLvoid*)offsetof(SkinWeights, bones));
+      glVertexAttribPointer(bindings.bone_weights_loc, MAX_BONE_INFLUENCES, GL_UNSIGNED_BYTE, GL_TRUE,  sizeof(SkinWeights), (const GLvoid*)offsetof(SkinWeights, weights));
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, level.ib);
+
+    const size_t material_index = entry.material_index;
+
+    if (material_index < textures.size() && textures[material_index]) {
+      textures[material_index]->bind(shader_program);
+    }
+
+    GLint loc = bindings.instance_transform_loc;
+
+    if (loc >= 0 && count > 1 && GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced) {
+      if (entry.tb == INVALID_OGL_VALUE) glGenBuffers(1, &(entry.tb));
+      glBindBuffer(GL_ARRAY_BUFFER, entry.tb);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * count, transforms, GL_STREAM_DRAW);
+
+      for (GLint c = 0; c < 4; ++c) {
+        glEnableVertexAttribArray(loc + c);
+        glVertexAttribPointer(loc + c, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (const GLvoid*)(sizeof(glm::vec4) * c));
+        glVertexAttribDivisorARB(loc + c, 1);
+      }
+
+      glDrawElementsInstancedARB(GL_TRIANGLES, level.num_indices, GL_UNSIGNED_INT, 0, count);
+
+      for (GLint c = 0; c < 4; ++c) {
+        glVertexAttribDivisorARB(loc + c, 0);
+        glDisableVertexAttribArray(loc + c);
+      }
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        if (loc >= 0)
+          for (GLint c = 0; c < 4; ++c)
+            glVertexAttrib4fv(loc + c, glm::value_ptr(transforms[i][c]));
+
+        glDrawElements(GL_TRIANGLES, level.num_indices, GL_UNSIGNED_INT, 0);
+      }
+    }
+
+    if (skin) {
+      glDisableVertexAttribArray(bindings.bone_indices_loc);
+      glDisableVertexAttribArray(bindings.bone_weights_loc);
+    }
+  }
+
+
+  bool quantize;
+  bool lod;
+  std::vector<lod_chain_t> lod_chains; // only held during import
+
   std::vector<MeshEntry> entries;
+  std::vector<SkeletonNode> skeleton; // empty unless some mesh is skinned on the GPU
+  std::vector<Instance> instances;
+  std::vector<std::vector<size_t> > entry_instances; // indices into instances, for each entry
   std::vector<Texture*> textures;
   glm::vec3 min_extremities, max_extremities, centroid_;
 };
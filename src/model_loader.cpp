@@ -0,0 +1,1727 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/ref.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "model_loader.h"
+
+
+/*
+ * Read-only memory map of a whole file.
+ */
+class MappedFile {
+public:
+  MappedFile() : fd(-1), data_(NULL), size_(0) { }
+
+  ~MappedFile() {
+    if (data_) munmap(const_cast<char*>(data_), size_);
+    if (fd >= 0) close(fd);
+  }
+
+  bool open(const std::string& filename, int advice = MADV_SEQUENTIAL) {
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) return false;
+    size_ = st.st_size;
+
+    void* addr = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) return false;
+    data_ = static_cast<const char*>(addr);
+
+    // Usually we read front to back (each thread in its own range).
+    madvise(addr, size_, advice);
+    return true;
+  }
+
+  const char* data() const { return data_; }
+  const char* end() const { return data_ + size_; }
+  size_t size() const { return size_; }
+
+private:
+  int fd;
+  const char* data_;
+  size_t size_;
+};
+
+
+/*
+ * Text parsing. The mapping isn't NUL-terminated, so everything takes an end pointer (strtod can't).
+ */
+static inline void skip_space(const char*& p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+}
+
+static inline void next_line(const char*& p, const char* end) {
+  const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+  p = newline ? newline + 1 : end;
+}
+
+static inline bool at_line_end(const char* p, const char* end) {
+  return p >= end || *p == '\n' || *p == '\r';
+}
+
+static bool parse_int(const char*& p, const char* end, long& value) {
+  skip_space(p, end);
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+  if (p >= end || *p < '0' || *p > '9') return false;
+
+  value = 0;
+  while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+  if (negative) value = -value;
+  return true;
+}
+
+static bool parse_float(const char*& p, const char* end, float& value) {
+  static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                         1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  skip_space(p, end);
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+  double mantissa = 0.0;
+  int exponent = 0;
+  bool digits = false;
+
+  while (p < end && *p >= '0' && *p <= '9') { mantissa = mantissa * 10.0 + (*p++ - '0'); digits = true; }
+  if (p < end && *p == '.') {
+    ++p;
+    while (p < end && *p >= '0' && *p <= '9') { mantissa = mantissa * 10.0 + (*p++ - '0'); --exponent; digits = true; }
+  }
+  if (!digits) return false;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    long e;
+    if (!parse_int(p, end, e)) return false;
+    exponent += e;
+  }
+
+  while (exponent > 22)  { mantissa *= 1e22; exponent -= 22; }
+  while (exponent < -22) { mantissa /= 1e22; exponent += 22; }
+  mantissa = exponent >= 0 ? mantissa * POWERS_OF_TEN[exponent] : mantissa / POWERS_OF_TEN[-exponent];
+
+  value = static_cast<float>(negative ? -mantissa : mantissa);
+  return true;
+}
+
+static std::string parse_word(const char*& p, const char* end) {
+  skip_space(p, end);
+  const char* begin = p;
+  while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') ++p;
+  return std::string(begin, p);
+}
+
+static bool parse_vec3(const char*& p, const char* end, glm::vec3& value) {
+  return parse_float(p, end, value.x) && parse_float(p, end, value.y) && parse_float(p, end, value.z);
+}
+
+
+/*
+ * Split [begin, end) into parts at line boundaries.
+ */
+static void split_lines(const char* begin, const char* end, size_t parts, std::vector<const char*>& bounds) {
+  bounds.assign(1, begin);
+  for (size_t i = 1; i < parts; ++i) {
+    const char* p = std::max(bounds.back(), begin + (end - begin) * i / parts);
+    if (p > begin && p < end && p[-1] != '\n') next_line(p, end);
+    bounds.push_back(p);
+  }
+  bounds.push_back(end);
+}
+
+
+/*
+ * Split count fixed-size records into parts.
+ */
+static size_t range_begin(size_t count, size_t parts, size_t i) {
+  return count * i / parts;
+}
+
+
+/*
+ * Run each job on its own thread and wait for all of them.
+ */
+template <typename Job>
+static void run_jobs(std::vector<Job>& jobs) {
+  if (jobs.size() == 1) {
+    jobs[0]();
+    return;
+  }
+
+  boost::thread_group group;
+  for (size_t i = 0; i < jobs.size(); ++i)
+    group.create_thread(boost::ref(jobs[i]));
+  group.join_all();
+}
+
+
+/*
+ * Area-weighted vertex normals, for files that don't have any.
+ */
+static void generate_normals(std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices) {
+  for (size_t i = 0; i < vertices.size(); ++i)
+    vertices[i].normal = glm::vec3(0.0f);
+
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    Vertex& a = vertices[indices[t]];
+    Vertex& b = vertices[indices[t+1]];
+    Vertex& c = vertices[indices[t+2]];
+    glm::vec3 n = glm::cross(b.pos - a.pos, c.pos - a.pos); // length is twice the area
+    a.normal += n;
+    b.normal += n;
+    c.normal += n;
+  }
+
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    float length = glm::length(vertices[i].normal);
+    if (length > 0.0f) vertices[i].normal /= length;
+  }
+}
+
+
+static std::vector<std::string> default_textures() {
+  std::vector<std::string> texture_filenames(2);
+  texture_filenames[0] = "./resources/white.png";
+  texture_filenames[1] = "./resources/black.png";
+  return texture_filenames;
+}
+
+
+static std::string directory_of(const std::string& filename) {
+  std::string::size_type slash_index = filename.find_last_of("/");
+  if (slash_index == std::string::npos) return ".";
+  if (slash_index == 0)                 return "/";
+  return filename.substr(0, slash_index);
+}
+
+
+static std::string lowercase_extension(const std::string& filename) {
+  std::string::size_type dot = filename.find_last_of(".");
+  if (dot == std::string::npos) return "";
+  std::string extension = filename.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return extension;
+}
+
+
+/***************************************************************************************************
+ * PLY
+ ***************************************************************************************************/
+
+enum PlyType { PLY_INVALID, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+// Where a vertex property goes.
+enum PlyTarget { TARGET_NONE, TARGET_X, TARGET_Y, TARGET_Z, TARGET_NX, TARGET_NY, TARGET_NZ, TARGET_U, TARGET_V };
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  bool list;
+  PlyType count_type;
+  PlyTarget target;
+  size_t offset; // within a binary record, if every property before it has a fixed size
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> properties;
+  bool fixed_size;
+  size_t record_size;
+};
+
+
+static PlyType ply_type(const std::string& name) {
+  if (name == "char"   || name == "int8")    return PLY_INT8;
+  if (name == "uchar"  || name == "uint8")   return PLY_UINT8;
+  if (name == "short"  || name == "int16")   return PLY_INT16;
+  if (name == "ushort" || name == "uint16")  return PLY_UINT16;
+  if (name == "int"    || name == "int32")   return PLY_INT32;
+  if (name == "uint"   || name == "uint32")  return PLY_UINT32;
+  if (name == "float"  || name == "float32") return PLY_FLOAT32;
+  if (name == "double" || name == "float64") return PLY_FLOAT64;
+  return PLY_INVALID;
+}
+
+static size_t ply_type_size(PlyType type) {
+  switch(type) {
+  case PLY_INT8:    case PLY_UINT8:  return 1;
+  case PLY_INT16:   case PLY_UINT16: return 2;
+  case PLY_INT32:   case PLY_UINT32: case PLY_FLOAT32: return 4;
+  case PLY_FLOAT64: return 8;
+  default:          return 0;
+  }
+}
+
+static PlyTarget ply_target(const std::string& name) {
+  if (name == "x")  return TARGET_X;
+  if (name == "y")  return TARGET_Y;
+  if (name == "z")  return TARGET_Z;
+  if (name == "nx") return TARGET_NX;
+  if (name == "ny") return TARGET_NY;
+  if (name == "nz") return TARGET_NZ;
+  if (name == "u" || name == "s" || name == "texture_u" || name == "texture_s") return TARGET_U;
+  if (name == "v" || name == "t" || name == "texture_v" || name == "texture_t") return TARGET_V;
+  return TARGET_NONE;
+}
+
+
+/*
+ * Read one binary value of any PLY type, swapping bytes if the file's endianness isn't ours.
+ */
+static inline double read_ply_binary(const char* p, PlyType type, bool swap) {
+  char bytes[8];
+  size_t size = ply_type_size(type);
+  if (swap) for (size_t i = 0; i < size; ++i) bytes[i] = p[size - 1 - i];
+  else      memcpy(bytes, p, size);
+
+  switch(type) {
+  case PLY_INT8:    { int8_t   v; memcpy(&v, bytes, 1); return v; }
+  case PLY_UINT8:   { uint8_t  v; memcpy(&v, bytes, 1); return v; }
+  case PLY_INT16:   { int16_t  v; memcpy(&v, bytes, 2); return v; }
+  case PLY_UINT16:  { uint16_t v; memcpy(&v, bytes, 2); return v; }
+  case PLY_INT32:   { int32_t  v; memcpy(&v, bytes, 4); return v; }
+  case PLY_UINT32:  { uint32_t v; memcpy(&v, bytes, 4); return v; }
+  case PLY_FLOAT32: { float    v; memcpy(&v, bytes, 4); return v; }
+  case PLY_FLOAT64: { double   v; memcpy(&v, bytes, 8); return v; }
+  default:          return 0.0;
+  }
+}
+
+
+static inline void assign_ply_target(Vertex& vertex, PlyTarget target, float value) {
+  switch(target) {
+  case TARGET_X:  vertex.pos.x = value; break;
+  case TARGET_Y:  vertex.pos.y = value; break;
+  case TARGET_Z:  vertex.pos.z = value; break;
+  case TARGET_NX: vertex.normal.x = value; break;
+  case TARGET_NY: vertex.normal.y = value; break;
+  case TARGET_NZ: vertex.normal.z = value; break;
+  case TARGET_U:  vertex.diffuse_tex.x = value; break;
+  case TARGET_V:  vertex.diffuse_tex.y = value; break;
+  default: break;
+  }
+}
+
+
+static Vertex empty_vertex() {
+  return Vertex(glm::vec3(0.0f), glm::vec2(0.0f), glm::vec2(0.0f), glm::vec3(0.0f));
+}
+
+
+/*
+ * One fixed-size binary vertex record.
+ */
+static inline Vertex read_ply_vertex(const PlyElement& element, const char* record, bool swap) {
+  Vertex vertex = empty_vertex();
+  for (size_t j = 0; j < element.properties.size(); ++j) {
+    const PlyProperty& property = element.properties[j];
+    if (property.target != TARGET_NONE)
+      assign_ply_target(vertex, property.target, read_ply_binary(record + property.offset, property.type, swap));
+  }
+  return vertex;
+}
+
+
+/*
+ * One ASCII vertex line.
+ */
+static bool parse_ply_vertex(const char*& p, const char* end, const PlyElement& element, Vertex& vertex) {
+  vertex = empty_vertex();
+  for (size_t j = 0; j < element.properties.size(); ++j) {
+    float value;
+    if (!parse_float(p, end, value)) return false;
+    assign_ply_target(vertex, element.properties[j].target, value);
+  }
+  next_line(p, end);
+  return true;
+}
+
+
+/*
+ * Add corner k of a face to the fan in ids. Returns true once that makes a triangle.
+ */
+static inline bool add_fan_corner(uint32_t* ids, size_t k, uint32_t index) {
+  if (k == 0) ids[0] = index;
+  else {
+    ids[1] = ids[2];
+    ids[2] = index;
+  }
+  return k >= 2;
+}
+
+
+/*
+ * One face record (ASCII or binary): call visit(ids) for each triangle of the fan made by its first property,
+ * the index list. Faces with fewer than three corners have none. Returns false on a malformed record or an
+ * index out of range.
+ */
+template <typename Visitor>
+static bool parse_ply_face(const char*& p, const char* end, const PlyElement& element, bool ascii, bool swap,
+                           size_t vertex_count, Visitor& visit) {
+  uint32_t ids[3] = { 0, 0, 0 };
+
+  if (ascii) {
+    long n, index;
+    if (!parse_int(p, end, n) || n < 0) return false;
+    for (long k = 0; k < n; ++k) {
+      if (!parse_int(p, end, index) || index < 0 || static_cast<size_t>(index) >= vertex_count) return false;
+      if (add_fan_corner(ids, k, index)) visit(ids);
+    }
+    next_line(p, end); // anything after the list
+    return true;
+  }
+
+  for (size_t j = 0; j < element.properties.size(); ++j) {
+    const PlyProperty& property = element.properties[j];
+    size_t value_size = ply_type_size(property.type), n = 1;
+
+    if (property.list) {
+      size_t count_size = ply_type_size(property.count_type);
+      if (static_cast<size_t>(end - p) < count_size) return false;
+      n = static_cast<size_t>(read_ply_binary(p, property.count_type, swap));
+      p += count_size;
+    }
+    if (static_cast<size_t>(end - p) < n * value_size) return false;
+
+    if (j == 0) {
+      for (size_t k = 0; k < n; ++k) {
+        double index = read_ply_binary(p + k * value_size, property.type, swap);
+        if (index < 0 || index >= vertex_count) return false;
+        if (add_fan_corner(ids, k, static_cast<uint32_t>(index))) visit(ids);
+      }
+    }
+    p += n * value_size;
+  }
+  return true;
+}
+
+
+/*
+ * Skip over an element's records, without reading them.
+ */
+static bool skip_ply_element(const char*& p, const char* end, const PlyElement& element, bool ascii, bool swap) {
+  if (ascii) {
+    for (size_t i = 0; i < element.count; ++i) next_line(p, end);
+    return true;
+  }
+  if (element.fixed_size) {
+    if (static_cast<size_t>(end - p) < element.count * element.record_size) return false;
+    p += element.count * element.record_size;
+    return true;
+  }
+  for (size_t i = 0; i < element.count; ++i) {
+    for (size_t j = 0; j < element.properties.size(); ++j) {
+      const PlyProperty& property = element.properties[j];
+      size_t value_size = ply_type_size(property.type), n = 1;
+      if (property.list) {
+        size_t count_size = ply_type_size(property.count_type);
+        if (static_cast<size_t>(end - p) < count_size) return false;
+        n = static_cast<size_t>(read_ply_binary(p, property.count_type, swap));
+        p += count_size;
+      }
+      if (static_cast<size_t>(end - p) < n * value_size) return false;
+      p += n * value_size;
+    }
+  }
+  return true;
+}
+
+
+static bool read_ply_header(const MappedFile& file, std::vector<PlyElement>& elements, bool& ascii, bool& swap, const char*& body) {
+  const char* p   = file.data();
+  const char* end = file.end();
+
+  if (parse_word(p, end) != "ply") return false;
+  next_line(p, end);
+
+  bool little_endian_host;
+  {
+    uint16_t one = 1;
+    little_endian_host = *reinterpret_cast<const char*>(&one) == 1;
+  }
+
+  while (p < end) {
+    std::string keyword = parse_word(p, end);
+
+    if (keyword == "format") {
+      std::string format = parse_word(p, end);
+      ascii = format == "ascii";
+      if      (format == "binary_little_endian") swap = !little_endian_host;
+      else if (format == "binary_big_endian")    swap = little_endian_host;
+      else if (!ascii)                           return false;
+    } else if (keyword == "element") {
+      PlyElement element;
+      element.name = parse_word(p, end);
+      long count;
+      if (!parse_int(p, end, count) || count < 0) return false;
+      element.count       = count;
+      element.fixed_size  = true;
+      element.record_size = 0;
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      if (elements.empty()) return false;
+      PlyElement& element = elements.back();
+      PlyProperty property;
+      std::string type = parse_word(p, end);
+      property.list = type == "list";
+      if (property.list) {
+        property.count_type = ply_type(parse_word(p, end));
+        property.type       = ply_type(parse_word(p, end));
+        if (property.count_type == PLY_INVALID) return false;
+      } else {
+        property.count_type = PLY_INVALID;
+        property.type       = ply_type(type);
+      }
+      if (property.type == PLY_INVALID) return false;
+      property.name   = parse_word(p, end);
+      property.target = element.name == "vertex" ? ply_target(property.name) : TARGET_NONE;
+      property.offset = element.record_size;
+
+      if (property.list) element.fixed_size = false;
+      else               element.record_size += ply_type_size(property.type);
+
+      element.properties.push_back(property);
+    } else if (keyword == "end_header") {
+      next_line(p, end);
+      body = p;
+      return true;
+    } // comment, obj_info: ignore
+
+    next_line(p, end);
+  }
+
+  return false;
+}
+
+
+/*
+ * Find the (first) vertex and face elements; any others are skipped. Vertices must have a fixed size.
+ */
+static bool find_ply_elements(const std::vector<PlyElement>& elements, size_t& vertex_element, size_t& face_element,
+                              bool& has_normals) {
+  bool found_vertex = false, found_face = false;
+  for (size_t e = 0; e < elements.size(); ++e) {
+    const PlyElement& element = elements[e];
+    if (element.name == "vertex" && !found_vertex) {
+      vertex_element = e;
+      found_vertex = true;
+    } else if (element.name == "face" && !element.properties.empty() && element.properties[0].list && !found_face) {
+      face_element = e;
+      found_face = true;
+    }
+  }
+  if (!found_vertex || !found_face || !elements[vertex_element].fixed_size) return false;
+
+  has_normals = false;
+  const PlyElement& vertices = elements[vertex_element];
+  for (size_t j = 0; j < vertices.properties.size(); ++j)
+    if (vertices.properties[j].target == TARGET_NX) has_normals = true;
+  return true;
+}
+
+
+/***************************************************************************************************
+ * OBJ
+ ***************************************************************************************************/
+
+/*
+ * One corner of a face as written. Negative indices count back from the most recent element, which in
+ * a parallel parse may be in an earlier range; relative ones are resolved once every range's counts are
+ * known.
+ */
+struct ObjCorner {
+  long v, vt, vn;          // 0-based within the file, or (if relative) within the range; -1 (absolute) if absent
+  unsigned char relative;  // bit 0: v, bit 1: vt, bit 2: vn
+};
+
+struct ObjCornerKey {
+  long v, vt, vn;
+  bool operator==(const ObjCornerKey& rhs) const { return v == rhs.v && vt == rhs.vt && vn == rhs.vn; }
+};
+
+static inline size_t hash_value(const ObjCornerKey& key) {
+  size_t seed = 0;
+  boost::hash_combine(seed, key.v);
+  boost::hash_combine(seed, key.vt);
+  boost::hash_combine(seed, key.vn);
+  return seed;
+}
+
+
+enum ObjKeyword { OBJ_OTHER, OBJ_POSITION, OBJ_TEXCOORD, OBJ_NORMAL, OBJ_FACE, OBJ_USEMTL, OBJ_MTLLIB };
+
+/*
+ * What a line holds, skipping past its keyword if it's one we read (comments, o, g, s, l: OBJ_OTHER).
+ */
+static ObjKeyword obj_keyword(const char*& p, const char* end) {
+  skip_space(p, end);
+  if (p >= end) return OBJ_OTHER;
+
+  if (p[0] == 'v' && p + 1 < end && (p[1] == ' ' || p[1] == '\t'))                 { p += 1; return OBJ_POSITION; }
+  if (p[0] == 'v' && p + 2 < end && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) { p += 2; return OBJ_TEXCOORD; }
+  if (p[0] == 'v' && p + 2 < end && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) { p += 2; return OBJ_NORMAL; }
+  if (p[0] == 'f' && p + 1 < end && (p[1] == ' ' || p[1] == '\t'))                 { p += 1; return OBJ_FACE; }
+  if (end - p > 7 && strncmp(p, "usemtl", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))  { p += 6; return OBJ_USEMTL; }
+  if (end - p > 7 && strncmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t'))  { p += 6; return OBJ_MTLLIB; }
+  return OBJ_OTHER;
+}
+
+
+static bool parse_obj_index(const char*& p, const char* end, long count, long& value, unsigned char& relative, unsigned char bit) {
+  long raw;
+  if (!parse_int(p, end, raw) || raw == 0) return false;
+  if (raw > 0) value = raw - 1;
+  else {
+    value = count + raw;
+    relative |= bit;
+  }
+  return true;
+}
+
+
+/*
+ * Append the corners of an f line. Negative indices are counted back from the counts given, and marked relative.
+ */
+static bool parse_obj_face(const char*& p, const char* end, long positions, long texcoords, long normals,
+                           std::vector<ObjCorner>& corners) {
+  skip_space(p, end);
+  while (!at_line_end(p, end)) {
+    ObjCorner corner;
+    corner.vt = corner.vn = -1;
+    corner.relative = 0;
+    if (!parse_obj_index(p, end, positions, corner.v, corner.relative, 1)) return false;
+    if (p < end && *p == '/') {
+      ++p;
+      if (p < end && *p != '/' && !parse_obj_index(p, end, texcoords, corner.vt, corner.relative, 2)) return false;
+      if (p < end && *p == '/') {
+        ++p;
+        if (!parse_obj_index(p, end, normals, corner.vn, corner.relative, 4)) return false;
+      }
+    }
+    corners.push_back(corner);
+    skip_space(p, end);
+  }
+  return true;
+}
+
+
+/*
+ * A corner's indices within the file, given the counts where the corner's range began.
+ */
+static inline ObjCornerKey resolve_obj_corner(const ObjCorner& corner, long position_base, long texcoord_base, long normal_base) {
+  ObjCornerKey key;
+  key.v  = corner.v  + ((corner.relative & 1) ? position_base : 0);
+  key.vt = corner.vt + ((corner.relative & 2) ? texcoord_base : 0);
+  key.vn = corner.vn + ((corner.relative & 4) ? normal_base   : 0);
+  return key;
+}
+
+static inline bool obj_corner_in_range(const ObjCornerKey& key, long positions, long texcoords, long normals) {
+  return key.v >= 0 && key.v < positions && key.vt < texcoords && key.vn < normals;
+}
+
+static inline Vertex obj_vertex(const ObjCornerKey& key, const std::vector<glm::vec3>& positions,
+                                const std::vector<glm::vec2>& texcoords, const std::vector<glm::vec3>& normals) {
+  return Vertex(positions[key.v],
+                key.vt >= 0 ? texcoords[key.vt] : glm::vec2(0.0f),
+                glm::vec2(0.0f),
+                key.vn >= 0 ? normals[key.vn] : glm::vec3(0.0f));
+}
+
+
+/*
+ * The pass every OBJ reader makes over a range of lines. For each line it understands, it calls the visitor's
+ * position(v), texcoord(vt), normal(vn), usemtl(name), mtllib(name), or face(corners) for faces of three or more
+ * corners, whose negative indices are counted back from the range's own counts (and marked relative). face() can
+ * return false to stop. Returns false on a malformed line.
+ */
+template <typename Visitor>
+static bool parse_obj(const char* p, const char* end, Visitor& visit) {
+  long positions = 0, texcoords = 0, normals = 0;
+  std::vector<ObjCorner> corners;
+
+  while (p < end) {
+    switch(obj_keyword(p, end)) {
+    case OBJ_POSITION: {
+      glm::vec3 v;
+      if (!parse_vec3(p, end, v)) return false;
+      visit.position(v);
+      ++positions;
+      break;
+    }
+    case OBJ_TEXCOORD: {
+      glm::vec2 vt(0.0f);
+      if (!parse_float(p, end, vt.x)) return false;
+      parse_float(p, end, vt.y); // optional
+      visit.texcoord(vt);
+      ++texcoords;
+      break;
+    }
+    case OBJ_NORMAL: {
+      glm::vec3 vn;
+      if (!parse_vec3(p, end, vn)) return false;
+      visit.normal(vn);
+      ++normals;
+      break;
+    }
+    case OBJ_FACE:
+      corners.clear();
+      if (!parse_obj_face(p, end, positions, texcoords, normals, corners)) return false;
+      if (corners.size() >= 3 && !visit.face(corners)) return false;
+      break;
+    case OBJ_USEMTL:
+      visit.usemtl(parse_word(p, end));
+      break;
+    case OBJ_MTLLIB:
+      visit.mtllib(parse_word(p, end));
+      break;
+    default:
+      break;
+    }
+
+    next_line(p, end);
+  }
+  return true;
+}
+
+
+/*
+ * Read the diffuse and specular maps out of a .mtl file. Returns false only if the file can't be read.
+ */
+static bool load_mtl(const std::string& filename, std::map<std::string, std::vector<std::string> >& materials) {
+  MappedFile file;
+  if (!file.open(filename)) return false;
+
+  std::string dir = directory_of(filename);
+  const char* p   = file.data();
+  const char* end = file.end();
+  std::vector<std::string>* current = NULL;
+
+  while (p < end) {
+    std::string keyword = parse_word(p, end);
+    if (keyword == "newmtl") {
+      current = &(materials[parse_word(p, end)] = default_textures());
+    } else if (current && (keyword == "map_Kd" || keyword == "map_Ks")) {
+      // The filename is the last word; anything before it is an option.
+      std::string path;
+      while (!at_line_end(p, end)) {
+        std::string word = parse_word(p, end);
+        if (!word.empty()) path = word;
+        skip_space(p, end);
+      }
+      if (!path.empty()) (*current)[keyword == "map_Kd" ? 0 : 1] = dir + "/" + path;
+    }
+    next_line(p, end);
+  }
+
+  return true;
+}
+
+
+/*
+ * Every material in the libraries an OBJ file names (relative to the file), warning about any that can't be read.
+ */
+static void load_mtl_libraries(const std::string& filename, const std::vector<std::string>& libraries,
+                               std::map<std::string, std::vector<std::string> >& materials) {
+  std::string dir = directory_of(filename);
+  for (size_t i = 0; i < libraries.size(); ++i)
+    if (!load_mtl(dir + "/" + libraries[i], materials))
+      std::cerr << "WARNING: Unable to read material library '" << libraries[i] << "'" << std::endl;
+}
+
+static std::vector<std::string> mtl_textures(const std::map<std::string, std::vector<std::string> >& materials,
+                                             const std::string& name) {
+  std::map<std::string, std::vector<std::string> >::const_iterator textures = materials.find(name);
+  return textures == materials.end() ? default_textures() : textures->second;
+}
+
+
+/***************************************************************************************************
+ * STL
+ ***************************************************************************************************/
+
+const size_t STL_HEADER_SIZE = 84;
+const size_t STL_RECORD_SIZE = 50;
+
+/*
+ * Binary files are exactly as long as their triangle count says (ASCII ones start with "solid", but so
+ * do some binary ones).
+ */
+static bool is_binary_stl(const MappedFile& file, uint32_t& count) {
+  if (file.size() < STL_HEADER_SIZE) return false;
+  memcpy(&count, file.data() + 80, sizeof(uint32_t));
+  return file.size() == STL_HEADER_SIZE + STL_RECORD_SIZE * static_cast<size_t>(count);
+}
+
+
+/*
+ * Binary triangle i. STL doesn't share vertices, so each corner gets the facet normal (worked out from the
+ * corners if the file left it zero).
+ */
+static inline void read_stl_triangle(const char* data, size_t i, Vertex* corners) {
+  float values[12];
+  memcpy(values, data + STL_HEADER_SIZE + i * STL_RECORD_SIZE, sizeof(values));
+
+  glm::vec3 normal(values[0], values[1], values[2]);
+  glm::vec3 a(values[3], values[4], values[5]),
+            b(values[6], values[7], values[8]),
+            c(values[9], values[10], values[11]);
+  if (glm::length(normal) == 0.0f) {
+    normal = glm::cross(b - a, c - a);
+    float length = glm::length(normal);
+    if (length > 0.0f) normal /= length;
+  }
+
+  corners[0] = Vertex(a, glm::vec2(0.0f), glm::vec2(0.0f), normal);
+  corners[1] = Vertex(b, glm::vec2(0.0f), glm::vec2(0.0f), normal);
+  corners[2] = Vertex(c, glm::vec2(0.0f), glm::vec2(0.0f), normal);
+}
+
+
+/*
+ * Call visit(corners) for each triangle of an ASCII file. These are rare and small enough that one thread is fine.
+ */
+template <typename Visitor>
+static bool parse_stl_ascii(const MappedFile& file, Visitor& visit) {
+  const char* p   = file.data();
+  const char* end = file.end();
+  if (parse_word(p, end) != "solid") return false;
+  next_line(p, end);
+
+  glm::vec3 normal(0.0f);
+  Vertex corners[3];
+  size_t corner = 0;
+  while (p < end) {
+    std::string keyword = parse_word(p, end);
+    if (keyword == "facet") {
+      parse_word(p, end); // "normal"
+      if (!parse_vec3(p, end, normal)) return false;
+    } else if (keyword == "vertex") {
+      glm::vec3 v;
+      if (!parse_vec3(p, end, v)) return false;
+      corners[corner % 3] = Vertex(v, glm::vec2(0.0f), glm::vec2(0.0f), normal);
+      if (++corner % 3 == 0) visit(corners);
+    }
+    next_line(p, end);
+  }
+
+  return corner > 0 && corner % 3 == 0;
+}
+
+
+/*
+ * Call visit(corners) for each triangle of a binary or ASCII file.
+ */
+template <typename Visitor>
+static bool walk_stl_triangles(const MappedFile& file, Visitor& visit) {
+  uint32_t count;
+  if (!is_binary_stl(file, count)) return parse_stl_ascii(file, visit);
+
+  Vertex corners[3];
+  for (size_t i = 0; i < count; ++i) {
+    read_stl_triangle(file.data(), i, corners);
+    visit(corners);
+  }
+  return count > 0;
+}
+
+
+/***************************************************************************************************
+ * Loading, in parallel ranges
+ ***************************************************************************************************/
+
+/*
+ * Parses a range of fixed-size binary vertex records.
+ */
+struct PlyBinaryVertexJob {
+  const PlyElement* element;
+  const char* data;
+  bool swap;
+  std::vector<Vertex>* vertices;
+  size_t begin, end;
+
+  void operator()() {
+    for (size_t i = begin; i < end; ++i)
+      (*vertices)[i] = read_ply_vertex(*element, data + i * element->record_size, swap);
+  }
+};
+
+
+/*
+ * Appends the triangles parse_ply_face() finds to an index list.
+ */
+struct PlyIndexVisitor {
+  std::vector<unsigned int>* indices;
+  void operator()(const uint32_t* ids) { indices->insert(indices->end(), ids, ids + 3); }
+};
+
+/*
+ * Keeps the first triangle parse_ply_face() finds, and counts them.
+ */
+struct PlyFirstTriangleVisitor {
+  unsigned int* ids;
+  size_t triangles;
+  void operator()(const uint32_t* found) {
+    if (triangles++ == 0) std::copy(found, found + 3, ids);
+  }
+};
+
+
+/*
+ * Parses a range of binary faces, assuming every one is a triangle. Sets ok to false if that's wrong.
+ */
+struct PlyBinaryTriangleJob {
+  const PlyElement* element;
+  const char* data;
+  bool swap;
+  size_t record_size;
+  size_t vertex_count;
+  std::vector<unsigned int>* indices;
+  size_t begin, end;
+  bool ok;
+
+  void operator()() {
+    ok = true;
+    for (size_t i = begin; i < end; ++i) {
+      const char* record = data + i * record_size;
+      PlyFirstTriangleVisitor triangle = { &(*indices)[i*3], 0 };
+      if (!parse_ply_face(record, record + record_size, *element, false, swap, vertex_count, triangle) || triangle.triangles != 1) {
+        ok = false;
+        return;
+      }
+    }
+  }
+};
+
+
+/*
+ * Parses a range of ASCII vertex lines.
+ */
+struct PlyAsciiVertexJob {
+  const PlyElement* element;
+  const char* text_begin;
+  const char* text_end;
+  std::vector<Vertex>* vertices;
+  size_t first;
+  size_t count;
+  bool ok;
+
+  void operator()() {
+    const char* p = text_begin;
+    ok = true;
+    for (size_t i = first; i < first + count; ++i) {
+      if (!parse_ply_vertex(p, text_end, *element, (*vertices)[i])) {
+        ok = false;
+        return;
+      }
+    }
+  }
+};
+
+
+/*
+ * Parses a range of ASCII face lines into its own index list (faces aren't all the same size).
+ */
+struct PlyAsciiFaceJob {
+  const PlyElement* element;
+  const char* text_begin;
+  const char* text_end;
+  size_t count;
+  size_t vertex_count;
+  std::vector<unsigned int> indices;
+  bool ok;
+
+  void operator()() {
+    const char* p = text_begin;
+    PlyIndexVisitor append = { &indices };
+    ok = true;
+    for (size_t i = 0; i < count; ++i) {
+      if (!parse_ply_face(p, text_end, *element, true, false, vertex_count, append)) {
+        ok = false;
+        return;
+      }
+    }
+  }
+};
+
+
+/*
+ * Find the start of each of count lines, and split them into parts. Returns the end of the last line.
+ */
+static const char* split_line_records(const char* p, const char* end, size_t count, size_t parts,
+                                      std::vector<const char*>& bounds, std::vector<size_t>& firsts) {
+  bounds.clear();
+  firsts.clear();
+  for (size_t i = 0; i < count; ++i) {
+    if (firsts.size() < parts && i == range_begin(count, parts, firsts.size())) {
+      bounds.push_back(p);
+      firsts.push_back(i);
+    }
+    next_line(p, end);
+  }
+  bounds.push_back(p);
+  firsts.push_back(count);
+  return p;
+}
+
+
+static bool load_ply(const MappedFile& file, NativeModel& model, size_t threads) {
+  std::vector<PlyElement> elements;
+  bool ascii = false, swap = false, has_normals;
+  size_t vertex_element, face_element;
+  const char* p;
+  if (!read_ply_header(file, elements, ascii, swap, p) ||
+      !find_ply_elements(elements, vertex_element, face_element, has_normals)) return false;
+
+  const char* end = file.end();
+  model.meshes.resize(1);
+  model.materials.assign(1, default_textures());
+  std::vector<Vertex>& vertices = model.meshes[0].vertices;
+  std::vector<unsigned int>& indices = model.meshes[0].indices;
+  size_t vertex_count = elements[vertex_element].count;
+
+  for (size_t e = 0; e < elements.size(); ++e) {
+    const PlyElement& element = elements[e];
+
+    if (e != vertex_element && e != face_element) {
+      if (!skip_ply_element(p, end, element, ascii, swap)) return false;
+      continue;
+    }
+
+    if (ascii) {
+      std::vector<const char*> bounds;
+      std::vector<size_t> firsts;
+      const char* next = split_line_records(p, end, element.count, threads, bounds, firsts);
+
+      if (e == vertex_element) {
+        vertices.resize(vertex_count);
+        std::vector<PlyAsciiVertexJob> jobs(firsts.size() - 1);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+          PlyAsciiVertexJob job = { &element, bounds[i], bounds[i+1], &vertices, firsts[i], firsts[i+1] - firsts[i], false };
+          jobs[i] = job;
+        }
+        run_jobs(jobs);
+        for (size_t i = 0; i < jobs.size(); ++i)
+          if (!jobs[i].ok) return false;
+      } else {
+        std::vector<PlyAsciiFaceJob> jobs(firsts.size() - 1);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+          jobs[i].element      = &element;
+          jobs[i].text_begin   = bounds[i];
+          jobs[i].text_end     = bounds[i+1];
+          jobs[i].count        = firsts[i+1] - firsts[i];
+          jobs[i].vertex_count = vertex_count;
+          jobs[i].indices.reserve(jobs[i].count * 3);
+        }
+        run_jobs(jobs);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+          if (!jobs[i].ok) return false;
+          indices.insert(indices.end(), jobs[i].indices.begin(), jobs[i].indices.end());
+        }
+      }
+
+      p = next;
+      continue;
+    }
+
+    // Binary.
+    if (e == vertex_element) {
+      if (static_cast<size_t>(end - p) < element.count * element.record_size) return false;
+      vertices.resize(vertex_count);
+
+      std::vector<PlyBinaryVertexJob> jobs(std::min(threads, std::max<size_t>(element.count, 1)));
+      for (size_t i = 0; i < jobs.size(); ++i) {
+        PlyBinaryVertexJob job = { &element, p, swap, &vertices,
+                                   range_begin(element.count, jobs.size(), i), range_begin(element.count, jobs.size(), i+1) };
+        jobs[i] = job;
+      }
+      run_jobs(jobs);
+
+      p += element.count * element.record_size;
+      continue;
+    }
+
+    // Faces made of nothing but a list of three indices have a fixed size after all; try that first.
+    if (element.properties.size() == 1) {
+      const PlyProperty& list = element.properties[0];
+      size_t record_size = ply_type_size(list.count_type) + 3 * ply_type_size(list.type);
+
+      if (static_cast<size_t>(end - p) >= element.count * record_size) {
+        std::vector<unsigned int> triangles(element.count * 3);
+        std::vector<PlyBinaryTriangleJob> jobs(std::min(threads, std::max<size_t>(element.count, 1)));
+        for (size_t i = 0; i < jobs.size(); ++i) {
+          PlyBinaryTriangleJob job = { &element, p, swap, record_size, vertex_count, &triangles,
+                                       range_begin(element.count, jobs.size(), i), range_begin(element.count, jobs.size(), i+1), false };
+          jobs[i] = job;
+        }
+        run_jobs(jobs);
+
+        bool all_triangles = true;
+        for (size_t i = 0; i < jobs.size(); ++i) all_triangles = all_triangles && jobs[i].ok;
+
+        if (all_triangles) {
+          indices.insert(indices.end(), triangles.begin(), triangles.end());
+          p += element.count * record_size;
+          continue;
+        }
+      }
+    }
+
+    // General case: walk the records one at a time.
+    PlyIndexVisitor append = { &indices };
+    for (size_t i = 0; i < element.count; ++i)
+      if (!parse_ply_face(p, end, element, false, swap, vertex_count, append)) return false;
+  }
+
+  if (vertices.empty() || indices.empty()) return false;
+  if (!has_normals) generate_normals(vertices, indices);
+  return true;
+}
+
+
+struct ObjFace {
+  size_t first_corner;
+  size_t corner_count;
+  long   material;         // index into the range's material names, or -1 to inherit from the previous range
+};
+
+struct ObjRangeJob {
+  const char* text_begin;
+  const char* text_end;
+
+  std::vector<glm::vec3> positions, normals;
+  std::vector<glm::vec2> texcoords;
+  std::vector<ObjCorner> corners;
+  std::vector<ObjFace>   faces;
+  std::vector<std::string> material_names;
+  std::vector<std::string> material_libraries;
+  long current_material;
+  bool ok;
+
+  void position(const glm::vec3& v)  { positions.push_back(v); }
+  void texcoord(const glm::vec2& vt) { texcoords.push_back(vt); }
+  void normal(const glm::vec3& vn)   { normals.push_back(vn); }
+  void mtllib(const std::string& name) { material_libraries.push_back(name); }
+
+  void usemtl(const std::string& name) {
+    material_names.push_back(name);
+    current_material = material_names.size() - 1;
+  }
+
+  bool face(const std::vector<ObjCorner>& face_corners) {
+    ObjFace record = { corners.size(), face_corners.size(), current_material };
+    corners.insert(corners.end(), face_corners.begin(), face_corners.end());
+    faces.push_back(record);
+    return true;
+  }
+
+  void operator()() {
+    current_material = -1;
+    ok = parse_obj(text_begin, text_end, *this);
+  }
+};
+
+
+static bool load_obj(const std::string& filename, const MappedFile& file, NativeModel& model, size_t threads) {
+  std::vector<const char*> bounds;
+  split_lines(file.data(), file.end(), threads, bounds);
+
+  std::vector<ObjRangeJob> jobs(threads);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    jobs[i].text_begin = bounds[i];
+    jobs[i].text_end   = bounds[i+1];
+  }
+  run_jobs(jobs);
+
+  // Global counts at the start of each range, for resolving relative indices.
+  std::vector<long> position_base(jobs.size(), 0), texcoord_base(jobs.size(), 0), normal_base(jobs.size(), 0);
+  std::vector<glm::vec3> positions, normals;
+  std::vector<glm::vec2> texcoords;
+  std::vector<std::string> libraries;
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (!jobs[i].ok) return false;
+    position_base[i] = positions.size();
+    texcoord_base[i] = texcoords.size();
+    normal_base[i]   = normals.size();
+    positions.insert(positions.end(), jobs[i].positions.begin(), jobs[i].positions.end());
+    texcoords.insert(texcoords.end(), jobs[i].texcoords.begin(), jobs[i].texcoords.end());
+    normals.insert(normals.end(), jobs[i].normals.begin(), jobs[i].normals.end());
+    libraries.insert(libraries.end(), jobs[i].material_libraries.begin(), jobs[i].material_libraries.end());
+    std::vector<glm::vec3>().swap(jobs[i].positions);
+    std::vector<glm::vec2>().swap(jobs[i].texcoords);
+    std::vector<glm::vec3>().swap(jobs[i].normals);
+  }
+
+  // Materials, from every library the file mentions.
+  std::map<std::string, std::vector<std::string> > library;
+  load_mtl_libraries(filename, libraries, library);
+
+  // One mesh per material in use, in order of first use; faces before any usemtl get the default.
+  std::map<std::string, size_t> mesh_for_material;
+  std::vector<boost::unordered_map<ObjCornerKey, unsigned int> > welded;
+  std::vector<bool> missing_normals; // for each mesh, whether any of its corners lacks a vn
+  std::string material = "";
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const ObjRangeJob& job = jobs[i];
+
+    for (size_t f = 0; f < job.faces.size(); ++f) {
+      const ObjFace& face = job.faces[f];
+      if (face.material >= 0) material = job.material_names[face.material];
+
+      std::map<std::string, size_t>::iterator found = mesh_for_material.find(material);
+      if (found == mesh_for_material.end()) {
+        found = mesh_for_material.insert(std::make_pair(material, model.meshes.size())).first;
+        model.meshes.push_back(NativeMesh());
+        model.meshes.back().material_index = model.materials.size();
+        welded.push_back(boost::unordered_map<ObjCornerKey, unsigned int>());
+        missing_normals.push_back(false);
+        model.materials.push_back(mtl_textures(library, material));
+      }
+
+      NativeMesh& mesh = model.meshes[found->second];
+      boost::unordered_map<ObjCornerKey, unsigned int>& mesh_welded = welded[found->second];
+
+      // Resolve and weld each corner.
+      std::vector<unsigned int> face_indices(face.corner_count);
+      for (size_t k = 0; k < face.corner_count; ++k) {
+        ObjCornerKey key = resolve_obj_corner(job.corners[face.first_corner + k], position_base[i], texcoord_base[i], normal_base[i]);
+        if (!obj_corner_in_range(key, positions.size(), texcoords.size(), normals.size())) return false;
+        if (key.vn < 0) missing_normals[found->second] = true;
+
+        boost::unordered_map<ObjCornerKey, unsigned int>::iterator it = mesh_welded.find(key);
+        if (it == mesh_welded.end()) {
+          it = mesh_welded.insert(std::make_pair(key, static_cast<unsigned int>(mesh.vertices.size()))).first;
+          mesh.vertices.push_back(obj_vertex(key, positions, texcoords, normals));
+        }
+        face_indices[k] = it->second;
+      }
+
+      for (size_t k = 2; k < face_indices.size(); ++k) {
+        mesh.indices.push_back(face_indices[0]);
+        mesh.indices.push_back(face_indices[k-1]);
+        mesh.indices.push_back(face_indices[k]);
+      }
+    }
+
+    // A usemtl at the end of a range still applies to the next one.
+    if (!job.material_names.empty()) material = job.material_names.back();
+  }
+
+  if (model.meshes.empty()) return false;
+
+  // Only meshes with corners lacking normals get generated ones; the rest keep what was authored.
+  for (size_t m = 0; m < model.meshes.size(); ++m)
+    if (missing_normals[m]) generate_normals(model.meshes[m].vertices, model.meshes[m].indices);
+
+  return true;
+}
+
+
+/*
+ * Parses a range of binary STL triangles.
+ */
+struct StlBinaryJob {
+  const char* data;
+  std::vector<Vertex>* vertices;
+  std::vector<unsigned int>* indices;
+  size_t begin, end;
+
+  void operator()() {
+    for (size_t i = begin; i < end; ++i) {
+      read_stl_triangle(data, i, &(*vertices)[i*3]);
+      for (size_t k = 0; k < 3; ++k) (*indices)[i*3+k] = i*3+k;
+    }
+  }
+};
+
+/*
+ * Appends each ASCII STL triangle's corners as vertices of their own.
+ */
+struct StlAppendVisitor {
+  std::vector<Vertex>* vertices;
+  std::vector<unsigned int>* indices;
+  void operator()(const Vertex* corners) {
+    for (size_t k = 0; k < 3; ++k) {
+      indices->push_back(vertices->size());
+      vertices->push_back(corners[k]);
+    }
+  }
+};
+
+
+static bool load_stl(const MappedFile& file, NativeModel& model, size_t threads) {
+  model.meshes.resize(1);
+  model.materials.assign(1, default_textures());
+  std::vector<Vertex>& vertices = model.meshes[0].vertices;
+  std::vector<unsigned int>& indices = model.meshes[0].indices;
+
+  uint32_t count;
+  if (!is_binary_stl(file, count)) {
+    StlAppendVisitor append = { &vertices, &indices };
+    return parse_stl_ascii(file, append);
+  }
+
+  vertices.resize(count * 3);
+  indices.resize(count * 3);
+
+  std::vector<StlBinaryJob> jobs(std::min(threads, std::max<size_t>(count, 1)));
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    StlBinaryJob job = { file.data(), &vertices, &indices, range_begin(count, jobs.size(), i), range_begin(count, jobs.size(), i+1) };
+    jobs[i] = job;
+  }
+  run_jobs(jobs);
+  return count > 0;
+}
+
+
+/***************************************************************************************************
+ * Streaming
+ ***************************************************************************************************/
+
+enum StreamFormat { STREAM_PLY, STREAM_OBJ, STREAM_STL };
+
+struct NativeStreamState {
+  MappedFile   file;
+  std::string  filename;
+  StreamFormat format;
+
+  size_t triangles;
+  std::vector<std::vector<std::string> > materials;
+  std::vector<size_t> mesh_materials;
+  glm::vec3 bounds_min, bounds_max;
+  double    centroid_sum[3];
+  size_t    vertex_count;
+
+  // PLY
+  std::vector<PlyElement>  elements;
+  std::vector<const char*> bodies; // where each element's records start
+  bool   ascii, swap, has_normals;
+  size_t vertex_element, face_element;
+  std::vector<Vertex> vertices;    // ASCII only; binary vertices are read from the mapping
+
+  // OBJ
+  std::vector<glm::vec3> positions, normals;
+  std::vector<glm::vec2> texcoords;
+  std::map<std::string, size_t> mesh_for_material;
+  std::vector<boost::unordered_map<ObjCornerKey, uint32_t> > corner_ids; // for each mesh
+
+  // Generated normals, by corner id, for each mesh that needs them (PLY has one mesh).
+  std::vector<std::vector<glm::vec3> > generated_normals;
+
+  NativeStreamState() : format(STREAM_PLY), triangles(0), vertex_count(0), ascii(false), swap(false), has_normals(false),
+                        vertex_element(0), face_element(0) {
+    bounds_min = glm::vec3( std::numeric_limits<float>::max());
+    bounds_max = glm::vec3(-std::numeric_limits<float>::max());
+    centroid_sum[0] = centroid_sum[1] = centroid_sum[2] = 0.0;
+  }
+
+  void add_vertex(const glm::vec3& pos) {
+    bounds_min = glm::min(bounds_min, pos);
+    bounds_max = glm::max(bounds_max, pos);
+    for (size_t k = 0; k < 3; ++k) centroid_sum[k] += pos[k];
+    ++vertex_count;
+  }
+};
+
+
+/*
+ * Add a triangle's area-weighted normal to each of its corners (as generate_normals() does).
+ */
+static void accumulate_normal(std::vector<glm::vec3>& normals, const uint32_t* ids, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+  glm::vec3 n = glm::cross(b - a, c - a);
+  for (size_t k = 0; k < 3; ++k) normals[ids[k]] += n;
+}
+
+static void normalize_all(std::vector<glm::vec3>& normals) {
+  for (size_t i = 0; i < normals.size(); ++i) {
+    float length = glm::length(normals[i]);
+    if (length > 0.0f) normals[i] /= length;
+  }
+}
+
+
+/*
+ * PLY: binary vertices are read from the mapping as the faces need them; ASCII ones are parsed once, up front.
+ */
+static Vertex ply_stream_vertex(const NativeStreamState& s, uint32_t i) {
+  Vertex vertex = s.ascii ? s.vertices[i] : read_ply_vertex(s.elements[s.vertex_element],
+                                                            s.bodies[s.vertex_element] + i * s.elements[s.vertex_element].record_size, s.swap);
+  if (!s.has_normals) vertex.normal = s.generated_normals[0][i];
+  return vertex;
+}
+
+
+template <typename Visitor>
+static bool walk_ply_faces(const NativeStreamState& s, Visitor& visit) {
+  const PlyElement& element = s.elements[s.face_element];
+  const char* p = s.bodies[s.face_element];
+  for (size_t i = 0; i < element.count; ++i)
+    if (!parse_ply_face(p, s.file.end(), element, s.ascii, s.swap, s.elements[s.vertex_element].count, visit)) return false;
+  return true;
+}
+
+
+/*
+ * First pass over a PLY file: count triangles and, if there are no normals, generate them.
+ */
+struct PlyCountVisitor {
+  NativeStreamState* s;
+  void operator()(const uint32_t* ids) {
+    ++s->triangles;
+    if (!s->has_normals)
+      accumulate_normal(s->generated_normals[0], ids, ply_stream_vertex(*s, ids[0]).pos, ply_stream_vertex(*s, ids[1]).pos,
+                        ply_stream_vertex(*s, ids[2]).pos);
+  }
+};
+
+struct PlyEmitVisitor {
+  const NativeStreamState* s;
+  TriangleSink* sink;
+  void operator()(const uint32_t* ids) {
+    Vertex corners[3] = { ply_stream_vertex(*s, ids[0]), ply_stream_vertex(*s, ids[1]), ply_stream_vertex(*s, ids[2]) };
+    sink->triangle(0, corners, ids);
+  }
+};
+
+
+static bool open_ply_stream(NativeStreamState& s) {
+  const char* p;
+  if (!read_ply_header(s.file, s.elements, s.ascii, s.swap, p) ||
+      !find_ply_elements(s.elements, s.vertex_element, s.face_element, s.has_normals)) return false;
+
+  for (size_t e = 0; e < s.elements.size(); ++e) {
+    s.bodies.push_back(p);
+    if (!skip_ply_element(p, s.file.end(), s.elements[e], s.ascii, s.swap)) return false;
+  }
+
+  const PlyElement& vertices = s.elements[s.vertex_element];
+  if (s.ascii) {
+    const char* q = s.bodies[s.vertex_element];
+    s.vertices.resize(vertices.count);
+    for (size_t i = 0; i < vertices.count; ++i)
+      if (!parse_ply_vertex(q, s.file.end(), vertices, s.vertices[i])) return false;
+  }
+
+  if (!s.has_normals) s.generated_normals.assign(1, std::vector<glm::vec3>(vertices.count, glm::vec3(0.0f)));
+
+  for (size_t i = 0; i < vertices.count; ++i)
+    s.add_vertex(ply_stream_vertex(s, i).pos);
+
+  PlyCountVisitor count = { &s };
+  if (!walk_ply_faces(s, count)) return false;
+  if (!s.has_normals) normalize_all(s.generated_normals[0]);
+
+  s.materials.assign(1, default_textures());
+  s.mesh_materials.assign(1, 0);
+  return s.triangles > 0;
+}
+
+
+/*
+ * OBJ: the first pass keeps the elements, numbers each distinct corner as load_obj() welds them, and sums the
+ * generated normals. Read in order, a range is the whole file, so parse_obj() resolves relative indices fully.
+ */
+struct ObjOpenVisitor {
+  NativeStreamState* s;
+  std::string material;
+  std::vector<std::string> mesh_material_names, libraries;
+  std::vector<bool> missing_normals;
+  std::vector<ObjCornerKey> keys;
+  std::vector<uint32_t> ids;
+
+  void position(const glm::vec3& v)  { s->positions.push_back(v); }
+  void texcoord(const glm::vec2& vt) { s->texcoords.push_back(vt); }
+  void normal(const glm::vec3& vn)   { s->normals.push_back(vn); }
+  void usemtl(const std::string& name) { material = name; }
+  void mtllib(const std::string& name) { libraries.push_back(name); }
+
+  bool face(const std::vector<ObjCorner>& corners) {
+    std::map<std::string, size_t>::iterator found = s->mesh_for_material.find(material);
+    if (found == s->mesh_for_material.end()) {
+      found = s->mesh_for_material.insert(std::make_pair(material, s->corner_ids.size())).first;
+      s->corner_ids.push_back(boost::unordered_map<ObjCornerKey, uint32_t>());
+      s->generated_normals.push_back(std::vector<glm::vec3>());
+      missing_normals.push_back(false);
+      mesh_material_names.push_back(material);
+    }
+    size_t mesh = found->second;
+    boost::unordered_map<ObjCornerKey, uint32_t>& mesh_ids = s->corner_ids[mesh];
+
+    keys.resize(corners.size());
+    ids.resize(corners.size());
+    for (size_t k = 0; k < corners.size(); ++k) {
+      keys[k] = resolve_obj_corner(corners[k], 0, 0, 0);
+      if (!obj_corner_in_range(keys[k], s->positions.size(), s->texcoords.size(), s->normals.size())) return false;
+
+      boost::unordered_map<ObjCornerKey, uint32_t>::iterator it = mesh_ids.find(keys[k]);
+      if (it == mesh_ids.end()) {
+        it = mesh_ids.insert(std::make_pair(keys[k], static_cast<uint32_t>(mesh_ids.size()))).first;
+        s->generated_normals[mesh].push_back(glm::vec3(0.0f));
+        s->add_vertex(s->positions[keys[k].v]);
+      }
+      ids[k] = it->second;
+      if (keys[k].vn < 0) missing_normals[mesh] = true;
+    }
+
+    for (size_t k = 2; k < corners.size(); ++k) {
+      uint32_t triangle[3] = { ids[0], ids[k-1], ids[k] };
+      accumulate_normal(s->generated_normals[mesh], triangle, s->positions[keys[0].v], s->positions[keys[k-1].v],
+                        s->positions[keys[k].v]);
+      ++s->triangles;
+    }
+    return true;
+  }
+};
+
+
+static bool open_obj_stream(NativeStreamState& s) {
+  ObjOpenVisitor open;
+  open.s = &s;
+  if (!parse_obj(s.file.data(), s.file.end(), open) || s.corner_ids.empty()) return false;
+
+  // Only meshes with corners lacking normals keep generated ones.
+  for (size_t m = 0; m < s.generated_normals.size(); ++m) {
+    if (open.missing_normals[m]) normalize_all(s.generated_normals[m]);
+    else                         std::vector<glm::vec3>().swap(s.generated_normals[m]);
+  }
+
+  std::map<std::string, std::vector<std::string> > library;
+  load_mtl_libraries(s.filename, open.libraries, library);
+  for (size_t m = 0; m < open.mesh_material_names.size(); ++m) {
+    s.materials.push_back(mtl_textures(library, open.mesh_material_names[m]));
+    s.mesh_materials.push_back(m);
+  }
+  return true;
+}
+
+
+struct ObjEmitVisitor {
+  const NativeStreamState* s;
+  TriangleSink* sink;
+  std::string material;
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> ids;
+
+  void position(const glm::vec3&)  { }
+  void texcoord(const glm::vec2&)  { }
+  void normal(const glm::vec3&)    { }
+  void usemtl(const std::string& name) { material = name; }
+  void mtllib(const std::string&)  { }
+
+  bool face(const std::vector<ObjCorner>& corners) {
+    std::map<std::string, size_t>::const_iterator found = s->mesh_for_material.find(material);
+    if (found == s->mesh_for_material.end()) return false; // the file changed under us
+    size_t mesh = found->second;
+    const std::vector<glm::vec3>& generated = s->generated_normals[mesh];
+
+    vertices.resize(corners.size());
+    ids.resize(corners.size());
+    for (size_t k = 0; k < corners.size(); ++k) {
+      ObjCornerKey key = resolve_obj_corner(corners[k], 0, 0, 0);
+      boost::unordered_map<ObjCornerKey, uint32_t>::const_iterator it = s->corner_ids[mesh].find(key);
+      if (it == s->corner_ids[mesh].end()) return false;
+      ids[k]      = it->second;
+      vertices[k] = obj_vertex(key, s->positions, s->texcoords, s->normals);
+      if (!generated.empty()) vertices[k].normal = generated[ids[k]];
+    }
+
+    for (size_t k = 2; k < corners.size(); ++k) {
+      Vertex triangle[3] = { vertices[0], vertices[k-1], vertices[k] };
+      uint32_t triangle_ids[3] = { ids[0], ids[k-1], ids[k] };
+      sink->triangle(mesh, triangle, triangle_ids);
+    }
+    return true;
+  }
+};
+
+
+/*
+ * STL: nothing is shared, so each triangle's corners get ids of their own.
+ */
+struct StlCountVisitor {
+  NativeStreamState* s;
+  void operator()(const Vertex* corners) {
+    for (size_t k = 0; k < 3; ++k) s->add_vertex(corners[k].pos);
+    ++s->triangles;
+  }
+};
+
+struct StlEmitVisitor {
+  TriangleSink* sink;
+  uint32_t next_id;
+  void operator()(const Vertex* corners) {
+    uint32_t ids[3] = { next_id, next_id + 1, next_id + 2 };
+    next_id += 3;
+    sink->triangle(0, corners, ids);
+  }
+};
+
+
+static bool open_stl_stream(NativeStreamState& s) {
+  s.materials.assign(1, default_textures());
+  s.mesh_materials.assign(1, 0);
+
+  StlCountVisitor count = { &s };
+  return walk_stl_triangles(s.file, count);
+}
+
+
+NativeTriangleStream::NativeTriangleStream() : state(new NativeStreamState) { }
+
+NativeTriangleStream::~NativeTriangleStream() {
+  delete state;
+}
+
+
+bool NativeTriangleStream::open(const std::string& filename) {
+  delete state;
+  state = new NativeStreamState;
+  state->filename = filename;
+
+  std::string extension = lowercase_extension(filename);
+  // Binary PLY vertices are looked up by index while the faces go by, so don't let them be dropped as read.
+  if (!state->file.open(filename, extension == "ply" ? MADV_NORMAL : MADV_SEQUENTIAL)) {
+    std::cerr << "Error: Unable to map '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  bool ok = false;
+  if      (extension == "ply") { state->format = STREAM_PLY; ok = open_ply_stream(*state); }
+  else if (extension == "obj") { state->format = STREAM_OBJ; ok = open_obj_stream(*state); }
+  else if (extension == "stl") { state->format = STREAM_STL; ok = open_stl_stream(*state); }
+
+  if (!ok) {
+    std::cerr << "WARNING: Native loader could not stream '" << filename << "'" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+bool NativeTriangleStream::read(TriangleSink& sink) const {
+  switch(state->format) {
+  case STREAM_PLY: {
+    PlyEmitVisitor emit = { state, &sink };
+    return walk_ply_faces(*state, emit);
+  }
+  case STREAM_OBJ: {
+    ObjEmitVisitor emit;
+    emit.s    = state;
+    emit.sink = &sink;
+    return parse_obj(state->file.data(), state->file.end(), emit);
+  }
+  default: {
+    StlEmitVisitor emit = { &sink, 0 };
+    return walk_stl_triangles(state->file, emit);
+  }
+  }
+}
+
+
+size_t NativeTriangleStream::mesh_count() const { return state->mesh_materials.size(); }
+size_t NativeTriangleStream::triangle_count() const { return state->triangles; }
+const std::vector<std::vector<std::string> >& NativeTriangleStream::materials() const { return state->materials; }
+size_t NativeTriangleStream::mesh_material(size_t mesh) const { return state->mesh_materials[mesh]; }
+
+glm::vec3 NativeTriangleStream::bounds_min() const { return state->bounds_min; }
+glm::vec3 NativeTriangleStream::bounds_max() const { return state->bounds_max; }
+
+glm::vec3 NativeTriangleStream::centroid() const {
+  if (!state->vertex_count) return glm::vec3(0.0f);
+  return glm::vec3(state->centroid_sum[0] / state->vertex_count, state->centroid_sum[1] / state->vertex_count,
+                   state->centroid_sum[2] / state->vertex_count);
+}
+
+
+/***************************************************************************************************
+ * Entry points
+ ***************************************************************************************************/
+
+bool has_native_loader(const std::string& filename) {
+  std::string extension = lowercase_extension(filename);
+  return extension == "ply" || extension == "obj" || extension == "stl";
+}
+
+
+bool load_native_model(const std::string& filename, NativeModel& model, size_t threads) {
+  if (threads == 0) threads = std::max(1u, boost::thread::hardware_concurrency());
+
+  MappedFile file;
+  if (!file.open(filename)) {
+    std::cerr << "Error: Unable to map '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  model.meshes.clear();
+  model.materials.clear();
+
+  std::string extension = lowercase_extension(filename);
+  bool ok = false;
+  if      (extension == "ply") ok = load_ply(file, model, threads);
+  else if (extension == "obj") ok = load_obj(filename, file, model, threads);
+  else if (extension == "stl") ok = load_stl(file, model, threads);
+
+  if (!ok) {
+    std::cerr << "WARNING: Native loader could not read '" << filename << "'" << std::endl;
+    model.meshes.clear();
+    model.materials.clear();
+    return false;
+  }
+
+  size_t triangles = 0;
+  for (size_t m = 0; m < model.meshes.size(); ++m)
+    triangles += model.meshes[m].indices.size() / 3;
+  std::cerr << "Read " << triangles << " triangles in " << model.meshes.size() << " meshes from " << filename
+            << " using " << threads << " threads" << std::endl;
+
+  return true;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef MODEL_LOADER_H
+# define MODEL_LOADER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "vertex_format.h"
+
+
+/** One drawable piece of a natively loaded model: everything that shares a material. */
+struct NativeMesh {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  size_t material_index;
+
+  NativeMesh() : material_index(0) { }
+};
+
+
+/** A natively loaded model, ready for Mesh::MeshEntry::init(). */
+struct NativeModel {
+  std::vector<NativeMesh> meshes;
+  std::vector<std::vector<std::string> > materials; // diffuse and specular texture filenames for each material
+};
+
+
+/** Is there a native loader for this file's extension (.ply, .obj, .stl)?
+ *
+ * @param[in] model filename.
+ */
+bool has_native_loader(const std::string& filename);
+
+
+/** Load a PLY, OBJ or STL model without ASSIMP.
+ *
+ * The file is memory-mapped and split into ranges which are parsed on separate threads, straight into
+ * Vertex and index arrays. Faces are triangulated as fans, and vertex normals are generated (area-weighted)
+ * if the file has none. Anything the loaders don't understand makes them return false, so the caller can
+ * fall back on ASSIMP.
+ *
+ * @param[in] model filename.
+ * @param[out] the model.
+ * @param[in] number of threads to use (0 for one per core).
+ *
+ * \returns true if the model was read.
+ */
+bool load_native_model(const std::string& filename, NativeModel& model, size_t threads = 0);
+
+
+/** Receives a model's triangles, one at a time, from NativeTriangleStream::read(). */
+class TriangleSink {
+public:
+  virtual ~TriangleSink() { }
+
+  /** One triangle.
+   *
+   * @param[in] mesh it belongs to.
+   * @param[in] its three corners.
+   * @param[in] an id for each corner; within a mesh, corners with the same id are the same vertex.
+   */
+  virtual void triangle(size_t mesh, const Vertex* corners, const uint32_t* ids) = 0;
+};
+
+
+struct NativeStreamState;
+
+/** Reads a PLY, OBJ or STL model a triangle at a time, for models too big to load (see ChunkStore::build()).
+ *
+ * The file is memory-mapped, and open() makes one pass over it for the bounds, the meshes, and any normals
+ * that need generating; read() then hands each triangle to a sink, as many times as needed. Faces are never
+ * held in memory. What is held depends on the format: nothing for STL and binary PLY (whose vertices are read
+ * straight out of the mapping), the vertices for ASCII PLY, and for OBJ the positions, texture coordinates,
+ * and normals, and an id for each distinct corner. Generated normals take another vec3 per vertex. Corners
+ * are the same as load_native_model() would give, except that STL vertices get ids but no welding.
+ */
+class NativeTriangleStream {
+public:
+  NativeTriangleStream();
+  ~NativeTriangleStream();
+
+  /** Map a model and make the first pass over it.
+   *
+   * @param[in] model filename.
+   *
+   * \returns true if the model can be streamed.
+   */
+  bool open(const std::string& filename);
+
+  /** Hand every triangle to a sink, in file order. */
+  bool read(TriangleSink& sink) const;
+
+  size_t mesh_count() const;
+  size_t triangle_count() const;
+  const std::vector<std::vector<std::string> >& materials() const; // diffuse and specular texture filenames for each material
+  size_t mesh_material(size_t mesh) const;
+
+  glm::vec3 bounds_min() const;
+  glm::vec3 bounds_max() const;
+  glm::vec3 centroid() const; // of the vertices, as Mesh computes it
+
+private:
+  NativeTriangleStream(const NativeTriangleStream&);
+  NativeTriangleStream& operator=(const NativeTriangleStream&);
+
+  NativeStreamState* state;
+};
+
+
+#endif // MODEL_LOADER_H
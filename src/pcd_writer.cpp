@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <cmath>
+#include <stdint.h>
+
+#include <Magick++.h>
+#include <pcl/io/lzf.h>
+
+#include "pcd_writer.h"
+
+
+bool write_pcd_file(const std::string& filename, const float* data, size_t count, CloudLayout layout, unsigned int width, unsigned int height,
+                    bool compressed) {
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  if (!out) return false;
+
+  size_t points = count / cloud_point_size(layout);
+  if (layout != CLOUD_ORGANIZED) {
+    width  = points;
+    height = 1;
+  }
+
+  // Put the header together first, so the file gets one header write and one data write.
+  std::ostringstream header;
+  if (layout == CLOUD_INDEXED)
+    header << "VERSION .7\nFIELDS x y z intensity index\nSIZE 4 4 4 4 4\nTYPE F F F F U\nCOUNT 1 1 1 1 1\n";
+  else
+    header << "VERSION .7\nFIELDS x y z intensity\nSIZE 4 4 4 4\nTYPE F F F F\nCOUNT 1 1 1 1\n";
+  header << "WIDTH " << width << '\n'
+         << "HEIGHT " << height << '\n'
+         << "VIEWPOINT 0 0 0 1 0 0 0\n"
+         << "POINTS " << points << '\n';
+
+  std::vector<char> packed;
+  uint32_t sizes[2] = { 0, static_cast<uint32_t>(sizeof(float) * points * cloud_point_size(layout)) };
+
+  if (compressed && points) {
+    // PCL expects each field's values together (all the x's, then all the y's, ...) before compression;
+    // that's also what makes the float patterns compress well.
+    size_t fields = cloud_point_size(layout);
+    std::vector<float> transposed(points * fields);
+    for (size_t f = 0; f < fields; ++f)
+      for (size_t i = 0; i < points; ++i)
+        transposed[f * points + i] = data[i * fields + f];
+
+    packed.resize(static_cast<size_t>(sizes[1] * 1.5f) + 8);
+    sizes[0] = pcl::lzfCompress(&transposed[0], sizes[1], &packed[0], packed.size());
+    if (!sizes[0]) std::cerr << "WARNING: Could not compress '" << filename << "'; writing it uncompressed." << std::endl;
+  }
+
+  header << (sizes[0] ? "DATA binary_compressed\n" : "DATA binary\n");
+  std::string h = header.str();
+
+  out.write(h.data(), h.size());
+  if (sizes[0]) {
+    out.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    out.write(&packed[0], sizes[0]);
+  } else {
+    out.write(reinterpret_cast<const char*>(data), sizeof(float) * count);
+  }
+  out.close();
+
+  return !out.fail();
+}
+
+
+bool write_range_image(const std::string& basename, const FrameBuffer& frame) {
+  if (frame.layout != CLOUD_ORGANIZED) {
+    std::cerr << "ERROR: Range images need organized frames" << std::endl;
+    return false;
+  }
+
+  // Same encoding as the color buffer: depth = near + value * (far - near) / 65536.
+  size_t pixels = static_cast<size_t>(frame.width) * frame.height;
+  float range = frame.far_plane - frame.near_plane;
+  std::vector<uint16_t> values(pixels, 0);
+  for (size_t i = 0; i < pixels; ++i) {
+    float z = frame.data[i*4 + 2];
+    if (z != z) continue; // NaN: no return
+    float value = std::floor((z - frame.near_plane) / range * 65536.0f + 0.5f);
+    values[i] = static_cast<uint16_t>(std::max(1.0f, std::min(65535.0f, value)));
+  }
+
+  try {
+    Magick::Image image;
+    image.read(frame.width, frame.height, "I", Magick::ShortPixel, &values[0]);
+    image.depth(16);
+    image.write(basename + ".png");
+  } catch (Magick::Exception& error) {
+    std::cerr << "ERROR: Could not write '" << basename << ".png': " << error.what() << std::endl;
+    return false;
+  }
+
+  std::string filename = basename + ".intrinsics";
+  std::ofstream out(filename.c_str());
+  out << std::setprecision(std::numeric_limits<float>::digits10 + 2)
+      << "# depth = near + value * (far - near) / 65536, where value 0 means no return\n"
+      << "# x = -(column + 0.5 - cx) * depth / fx, y = -(row + 0.5 - cy) * depth / fy, with row 0 at the top\n"
+      << "width "  << frame.width      << '\n'
+      << "height " << frame.height     << '\n'
+      << "fx "     << frame.fx         << '\n'
+      << "fy "     << frame.fy         << '\n'
+      << "cx "     << frame.width  * 0.5f << '\n'
+      << "cy "     << frame.height * 0.5f << '\n'
+      << "near "   << frame.near_plane << '\n'
+      << "far "    << frame.far_plane  << '\n';
+  out.close();
+
+  return !out.fail();
+}
+
+
+PcdWriter::PcdWriter(size_t queue_length, size_t capacity)
+: pool(queue_length, capacity),
+  in_progress(0),
+  written(0),
+  failed(0),
+  done(false),
+  thread(&PcdWriter::run, this)
+{ }
+
+
+PcdWriter::~PcdWriter() {
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    done = true;
+  }
+  queued.notify_all();
+  thread.join();
+  archive.close();
+
+  std::cerr << "PCD writer wrote " << written << " files";
+  if (failed)              std::cerr << " (" << failed << " failed)";
+  if (pool.stall_count())  std::cerr << "; rendering waited on the disk " << pool.stall_count() << " times";
+  std::cerr << std::endl;
+}
+
+
+FrameBuffer* PcdWriter::acquire() {
+  FrameBuffer* frame = pool.acquire(false);
+  if (frame) return frame;
+
+  std::cerr << "WARNING: PCD writer is " << pending() << " frames behind; waiting for the disk." << std::endl;
+  return pool.acquire(true);
+}
+
+
+void PcdWriter::write(const std::string& basename, FrameBuffer* frame, FrameFormat format) {
+  Job job;
+  job.basename = basename;
+  job.frame    = frame;
+  job.format   = format;
+
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    jobs.push_back(job);
+  }
+  queued.notify_one();
+}
+
+
+bool PcdWriter::open_archive(const std::string& filename, const std::string& metadata) {
+  flush();
+  return archive.open(filename, metadata);
+}
+
+
+void PcdWriter::flush() {
+  boost::mutex::scoped_lock lock(mutex);
+  while (!jobs.empty() || in_progress) idle.wait(lock);
+}
+
+
+size_t PcdWriter::pending() {
+  boost::mutex::scoped_lock lock(mutex);
+  return jobs.size() + in_progress;
+}
+
+
+void PcdWriter::run() {
+  boost::mutex::scoped_lock lock(mutex);
+
+  while (true) {
+    while (jobs.empty() && !done) queued.wait(lock);
+    if (jobs.empty()) break; // done, and nothing left to write
+
+    Job job = jobs.front();
+    jobs.pop_front();
+    ++in_progress;
+
+    lock.unlock();
+    const FrameBuffer& frame = *(job.frame);
+    bool ok;
+    if (job.format == FRAME_RANGE_IMAGE) {
+      ok = write_range_image(job.basename, frame);
+    } else if (job.format == FRAME_ARCHIVE) {
+      ok = archive.is_open() && archive.append(frame, frame.pose, frame.timestamp);
+      if (!ok) std::cerr << "ERROR: Could not append frame " << frame.timestamp << " to the archive" << std::endl;
+    } else {
+      ok = write_pcd_file(job.basename + ".pcd", &(frame.data[0]), frame.count, frame.layout, frame.width, frame.height,
+                          job.format == FRAME_PCD_COMPRESSED);
+      if (!ok) std::cerr << "ERROR: Could not write '" << job.basename << ".pcd'" << std::endl;
+    }
+    pool.release(job.frame);
+    lock.lock();
+
+    --in_progress;
+    if (ok) ++written;
+    else    ++failed;
+    if (jobs.empty()) idle.notify_all();
+  }
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef PCD_WRITER_H
+# define PCD_WRITER_H
+
+#include <string>
+#include <deque>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "frame_pool.h"
+#include "frame_archive.h"
+
+const size_t DEFAULT_PCD_QUEUE_LENGTH = 8;
+
+
+/** What a frame is written as. */
+enum FrameFormat {
+  FRAME_PCD_BINARY,      // PCD, DATA binary
+  FRAME_PCD_COMPRESSED,  // PCD, DATA binary_compressed (LZF, one field after another, as PCL reads it)
+  FRAME_RANGE_IMAGE,     // 16-bit grayscale PNG of depth, with a text file of intrinsics (organized frames only)
+  FRAME_ARCHIVE          // appended to the archive given to open_archive(), with its pose and timestamp
+};
+
+
+/** Write a point cloud as a binary PCD file.
+ *
+ * @param[in] filename, including the extension.
+ * @param[in] point data (see CloudLayout).
+ * @param[in] number of floats.
+ * @param[in] layout of the points.
+ * @param[in] image width, for organized clouds.
+ * @param[in] image height, for organized clouds.
+ * @param[in] whether to write binary_compressed instead of binary data.
+ *
+ * \returns false if the file couldn't be written.
+ */
+bool write_pcd_file(const std::string& filename, const float* data, size_t count,
+                    CloudLayout layout = CLOUD_UNORGANIZED, unsigned int width = 0, unsigned int height = 0,
+                    bool compressed = false);
+
+
+/** Write an organized frame as a range image: basename.png holds depth along the optical axis as 16-bit
+ *  values (0 for no return), and basename.intrinsics says how to turn them back into points.
+ *
+ * @param[in] file basename (without extension).
+ * @param[in] an organized frame, with its sensor model filled in.
+ *
+ * \returns false if either file couldn't be written.
+ */
+bool write_range_image(const std::string& basename, const FrameBuffer& frame);
+
+
+/** Writes PCD files (or range images) on a background thread, so saving a frame costs the render loop
+ *  only the readback; compression happens on the writer thread too.
+ *
+ * Frames are rendered into buffers from a fixed pool (acquire()) and handed over with write(); the
+ * writer thread writes them out in order and returns the buffers. If the disk falls behind, the pool
+ * runs dry and acquire() blocks, which is reported on stderr, so memory use stays bounded.
+ */
+class PcdWriter {
+public:
+  /** Constructor. Starts the writer thread.
+   *
+   * @param[in] frames that may be queued or in flight at once.
+   * @param[in] floats in each frame buffer (four per pixel).
+   */
+  PcdWriter(size_t queue_length, size_t capacity);
+
+  /** Writes everything still queued, then stops the thread. */
+  ~PcdWriter();
+
+  /** Get an empty frame buffer, waiting for the writer if every buffer is queued. */
+  FrameBuffer* acquire();
+
+  /** Queue a filled buffer to be written. The writer owns it until it's done, then returns it to the pool.
+   *
+   * @param[in] file basename (the extension depends on the format).
+   * @param[in] buffer from acquire().
+   * @param[in] what to write.
+   */
+  void write(const std::string& basename, FrameBuffer* frame, FrameFormat format = FRAME_PCD_BINARY);
+
+  /** Send FRAME_ARCHIVE frames to a single archive file instead of one file per frame. The archive's index
+   *  is written when the writer is destroyed.
+   *
+   * @param[in] archive filename.
+   * @param[in] metadata stored in the archive header (e.g. the generation parameters).
+   *
+   * \returns false if the archive couldn't be created.
+   */
+  bool open_archive(const std::string& filename, const std::string& metadata);
+
+  /** Block until every queued frame has been written. */
+  void flush();
+
+  /** Number of frames queued but not yet written. */
+  size_t pending();
+
+private:
+  struct Job {
+    std::string  basename;
+    FrameBuffer* frame;
+    FrameFormat  format;
+  };
+
+  void run();
+
+  FramePool pool;
+  FrameArchiveWriter archive; // only touched by the writer thread once it's open
+  std::deque<Job> jobs;
+  size_t in_progress;
+  size_t written;
+  size_t failed;
+  bool done;
+
+  boost::mutex mutex;
+  boost::condition_variable queued;
+  boost::condition_variable idle;
+  boost::thread thread;
+};
+
+
+#endif // PCD_WRITER_H
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <iostream>
+#include <boost/bind.hpp>
+
+#include "pipeline.h"
+
+
+PoseIngest::PoseIngest(receiver_t receive_, size_t depth)
+: receive(receive_), ready(depth + 1), free_slots(depth + 1), drops(0), done(false)
+{
+  // One slot more than the queue depth: the one being received into.
+  for (size_t i = 0; i < depth + 1; ++i) {
+    slots.push_back(new PoseUpdate);
+    free_slots.push(slots.back());
+  }
+  thread = boost::thread(&PoseIngest::run, this);
+}
+
+
+PoseIngest::~PoseIngest() {
+  done = true;
+  free_bell.ring();
+  thread.join(); // waits for the receive function to time out
+
+  for (size_t i = 0; i < slots.size(); ++i)
+    delete slots[i];
+}
+
+
+PoseUpdate* PoseIngest::next(bool latest, unsigned int timeout_ms) {
+  PoseUpdate* pose = NULL;
+  if (!ready.pop(pose)) {
+    ready_bell.wait(timeout_ms);
+    if (!ready.pop(pose)) return NULL;
+  }
+
+  if (latest) {
+    PoseUpdate* newer;
+    while (!pose->shutdown && ready.pop(newer)) {
+      release(pose);
+      ++drops;
+      pose = newer;
+    }
+  }
+
+  return pose;
+}
+
+
+void PoseIngest::release(PoseUpdate* pose) {
+  free_slots.push(pose);
+  free_bell.ring();
+}
+
+
+void PoseIngest::run() {
+  PoseUpdate* slot = NULL;
+
+  while (!done) {
+    if (!slot && !free_slots.pop(slot)) { // the renderer is depth poses behind
+      free_bell.wait();
+      continue;
+    }
+
+    recv_result_t result = receive(*slot);
+    if (result != RECV_SUCCESS && result != RECV_SHUTDOWN) continue; // timed out, or a bad message
+
+    slot->shutdown = result == RECV_SHUTDOWN;
+    ready.push(slot);
+    ready_bell.ring();
+    if (result == RECV_SHUTDOWN) break;
+    slot = NULL;
+  }
+}
+
+
+CloudPipeline::CloudPipeline(zmq::socket_t& publisher_, MessagePool& pool_, uint32_t encoding_, CloudLayout layout_,
+                             size_t workers, size_t depth, ShmRingWriter* ring_, TraceLog* trace_log_)
+: publisher(publisher_), pool(pool_), encoding(encoding_ & WIRE_ENCODINGS), layout(layout_), ring(ring_), trace_log(trace_log_),
+  free_frames(depth), readback(depth), unprojected(depth),
+  next_sequence(0), render_drops(0), publish_drops(0), published(0), done(false)
+{
+  for (size_t i = 0; i < depth; ++i) {
+    frames.push_back(new ReadbackFrame);
+    free_frames.push(frames.back());
+  }
+
+  for (size_t i = 0; i < workers; ++i)
+    workers_group.create_thread(boost::bind(&CloudPipeline::unproject_worker, this));
+  publish_thread = boost::thread(&CloudPipeline::publish_worker, this);
+}
+
+
+CloudPipeline::~CloudPipeline() {
+  flush();
+
+  done = true;
+  readback_bell.ring();
+  unprojected_bell.ring();
+  workers_group.join_all();
+  publish_thread.join();
+
+  for (size_t i = 0; i < frames.size(); ++i)
+    delete frames[i];
+
+  if (dropped())
+    std::cerr << "Pipeline dropped " << render_drops << " frames waiting on unprojection and " << publish_drops
+              << " waiting on subscribers" << std::endl;
+}
+
+
+ReadbackFrame* CloudPipeline::acquire(bool wait) {
+  ReadbackFrame* frame = NULL;
+  while (!free_frames.pop(frame)) {
+    if (!wait) {
+      ++render_drops;
+      return NULL;
+    }
+    free_bell.wait();
+  }
+  return frame;
+}
+
+
+void CloudPipeline::submit(ReadbackFrame* frame) {
+  frame->sequence = next_sequence++;
+  readback.push(frame);
+  readback_bell.ring();
+}
+
+
+void CloudPipeline::flush() {
+  boost::mutex::scoped_lock lock(progress_mutex);
+  while (published < next_sequence) progress.wait(lock);
+}
+
+
+void CloudPipeline::unproject_worker() {
+  std::vector<char> scratch;
+
+  while (true) {
+    ReadbackFrame* frame;
+    if (!readback.pop(frame)) {
+      if (done) break;
+      readback_bell.wait();
+      continue;
+    }
+
+    frame->cloud = pool.acquire();
+
+    if (frame->cloud) {
+      SensorModel sensor;
+      sensor.projection_x = frame->projection_x;
+      sensor.projection_y = frame->projection_y;
+      sensor.near_plane   = frame->header.near_plane;
+      sensor.far_plane    = frame->header.far_plane;
+
+      float* points = reinterpret_cast<float*>(frame->cloud + sizeof(wire_header_t));
+      size_t count  = unproject_pixels(&(frame->rgba[0]), frame->width, frame->height, sensor, points, layout);
+
+      wire_header_t* header = reinterpret_cast<wire_header_t*>(frame->cloud);
+      *header = frame->header;
+      header->point_count = count / cloud_point_size(layout);
+      if (encoding) encode_point_cloud(frame->cloud, encoding, scratch);
+    } else {
+      ++publish_drops;
+    }
+
+    unprojected.push(frame);
+    unprojected_bell.ring();
+  }
+}
+
+
+void CloudPipeline::publish_worker() {
+  std::vector<ReadbackFrame*> waiting(frames.size(), NULL); // unprojected out of order, by sequence % depth
+  uint64_t next = 0;
+
+  while (true) {
+    ReadbackFrame* frame;
+    if (!unprojected.pop(frame)) {
+      if (done) break;
+      unprojected_bell.wait();
+      continue;
+    }
+
+    waiting[frame->sequence % waiting.size()] = frame;
+    size_t sent = 0;
+    while (waiting[next % waiting.size()] && waiting[next % waiting.size()]->sequence == next) {
+      ReadbackFrame*& ready = waiting[next % waiting.size()];
+      if (ready->cloud) {
+        send_point_cloud(publisher, pool, ready->cloud, ring);
+        if (trace_log) {
+          ready->trace.mark(TRACE_PUBLISHED);
+          trace_log->record(ready->trace);
+        }
+      }
+      free_frames.push(ready);
+      ready = NULL;
+      ++next;
+      ++sent;
+    }
+
+    if (sent) {
+      free_bell.ring();
+      boost::mutex::scoped_lock lock(progress_mutex);
+      published = next;
+      progress.notify_all();
+    }
+  }
+}
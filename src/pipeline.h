@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef PIPELINE_H
+# define PIPELINE_H
+
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "frame_pool.h"
+#include "frame_trace.h"
+#include "pose_history.h"
+#include "service/subscribe.h"
+#include "service/publish.h"
+
+/*
+ * Stages of the pipelined render loop (--pipeline), each on its own thread(s), joined by bounded
+ * lock-free queues:
+ *
+ *   pose ingest --> render and read back (GL thread) --> unproject and encode (worker pool) --> publish
+ *
+ * Poses and read-back frames live in slots allocated up front and cycled back through a free queue, and
+ * clouds in MessagePool buffers, so frames don't allocate. The queues never block; a stage with nothing
+ * to do waits on a Doorbell. Throughput is then set by the slowest stage rather than the sum of them.
+ */
+
+const size_t DEFAULT_PIPELINE_DEPTH   = 4;
+const size_t DEFAULT_PIPELINE_WORKERS = 2;
+
+
+/** Lets a thread sleep until another has queued something for it. A ring can slip in between a failed
+ *  pop and the wait, so waits are short and callers poll again when they return.
+ */
+class Doorbell {
+public:
+  void ring() {
+    boost::mutex::scoped_lock lock(mutex);
+    rung.notify_all();
+  }
+
+  void wait(unsigned int milliseconds = 1) {
+    boost::mutex::scoped_lock lock(mutex);
+    rung.timed_wait(lock, boost::posix_time::milliseconds(milliseconds));
+  }
+
+private:
+  boost::mutex mutex;
+  boost::condition_variable rung;
+};
+
+
+/** Receives poses on a thread of its own, so the render loop never waits on the network.
+ *
+ * The receive function should time out now and then (e.g. with ZMQ_RCVTIMEO) so the thread can notice
+ * it's being stopped. If the renderer falls depth poses behind, the ingest thread stops receiving, and
+ * ZeroMQ's queue (or conflation) takes over.
+ */
+class PoseIngest {
+public:
+  typedef boost::function<recv_result_t (PoseUpdate&)> receiver_t;
+
+  /** Constructor. Starts the ingest thread.
+   *
+   * @param[in] function that receives one pose message into a PoseUpdate.
+   * @param[in] poses that may be waiting for the renderer.
+   */
+  PoseIngest(receiver_t receive_, size_t depth);
+  ~PoseIngest();
+
+  /** Get the next pose (render thread).
+   *
+   * @param[in] whether to skip to the newest pose, dropping any older ones still waiting.
+   * @param[in] how long to wait for one.
+   *
+   * \returns A pose to give back with release() once it's applied, or NULL if none came in time.
+   */
+  PoseUpdate* next(bool latest, unsigned int timeout_ms);
+
+  /** Give a pose back for reuse. */
+  void release(PoseUpdate* pose);
+
+  /** Number of poses skipped by next(true, ...). */
+  size_t dropped() const { return drops; }
+
+private:
+  void run();
+
+  receiver_t receive;
+  std::vector<PoseUpdate*> slots;
+  boost::lockfree::spsc_queue<PoseUpdate*> ready;      // ingest -> render
+  boost::lockfree::spsc_queue<PoseUpdate*> free_slots; // render -> ingest
+  Doorbell ready_bell, free_bell;
+  boost::atomic<size_t> drops;
+  boost::atomic<bool> done;
+  boost::thread thread;
+};
+
+
+/** A frame read back on the GL thread, waiting to be turned into points. */
+struct ReadbackFrame {
+  std::vector<unsigned char> rgba;
+  unsigned int width, height;
+  float projection_x, projection_y; // see SensorModel
+  wire_header_t header;             // type, fields, frame_id, pose, and near/far filled in by the renderer
+  uint64_t sequence;                // set by submit()
+  FrameTrace trace;                 // stages so far, if tracing
+  char* cloud;                      // unprojected and encoded by a worker, or NULL if the frame was dropped
+};
+
+
+/** Turns read-back frames into points on a pool of worker threads, encodes them, and publishes them
+ *  from one more thread, in the order they were rendered.
+ *
+ * The renderer gets a ReadbackFrame from acquire(), fills it, and submit()s it. A frame isn't free again
+ * until it's been published, so if the workers and publisher are depth frames behind, acquire() either
+ * waits or returns NULL so the renderer can drop the frame; if the subscribers are so far behind that the
+ * message pool is empty, a worker drops the frame. With at most depth frames in flight, the publisher puts
+ * frames finished out of order back in order in a ring of depth slots.
+ */
+class CloudPipeline {
+public:
+  /** Constructor. Starts the threads.
+   *
+   * @param[in] socket to publish on (only the publish thread uses it until flush()).
+   * @param[in] pool of send buffers.
+   * @param[in] encoding bits to apply (see encode_point_cloud()).
+   * @param[in] how to lay out the points.
+   * @param[in] number of unprojection workers.
+   * @param[in] frames that may be waiting for or in the workers.
+   * @param[in] shared memory ring to publish into instead of the socket, if any.
+   * @param[in] where to record each frame's trace once it's published, if anywhere.
+   */
+  CloudPipeline(zmq::socket_t& publisher_, MessagePool& pool_, uint32_t encoding_, CloudLayout layout_,
+                size_t workers, size_t depth, ShmRingWriter* ring_ = NULL, TraceLog* trace_log_ = NULL);
+  ~CloudPipeline();
+
+  /** Get a frame to read back into (render thread).
+   *
+   * @param[in] whether to wait for one if the workers are behind.
+   *
+   * \returns A frame, or NULL if none was free and wait was false.
+   */
+  ReadbackFrame* acquire(bool wait);
+
+  /** Hand a filled frame to the workers (render thread). */
+  void submit(ReadbackFrame* frame);
+
+  /** Block until everything submitted has been published (or dropped). */
+  void flush();
+
+  /** Frames dropped anywhere in the pipeline. */
+  size_t dropped() const { return render_drops + publish_drops; }
+
+private:
+  void unproject_worker();
+  void publish_worker();
+
+  zmq::socket_t& publisher;
+  MessagePool& pool;
+  uint32_t encoding;
+  CloudLayout layout;
+  ShmRingWriter* ring;
+  TraceLog* trace_log;
+
+  std::vector<ReadbackFrame*> frames;
+  boost::lockfree::queue<ReadbackFrame*> free_frames;   // publisher -> render
+  boost::lockfree::queue<ReadbackFrame*> readback;      // render -> workers
+  boost::lockfree::queue<ReadbackFrame*> unprojected;   // workers -> publisher
+  Doorbell free_bell, readback_bell, unprojected_bell;
+
+  uint64_t next_sequence;       // render thread only
+  boost::atomic<size_t> render_drops, publish_drops;
+  boost::mutex progress_mutex;  // just for flush()
+  boost::condition_variable progress;
+  uint64_t published;           // sequences published or dropped, guarded by progress_mutex
+
+  boost::atomic<bool> done;
+  boost::thread_group workers_group;
+  boost::thread publish_thread;
+};
+
+
+#endif // PIPELINE_H
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef POSE_HISTORY_H
+# define POSE_HISTORY_H
+
+#include <deque>
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+#include "quaternion.h"
+#include "service/service.h"
+
+const size_t DEFAULT_POSE_HISTORY   = 1024;
+const double DEFAULT_TIMESTAMP_RATE = 1000.0; // timestamp units per second of physics time (milliseconds)
+
+
+/** Everything a pose message says about a frame. */
+struct PoseUpdate {
+  timestamp_t timestamp;
+  glm::dquat object, sensor;
+  glm::dvec3 translation;
+  std::vector<glm::dquat> other_objects;
+  std::vector<glm::dvec3> other_offsets;
+  std::vector<double> joint_angles;
+  bool shutdown;
+  uint64_t received; // when it arrived, in monotonic_ns() time
+};
+
+
+/** How to interpolate positions and joint angles between poses (attitudes are always SLERPed). */
+enum PoseInterpolation {
+  POSE_LINEAR,
+  POSE_CUBIC   // Hermite, with tangents from the neighboring poses
+};
+
+
+/** A short, timestamped history of the poses received from physics, so that the sensor can be rendered
+ *  at its own rate: poses are interpolated between samples and extrapolated a little past the newest.
+ *
+ * Times are in timestamp units, as doubles so that frames can fall between ticks.
+ */
+class PoseHistory {
+public:
+  /** Constructor.
+   *
+   * @param[in] most poses to keep; the oldest are dropped beyond this.
+   * @param[in] how to interpolate positions and joint angles.
+   * @param[in] how far past the newest pose (in timestamp units) sample() may extrapolate.
+   */
+  PoseHistory(size_t capacity_ = DEFAULT_POSE_HISTORY, PoseInterpolation mode_ = POSE_LINEAR, double max_extrapolation_ = 0.0)
+  : capacity(std::max<size_t>(capacity_, 4)), mode(mode_), max_extrapolation(max_extrapolation_)
+  { }
+
+  /** Add a pose. Poses must arrive in timestamp order; any that don't are ignored.
+   *
+   * \returns true if the pose was added.
+   */
+  bool add(const PoseUpdate& pose) {
+    if (!poses.empty() && pose.timestamp <= poses.back().timestamp) return false;
+    if (poses.size() == capacity) poses.pop_front();
+    poses.push_back(pose);
+    return true;
+  }
+
+  bool empty() const { return poses.empty(); }
+  size_t size() const { return poses.size(); }
+  timestamp_t oldest() const { return poses.front().timestamp; }
+  timestamp_t newest() const { return poses.back().timestamp; }
+
+  /** Drop poses that are no longer needed to sample at t or later. */
+  void discard_before(double t) {
+    size_t keep = mode == POSE_CUBIC ? 2 : 1; // poses at or before t still needed
+    while (poses.size() > keep && poses[keep].timestamp <= t)
+      poses.pop_front();
+  }
+
+  /** The pose at some time.
+   *
+   * @param[in] time, in timestamp units.
+   * @param[out] the interpolated pose (its timestamp is t, rounded).
+   *
+   * \returns false if t is before the oldest pose, or too far past the newest.
+   */
+  bool sample(double t, PoseUpdate& pose) const {
+    if (poses.empty() || t < poses.front().timestamp || t > poses.back().timestamp + max_extrapolation) return false;
+
+    if (poses.size() == 1) { // hold the only pose we have
+      pose = poses.front();
+    } else {
+      // The interval containing t; past the newest, the last interval extended.
+      size_t i = 0;
+      while (i + 2 < poses.size() && poses[i+1].timestamp <= t) ++i;
+      const PoseUpdate &a = poses[i], &b = poses[i+1];
+
+      double dt = (double)(b.timestamp) - (double)(a.timestamp);
+      double u  = (t - a.timestamp) / dt;
+      bool cubic = mode == POSE_CUBIC && u <= 1.0; // extrapolating a cubic overshoots; go straight
+
+      pose = a;
+      pose.object = quaternion_slerp(a.object, b.object, u);
+      pose.sensor = quaternion_slerp(a.sensor, b.sensor, u);
+      pose.translation = cubic ? hermite(i, u, &PoseHistory::translation_of, 0) : a.translation + (b.translation - a.translation) * u;
+
+      for (size_t j = 0; j < pose.other_objects.size() && j < b.other_objects.size(); ++j) {
+        pose.other_objects[j] = quaternion_slerp(a.other_objects[j], b.other_objects[j], u);
+        pose.other_offsets[j] = cubic ? hermite(i, u, &PoseHistory::offset_of, j) : a.other_offsets[j] + (b.other_offsets[j] - a.other_offsets[j]) * u;
+      }
+
+      for (size_t j = 0; j < pose.joint_angles.size() && j < b.joint_angles.size(); ++j)
+        pose.joint_angles[j] = cubic ? hermite(i, u, &PoseHistory::joint_angle_of, j).x : a.joint_angles[j] + (b.joint_angles[j] - a.joint_angles[j]) * u;
+    }
+
+    pose.timestamp = static_cast<timestamp_t>(t + 0.5);
+    pose.shutdown  = false;
+    return true;
+  }
+
+private:
+  typedef glm::dvec3 (*component_t)(const PoseUpdate&, size_t);
+
+  static glm::dvec3 translation_of(const PoseUpdate& pose, size_t)     { return pose.translation; }
+  static glm::dvec3 offset_of(const PoseUpdate& pose, size_t j)        { return j < pose.other_offsets.size() ? pose.other_offsets[j] : glm::dvec3(0.0); }
+  static glm::dvec3 joint_angle_of(const PoseUpdate& pose, size_t j)   { return glm::dvec3(j < pose.joint_angles.size() ? pose.joint_angles[j] : 0.0); }
+
+  /** Cubic Hermite interpolation of some component between poses i and i+1, with each end's tangent
+   *  taken from its neighbors (which needn't be evenly spaced), or one-sided at the ends of the history.
+   */
+  glm::dvec3 hermite(size_t i, double u, component_t component, size_t j) const {
+    const PoseUpdate &a = poses[i], &b = poses[i+1];
+    double dt = (double)(b.timestamp) - (double)(a.timestamp);
+    glm::dvec3 pa = component(a, j), pb = component(b, j);
+
+    glm::dvec3 ma = i > 0 ? (pb - component(poses[i-1], j)) * (dt / ((double)(b.timestamp) - (double)(poses[i-1].timestamp))) : pb - pa;
+    glm::dvec3 mb = i + 2 < poses.size() ? (component(poses[i+2], j) - pa) * (dt / ((double)(poses[i+2].timestamp) - (double)(a.timestamp))) : pb - pa;
+
+    double u2 = u * u, u3 = u2 * u;
+    return pa * (2*u3 - 3*u2 + 1) + ma * (u3 - 2*u2 + u) + pb * (3*u2 - 2*u3) + mb * (u3 - u2);
+  }
+
+  std::deque<PoseUpdate> poses;
+  size_t capacity;
+  PoseInterpolation mode;
+  double max_extrapolation;
+};
+
+
+#endif // POSE_HISTORY_H
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+/*
+ * Converts a binary pose log (see BinaryPoseLogger) to PoseLogger's text format: per line, the
+ * timestamp, the 4x4 pose (row by row, comma-separated), and the score, separated by tabs.
+ *
+ *   pose_log_to_text sensor.plog sensor.pose
+ */
+
+#include <iostream>
+#include <cstdlib>
+
+#include "service/pose_logger.h"
+
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " binary_log text_log" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  BinaryPoseLogReader reader(argv[1]);
+  if (!reader.good()) return EXIT_FAILURE;
+
+  PoseLogger writer(argv[2]);
+  pose_log_record_t record;
+  Eigen::Matrix4f pose;
+  size_t count = 0;
+  while (reader.next(record)) {
+    record.pose.get_pose(pose);
+    writer.log(record.timestamp, pose, record.pose.score);
+    ++count;
+  }
+
+  std::cerr << "Converted " << count << " poses" << std::endl;
+  return EXIT_SUCCESS;
+}
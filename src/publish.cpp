@@ -31,6 +31,10 @@
 
 #include <iostream>
 #include <sstream>
+#include <limits>
+#include <cmath>
+
+#include <pcl/io/lzf.h>
 
 #include "service/publish.h"
 
@@ -60,27 +64,44 @@ void send_shutdown(zmq::socket_t& publisher) {
   memcpy(Pkthxbai.data(), PBYE, 8);
   publisher.send(Pkthxbai);
 
+  const char BBYE[] = "BKTHXBAI";
+  zmq::message_t Bkthxbai(8);
+  memcpy(Bkthxbai.data(), BBYE, 8);
+  publisher.send(Bkthxbai);
+
   const char cBYE[] = "cKTHXBAI";
   zmq::message_t ckthxbai(8);
   memcpy(ckthxbai.data(), cBYE, 8);
   publisher.send(ckthxbai);
+
+  const char oBYE[] = "oKTHXBAI";
+  zmq::message_t okthxbai(8);
+  memcpy(okthxbai.data(), oBYE, 8);
+  publisher.send(okthxbai);
+
+  const char iBYE[] = "iKTHXBAI";
+  zmq::message_t ikthxbai(8);
+  memcpy(ikthxbai.data(), iBYE, 8);
+  publisher.send(ikthxbai);
 }
 
 
-void sync_publish(zmq::socket_t& publisher, zmq::socket_t& sync_service, int port, size_t expected_subscribers, int conflate) {
+void sync_publish(zmq::socket_t& publisher, zmq::socket_t& sync_service, int port, size_t expected_subscribers, int conflate,
+                  const std::string& transport) {
   if (conflate)
     publisher.setsockopt(ZMQ_CONFLATE, &conflate, sizeof(int)); // keep only last message received
   
-  std::ostringstream publish_address, sync_address;
-
-  publish_address << "tcp://*:" << port << std::flush;
-  sync_address    << "tcp://*:" << port+1 << std::flush;
-  std::string publish_address_string = publish_address.str(),
-                 sync_address_string = sync_address.str();
+  std::string publish_address_string = service_endpoint(transport, port, true),
+                 sync_address_string = service_endpoint(transport, port+1, true);
 
   publisher.bind(publish_address_string.c_str());
   sync_service.bind(sync_address_string.c_str());
 
+  if (expected_subscribers == 0) { // subscribers come and go; see answer_sync_requests()
+    std::cerr << "Bound to " << publish_address_string << std::endl;
+    return;
+  }
+
   if (expected_subscribers == 1)
     std::cerr << "Waiting for 1 subscriber..." << std::flush;
   else
@@ -102,25 +123,229 @@ void sync_publish(zmq::socket_t& publisher, zmq::socket_t& sync_service, int por
 }
 
 
-void send_pose(zmq::socket_t& publisher, const Eigen::Matrix4f& pose, const unsigned long& timestamp) {
-  size_t size = sizeof(char) + sizeof(unsigned long) + 16 * sizeof(float);
-  void* send_buffer = malloc(size);
-  void* timestamp_buffer = static_cast<void*>(static_cast<char*>(send_buffer) + 1);
-  void* pose_buffer = static_cast<void*>(static_cast<char*>(send_buffer) + sizeof(unsigned long) + 1);
+size_t answer_sync_requests(zmq::socket_t& sync_service) {
+  size_t answered = 0;
+  zmq::message_t request;
+  while (sync_service.recv(&request, ZMQ_NOBLOCK)) {
+    zmq::message_t reply(0);
+    sync_service.send(reply);
+    ++answered;
+  }
+  return answered;
+}
+
+
+bool receive_subscriptions(zmq::socket_t& publisher, SubscriptionTracker& subscriptions) {
+  bool changed = false;
+  zmq::message_t message;
+  while (publisher.recv(&message, ZMQ_NOBLOCK))
+    if (subscriptions.update(message)) changed = true;
+  return changed;
+}
 
-  const char TYPE = 'p';
 
-  memcpy(send_buffer, &TYPE, sizeof(char));
-  memcpy(timestamp_buffer, &timestamp, sizeof(unsigned long));
-  memcpy(pose_buffer, pose.data(), 16 * sizeof(float));
+void send_pose(zmq::socket_t& publisher, const Eigen::Matrix4f& pose, const unsigned long& timestamp) {
+  wire_header_t header('p', 0);
+  header.frame_id = timestamp;
+  for (size_t i = 0; i < 16; ++i)
+    header.pose[i] = pose.data()[i];
 
-  zmq::message_t message(send_buffer, size, c_message_free, NULL);
+  zmq::message_t message(sizeof(wire_header_t));
+  memcpy(message.data(), &header, sizeof(wire_header_t));
   publisher.send(message);
 }
 
 
+bool send_point_cloud(zmq::socket_t& publisher, MessagePool& pool, char* buffer, ShmRingWriter* ring) {
+  const wire_header_t* header = reinterpret_cast<const wire_header_t*>(buffer);
+  if (ring) {
+    bool written = ring->write(buffer, sizeof(wire_header_t) + header->payload_size());
+    pool.recycle(buffer);
+    return written;
+  }
+  return pool.send(publisher, buffer, sizeof(wire_header_t), sizeof(wire_header_t), header->payload_size());
+}
+
+
+size_t encode_point_cloud(char* buffer, uint32_t encoding, std::vector<char>& scratch) {
+  wire_header_t* header = reinterpret_cast<wire_header_t*>(buffer);
+  char* payload = buffer + sizeof(wire_header_t);
+  size_t count = header->point_count;
+
+  const char* source = payload;
+  size_t bytes = count * header->point_stride;
+
+  if ((encoding & WIRE_QUANTIZED) && header->has(WIRE_XYZ) && !header->has(WIRE_NORMAL) &&
+      !(header->flags & WIRE_ENCODINGS)) {
+    bool intensity_8 = (encoding & WIRE_INTENSITY_8) != 0;
+    size_t in_stride  = header->point_stride;
+    size_t out_stride = wire_header_t::quantized_point_stride(header->fields, intensity_8);
+    size_t intensity_offset = header->offset(WIRE_INTENSITY), index_offset = header->offset(WIRE_INDEX);
+
+    // Quantize relative to the bounding box of the points that are there.
+    float lower[3], upper[3];
+    for (size_t j = 0; j < 3; ++j) {
+      lower[j] =  std::numeric_limits<float>::max();
+      upper[j] = -std::numeric_limits<float>::max();
+    }
+    for (size_t i = 0; i < count; ++i) {
+      const float* p = reinterpret_cast<const float*>(payload + i * in_stride);
+      if (std::isnan(p[0])) continue;
+      for (size_t j = 0; j < 3; ++j) {
+        lower[j] = std::min(lower[j], p[j]);
+        upper[j] = std::max(upper[j], p[j]);
+      }
+    }
+
+    header->precision = 0.0f;
+    for (size_t j = 0; j < 3; ++j) {
+      if (lower[j] > upper[j]) lower[j] = upper[j] = 0.0f; // no returns
+      header->origin[j] = 0.5f * (lower[j] + upper[j]);
+      header->scale[j]  = std::max(0.5f * (upper[j] - lower[j]) / 32767.0f, std::numeric_limits<float>::min());
+      // Half a step, plus what float arithmetic loses decoding coordinates this large.
+      float magnitude = std::max(std::fabs(lower[j]), std::fabs(upper[j]));
+      header->precision = std::max(header->precision, 0.5f * header->scale[j] + 2.0f * std::numeric_limits<float>::epsilon() * magnitude);
+    }
+
+    scratch.resize(count * out_stride + 1);
+    for (size_t i = 0; i < count; ++i) {
+      const float* p = reinterpret_cast<const float*>(payload + i * in_stride);
+      char* q = &scratch[i * out_stride];
+
+      int16_t steps[3];
+      for (size_t j = 0; j < 3; ++j) {
+        if (std::isnan(p[0])) steps[j] = std::numeric_limits<int16_t>::min();
+        else {
+          float s = std::floor((p[j] - header->origin[j]) / header->scale[j] + 0.5f);
+          steps[j] = static_cast<int16_t>(std::max(-32767.0f, std::min(32767.0f, s)));
+        }
+      }
+      memcpy(q, steps, sizeof(steps));
+      q += sizeof(steps);
+
+      if (header->has(WIRE_INTENSITY)) {
+        float intensity = std::max(0.0f, p[intensity_offset]);
+        if (intensity_8) {
+          *reinterpret_cast<uint8_t*>(q) = static_cast<uint8_t>(std::min(255.0f, intensity * 256.0f));
+          q += 1;
+        } else {
+          uint16_t value = static_cast<uint16_t>(std::min(65535.0f, intensity * 65536.0f));
+          memcpy(q, &value, sizeof(uint16_t));
+          q += 2;
+        }
+      }
+      if (header->has(WIRE_INDEX)) memcpy(q, p + index_offset, sizeof(uint32_t));
+    }
+
+    header->flags        |= WIRE_QUANTIZED | (intensity_8 ? WIRE_INTENSITY_8 : 0);
+    header->point_stride  = out_stride;
+    source = &scratch[0];
+    bytes  = count * out_stride;
+  }
+
+  if ((encoding & WIRE_COMPRESSED) && bytes > 0 && !(header->flags & WIRE_COMPRESSED)) {
+    if (source == payload) {
+      scratch.assign(payload, payload + bytes);
+      source = &scratch[0];
+    }
+
+    // LZF gives up (returns 0) if the output wouldn't be smaller than the space given, i.e. the input.
+    unsigned int compressed = pcl::lzfCompress(source, bytes, payload, bytes);
+    if (compressed > 0) {
+      header->flags       |= WIRE_COMPRESSED;
+      header->encoded_size = compressed;
+      return compressed;
+    }
+  }
+
+  if (source != payload) memcpy(payload, source, bytes);
+  return bytes;
+}
+
+
+EncodingPublisher::~EncodingPublisher() {
+  if (!encoding) return;
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    done = true;
+  }
+  queued.notify_all();
+  thread.join();
+}
+
+
+void EncodingPublisher::send(char* buffer) {
+  if (!encoding) {
+    send_point_cloud(publisher, pool, buffer, ring);
+    return;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    queue.push_back(buffer);
+  }
+  queued.notify_one();
+}
+
+
+void EncodingPublisher::flush() {
+  boost::mutex::scoped_lock lock(mutex);
+  while (!queue.empty() || in_progress) idle.wait(lock);
+}
+
+
+void EncodingPublisher::run() {
+  std::vector<char> scratch;
+  boost::mutex::scoped_lock lock(mutex);
+
+  while (true) {
+    while (queue.empty() && !done) queued.wait(lock);
+    if (queue.empty()) break;
+
+    char* buffer = queue.front();
+    queue.pop_front();
+    ++in_progress;
+
+    lock.unlock();
+    encode_point_cloud(buffer, encoding, scratch);
+    send_point_cloud(publisher, pool, buffer, ring);
+    lock.lock();
+
+    --in_progress;
+    if (queue.empty()) idle.notify_all();
+  }
+}
+
+
+void bind_acknowledgements(zmq::socket_t& acknowledgements, int port, const std::string& transport) {
+  std::string address = service_endpoint(transport, port+2, true);
+  acknowledgements.bind(address.c_str());
+}
+
+
+recv_result_t receive_acknowledgement(zmq::socket_t& acknowledgements, uint32_t& subscriber, uint64_t& frame_id, int flags) {
+  zmq::message_t message;
+  bool result = acknowledgements.recv(&message, flags);
+
+  if ((flags & ZMQ_NOBLOCK) && !result)
+    return RECV_NOUPDATE;
+  else if (!result || message.size() != 1 + sizeof(uint32_t) + sizeof(uint64_t) || static_cast<const char*>(message.data())[0] != 'a')
+    return RECV_FAILURE;
+
+  const char* bytes = static_cast<const char*>(message.data()) + 1;
+  memcpy(&subscriber, bytes, sizeof(uint32_t));
+  memcpy(&frame_id, bytes + sizeof(uint32_t), sizeof(uint64_t));
+  return RECV_SUCCESS;
+}
+
+
 void send_poses(zmq::socket_t& publisher, const pose_message_t::ptr& poses) {
   boost::shared_ptr<zmq::message_t> msg(poses->to_zmq());
   publisher.send(*msg);
 }
 
+
+bool send_pose_batch(zmq::socket_t& publisher, PoseBatch& poses, int flags) {
+  return publisher.send(poses.to_zmq(), flags);
+}
+
@@ -32,10 +32,14 @@
 #define GLM_FORCE_RADIANS 1
 
 #include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <sstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
 
 
-std::string to_string(const glm::dquat& q) {
+inline std::string to_string(const glm::dquat& q) {
   std::ostringstream out;
   out << q[3] << ", " << q[0] << ", " << q[1] << ", " << q[2] << std::flush;
   return out.str();
@@ -48,7 +52,7 @@ std::string to_string(const glm::dquat& q) {
  *
  * \returns A 4x4 matrix that can be multiplied by a quaternion to get the quaternion time derivative.
  */
-glm::dmat4 big_omega(const glm::dvec3& w) {
+inline glm::dmat4 big_omega(const glm::dvec3& w) {
   /* Equation 10 from Markley 2003, except we want to invert it to handle the fact that
    * Eigen stores its w before xyz instead of after. 
    * Also, we need to transpose the matrix as we initialize it. */
@@ -70,7 +74,7 @@ glm::dmat4 big_omega(const glm::dvec3& w) {
  *
  * \returns The time derivative as a 4-vector.
  */
-glm::dvec4 quaternion_time_derivative(const glm::dquat& q, const glm::dvec3& w) {
+inline glm::dvec4 quaternion_time_derivative(const glm::dquat& q, const glm::dvec3& w) {
   glm::dvec4 v(q[0], q[1], q[2], q[3]);
   v = big_omega(w)*v;
   return v;
@@ -85,7 +89,7 @@ glm::dvec4 quaternion_time_derivative(const glm::dquat& q, const glm::dvec3& w)
  *
  * \returns The resulting quaternion.
  */
-glm::dquat quaternion_change(const glm::dquat& q, const glm::dvec3& w, double dt) {
+inline glm::dquat quaternion_change(const glm::dquat& q, const glm::dvec3& w, double dt) {
   glm::dvec4 v = quaternion_time_derivative(q, w) * dt;
   
   glm::dquat r;
@@ -98,7 +102,7 @@ glm::dquat quaternion_change(const glm::dquat& q, const glm::dvec3& w, double dt
 }
 
 
-glm::dquat qcross(const glm::dquat& p, const glm::dquat& q) {
+inline glm::dquat qcross(const glm::dquat& p, const glm::dquat& q) {
   glm::dvec3 qv(q[1], q[2], q[3]);
   glm::dvec3 pv(p[1], p[2], p[3]);
   glm::dvec3 rv = p[0] * qv + q[0] * pv - glm::cross(pv, qv);
@@ -108,4 +112,31 @@ glm::dquat qcross(const glm::dquat& p, const glm::dquat& q) {
   return r;
 }
 
+
+/** Spherical linear interpolation between two attitudes, taking the shorter way around. Values of t
+ *  outside [0,1] extrapolate at the same angular rate.
+ *
+ * @param[in] attitude at t = 0
+ * @param[in] attitude at t = 1
+ * @param[in] fraction of the way from p to q
+ *
+ * \returns The interpolated quaternion.
+ */
+inline glm::dquat quaternion_slerp(const glm::dquat& p, const glm::dquat& q, double t) {
+  glm::dquat q1 = glm::dot(p, q) < 0.0 ? -q : q; // q and -q are the same attitude
+
+  glm::dquat delta = glm::conjugate(p) * q1;     // p * delta == q1
+  double half_angle = std::acos(std::min(1.0, std::max(-1.0, delta.w)));
+  double s = std::sin(half_angle);
+
+  if (s < 1e-9) { // nearly the same attitude; the axis is meaningless, but a lerp is exact enough
+    glm::dquat r(p.w + (q1.w - p.w) * t, p.x + (q1.x - p.x) * t, p.y + (q1.y - p.y) * t, p.z + (q1.z - p.z) * t);
+    return glm::normalize(r);
+  }
+
+  glm::dvec3 axis(delta.x / s, delta.y / s, delta.z / s);
+  double a = half_angle * t;
+  return glm::normalize(p * glm::dquat(std::cos(a), axis * std::sin(a)));
+}
+
 #endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <iostream>
+#include <cstring>
+
+#include "service/render_service.h"
+
+
+static bool more_parts(zmq::socket_t& socket) {
+  int more = 0;
+  size_t more_size = sizeof(int);
+  socket.getsockopt(ZMQ_RCVMORE, static_cast<void*>(&more), &more_size);
+  return more != 0;
+}
+
+
+static void discard_remaining_parts(zmq::socket_t& socket) {
+  while (more_parts(socket)) {
+    zmq::message_t part;
+    socket.recv(&part);
+  }
+}
+
+
+void bind_render_service(zmq::socket_t& router, int port, const std::string& transport) {
+  std::string address = service_endpoint(transport, port, true);
+  router.bind(address.c_str());
+  std::cerr << "Serving render requests on " << address << std::endl;
+}
+
+
+recv_result_t receive_render_request(zmq::socket_t& router, RenderRequest& request, int flags) {
+  zmq::message_t identity;
+  bool result = router.recv(&identity, flags);
+
+  if ((flags & ZMQ_NOBLOCK) && !result)
+    return RECV_NOUPDATE;
+  else if (!result)
+    return RECV_FAILURE;
+
+  request.client.assign(static_cast<const char*>(identity.data()), identity.size());
+  request.header    = render_request_t();
+  request.next_pose = 0;
+  request.poses.clear();
+
+  // The rest of a multipart message has already arrived, so none of this blocks.
+  zmq::message_t header, poses;
+  bool complete = more_parts(router) && router.recv(&header) && more_parts(router) && router.recv(&poses);
+  discard_remaining_parts(router);
+
+  const render_request_t* h = static_cast<const render_request_t*>(header.data());
+  if (!complete || header.size() < sizeof(render_request_t) || h->type != 'q' ||
+      std::memcmp(h->magic, WIRE_MAGIC, sizeof(h->magic)) != 0) {
+    std::cerr << "Error: discarding a malformed render request" << std::endl;
+    return RECV_FAILURE; // nothing trustworthy to reply to
+  }
+
+  memcpy(&request.header, h, sizeof(render_request_t));
+  if (h->version != RENDER_SERVICE_VERSION || h->pose_size == 0 ||
+      poses.size() != static_cast<size_t>(h->pose_count) * h->pose_size * sizeof(double)) {
+    std::cerr << "Error: render request " << h->request_id << " (version " << h->version << ") doesn't match its "
+              << poses.size() << " bytes of poses" << std::endl;
+    send_render_error(router, request.client, request.header, 0, RENDER_BAD_REQUEST);
+    return RECV_FAILURE;
+  }
+
+  request.poses.resize(static_cast<size_t>(h->pose_count) * h->pose_size);
+  if (!request.poses.empty()) memcpy(&request.poses[0], poses.data(), poses.size());
+  return RECV_SUCCESS;
+}
+
+
+/** Sends the identity and reply header that start every reply. Returns false only if nothing was queued:
+ *  once the identity is, the message has to be finished, or the client's next reply would run into it.
+ */
+static bool send_reply_header(zmq::socket_t& router, const std::string& client, const render_reply_t& reply, bool more) {
+  zmq::message_t identity(client.size()), header(sizeof(render_reply_t));
+  memcpy(identity.data(), client.data(), client.size());
+  memcpy(header.data(), &reply, sizeof(render_reply_t));
+  if (!router.send(identity, ZMQ_SNDMORE)) return false;
+
+  if (!router.send(header, more ? ZMQ_SNDMORE : 0)) {
+    std::cerr << "Error: unable to send the header of render reply " << reply.request_id << "/" << reply.pose_index << std::endl;
+    if (!more) { // close the message; the client will discard it as malformed
+      zmq::message_t end;
+      router.send(end);
+    }
+  }
+  return true;
+}
+
+
+bool send_render_reply(zmq::socket_t& router, MessagePool& pool, const RenderRequest& request, uint32_t pose_index, char* buffer) {
+  render_reply_t reply(request.header.request_id, request.header.pose_count);
+  reply.pose_index = pose_index;
+
+  // A ROUTER drops messages for clients that have gone away, so this won't block on them.
+  if (!send_reply_header(router, request.client, reply, true)) {
+    pool.recycle(buffer);
+    return false;
+  }
+
+  // The reply is under way, so the cloud has to follow to finish it.
+  const wire_header_t* header = reinterpret_cast<const wire_header_t*>(buffer);
+  if (!pool.send(router, buffer, sizeof(wire_header_t), sizeof(wire_header_t), header->payload_size()))
+    std::cerr << "Error: render reply " << reply.request_id << "/" << pose_index << " was cut short" << std::endl;
+  return true;
+}
+
+
+void send_render_error(zmq::socket_t& router, const std::string& client, const render_request_t& request, uint32_t pose_index,
+                       render_status_t status) {
+  render_reply_t reply(request.request_id, request.pose_count);
+  reply.pose_index = pose_index;
+  reply.status     = status;
+  send_reply_header(router, client, reply, false);
+}
+
+
+bool send_render_request(zmq::socket_t& client, uint64_t request_id, const std::vector<double>& poses, size_t pose_size) {
+  if (pose_size == 0 || poses.size() % pose_size != 0) {
+    std::cerr << "Error: " << poses.size() << " pose values aren't a whole number of " << pose_size << "-value poses" << std::endl;
+    return false;
+  }
+
+  render_request_t request(request_id, poses.size() / pose_size, pose_size);
+  zmq::message_t header(sizeof(render_request_t)), body(poses.size() * sizeof(double));
+  memcpy(header.data(), &request, sizeof(render_request_t));
+  if (!poses.empty()) memcpy(body.data(), &poses[0], poses.size() * sizeof(double));
+
+  bool sent = client.send(header, ZMQ_SNDMORE);
+  return client.send(body) && sent;
+}
+
+
+recv_result_t receive_render_reply(zmq::socket_t& client, render_reply_t& reply, CloudView& view, int flags) {
+  zmq::message_t header;
+  bool result = client.recv(&header, flags);
+
+  if ((flags & ZMQ_NOBLOCK) && !result)
+    return RECV_NOUPDATE;
+  else if (!result)
+    return RECV_FAILURE;
+
+  const render_reply_t* h = static_cast<const render_reply_t*>(header.data());
+  if (header.size() < sizeof(render_reply_t) || h->type != 'r' || std::memcmp(h->magic, WIRE_MAGIC, sizeof(h->magic)) != 0) {
+    std::cerr << "Error: received a malformed render reply" << std::endl;
+    discard_remaining_parts(client);
+    return RECV_FAILURE;
+  }
+  memcpy(&reply, h, sizeof(render_reply_t));
+
+  if (reply.status != RENDER_OK || reply.pose_count == 0) { // no cloud follows
+    discard_remaining_parts(client);
+    return RECV_SUCCESS;
+  }
+  if (!more_parts(client)) {
+    std::cerr << "Error: render reply " << reply.request_id << "/" << reply.pose_index << " has no point cloud" << std::endl;
+    return RECV_FAILURE;
+  }
+
+  // The cloud follows as it would from a publisher.
+  return view.receive(client);
+}
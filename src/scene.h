@@ -45,7 +45,11 @@
 #include <glm/gtx/projection.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <cmath>
+#include <algorithm>
+#include <stdint.h>
 #include "mesh.h"
+#include "chunk_store.h"
+#include "pcd_writer.h"
 #include "quaternion.h"
 
 #define _USE_MATH_DEFINES
@@ -59,6 +63,23 @@ const float NEAR_PLANE_FACTOR = 0.99;
 const float FAR_PLANE_FACTOR = 1.01;
 
 
+/** An additional object in the scene, posed independently of the primary (client) object.
+ *
+ * Its attitude follows the same convention as the primary object's, and its offset is the position of its
+ * origin relative to the primary object's origin, in the frame of the sensor-client translation.
+ */
+struct SceneObject {
+  Mesh* mesh;
+  float scale_factor;
+  glm::dquat attitude;
+  glm::dvec3 offset;
+  glm::mat4 model;         // model matrix, including the scale factor; updated by Scene::set_object_pose()
+  size_t visible_count;    // number of mesh instances inside the field of view in the last frame
+
+  SceneObject() : mesh(NULL), scale_factor(1.0f), attitude(1.0, 0.0, 0.0, 0.0), offset(0.0), model(1.0f), visible_count(0) { }
+};
+
+
 /** Simple object and sensor OpenGL scene, which handles loading and rendering meshes, and also writing out point clouds.
  *
  * This file currently contains two independent render strategies -- one from before I started using quaternions and
@@ -78,9 +99,16 @@ public:
    * @param[in] 3D model file to load.
    * @param[in] amount by which to scale the model we load.
    * @param[in] initial camera distance.
+   * @param[in] whether to quantize vertex positions and attributes on the GPU.
+   * @param[in] whether to use simplified levels of detail for distant meshes.
+   * @param[in] GPU memory budget in bytes, used only if filename is a chunk file (see chunk_store.h).
    */
-  Scene(const std::string& filename, float scale_factor_, float camera_d_, int noise_model_, float noise_coefficient_, int noise_seed_)
-  : scale_factor(scale_factor_),
+  Scene(const std::string& filename, float scale_factor_, float camera_d_, int noise_model_, float noise_coefficient_, int noise_seed_, bool quantize = false, bool lod = false, size_t gpu_budget = DEFAULT_GPU_BUDGET)
+  : mesh(quantize, lod),
+    chunks(NULL),
+    quantize(quantize),
+    lod(lod),
+    scale_factor(scale_factor_),
     projection(1.0),
     camera_d(camera_d_),
     noise_model(noise_model_),
@@ -88,18 +116,131 @@ public:
     noise_coefficient(noise_coefficient_),
     near_plane_bound(camera_d_ - BOX_HALF_DIAGONAL),
     real_near_plane(std::max(MIN_NEAR_PLANE, camera_d_-BOX_HALF_DIAGONAL)),
-    far_plane(camera_d_+BOX_HALF_DIAGONAL)
+    far_plane(camera_d_+BOX_HALF_DIAGONAL),
+    lod_tolerance(1.0f),
+    range_resolution(0.0f)
   {
     std::cerr << "camera_d = " << camera_d << std::endl;
-    mesh.load_mesh(filename);
 
-    glm::vec3 dimensions = mesh.dimensions();
+    if (ChunkStore::is_chunk_file(filename)) {
+      chunks = new ChunkStore(quantize, gpu_budget);
+      chunks->open(filename);
+    } else {
+      mesh.load_mesh(filename);
+    }
+
+    glm::vec3 dimensions = chunks ? chunks->dimensions() : mesh.dimensions();
     std::cerr << "Object dimensions as modeled: " << dimensions.x << '\t' << dimensions.y << '\t' << dimensions.z << std::endl;
-    glm::vec3 centroid = mesh.centroid();
+    glm::vec3 centroid = chunks ? chunks->centroid() : mesh.centroid();
     std::cerr << "Center of object as modeled: " << centroid.x << '\t' << centroid.y << '\t' << centroid.z << std::endl;
   }
 
 
+  ~Scene() {
+    delete chunks;
+    for (size_t i = 0; i < objects.size(); ++i)
+      delete objects[i].mesh;
+  }
+
+
+  /** Load another object into the scene. It is rendered in the same pass as the primary object (so the
+   *  two occlude each other), and can be posed independently with set_object_pose().
+   *
+   * Chunk files can only be used for the primary object.
+   *
+   * @param[in] 3D model file to load.
+   * @param[in] amount by which to scale the model.
+   * @param[in] initial position relative to the primary object (see SceneObject).
+   *
+   * \returns The object's index for set_object_pose(); the primary object is 0, so this starts at 1.
+   */
+  size_t add_object(const std::string& filename, float scale_factor_, const glm::dvec3& offset = glm::dvec3(0.0)) {
+    SceneObject object;
+    object.mesh         = new Mesh(quantize, lod);
+    object.scale_factor = scale_factor_;
+    object.mesh->load_mesh(filename);
+
+    objects.push_back(object);
+    set_object_pose(objects.size(), object.attitude, offset);
+
+    glm::vec3 dimensions = object.mesh->dimensions();
+    std::cerr << "Object " << objects.size() << " dimensions as modeled: " << dimensions.x << '\t' << dimensions.y << '\t' << dimensions.z << std::endl;
+
+    return objects.size();
+  }
+
+
+  /** Pose an additional object.
+   *
+   * @param[in] object index, as returned by add_object() (1 and up).
+   * @param[in] object attitude.
+   * @param[in] position relative to the primary object.
+   */
+  void set_object_pose(size_t index, const glm::dquat& attitude, const glm::dvec3& offset) {
+    SceneObject& object = objects.at(index - 1);
+    object.attitude = attitude;
+    object.offset   = offset;
+
+    glm::dquat flip = glm::angleAxis<double>(M_PI, glm::dvec3(0.0,1.0,0.0));
+    object.model = glm::mat4(glm::translate(glm::dmat4(1.0), offset) *
+                             glm::inverse(glm::mat4_cast(attitude * flip)) *
+                             glm::scale(glm::dmat4(1.0), glm::dvec3(object.scale_factor)));
+  }
+
+
+  /** Number of objects in the scene, including the primary object. */
+  size_t object_count() const { return objects.size() + 1; }
+
+
+  /** Make a node of a skinned model's skeleton controllable with set_joint_angles().
+   *
+   * The node is looked up in the primary object first, then in each additional object.
+   *
+   * @param[in] node name (from the model file).
+   * @param[in] rotation axis in the node's own frame.
+   *
+   * \returns false if no object has a skeleton node by that name.
+   */
+  bool add_joint(const std::string& name, const glm::vec3& axis) {
+    SceneJoint joint;
+    joint.axis = axis;
+
+    int index = chunks ? -1 : mesh.joint_index(name);
+    if (index >= 0) joint.mesh = &mesh;
+    for (size_t i = 0; index < 0 && i < objects.size(); ++i) {
+      index = objects[i].mesh->joint_index(name);
+      if (index >= 0) joint.mesh = objects[i].mesh;
+    }
+
+    if (index < 0) {
+      std::cerr << "WARNING: No skinned object has a node named '" << name << "'" << std::endl;
+      return false;
+    }
+
+    joint.index = index;
+    joints.push_back(joint);
+    return true;
+  }
+
+
+  /** Number of joints added with add_joint(). */
+  size_t joint_count() const { return joints.size(); }
+
+
+  /** Set every joint's angle, in the order they were added, and re-pose the skinned meshes.
+   *
+   * @param[in] joint angles (radians); extra values are ignored, and missing ones leave joints as they were.
+   */
+  void set_joint_angles(const std::vector<double>& angles) {
+    for (size_t i = 0; i < joints.size() && i < angles.size(); ++i)
+      joints[i].mesh->set_joint(joints[i].index, joints[i].axis, angles[i]);
+
+    if (!chunks) mesh.update_skeleton();
+    for (size_t i = 0; i < objects.size(); ++i)
+      objects[i].mesh->update_skeleton();
+  }
+
+
   /** Set OpenGL options.
    *
    */
@@ -138,9 +279,56 @@ public:
     glm::vec4 camera_pos_mc = inverse_model * inverse_view * glm::vec4(0.0, 0.0, 0.0, 1.0);
     glm::mat4 model = glm::inverse(inverse_model);
     
-    near_plane_bound = mesh.near_plane_bound(model, camera_pos_mc);
-    real_near_plane = near_plane_bound * NEAR_PLANE_FACTOR;
-    far_plane = mesh.far_plane_bound(model, camera_pos_mc) * FAR_PLANE_FACTOR;
+    // Pick levels of detail. The colors only have 16 bits for range, so a range bin is 1/65536 of the
+    // distance between the planes (or the sensor's own resolution, if that's coarser).
+    glm::ivec4 viewport;
+    glGetIntegerv(GL_VIEWPORT, glm::value_ptr(viewport));
+    float pixel_angle = fov * RADIANS_PER_DEGREE / std::max(1, std::max(viewport[2], viewport[3]));
+    float lod_error = 0.0f;
+
+    // The planes have to take in every object we can see, since they share the depth buffer.
+    float near_bound = std::numeric_limits<float>::max(), far_bound = 0.0f;
+
+    if (chunks) {
+      // Out-of-core models don't have a k-D tree, so use the bounding boxes of the chunks we can see.
+      chunks->cull(view_physics * model, fov * RADIANS_PER_DEGREE, ASPECT_RATIO, near_bound, far_bound);
+    } else if (mesh.cull(view_physics * model, fov * RADIANS_PER_DEGREE, ASPECT_RATIO) || objects.empty()) {
+      near_bound = mesh.near_plane_bound(model, camera_pos_mc);
+      far_bound  = mesh.far_plane_bound(model, camera_pos_mc);
+    }
+
+    std::vector<glm::vec4> object_camera_pos(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) {
+      SceneObject& object = objects[i];
+      object.visible_count = object.mesh->cull(view_physics * object.model, fov * RADIANS_PER_DEGREE, ASPECT_RATIO);
+      if (!object.visible_count) continue;
+
+      // The bounds only need the model's rotation and scale; its offset is already in the camera position.
+      glm::mat4 linear(glm::mat3(object.model));
+      object_camera_pos[i] = glm::inverse(object.model) * inverse_view * glm::vec4(0.0, 0.0, 0.0, 1.0);
+      near_bound = std::min(near_bound, object.mesh->near_plane_bound(linear, object_camera_pos[i]));
+      far_bound  = std::max(far_bound,  object.mesh->far_plane_bound(linear, object_camera_pos[i]));
+    }
+
+    if (far_bound > 0.0f) { // otherwise nothing is in view, and the old planes are as good as any
+      near_plane_bound = near_bound;
+      real_near_plane = std::max(MIN_NEAR_PLANE, near_plane_bound * NEAR_PLANE_FACTOR);
+      far_plane = far_bound * FAR_PLANE_FACTOR;
+    }
+
+    float range_bin = std::max((far_plane - real_near_plane) / 65536.0f, range_resolution);
+
+    if (chunks) lod_error = chunks->page(camera_pos_mc, scale_factor, pixel_angle, lod_tolerance * range_bin);
+    else        lod_error = mesh.select_lods(camera_pos_mc, scale_factor, pixel_angle, lod_tolerance * range_bin);
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+      if (!objects[i].visible_count) continue;
+      lod_error = std::max(lod_error, objects[i].mesh->select_lods(object_camera_pos[i], objects[i].scale_factor, pixel_angle, lod_tolerance * range_bin));
+    }
+
+    // Simplified surfaces can be up to lod_error closer or farther than the real one; don't clip them.
+    real_near_plane = std::max(MIN_NEAR_PLANE, real_near_plane - lod_error);
+    far_plane += lod_error;
 
     projection = glm::perspective<float>(fov * M_PI / 180.0, ASPECT_RATIO, real_near_plane, far_plane);
   }
@@ -204,20 +392,17 @@ public:
     GLint v_id = glGetUniformLocation(shader_program->id(), "ViewMatrix");
     glUniformMatrix4fv(v_id, 1, GL_FALSE, &view_physics[0][0]);
     
-    glm::mat4 model_view = view_physics * model;
-    GLint mv_id = glGetUniformLocation(shader_program->id(), "ModelViewMatrix");
-    glUniformMatrix4fv(mv_id, 1, GL_FALSE, &model_view[0][0]);
+    set_model_view(shader_program, view_physics * model);
 
-    glm::mat3 normal_matrix = glm::inverseTranspose(glm::mat3(model_view));
-    GLint normal_id = glGetUniformLocation(shader_program->id(), "NormalMatrix");
-    glUniformMatrix3fv(normal_id, 1, false, static_cast<GLfloat*>(glm::value_ptr(normal_matrix)));
-    
-    glm::mat4 model_view_projection = projection * model_view;
-    
-    GLint mvp_id = glGetUniformLocation(shader_program->id(), "ModelViewProjectionMatrix");
-    glUniformMatrix4fv(mvp_id, 1, GL_FALSE, &model_view_projection[0][0]);
+    if (chunks) chunks->render(shader_program);
+    else        mesh.render(shader_program);
 
-    mesh.render(shader_program);
+    // Everything goes into the same depth buffer, so objects occlude one another.
+    for (size_t i = 0; i < objects.size(); ++i) {
+      if (!objects[i].visible_count) continue;
+      set_model_view(shader_program, view_physics * objects[i].model);
+      objects[i].mesh->render(shader_program);
+    }
 
     check_gl_error();
 
@@ -232,6 +417,25 @@ public:
   }
   
 
+  /** Set the model-view, normal, and model-view-projection matrices for the next object drawn.
+   *
+   * @param[in] the GLSL shader program.
+   * @param[in] model-view matrix.
+   */
+  void set_model_view(Shader* shader_program, const glm::mat4& model_view) {
+    GLint mv_id = glGetUniformLocation(shader_program->id(), "ModelViewMatrix");
+    glUniformMatrix4fv(mv_id, 1, GL_FALSE, &model_view[0][0]);
+
+    glm::mat3 normal_matrix = glm::inverseTranspose(glm::mat3(model_view));
+    GLint normal_id = glGetUniformLocation(shader_program->id(), "NormalMatrix");
+    glUniformMatrix3fv(normal_id, 1, false, static_cast<GLfloat*>(glm::value_ptr(normal_matrix)));
+
+    glm::mat4 model_view_projection = projection * model_view;
+    GLint mvp_id = glGetUniformLocation(shader_program->id(), "ModelViewProjectionMatrix");
+    glUniformMatrix4fv(mvp_id, 1, GL_FALSE, &model_view_projection[0][0]);
+  }
+
+
   /** Render the scene, calculating the view and inverse model matrices from attitudes (as quaternions) and translations.
    *
    * @param[in] the GLSL shader program.
@@ -361,65 +565,51 @@ public:
   }
 
 
+  /** The sensor model for the frame just rendered. */
+  SensorModel sensor_model() const {
+    SensorModel sensor;
+    sensor.projection_x = projection[0][0];
+    sensor.projection_y = projection[1][1];
+    sensor.near_plane   = real_near_plane;
+    sensor.far_plane    = far_plane;
+    return sensor;
+  }
+
+
+  /** Read back the color buffer, which holds each pixel's depth and intensity.
+   *
+   * @param[out] RGBA pixels, bottom row first (resized to fit).
+   * @param[in] width of the sensor viewport
+   * @param[in] height of the sensor viewport
+   */
+  void read_pixels(std::vector<unsigned char>& rgba, unsigned int width, unsigned int height) const {
+    rgba.resize(4*width*height);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)(&rgba[0]));
+  }
+
+
   /** Write only the data component of a point cloud to a buffer (no headers).
    *
-   * Writes the point cloud to a buffer as x,y,z,i (in binary). Returns a size_t indicating the number of floating point 
-   * entries written (note: not the number of bytes written).
+   * Writes the point cloud to a buffer as x,y,z,i (in binary), in camera coordinates. Depending on the
+   * layout, pixels without a return are skipped (CLOUD_UNORGANIZED), skipped but with each point's pixel
+   * index appended (CLOUD_INDEXED), or written as NaN so that the cloud keeps the image's rows and
+   * columns (CLOUD_ORGANIZED). Pixels are written top row first. Returns a size_t indicating the number of
+   * floating point entries written (note: not the number of bytes written).
    *
-   * @param[in] model attitude quaternion.
-   * @param[in] model-sensor translation.
-   * @param[in] camera (sensor) attitude quaternion.
-   * @param[out] the data buffer to which we wrote (pre-allocated by the calling function!)
+   * @param[out] the data buffer to which we wrote (pre-allocated by the calling function, with room for
+   *             cloud_point_size(layout) floats per pixel!)
    * @param[in] width of the sensor viewport
-   * @parma[in] height of the sensor viewport
+   * @param[in] height of the sensor viewport
+   * @param[in] how to lay out the points.
    *
-   * \returns The total number of entries written to data (not the number of floats, mind you).
+   * \returns The total number of entries written to data (not the number of points, mind you).
    */  
-  size_t write_point_cloud(float* data, unsigned int width, unsigned int height) {
-    glm::ivec4 viewport;
-    glm::mat4 identity(1.0);
-    
-    glGetIntegerv( GL_VIEWPORT, (int*)&viewport );
-
-    size_t data_count = 0;
-    
-    unsigned char rgba[4*width*height];
-
-    glm::mat4 axis_flip = glm::scale(glm::mat4(1.0), glm::vec3(-1.0, 1.0, -1.0));
-
-    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)(rgba));
-
-    for (size_t i = 0; i < height; ++i) {
-      for (size_t j = 0; j < width; ++j) {
-        size_t pos = 4*(j*height+i);
-        
-        int gb = rgba[pos + 1] * 255 + rgba[pos + 2];
-        if (gb == 0) continue;
-        double t = gb / 65536.0;
-        double d = t * (far_plane - real_near_plane) + real_near_plane;
-
-        glm::vec3 win(i,j,t);
-	glm::vec4 position(glm::unProject(win, identity, projection, viewport), 0.0);
-
-	// Transform back into camera coordinates
-	position.z = -d; // Substitute in our correct distance value.
-	glm::vec4 position_cc = axis_flip * position;
-
-
-        data[data_count]   =  position_cc[0];
-        data[data_count+1] =  position_cc[1];
-        data[data_count+2] =  position_cc[2];
-        data[data_count+3] =  rgba[pos + 0] / 256.0;
-	
-        data_count += 4;
-      }
-    }
-
-    return data_count;    
+  size_t write_point_cloud(float* data, unsigned int width, unsigned int height, CloudLayout layout = CLOUD_UNORGANIZED) {
+    read_pixels(pixels, width, height);
+    return unproject_pixels(&pixels[0], width, height, sensor_model(), data, layout);
   }
 
 
-
   /** Write the current color buffer as a PCD (point cloud file).
    *
    * @param[in] model attitude quaternion.
@@ -428,38 +618,82 @@ public:
    * @param[in] output file basename (without the extension, which will be .pcd)
    * @param[in] width of the viewport.
    * @param[in] height of the viewport.
+   * @param[in] how to lay out the points.
    */
-  void save_point_cloud(const std::string& basename, unsigned int width, unsigned int height) {
-   std::string filename = basename + ".pcd";
+  void save_point_cloud(const std::string& basename, unsigned int width, unsigned int height, CloudLayout layout = CLOUD_UNORGANIZED) {
+    std::string filename = basename + ".pcd";
 
     std::cerr << "Saving point cloud..." << std::endl;
 
-    float* data       = new float[4*width*height + 4];
-    size_t data_count = write_point_cloud(data, width, height);
-    
-    std::ofstream out(filename.c_str());
-    
-    // Print PCD header
-    out << "VERSION .7\nFIELDS x y z intensity\nSIZE 4 4 4 4\nTYPE F F F F\nCOUNT 1 1 1 1\n";
-    out << "WIDTH " << data_count / 4 << std::endl;
-    out << "HEIGHT " << 1 << std::endl;
+    std::vector<float> data(cloud_point_size(layout)*width*height + 4);
+    size_t data_count = write_point_cloud(&data[0], width, height, layout);
 
-    out << "VIEWPOINT 0 0 0 1 0 0 0" << std::endl;
-    out << "POINTS " << data_count / 4 << std::endl;
-    out << "DATA binary" << std::endl;
-    out.write((char*)(data), sizeof(float)*data_count);
+    if (write_pcd_file(filename, &data[0], data_count, layout, width, height))
+      std::cerr << "Saved '" << filename << "'" << std::endl;
+    else
+      std::cerr << "ERROR: Could not write '" << filename << "'" << std::endl;
+  }
 
-    out.close();
 
-    std::cerr << "Saved '" << filename << "'" << std::endl;
+  /** Read back the current color buffer and queue it to be written as a PCD file (or range image) in the
+   *  background.
+   *
+   * Blocks only if the writer has fallen so far behind that its buffers are all in use.
+   *
+   * @param[in] output file basename (without the extension)
+   * @param[in] width of the viewport.
+   * @param[in] height of the viewport.
+   * @param[in] writer, whose buffers must hold at least cloud_point_size(layout)*width*height floats.
+   * @param[in] how to lay out the points (range images must be CLOUD_ORGANIZED).
+   * @param[in] what to write.
+   * @param[in] pose to record with the frame (model-view matrix without scaling), for archives.
+   * @param[in] timestamp to record with the frame, for archives.
+   */
+  void save_point_cloud(const std::string& basename, unsigned int width, unsigned int height, PcdWriter& writer,
+                        CloudLayout layout = CLOUD_UNORGANIZED, FrameFormat format = FRAME_PCD_BINARY,
+                        const glm::dmat4& pose = glm::dmat4(1.0), uint64_t timestamp = 0) {
+    FrameBuffer* frame = writer.acquire();
+    frame->width      = width;
+    frame->height     = height;
+    frame->layout     = layout;
+    frame->near_plane = real_near_plane;
+    frame->far_plane  = far_plane;
+    frame->fx         = projection[0][0] * width * 0.5f;
+    frame->fy         = projection[1][1] * height * 0.5f;
+    frame->timestamp  = timestamp;
+    std::copy(glm::value_ptr(pose), glm::value_ptr(pose) + 16, frame->pose);
+    frame->count      = write_point_cloud(&(frame->data[0]), width, height, layout);
+    writer.write(basename, frame, format);
   }
   
 
+  /** Set how much error simplified levels of detail may introduce.
+   *
+   * @param[in] tolerance in range bins.
+   * @param[in] the sensor's range resolution in world units; the range bin is the larger of this and the
+   *            16-bit range encoding's resolution.
+   */
+  void set_lod_tolerance(float bins, float range_resolution_ = 0.0f) {
+    lod_tolerance    = bins;
+    range_resolution = range_resolution_;
+  }
+
   float get_near_plane() const { return real_near_plane; }
   float get_far_plane() const { return far_plane; }
 
 private:
   Mesh mesh;
+  ChunkStore* chunks; // NULL unless the model is a chunk file
+  bool quantize;
+  bool lod;
+  std::vector<SceneObject> objects; // everything besides the primary object
+
+  struct SceneJoint {
+    Mesh*     mesh;
+    size_t    index;
+    glm::vec3 axis;
+  };
+  std::vector<SceneJoint> joints;
   float scale_factor;
 
   glm::mat4 projection;
@@ -470,6 +704,10 @@ private:
   GLfloat near_plane_bound;
   GLfloat real_near_plane;
   GLfloat far_plane;
+  float lod_tolerance;
+  float range_resolution;
+
+  std::vector<unsigned char> pixels; // read back by write_point_cloud(), kept from frame to frame
 };
 
 #endif
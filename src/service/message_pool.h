@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef SERVICE_MESSAGE_POOL_H
+# define SERVICE_MESSAGE_POOL_H
+
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <zmq.hpp>
+#include <boost/thread/mutex.hpp>
+
+const size_t DEFAULT_MESSAGE_POOL_SIZE = 4;
+
+
+/** A fixed set of send buffers, locked in memory, that ZeroMQ hands back when it's done with them.
+ *
+ * Fill a buffer from acquire() and pass it to send(); the message (or message parts) are built around
+ * the buffer (no copy), and ZeroMQ's free callback, which runs on its I/O thread once every subscriber's
+ * copy is on the wire, returns it to the pool. Steady-state publishing therefore allocates nothing.
+ *
+ * The pool has to outlive the ZeroMQ context, since the context may still be flushing messages when
+ * the sockets go away.
+ */
+class MessagePool {
+public:
+  /** Constructor. Allocates and locks every buffer up front.
+   *
+   * @param[in] number of buffers (messages that may be queued at once).
+   * @param[in] bytes in each buffer.
+   */
+  MessagePool(size_t count, size_t capacity_)
+  : capacity(capacity_), drops(0)
+  {
+    bool locked = true;
+    for (size_t i = 0; i < count; ++i) {
+      // Each buffer is preceded by its bookkeeping, so a buffer pointer is all ZeroMQ has to give back.
+      char* raw = static_cast<char*>(malloc(SLOT_SIZE + capacity));
+      if (locked && mlock(raw, SLOT_SIZE + capacity) != 0) {
+        std::cerr << "WARNING: Unable to lock publish buffers in memory (see ulimit -l); they may be paged out." << std::endl;
+        locked = false;
+      }
+      Slot* slot = reinterpret_cast<Slot*>(raw);
+      slot->pool       = this;
+      slot->references = 0;
+      buffers.push_back(raw + SLOT_SIZE);
+      free_list.push_back(raw + SLOT_SIZE);
+    }
+  }
+
+  /** Frees the buffers. Any still held by ZeroMQ (the context hasn't been terminated) are leaked rather
+   *  than freed out from under it.
+   */
+  ~MessagePool() {
+    boost::mutex::scoped_lock lock(mutex);
+    if (free_list.size() < buffers.size()) {
+      std::cerr << "WARNING: " << buffers.size() - free_list.size() << " publish buffers still in flight at exit" << std::endl;
+      return;
+    }
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      munlock(buffers[i] - SLOT_SIZE, SLOT_SIZE + capacity);
+      free(buffers[i] - SLOT_SIZE);
+    }
+  }
+
+  /** Take a buffer to fill.
+   *
+   * \returns A buffer of buffer_size() bytes, or NULL if ZeroMQ still holds all of them (the subscribers
+   *          are behind); the caller should skip this message rather than wait.
+   */
+  char* acquire() {
+    boost::mutex::scoped_lock lock(mutex);
+    if (free_list.empty()) {
+      ++drops;
+      return NULL;
+    }
+    char* buffer = free_list.back();
+    free_list.pop_back();
+    return buffer;
+  }
+
+  /** Send a filled buffer without copying it. It comes back to the pool when ZeroMQ is done with it.
+   *
+   * @param[in] socket to send on.
+   * @param[in] buffer from acquire().
+   * @param[in] bytes of the buffer in use.
+   * @param[in] send flags.
+   *
+   * \returns Whether the message was queued.
+   */
+  bool send(zmq::socket_t& socket, char* buffer, size_t size, int flags = 0) {
+    slot(buffer)->references = 1;
+    zmq::message_t message(buffer, size, release, NULL);
+    return socket.send(message, flags);
+  }
+
+  /** Send a filled buffer as two message parts (e.g. a header and a payload), neither copied. The buffer
+   *  comes back to the pool once ZeroMQ is done with both.
+   *
+   * @param[in] socket to send on.
+   * @param[in] buffer from acquire().
+   * @param[in] bytes in the first part, which starts the buffer.
+   * @param[in] offset of the second part.
+   * @param[in] bytes in the second part.
+   *
+   * \returns Whether both parts were queued.
+   */
+  bool send(zmq::socket_t& socket, char* buffer, size_t first_size, size_t second_offset, size_t second_size) {
+    slot(buffer)->references = 2;
+    zmq::message_t first(buffer, first_size, release, NULL);
+    zmq::message_t second(buffer + second_offset, second_size, release, buffer);
+    bool sent = socket.send(first, ZMQ_SNDMORE);
+    return socket.send(second) && sent;
+  }
+
+  /** Give back a buffer that wasn't sent (or was sent some other way). */
+  void recycle(char* buffer) {
+    boost::mutex::scoped_lock lock(mutex);
+    free_list.push_back(buffer);
+  }
+
+  /** Number of buffers. */
+  size_t size() const { return buffers.size(); }
+
+  /** Bytes in each buffer. */
+  size_t buffer_size() const { return capacity; }
+
+  /** Number of buffers taken and not yet back (e.g. still queued for subscribers). */
+  size_t in_use() {
+    boost::mutex::scoped_lock lock(mutex);
+    return buffers.size() - free_list.size();
+  }
+
+  /** Number of times acquire() came up empty. */
+  size_t drop_count() {
+    boost::mutex::scoped_lock lock(mutex);
+    return drops;
+  }
+
+private:
+  struct Slot {
+    MessagePool* pool;
+    int references; // message parts ZeroMQ still holds
+  };
+  static const size_t SLOT_SIZE = 64; // keeps buffers as aligned as malloc's, and off the slot's cache line
+
+  static Slot* slot(char* buffer) { return reinterpret_cast<Slot*>(buffer - SLOT_SIZE); }
+
+  /** ZeroMQ free callback; hint is the start of the buffer, or NULL if data is. */
+  static void release(void* data, void* hint) {
+    char* buffer = static_cast<char*>(hint ? hint : data);
+    Slot* s = slot(buffer);
+    boost::mutex::scoped_lock lock(s->pool->mutex);
+    if (--(s->references) == 0) s->pool->free_list.push_back(buffer);
+  }
+
+  std::vector<char*> buffers;
+  std::vector<char*> free_list;
+  size_t capacity;
+  size_t drops;
+
+  boost::mutex mutex;
+};
+
+
+#endif // SERVICE_MESSAGE_POOL_H
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef SERVICE_POSE_BATCH_H
+# define SERVICE_POSE_BATCH_H
+
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <stdint.h>
+#include <zmq.hpp>
+
+#include "service.h"
+#include "wire_format.h"
+
+/*
+ * Batches of pose hypotheses (e.g. a particle filter's), as one message of type 'B':
+ *
+ *   pose_batch_header_t | count records of record_size bytes, each starting with a pose_record_t
+ *
+ * Unlike pose_message_t ('P'), the count is 32 bits, and the layout is fixed, so batches are written
+ * straight into the outgoing message (PoseBatch) and read in place from the incoming one (PoseBatchView).
+ */
+
+const uint16_t POSE_BATCH_VERSION = 1;
+
+/** pose_record_t flags. */
+enum pose_record_flag_t {
+  POSE_CONVERGED = 1
+};
+
+
+/** One hypothesis: a 4x4 column-major transform and its score. */
+struct pose_record_t {
+  float    pose[16];
+  float    score;
+  uint32_t flags;
+
+  void set(const Eigen::Matrix4f& p, float score_ = std::numeric_limits<float>::infinity(), bool converged = false) {
+    memcpy(pose, p.data(), sizeof(float)*16);
+    score = score_;
+    flags = converged ? POSE_CONVERGED : 0;
+  }
+
+  void get_pose(Eigen::Matrix4f& p) const {
+    memcpy(p.data(), pose, sizeof(float)*16);
+  }
+
+  bool converged() const { return (flags & POSE_CONVERGED) != 0; }
+};
+
+
+/** Start of a pose batch message. */
+struct pose_batch_header_t {
+  char        type;         // 'B'
+  char        magic[3];     // WIRE_MAGIC
+  uint16_t    version;
+  uint16_t    byte_order;   // WIRE_BYTE_ORDER, as the sender wrote it
+  uint32_t    count;
+  uint32_t    record_size;  // bytes per record; newer senders may append to pose_record_t
+  timestamp_t timestamp;
+};
+
+typedef char pose_record_size_check[sizeof(pose_record_t) == 72 ? 1 : -1];
+typedef char pose_batch_header_size_check[sizeof(pose_batch_header_t) == 24 ? 1 : -1];
+
+
+/** A batch being written, directly into the message that will carry it. */
+class PoseBatch {
+public:
+  /** Constructor.
+   *
+   * @param[in] number of poses (all identity, with infinite scores, until set).
+   * @param[in] timestamp of the sensor image the poses are for.
+   */
+  PoseBatch(uint32_t count = 0, timestamp_t timestamp = 0) {
+    reset(count, timestamp);
+  }
+
+  /** Start a new batch (e.g. after the last was sent, which empties the message). */
+  void reset(uint32_t count, timestamp_t timestamp) {
+    message.rebuild(sizeof(pose_batch_header_t) + static_cast<size_t>(count) * sizeof(pose_record_t));
+
+    pose_batch_header_t* h = header();
+    h->type        = 'B';
+    memcpy(h->magic, WIRE_MAGIC, sizeof(h->magic));
+    h->version     = POSE_BATCH_VERSION;
+    h->byte_order  = WIRE_BYTE_ORDER;
+    h->count       = count;
+    h->record_size = sizeof(pose_record_t);
+    h->timestamp   = timestamp;
+
+    for (uint32_t i = 0; i < count; ++i)
+      (*this)[i].set(Eigen::Matrix4f::Identity());
+  }
+
+  uint32_t size() const { return header()->count; }
+  timestamp_t timestamp() const { return header()->timestamp; }
+
+  pose_record_t& operator[](uint32_t k) { return records()[k]; }
+  const pose_record_t& operator[](uint32_t k) const { return records()[k]; }
+
+  /** The message, for sending; empty once sent, until reset(). */
+  zmq::message_t& to_zmq() { return message; }
+
+private:
+  pose_batch_header_t* header() const {
+    return static_cast<pose_batch_header_t*>(const_cast<void*>(message.data()));
+  }
+
+  pose_record_t* records() const {
+    return reinterpret_cast<pose_record_t*>(static_cast<char*>(const_cast<void*>(message.data())) + sizeof(pose_batch_header_t));
+  }
+
+  zmq::message_t message;
+};
+
+
+/** A received batch, read in place from the message (or, if the message isn't suitably aligned or its
+ *  records are longer than this build's, from an arena that's reused across messages).
+ */
+class PoseBatchView {
+public:
+  PoseBatchView() : records(NULL) {
+    memset(&header_, 0, sizeof(header_));
+  }
+
+  /** Take a received message. Keeps it until the next one.
+   *
+   * \returns false (with an error) if it isn't a pose batch this build can read.
+   */
+  bool decode(zmq::message_t& msg) {
+    records = NULL;
+    header_.count = 0;
+    message.move(&msg);
+
+    const char* bytes = static_cast<const char*>(message.data());
+    if (message.size() < sizeof(pose_batch_header_t) || bytes[0] != 'B' || memcmp(bytes + 1, WIRE_MAGIC, sizeof(WIRE_MAGIC)) != 0) {
+      std::cerr << "Error: message of " << message.size() << " bytes isn't a pose batch" << std::endl;
+      return false;
+    }
+    pose_batch_header_t h;
+    memcpy(&h, bytes, sizeof(pose_batch_header_t));
+    if (h.byte_order != WIRE_BYTE_ORDER || h.record_size < sizeof(pose_record_t) ||
+        (message.size() - sizeof(pose_batch_header_t)) / h.record_size < h.count) {
+      std::cerr << "Error: pose batch of " << h.count << " poses is from a sender of another byte order, or is truncated" << std::endl;
+      return false;
+    }
+
+    header_ = h;
+    const char* first = bytes + sizeof(pose_batch_header_t);
+    if (h.record_size == sizeof(pose_record_t) && reinterpret_cast<uintptr_t>(first) % sizeof(float) == 0) {
+      records = reinterpret_cast<const pose_record_t*>(first);
+    } else {
+      arena.resize(h.count);
+      for (uint32_t i = 0; i < h.count; ++i)
+        memcpy(&arena[i], first + static_cast<size_t>(i) * h.record_size, sizeof(pose_record_t));
+      records = arena.empty() ? NULL : &arena[0];
+    }
+    return true;
+  }
+
+  uint32_t size() const { return header_.count; }
+  bool empty() const { return header_.count == 0; }
+  timestamp_t timestamp() const { return header_.timestamp; }
+
+  const pose_record_t& operator[](uint32_t k) const { return records[k]; }
+
+private:
+  pose_batch_header_t header_;
+  zmq::message_t message;
+  const pose_record_t* records;
+  std::vector<pose_record_t> arena;
+};
+
+
+#endif // SERVICE_POSE_BATCH_H
@@ -35,9 +35,18 @@
 #include <Eigen/Dense>
 #include <Eigen/Core>
 #include <fstream>
+#include <iostream>
+#include <cstring>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread/thread.hpp>
 
 // Need timestamp typedefs
 #include "service.h"
+#include "pose_batch.h"
+
+const size_t DEFAULT_POSE_LOG_CAPACITY = 4096; // records that may wait for the writer thread
+
 
 class PoseLogger {
 public:
@@ -63,4 +72,150 @@ protected:
   Eigen::IOFormat pose_format;
 };
 
+
+/*
+ * Binary pose logs: a pose_log_header_t, then one pose_log_record_t per pose, in the writer's byte order.
+ * pose_log_to_text converts them to PoseLogger's text format.
+ */
+const char     POSE_LOG_MAGIC[8]  = {'G','L','D','P','L','O','G','\0'};
+const uint16_t POSE_LOG_VERSION   = 1;
+
+struct pose_log_header_t {
+  char     magic[8];
+  uint16_t version;
+  uint16_t byte_order;   // WIRE_BYTE_ORDER, as the writer wrote it
+  uint32_t record_size;
+};
+
+struct pose_log_record_t {
+  timestamp_t   timestamp;
+  pose_record_t pose;
+};
+
+typedef char pose_log_header_size_check[sizeof(pose_log_header_t) == 16 ? 1 : -1];
+typedef char pose_log_record_size_check[sizeof(pose_log_record_t) == 80 ? 1 : -1];
+
+
+/** Logs poses as binary records, for when PoseLogger's formatting would cost more than the estimates it
+ *  records. log() just copies a record into a lock-free ring; a background thread writes them out.
+ *
+ * One thread may log (the ring is single-producer). If the writer falls the whole ring behind, records
+ * are dropped rather than making the caller wait.
+ */
+class BinaryPoseLogger {
+public:
+  /** Constructor. Opens the log and starts the writer thread.
+   *
+   * @param[in] filename of the log.
+   * @param[in] records that may wait for the writer.
+   */
+  BinaryPoseLogger(const std::string& filename, size_t capacity = DEFAULT_POSE_LOG_CAPACITY)
+  : out(filename.c_str(), std::ios_base::out | std::ios_base::binary), ring(capacity), drops(0), done(false)
+  {
+    if (!out) {
+      std::cerr << "Error: unable to open pose log '" << filename << "'" << std::endl;
+      return;
+    }
+
+    pose_log_header_t header;
+    memcpy(header.magic, POSE_LOG_MAGIC, sizeof(POSE_LOG_MAGIC));
+    header.version     = POSE_LOG_VERSION;
+    header.byte_order  = WIRE_BYTE_ORDER;
+    header.record_size = sizeof(pose_log_record_t);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(pose_log_header_t));
+
+    writer = boost::thread(&BinaryPoseLogger::run, this);
+  }
+
+  ~BinaryPoseLogger() {
+    close();
+  }
+
+  /** Queue a pose to be logged. Doesn't block, allocate, or format.
+   *
+   * \returns false if the ring was full and the pose was dropped.
+   */
+  bool log(const timestamp_t& timestamp, const Eigen::Matrix4f& pose, float score = std::numeric_limits<float>::infinity(),
+           bool converged = false) {
+    pose_log_record_t record;
+    record.timestamp = timestamp;
+    record.pose.set(pose, score, converged);
+    if (ring.push(record)) return true;
+    drops.fetch_add(1, boost::memory_order_relaxed);
+    return false;
+  }
+
+  /** Write out whatever is queued, and close the log. */
+  void close() {
+    if (done.exchange(true)) return;
+    if (writer.joinable()) writer.join();
+    out.close();
+    if (drops) std::cerr << "WARNING: Pose log dropped " << drops << " poses" << std::endl;
+  }
+
+  /** Poses dropped because the ring was full. */
+  size_t dropped() const { return drops; }
+
+protected:
+  void run() {
+    pose_log_record_t batch[64];
+    while (true) {
+      // Read done before draining, so nothing logged before close() is left behind.
+      bool stopping = done.load(boost::memory_order_acquire);
+      size_t count;
+      while ((count = ring.pop(batch, 64)) > 0)
+        out.write(reinterpret_cast<const char*>(batch), count * sizeof(pose_log_record_t));
+      if (stopping) break;
+      // Polling keeps log() free of any wakeup; a millisecond of latency doesn't matter for a log.
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    out.flush();
+  }
+
+  std::ofstream out;
+  boost::lockfree::spsc_queue<pose_log_record_t> ring;
+  boost::atomic<size_t> drops;
+  boost::atomic<bool> done;
+  boost::thread writer;
+};
+
+
+/** Reads a log written by BinaryPoseLogger. */
+class BinaryPoseLogReader {
+public:
+  BinaryPoseLogReader(const std::string& filename)
+  : in(filename.c_str(), std::ios_base::in | std::ios_base::binary), record_size(0)
+  {
+    pose_log_header_t header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(pose_log_header_t)) ||
+        memcmp(header.magic, POSE_LOG_MAGIC, sizeof(POSE_LOG_MAGIC)) != 0) {
+      std::cerr << "Error: '" << filename << "' isn't a binary pose log" << std::endl;
+      return;
+    }
+    if (header.byte_order != WIRE_BYTE_ORDER || header.record_size < sizeof(pose_log_record_t)) {
+      std::cerr << "Error: pose log '" << filename << "' is from a machine of another byte order, or is corrupt" << std::endl;
+      return;
+    }
+    record_size = header.record_size;
+    skip.resize(record_size - sizeof(pose_log_record_t));
+  }
+
+  bool good() const { return record_size > 0; }
+
+  /** Read the next record.
+   *
+   * \returns false at the end of the log (a partly written last record is ignored).
+   */
+  bool next(pose_log_record_t& record) {
+    if (!record_size || !in.read(reinterpret_cast<char*>(&record), sizeof(pose_log_record_t))) return false;
+    if (!skip.empty() && !in.read(&skip[0], skip.size())) return false; // fields from a newer writer
+    return true;
+  }
+
+protected:
+  std::ifstream in;
+  uint32_t record_size;
+  std::vector<char> skip;
+};
+
 #endif // SERVICE_POSE_LOGGER_H
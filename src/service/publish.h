@@ -33,8 +33,18 @@
 # define PUBLISH_H
 
 #include "service.h"
+#include "message_pool.h"
+#include "wire_format.h"
+#include "shm_ring.h"
+#include "pose_batch.h"
 
+#include <deque>
+#include <set>
+#include <string>
 #include <pcl/point_cloud.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 void cpp_message_free(float* data, void* hint);
 
@@ -54,12 +64,91 @@ void send_shutdown(zmq::socket_t& publisher);
  * \param starting TCP port (publishing port; port+1 will be used for
  * synchronization TCP port)
  * \param number of subscribers to wait for (more are allowed, but
- * this many will be required before publishing begins)
+ * this many will be required before publishing begins), or 0 not to
+ * wait at all, leaving the synchronization socket bound so that
+ * subscribers can join later (see answer_sync_requests())
+ * \param keep only the last message queued for each subscriber
+ * \param transport tcp, ipc, inproc, or shm (see service_endpoint())
  */
-void sync_publish(zmq::socket_t& publisher, zmq::socket_t& sync_service, int port, size_t expected_subscribers = 1, int conflate = 0);
+void sync_publish(zmq::socket_t& publisher, zmq::socket_t& sync_service, int port, size_t expected_subscribers = 1, int conflate = 0,
+                  const std::string& transport = "tcp");
 
 
-/** \brief sends a pose to subscribers
+/** \brief Answer any synchronization requests waiting on a socket left
+ * bound by sync_publish(), without blocking.
+ * \param socket through which to synchronize
+ * \return the number of subscribers answered
+ */
+size_t answer_sync_requests(zmq::socket_t& sync_service);
+
+
+/** \brief Keeps track of what subscribers to a ZMQ_XPUB socket currently want.
+ *
+ * An XPUB socket passes on a subscription message (a 1 to subscribe or a 0 to unsubscribe, then the
+ * prefix) the first time any subscriber subscribes to a prefix, and again once the last one to have
+ * subscribed to it unsubscribes or disconnects, so a set of prefixes is all it takes.
+ */
+class SubscriptionTracker {
+public:
+  /** Apply a subscription message from the socket.
+   *
+   * \returns false if it wasn't one.
+   */
+  bool update(const zmq::message_t& message) {
+    if (message.size() == 0) return false;
+    const char* data = static_cast<const char*>(message.data());
+    std::string prefix(data + 1, message.size() - 1);
+    if      (data[0] == 1) prefixes.insert(prefix);
+    else if (data[0] == 0) prefixes.erase(prefix);
+    else return false;
+    return true;
+  }
+
+  /** Whether anyone is subscribed to messages of a given type (to it, or to everything). */
+  bool wants(char type) const {
+    if (prefixes.empty()) return false;
+    if (prefixes.begin()->empty()) return true; // sorts first
+    std::set<std::string>::const_iterator it = prefixes.lower_bound(std::string(1, type));
+    return it != prefixes.end() && (*it)[0] == type;
+  }
+
+  /** Whether anyone is subscribed to anything. */
+  bool any() const { return !prefixes.empty(); }
+
+private:
+  std::set<std::string> prefixes;
+};
+
+
+/** \brief Read every subscription message waiting on a ZMQ_XPUB socket, without blocking. Only the
+ * thread that publishes on the socket may call this.
+ * \param[in] publisher the XPUB socket
+ * \param[in,out] subscriptions to update
+ * \return whether anything changed
+ */
+bool receive_subscriptions(zmq::socket_t& publisher, SubscriptionTracker& subscriptions);
+
+
+/** \brief Open a socket for subscribers' acknowledgements (see send_acknowledgement()), on port+2.
+ * \param socket (ZMQ_PULL) through which acknowledgements arrive
+ * \param starting TCP port (publishing port)
+ * \param transport tcp, ipc, inproc, or shm (see service_endpoint())
+ */
+void bind_acknowledgements(zmq::socket_t& acknowledgements, int port, const std::string& transport = "tcp");
+
+
+/** \brief receives one acknowledgement
+ *  \param[in] acknowledgements the socket from bind_acknowledgements()
+ *  \param[out] subscriber the id the subscriber chose
+ *  \param[out] frame_id the newest cloud it has received
+ *  \param[in] flags to pass to zmq recv (ZMQ_NOBLOCK unless waiting for one)
+ *  \return RECV_SUCCESS, RECV_NOUPDATE if none was waiting, or RECV_FAILURE for a malformed one
+ */
+recv_result_t receive_acknowledgement(zmq::socket_t& acknowledgements, uint32_t& subscriber, uint64_t& frame_id,
+                                      int flags = ZMQ_NOBLOCK);
+
+
+/** \brief sends a pose to subscribers, as a wire_header_t of type 'p' with no points
   * \param[in] publisher the socket through which the data will be sent
   * \param[in] timestamp the timestamp of the sensor image to which the pose corresponds
   * \param[in] pose the 4x4 matrix that is to be sent
@@ -74,6 +163,16 @@ void send_pose(zmq::socket_t& publisher, const Eigen::Matrix4f& pose, const time
 void send_poses(zmq::socket_t& publisher, const pose_message_t::ptr& poses);
 
 
+/** \brief sends a batch of poses and scores to subscribers, without copying it (any number of poses;
+  *        see PoseBatch)
+  * \param[in] publisher the socket through which the data will be sent
+  * \param[in] poses the batch, which is empty afterwards until reset
+  * \param[in] flags to pass to zmq send
+  * \return whether the batch was queued
+  */
+bool send_pose_batch(zmq::socket_t& publisher, PoseBatch& poses, int flags = 0);
+
+
 /** \brief sends a vector of some type to subscribers
  *  \param[in] publisher
  *  \param[in] values the values that will be published
@@ -101,28 +200,149 @@ void send_vector(zmq::socket_t& publisher, const timestamp_t& timestamp, const t
 }
 
 
-/** \brief sends a disorganized point cloud to subscribers (assumption 
-  * is that both the sender and recipient have the same size PointT)
+/** \brief sends a point cloud laid out in a pooled buffer, without copying it: a wire_header_t at the
+  * start of the buffer is sent as the first message part, and the header's point_count points, starting
+  * sizeof(wire_header_t) bytes in, as the second
+  * \param[in] publisher the socket through which the data will be sent
+  * \param[in] pool the buffer came from
+  * \param[in] buffer from pool.acquire(), with header and points filled in
+  * \param[in] ring if not NULL, the shared memory ring to copy the cloud (header and points together) into
+  *             instead, after which the buffer goes straight back to the pool
+  * \returns whether the message was queued
+  */
+bool send_point_cloud(zmq::socket_t& publisher, MessagePool& pool, char* buffer, ShmRingWriter* ring = NULL);
+
+
+/** \brief encodes a point cloud in a pooled buffer in place, to save bandwidth
+  *
+  * Quantizing stores each coordinate as an int16 step of a per-frame scale from the center of the cloud's
+  * bounding box (so the error is at most half a step, which goes in the header's precision), and the
+  * intensity in 16 or 8 bits. Compressing runs LZF over the result, and is skipped if it doesn't help.
+  * Clouds with normals aren't quantized.
+  *
+  * \param[in,out] buffer a wire_header_t followed by the points, as for send_point_cloud()
+  * \param[in] encoding the wire_flag_t encoding bits to apply (WIRE_QUANTIZED, WIRE_INTENSITY_8, WIRE_COMPRESSED)
+  * \param[in,out] scratch working space, reused between calls
+  * \returns the payload's size in bytes, now
+  */
+size_t encode_point_cloud(char* buffer, uint32_t encoding, std::vector<char>& scratch);
+
+
+/** \brief Encodes point clouds on a worker thread, then publishes them.
+ *
+ * Buffers handed to send() are encoded (see encode_point_cloud()) and sent in order; the pool gets them
+ * back once ZeroMQ is done with them. Without an encoding, send() publishes directly and no thread is
+ * started. Once a publisher is running, only it may send on the socket: flush() it first.
+ */
+class EncodingPublisher {
+public:
+  /** Constructor.
+   *
+   * @param[in] socket to publish on.
+   * @param[in] pool the buffers come from.
+   * @param[in] encoding bits to apply (0 for none).
+   * @param[in] shared memory ring to publish into instead of the socket, if any.
+   */
+  EncodingPublisher(zmq::socket_t& publisher_, MessagePool& pool_, uint32_t encoding_, ShmRingWriter* ring_ = NULL)
+  : publisher(publisher_), pool(pool_), encoding(encoding_ & WIRE_ENCODINGS), ring(ring_), in_progress(0), done(false)
+  {
+    if (encoding) thread = boost::thread(&EncodingPublisher::run, this);
+  }
+
+  /** Sends everything still queued, then stops the thread. */
+  ~EncodingPublisher();
+
+  /** Queue a filled buffer from the pool (see send_point_cloud()) to be encoded and published. */
+  void send(char* buffer);
+
+  /** Block until every queued cloud has been sent. */
+  void flush();
+
+private:
+  void run();
+
+  zmq::socket_t& publisher;
+  MessagePool& pool;
+  uint32_t encoding;
+  ShmRingWriter* ring;
+
+  std::deque<char*> queue;
+  size_t in_progress;
+  bool done;
+
+  boost::mutex mutex;
+  boost::condition_variable queued;
+  boost::condition_variable idle;
+  boost::thread thread;
+};
+
+
+/** \brief sends a disorganized point cloud to subscribers, as a wire_header_t part (type 'c', xyz and
+  * intensity) and a part with the points
   * \param[in] publisher the socket through which the data will be sent
   * \param[in] timestamp
   * \param[in] cloud
   */ 
 template <typename PointT>
 void send_disorganized_point_cloud(zmq::socket_t& publisher, const timestamp_t& timestamp, typename pcl::PointCloud<PointT>::ConstPtr cloud) {
+  wire_header_t header('c');
+  header.width       = cloud->width;
+  header.height      = cloud->height;
+  header.point_count = cloud->width * cloud->height;
+  header.frame_id    = timestamp;
+
+  size_t cloud_size = header.point_count * header.point_stride;
+  float* points = static_cast<float*>(malloc(cloud_size + 1)); // never zero bytes
+  for (size_t i = 0; i < header.point_count; ++i) {
+    points[i*4 + 0] = cloud->points[i].x;
+    points[i*4 + 1] = cloud->points[i].y;
+    points[i*4 + 2] = cloud->points[i].z;
+    points[i*4 + 3] = 0.0f;
+  }
+
+  zmq::message_t header_message(sizeof(wire_header_t));
+  memcpy(header_message.data(), &header, sizeof(wire_header_t));
+  zmq::message_t message(points, cloud_size, c_message_free, NULL);
+  publisher.send(header_message, ZMQ_SNDMORE);
+  publisher.send(message);
+}
+
+
+/** \brief sends a disorganized point cloud to subscribers, using a buffer from a pool instead of
+  * allocating one
+  * \param[in] publisher the socket through which the data will be sent
+  * \param[in] pool of send buffers, each large enough for the header and cloud
+  * \param[in] timestamp
+  * \param[in] cloud
+  * \returns false if every buffer in the pool was still in use (nothing was sent)
+  */ 
+template <typename PointT>
+bool send_disorganized_point_cloud(zmq::socket_t& publisher, MessagePool& pool, const timestamp_t& timestamp, typename pcl::PointCloud<PointT>::ConstPtr cloud) {
+  wire_header_t header('c');
+  header.width       = cloud->width;
+  header.height      = cloud->height;
+  header.point_count = cloud->width * cloud->height;
+  header.frame_id    = timestamp;
 
-  size_t cloud_size = cloud->width * cloud->height * sizeof(PointT);
-  void* send_buffer = malloc(sizeof(timestamp_t) + cloud_size + 1);
-  void* timestamp_buffer = static_cast<void*>(static_cast<char*>(send_buffer) + 1);
-  void* cloud_buffer = static_cast<void*>(static_cast<char*>(send_buffer) + sizeof(timestamp_t) + 1);
+  size_t size = sizeof(wire_header_t) + header.point_count * header.point_stride;
+  if (size > pool.buffer_size()) {
+    std::cerr << "Error: point cloud of " << size << " bytes does not fit in a " << pool.buffer_size() << "-byte publish buffer" << std::endl;
+    return false;
+  }
 
-  const char TYPE = 'c';
+  char* send_buffer = pool.acquire();
+  if (!send_buffer) return false;
 
-  memcpy(send_buffer, &TYPE, sizeof(char));
-  memcpy(timestamp_buffer, &timestamp, sizeof(timestamp_t));
-  memcpy(cloud_buffer, &(cloud->points), cloud_size);
+  memcpy(send_buffer, &header, sizeof(wire_header_t));
+  float* points = reinterpret_cast<float*>(send_buffer + sizeof(wire_header_t));
+  for (size_t i = 0; i < header.point_count; ++i) {
+    points[i*4 + 0] = cloud->points[i].x;
+    points[i*4 + 1] = cloud->points[i].y;
+    points[i*4 + 2] = cloud->points[i].z;
+    points[i*4 + 3] = 0.0f;
+  }
 
-  zmq::message_t message(send_buffer, sizeof(timestamp_t) + sizeof(char) + cloud_size, message_free, NULL);
-  publisher.send(message);
+  return send_point_cloud(publisher, pool, send_buffer);
 }
 
 #endif // PUBLISH_H
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef SERVICE_RENDER_SERVICE_H
+# define SERVICE_RENDER_SERVICE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <zmq.hpp>
+
+#include "service.h"
+#include "wire_format.h"
+#include "message_pool.h"
+#include "subscribe.h"
+
+/*
+ * On-demand rendering (glidar --serve PORT). Clients connect DEALER sockets to the server's ROUTER and
+ * send requests of two parts:
+ *
+ *   render_request_t | poses (pose_count * pose_size doubles)
+ *
+ * Each pose has the layout of a physics pose vector: the model quaternion (w,x,y,z), the sensor-model
+ * translation, and the sensor quaternion; then, if the scene has them, 7 values for each additional object
+ * and an angle for each joint. The server answers each pose separately, in order within a request, with
+ *
+ *   render_reply_t | wire_header_t | points
+ *
+ * the last two as for a published cloud, so they can be read with CloudView. A request the server can't
+ * use gets a single reply with an error status and no cloud, as does a pose whose cloud couldn't be sent
+ * (RENDER_FAILED), and a request with no poses gets a single RENDER_OK reply with no cloud. Clients may keep several requests in flight
+ * and match replies by request_id; the server interleaves poses from every client's requests.
+ */
+
+const uint16_t RENDER_SERVICE_VERSION = 1;
+const size_t   DEFAULT_RENDER_BATCH   = 64; // poses rendered per loop
+
+enum render_status_t {
+  RENDER_OK          = 0,
+  RENDER_BAD_REQUEST = 1, // malformed, or the pose size doesn't fit the scene
+  RENDER_FAILED      = 2  // the cloud couldn't be sent
+};
+
+
+/** \brief First part of a render request. */
+struct render_request_t {
+  char     type;         // 'q'
+  char     magic[3];     // WIRE_MAGIC
+  uint16_t version;
+  uint16_t header_size;  // bytes, for forward compatibility
+  uint32_t pose_count;
+  uint32_t pose_size;    // doubles per pose
+  uint64_t request_id;   // chosen by the client; echoed in every reply
+
+  render_request_t(uint64_t request_id_ = 0, uint32_t pose_count_ = 0, uint32_t pose_size_ = 11)
+  : type('q'), version(RENDER_SERVICE_VERSION), header_size(sizeof(render_request_t)), pose_count(pose_count_),
+    pose_size(pose_size_), request_id(request_id_)
+  {
+    memcpy(magic, WIRE_MAGIC, sizeof(magic));
+  }
+};
+
+/** \brief First part of each reply to a render request. */
+struct render_reply_t {
+  char     type;         // 'r'
+  char     magic[3];
+  uint16_t version;
+  uint16_t status;       // render_status_t
+  uint32_t pose_index;   // which of the request's poses this is
+  uint32_t pose_count;   // how many poses the request had
+  uint64_t request_id;
+
+  render_reply_t(uint64_t request_id_ = 0, uint32_t pose_count_ = 0)
+  : type('r'), version(RENDER_SERVICE_VERSION), status(RENDER_OK), pose_index(0), pose_count(pose_count_),
+    request_id(request_id_)
+  {
+    memcpy(magic, WIRE_MAGIC, sizeof(magic));
+  }
+};
+
+typedef char render_request_size_check[sizeof(render_request_t) == 24 ? 1 : -1];
+typedef char render_reply_size_check[sizeof(render_reply_t) == 24 ? 1 : -1];
+
+
+/** \brief A request as the server holds it until every pose has been answered. */
+struct RenderRequest {
+  std::string client;        // ROUTER identity to reply to
+  render_request_t header;
+  std::vector<double> poses;
+  uint32_t next_pose;        // the next one to render
+};
+
+
+/** \brief binds a render server's ROUTER socket
+ *  \param[in] router the socket
+ *  \param[in] port the port to listen on
+ *  \param[in] transport tcp, ipc, or inproc (see service_endpoint())
+ */
+void bind_render_service(zmq::socket_t& router, int port, const std::string& transport = "tcp");
+
+
+/** \brief receives one request on a render server's ROUTER socket, answering malformed ones itself
+ *  \param[in] router the socket
+ *  \param[out] request the request (next_pose is 0)
+ *  \param[in] flags to pass to zmq recv (mainly only 0 or ZMQ_NOBLOCK)
+ *  \return RECV_SUCCESS, RECV_NOUPDATE if nothing was waiting, or RECV_FAILURE for a bad request
+ */
+recv_result_t receive_render_request(zmq::socket_t& router, RenderRequest& request, int flags = 0);
+
+
+/** \brief replies to one pose of a request with a cloud, without copying it
+ *  \param[in] router the server's socket
+ *  \param[in] pool the buffer came from
+ *  \param[in] request the request
+ *  \param[in] pose_index which pose the cloud is for
+ *  \param[in] buffer from pool.acquire(), with a wire_header_t and points, as for send_point_cloud()
+ *  \return false if none of the reply could be queued (the buffer is back in the pool, and an error can be
+ *          sent in its place); once the reply is started, it's always finished
+ */
+bool send_render_reply(zmq::socket_t& router, MessagePool& pool, const RenderRequest& request, uint32_t pose_index, char* buffer);
+
+
+/** \brief replies to a request (or one of its poses) with a status and no cloud: an error, or RENDER_OK
+ *  for a request with no poses */
+void send_render_error(zmq::socket_t& router, const std::string& client, const render_request_t& request, uint32_t pose_index,
+                       render_status_t status);
+
+
+/** \brief sends a render request from a client's DEALER socket
+ *  \param[in] client the socket, connected to the server
+ *  \param[in] request_id chosen by the client, to match replies with
+ *  \param[in] poses pose_size doubles for each pose
+ *  \param[in] pose_size doubles per pose (11 unless the scene has additional objects or joints)
+ *  \return whether the request was queued
+ */
+bool send_render_request(zmq::socket_t& client, uint64_t request_id, const std::vector<double>& poses, size_t pose_size = 11);
+
+
+/** \brief receives one reply on a client's DEALER socket
+ *  \param[in] client the socket
+ *  \param[out] reply which request and pose the reply answers, and its status
+ *  \param[out] view the cloud, if reply.status is RENDER_OK and the request had poses
+ *  \param[in] flags to pass to zmq recv (mainly only 0 or ZMQ_NOBLOCK)
+ *  \return recv_result_t for the reply
+ */
+recv_result_t receive_render_reply(zmq::socket_t& client, render_reply_t& reply, CloudView& view, int flags = 0);
+
+
+#endif // SERVICE_RENDER_SERVICE_H
@@ -41,6 +41,13 @@ typedef long long long_signed_timestamp_t; // Safer than the above; use for conv
 #include <Eigen/Dense>
 #include <Eigen/StdVector>
 
+enum recv_result_t {
+  RECV_SHUTDOWN,
+  RECV_SUCCESS,
+  RECV_NOUPDATE,
+  RECV_FAILURE
+};
+
 struct pose_output_t {
   typedef float score_t;
 
@@ -73,6 +80,8 @@ struct pose_output_t {
 };
 
 #include <vector>
+#include <string>
+#include <sstream>
 #include <zmq.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -129,10 +138,11 @@ struct pose_message_t {
   }
 
   pose_message_t(const zmq::message_t& msg) {
-    // get the timestamp and size
-    memcpy(static_cast<void*>(this),
-	   static_cast<const void*>(static_cast<const char*>(msg.data()) + 1), // ignore type indicator, so start at +1
-	   sizeof(short_size_t) + sizeof(timestamp_t));
+    // get the timestamp and size (type indicator first, so start at +1), one field at a time so the
+    // wire layout doesn't depend on this struct's
+    const char* bytes = static_cast<const char*>(msg.data()) + 1;
+    memcpy(&timestamp, bytes, sizeof(timestamp_t));
+    memcpy(&size, bytes + sizeof(timestamp_t), sizeof(short_size_t));
 
     data = new pose_output_t[size];
 
@@ -153,10 +163,10 @@ struct pose_message_t {
     // Copy the type indicator
     memcpy(msg->data(), &TYPE, sizeof(char));
 
-    // Copy the size and timestamp
-    memcpy(static_cast<void*>(static_cast<char*>(msg->data()) + 1),
-	   static_cast<void*>(this),
-	   sizeof(short_size_t) + sizeof(timestamp_t));
+    // Copy the timestamp and size
+    char* bytes = static_cast<char*>(msg->data()) + 1;
+    memcpy(bytes, &timestamp, sizeof(timestamp_t));
+    memcpy(bytes + sizeof(timestamp_t), &size, sizeof(short_size_t));
 
     // Figure out the start point for the matrices
     pose_output_t* p = static_cast<pose_output_t*>(static_cast<void*>(static_cast<char*>(msg->data()) + sizeof(char) + sizeof(short_size_t) + sizeof(timestamp_t)));
@@ -225,4 +235,21 @@ bool from_zmq(const zmq::message_t& msg, char& prefix, timestamp_t& timestamp, t
 }
 
 
+/** \brief builds the ZeroMQ endpoint for a port on a transport
+ *  \param[in] transport "tcp"; "ipc", a socket file in /tmp (same host only, and faster); or "inproc" (same
+ *             process only). "shm" clouds travel through a shared memory ring (see shm_ring.h), and their
+ *             sockets use ipc.
+ *  \param[in] port the port (for ipc and inproc, just part of the name)
+ *  \param[in] bind whether the endpoint is for binding (or else for connecting to)
+ *  \return the endpoint, e.g. tcp://localhost:5555
+ */
+inline std::string service_endpoint(const std::string& transport, int port, bool bind) {
+  std::ostringstream endpoint;
+  if (transport == "ipc" || transport == "shm") endpoint << "ipc:///tmp/glidar-" << port;
+  else if (transport == "inproc")               endpoint << "inproc://glidar-" << port;
+  else                                          endpoint << (bind ? "tcp://*:" : "tcp://localhost:") << port;
+  return endpoint.str();
+}
+
+
 #endif // SERVICE_H
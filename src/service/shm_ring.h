@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef SERVICE_SHM_RING_H
+# define SERVICE_SHM_RING_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "service.h"
+
+/*
+ * A ring of message slots in POSIX shared memory, for subscribers on the same host as the publisher: the
+ * publisher can build a message right in its slot (begin_write()/end_write()), and subscribers can read it
+ * there (acquire()), so a cloud needn't be copied at all, let alone through the TCP stack.
+ *
+ * There is one writer. Each slot is guarded by a seqlock, so the writer never waits for readers; a reader
+ * that falls a whole ring behind, or whose slot is overwritten while it reads, skips the message (and
+ * counts it as dropped). Readers sleep on a futex (on Linux; elsewhere they poll) until the writer posts.
+ *
+ * ZeroMQ is still used for synchronization and for the shutdown message; the writer also marks the ring
+ * shut down, for readers that only watch the ring.
+ */
+
+const size_t DEFAULT_SHM_RING_SLOTS = 4;
+const uint32_t SHM_RING_VERSION     = 1;
+
+
+/** \brief the shared memory object name of the ring published alongside a port */
+std::string shm_ring_name(int port);
+
+
+/** \brief Shared layout at the start of the ring. Every slot follows, slot_size bytes apart. */
+struct shm_ring_header_t {
+  char     magic[8];                // "GLIDRNG\0"
+  uint32_t version;
+  uint32_t slot_count;
+  uint64_t slot_size;               // bytes per slot, including its shm_slot_header_t
+  boost::atomic<uint64_t> written;  // messages written so far
+  boost::atomic<uint32_t> posted;   // futex word: bumped whenever there's something new for readers
+  boost::atomic<uint32_t> shutdown; // nonzero once the writer has shut down
+};
+
+/** \brief Start of each slot; the message follows. */
+struct shm_slot_header_t {
+  boost::atomic<uint64_t> sequence; // 2n+1 while message n is being written, 2n+2 once it's written
+  uint64_t size;                    // bytes in the message
+};
+
+
+/** \brief Writes messages into a new ring (replacing any left over with the same name). */
+class ShmRingWriter {
+public:
+  /** \brief creates the ring
+   *  \param[in] name shared memory object name (see shm_ring_name())
+   *  \param[in] slots messages the ring holds (at least 2)
+   *  \param[in] capacity largest message, in bytes
+   */
+  ShmRingWriter(const std::string& name, size_t slots, size_t capacity);
+
+  /** \brief marks the ring shut down and removes its name (readers keep their mappings) */
+  ~ShmRingWriter();
+
+  /** \brief copies a message into the next slot and wakes readers
+   *  \return false if the message is larger than the slots
+   */
+  bool write(const char* data, size_t size);
+
+  /** \brief starts the next message in place; readers skip its slot until end_write()
+   *  \return where to put the message (capacity() bytes)
+   */
+  char* begin_write();
+
+  /** \brief finishes the message from begin_write() and wakes readers
+   *  \param[in] size bytes in the message (at most capacity())
+   */
+  void end_write(size_t size);
+
+  /** \brief tells readers nothing more is coming */
+  void shutdown();
+
+  size_t capacity() const { return slot_size - SLOT_HEADER_SIZE; }
+
+  static const size_t SLOT_HEADER_SIZE = 64; // keeps each message cache-line aligned
+
+private:
+  std::string name;
+  boost::interprocess::shared_memory_object memory;
+  boost::interprocess::mapped_region region;
+  shm_ring_header_t* header;
+  size_t slot_size;
+};
+
+
+/** \brief Reads messages from a ring. Any number of readers may share one. */
+class ShmRingReader {
+public:
+  /** \brief opens the ring; reading starts with the next message written
+   *  \param[in] name shared memory object name (see shm_ring_name())
+   *  \throws boost::interprocess::interprocess_exception if there's no such ring
+   */
+  ShmRingReader(const std::string& name);
+
+  /** \brief finds the next message, to be read where it is in the ring
+   *
+   * The writer may start overwriting the message once it laps this reader, so check valid() after reading
+   * it, and throw away whatever was made from it if that fails.
+   *
+   *  \param[out] data the message
+   *  \param[out] size bytes in the message
+   *  \param[in] timeout_ms how long to wait for one (negative to wait indefinitely)
+   *  \param[in] latest whether to skip to the newest message, dropping any older ones not yet read
+   *  \return RECV_SUCCESS, RECV_NOUPDATE on timeout, RECV_SHUTDOWN once the writer has shut down, or
+   *          RECV_FAILURE if the ring is unusable
+   */
+  recv_result_t acquire(const char*& data, size_t& size, int timeout_ms = -1, bool latest = false);
+
+  /** \brief whether the message from acquire() is still intact; if the writer has started overwriting it,
+   *         it counts as dropped
+   */
+  bool valid();
+
+  /** \brief copies out the next message (see acquire())
+   *  \param[out] message the message, resized to fit
+   */
+  recv_result_t read(std::vector<char>& message, int timeout_ms = -1, bool latest = false);
+
+  /** \brief messages skipped because the writer overtook this reader */
+  size_t dropped() const { return drops; }
+
+private:
+  boost::interprocess::shared_memory_object memory;
+  boost::interprocess::mapped_region region;
+  shm_ring_header_t* header;
+  uint64_t next;
+  size_t drops;
+
+  const shm_slot_header_t* held; // slot of the message from acquire(), if any
+  uint64_t held_sequence;
+};
+
+
+#endif // SERVICE_SHM_RING_H
@@ -33,18 +33,18 @@
 # define SUBSCRIBE_H
 
 #include "service.h"
+#include "wire_format.h"
+#include "shm_ring.h"
+#include "pose_batch.h"
 
 #include <zmq.hpp>
 #include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/point_traits.h>
+#include <boost/type_traits/integral_constant.hpp>
 
 #include <cstdio> // strncmp
-
-enum recv_result_t {
-  RECV_SHUTDOWN,
-  RECV_SUCCESS,
-  RECV_NOUPDATE,
-  RECV_FAILURE
-};
+#include <stdint.h>
 
 /** \brief Open a subscription socket which makes the publisher wait
   * for synchronization before sending.
@@ -54,8 +54,27 @@ enum recv_result_t {
   * synchronization TCP port)
   * \param[in] highwater mark for receiving (drop after this many in queue)
   * \param[in] type of messages to receive (p for pose, c for cloud)
+  * \param[in] transport tcp, ipc, inproc, or shm (see service_endpoint())
   */
-void sync_subscribe(zmq::socket_t& subscriber, zmq::socket_t& sync_client, int port, int highwater, char type);
+void sync_subscribe(zmq::socket_t& subscriber, zmq::socket_t& sync_client, int port, int highwater, char type,
+                    const std::string& transport = "tcp");
+
+
+/** \brief Connect a socket for acknowledging clouds to a publisher (port+2), so that it can tell when
+  * this subscriber falls behind (see --backpressure).
+  * \param[in] socket (ZMQ_PUSH) through which to acknowledge
+  * \param[in] starting TCP port (the publisher's)
+  * \param[in] transport tcp, ipc, inproc, or shm (see service_endpoint())
+  */
+void connect_acknowledgements(zmq::socket_t& acknowledgements, int port, const std::string& transport = "tcp");
+
+
+/** \brief acknowledges a cloud; never blocks (the acknowledgement is dropped if it can't be queued)
+  * \param[in] acknowledgements the socket from connect_acknowledgements()
+  * \param[in] subscriber an id for this subscriber, unique among the publisher's subscribers
+  * \param[in] header the header of the newest cloud received
+  */
+void send_acknowledgement(zmq::socket_t& acknowledgements, uint32_t subscriber, const wire_header_t& header);
 
 
 /** \brief Open a subscription socket which doesn't make the publisher
@@ -65,8 +84,9 @@ void sync_subscribe(zmq::socket_t& subscriber, zmq::socket_t& sync_client, int p
  * \param[in] starting TCP port (subscription port; port+1 will be used for
  * synchronization TCP port)
  * \param[in] highwater mark for receiving (drop after this many in queue)
+ * \param[in] transport tcp, ipc, or inproc (see service_endpoint())
  */
-void subscribe(zmq::socket_t& subscriber, int port, int highwater);
+void subscribe(zmq::socket_t& subscriber, int port, int highwater, const std::string& transport = "tcp");
 
 
 bool received_shutdown(zmq::message_t& msg);
@@ -91,55 +111,289 @@ recv_result_t receive_pose(zmq::socket_t& subscriber, Eigen::Matrix4f& pose, tim
 recv_result_t receive_poses(zmq::socket_t& subscriber, pose_message_t::ptr& poses, int flags = 0);
 
 
+/** \brief receives a batch of poses and scores from a publisher (see send_pose_batch), to be read in place
+ *  \param[in] subscriber the socket through which the data will be received
+ *  \param[out] poses the batch received, which holds on to the message until the next one
+ *  \param[in] flags to pass to zmq recv (mainly only 0 or ZMQ_NOBLOCK)
+ *  \return recv_result_t indicating whether a new batch was received or a shutdown signal
+ */
+recv_result_t receive_pose_batch(zmq::socket_t& subscriber, PoseBatchView& poses, int flags = 0);
+
+
+/** \brief receives a point cloud message: its wire_header_t, then the part holding the points
+ *  \param[in] subscriber the socket through which the data will be received
+ *  \param[out] header the message header
+ *  \param[out] payload the points (header.point_count of them, header.point_stride bytes apart), to be
+ *               read in place
+ *  \param[in] flags to pass to zmq recv (mainly only 0 or ZMQ_NOBLOCK)
+ *  \return recv_result_t indicating whether a new point cloud was received or a shutdown signal
+ */
+recv_result_t receive_cloud_message(zmq::socket_t& subscriber, wire_header_t& header, zmq::message_t& payload, int flags = 0);
+
+
+/** \brief decodes a quantized and/or compressed point cloud (see encode_point_cloud())
+ *  \param[in,out] header the message header, which is changed to describe the decoded points (32-bit
+ *                  fields, no encoding flags; origin, scale, and precision are kept)
+ *  \param[in] payload the points as received
+ *  \param[in] size of payload in bytes
+ *  \param[in,out] scratch working space, reused between calls
+ *  \param[out] points the decoded points
+ *  \return false if the payload couldn't be decoded
+ */
+bool decode_point_cloud(wire_header_t& header, const char* payload, size_t size, std::vector<char>& scratch, std::vector<float>& points);
+
+
+/** \brief A received point cloud, read in place.
+ *
+ * The view owns the message the points arrived in, so nothing is copied or allocated per point: accessors
+ * read straight from the message (respecting its point stride), and xyz() and intensities() wrap it in
+ * Eigen maps. A PCL cloud owns its storage, so to_point_cloud() has to copy, but it does so in one pass
+ * (or one memcpy when PointT's layout matches the message's), and keeps the intensity if PointT has one.
+ *
+ * Clouds sent quantized or compressed are decoded into a buffer the view keeps (and reuses), so they
+ * read the same way; header().precision says how much error the encoding allowed.
+ *
+ * Clouds from a shared memory ring aren't copied out of it either, so the publisher can overwrite them;
+ * see valid().
+ *
+ * Receiving into the same view again reuses it; references into the previous cloud are then invalid.
+ */
+class CloudView {
+public:
+  typedef Eigen::Map<const Eigen::Matrix3Xf, 0, Eigen::OuterStride<> >       xyz_map_t;
+  typedef Eigen::Map<const Eigen::RowVectorXf, 0, Eigen::InnerStride<> >    intensity_map_t;
+
+  CloudView() : points(NULL), ring(NULL) { header_.point_count = 0; }
+
+  /** \brief receives the next cloud into the view
+   *  \param[in] subscriber the socket through which the data will be received
+   *  \param[in] flags to pass to zmq recv (mainly only 0 or ZMQ_NOBLOCK)
+   *  \return recv_result_t indicating whether a new point cloud was received or a shutdown signal
+   */
+  recv_result_t receive(zmq::socket_t& subscriber, int flags = 0) {
+    ring = NULL;
+    recv_result_t result = receive_cloud_message(subscriber, header_, payload, flags);
+    return use_payload(result, static_cast<const char*>(payload.data()), payload.size());
+  }
+
+  /** \brief receives the next cloud from a shared memory ring into the view, to be read in place in the
+   *         ring (see ShmRingReader; encoded clouds are decoded out of it)
+   *
+   * The publisher may overwrite the cloud once it laps this subscriber, so check valid() after using it.
+   *
+   *  \param[in] ring the ring the publisher writes clouds into
+   *  \param[in] timeout_ms how long to wait for a cloud (negative to wait indefinitely)
+   *  \param[in] latest whether to skip to the newest cloud in the ring
+   *  \return recv_result_t indicating whether a new point cloud was received or the ring was shut down
+   */
+  recv_result_t receive(ShmRingReader& ring_, int timeout_ms = -1, bool latest = false) {
+    while (true) {
+      const char* data;
+      size_t size;
+      recv_result_t result = ring_.acquire(data, size, timeout_ms, latest);
+      if (result != RECV_SUCCESS) {
+        ring = NULL;
+        return use_payload(result, NULL, 0);
+      }
+
+      if (!parse_wire_header(data, size, header_)) result = RECV_FAILURE;
+      else if (size < header_.header_size + header_.payload_size()) result = RECV_FAILURE;
+      result = result == RECV_SUCCESS ? use_payload(result, data + header_.header_size, size - header_.header_size)
+                                      : use_payload(result, NULL, 0);
+
+      // Whatever came out of a slot the publisher has since started on is garbage; go on to the next cloud.
+      if (!ring_.valid()) continue;
+      if (result == RECV_FAILURE) std::cerr << "Error: malformed cloud in shared memory ring" << std::endl;
+
+      ring = result == RECV_SUCCESS && !(header_.flags & WIRE_ENCODINGS) ? &ring_ : NULL;
+      return result;
+    }
+  }
+
+  /** \brief whether the cloud is still intact; only a cloud read in place from a shared memory ring can
+   *         stop being, if the publisher laps this subscriber. Check after using the cloud, and throw away
+   *         whatever was made from it if this fails.
+   */
+  bool valid() { return !ring || ring->valid(); }
+
+  /** \brief receives every cloud that's waiting, keeping only the last (blocks if there are none)
+   *  \param[in] subscriber the socket through which the data will be received
+   *  \return recv_result_t for the last message received
+   */
+  recv_result_t receive_most_recent(zmq::socket_t& subscriber) {
+    recv_result_t result = receive(subscriber);
+
+    int events = 0;
+    size_t events_size = sizeof(int);
+    subscriber.getsockopt(ZMQ_EVENTS, static_cast<void*>(&events), &events_size);
+    while (result != RECV_SHUTDOWN && (events & ZMQ_POLLIN)) {
+      result = receive(subscriber);
+      subscriber.getsockopt(ZMQ_EVENTS, static_cast<void*>(&events), &events_size);
+    }
+
+    return result;
+  }
+
+  const wire_header_t& header() const { return header_; }
+  size_t size() const                 { return header_.point_count; }
+  bool empty() const                  { return header_.point_count == 0; }
+  timestamp_t timestamp() const       { return header_.frame_id; }
+  bool organized() const              { return (header_.flags & WIRE_ORGANIZED) != 0; }
+  bool has(wire_field_t field) const  { return header_.has(field); }
+
+  /** Pointer to point i's x, y, and z. */
+  const float* xyz(size_t i) const    { return field(i, WIRE_XYZ); }
+  float x(size_t i) const             { return xyz(i)[0]; }
+  float y(size_t i) const             { return xyz(i)[1]; }
+  float z(size_t i) const             { return xyz(i)[2]; }
+
+  /** Point i's intensity, or 0 if the cloud has none. */
+  float intensity(size_t i) const     { return has(WIRE_INTENSITY) ? *field(i, WIRE_INTENSITY) : 0.0f; }
+
+  /** Point i's pixel index (row times width plus column), if the cloud has them. */
+  uint32_t index(size_t i) const {
+    uint32_t value;
+    memcpy(&value, field(i, WIRE_INDEX), sizeof(uint32_t));
+    return value;
+  }
+
+  /** A 3xN matrix of the points' coordinates, mapped onto the message. */
+  xyz_map_t xyz() const {
+    return xyz_map_t(reinterpret_cast<const float*>(points), 3, size(), Eigen::OuterStride<>(header_.point_stride / sizeof(float)));
+  }
+
+  /** A 1xN vector of the intensities, mapped onto the message (the cloud must have them). */
+  intensity_map_t intensities() const {
+    return intensity_map_t(field(0, WIRE_INTENSITY), size(), Eigen::InnerStride<>(header_.point_stride / sizeof(float)));
+  }
+
+  /** \brief copies the points into a PCL cloud, keeping the sensor image's shape if the cloud is organized
+   *  \param[out] cloud which will be resized to fit
+   */
+  template <typename PointT>
+  void to_point_cloud(pcl::PointCloud<PointT>& cloud) const {
+    typedef boost::integral_constant<bool, pcl::traits::has_field<PointT, pcl::fields::intensity>::value> has_intensity;
+
+    if (organized()) {
+      cloud.width    = header_.width;
+      cloud.height   = header_.height;
+      cloud.is_dense = false;
+    } else {
+      cloud.width    = size();
+      cloud.height   = 1;
+    }
+    cloud.points.resize(size());
+    if (empty()) return;
+
+    // pcl::PointXYZ is x, y, z, and a fourth float, the same size as an xyz-intensity point, so it can be
+    // copied whole; but PCL takes that fourth float as the homogeneous coordinate, so it has to be reset to
+    // 1 rather than left holding the intensity.
+    if (sizeof(PointT) == header_.point_stride && header_.offset(WIRE_XYZ) == 0 && !has_intensity::value) {
+      memcpy(&(cloud.points[0]), points, size() * sizeof(PointT));
+      for (size_t i = 0; i < size(); ++i)
+        cloud.points[i].data[3] = 1.0f;
+      return;
+    }
+
+    for (size_t i = 0; i < size(); ++i) {
+      const float* p = xyz(i);
+      cloud.points[i].x = p[0];
+      cloud.points[i].y = p[1];
+      cloud.points[i].z = p[2];
+      set_intensity(cloud.points[i], i, has_intensity());
+    }
+  }
+
+private:
+  /** Points the view at a received payload, decoding it if need be. */
+  recv_result_t use_payload(recv_result_t result, const char* data, size_t size) {
+    if (result == RECV_SUCCESS && (header_.flags & WIRE_ENCODINGS)) {
+      if (decode_point_cloud(header_, data, size, scratch, decoded))
+        points = reinterpret_cast<const char*>(&decoded[0]);
+      else
+        result = RECV_FAILURE;
+    } else if (result == RECV_SUCCESS) {
+      points = data;
+    }
+
+    if (result != RECV_SUCCESS) {
+      points = NULL;
+      header_.point_count = 0;
+    }
+    return result;
+  }
+
+  const float* field(size_t i, wire_field_t f) const {
+    return reinterpret_cast<const float*>(points + i * header_.point_stride) + header_.offset(f);
+  }
+
+  template <typename PointT>
+  void set_intensity(PointT& point, size_t i, boost::true_type) const { point.intensity = intensity(i); }
+  template <typename PointT>
+  void set_intensity(PointT&, size_t, boost::false_type) const { }
+
+  wire_header_t header_;
+  zmq::message_t payload;
+  const char* points;
+  ShmRingReader* ring;        // if the points are in a shared memory ring
+
+  std::vector<char>  scratch; // for decoding encoded clouds
+  std::vector<float> decoded;
+};
+
+
 /** \brief receives a point cloud from a publisher
  *  \param[in] subscriber the socket through which the data will be received
- *  \param[out] cloud the point cloud that is received
+ *  \param[out] cloud the point cloud that is received (flattened, even if it was sent organized)
  *  \param[out] timestamp at which the point cloud was generated
  *  \param[in] flags to pass to zmq recv (mainly only 0 or ZMQ_NOBLOCK)
  *  \return recv_result_t indicating whether a new point cloud was received or a shutdown signal
  */ 
 template <typename PointT>
 recv_result_t receive_disorganized_point_cloud(zmq::socket_t& subscriber, typename pcl::PointCloud<PointT>::Ptr& cloud, timestamp_t& timestamp, int flags = 0) {
-  
-  zmq::message_t message;
-  bool result = subscriber.recv(&message, flags);
+  CloudView view;
+  recv_result_t result = view.receive(subscriber, flags);
+  if (result != RECV_SUCCESS) return result;
 
-  // If ZMQ_NOBLOCK is passed in as a flag, we don't actually need to receive any result
-  // to report success. The only time we report failure is if a shutdown message is
-  // received.
-  if ((flags & ZMQ_NOBLOCK) && !result)
-    return RECV_NOUPDATE;
-  else if (!result)
-    return RECV_FAILURE;
+  timestamp = view.timestamp();
+  std::cerr << "Received a point cloud of size " << view.size() << " points" << std::endl;
 
-  float* data = NULL;
+  cloud.reset(new pcl::PointCloud<PointT>);
+  view.to_point_cloud(*cloud);
+  cloud->width  = view.size();
+  cloud->height = 1;
 
-  if (received_shutdown(message)) {
-    return RECV_SHUTDOWN;
+  return RECV_SUCCESS;
+}
 
-  } else {
-    size_t size = (message.size() - sizeof(timestamp_t) - sizeof(char)) / (4*sizeof(float));
-    void* timestamp_pos = static_cast<void*>(static_cast<char*>(message.data()) + 1);
 
-    // Get the timestamp
-    memcpy(&timestamp, timestamp_pos, sizeof(timestamp_t));
+/** \brief receives an organized point cloud (message type 'o') from a publisher
+ *
+ * The cloud keeps the sensor image's rows and columns (top row first), with NaN coordinates for pixels
+ * that had no return, so neighbors can be found without a k-D tree.
+ *
+ *  \param[in] subscriber the socket through which the data will be received
+ *  \param[out] cloud the point cloud that is received
+ *  \param[out] timestamp at which the point cloud was generated
+ *  \param[in] flags to pass to zmq recv (mainly only 0 or ZMQ_NOBLOCK)
+ *  \return recv_result_t indicating whether a new point cloud was received or a shutdown signal
+ */ 
+template <typename PointT>
+recv_result_t receive_organized_point_cloud(zmq::socket_t& subscriber, typename pcl::PointCloud<PointT>::Ptr& cloud, timestamp_t& timestamp, int flags = 0) {
+  CloudView view;
+  recv_result_t result = view.receive(subscriber, flags);
+  if (result != RECV_SUCCESS) return result;
 
-    data = static_cast<float*>(static_cast<void*>(static_cast<char*>(message.data()) + sizeof(timestamp_t) + sizeof(char)));
+  if (!view.organized()) {
+    std::cerr << "Received a point cloud of type '" << view.header().type << "', which isn't organized" << std::endl;
+    return RECV_FAILURE;
+  }
 
-    std::cerr << "Received a point cloud of size " << size << " points" << std::endl;
-    // allocate the cloud with the correct size right off the bat.
-    cloud.reset(new pcl::PointCloud<PointT>(size, 1));
+  timestamp = view.timestamp();
+  cloud.reset(new pcl::PointCloud<PointT>);
+  view.to_point_cloud(*cloud);
 
-    for (size_t i = 0; i < size; ++i) {
-      cloud->points[i].x = data[i*4 + 0];
-      cloud->points[i].y = data[i*4 + 1];
-      cloud->points[i].z = data[i*4 + 2];
-      //cloud.points[i].intensity = data[i*4 + 3];     
-    }
-    //memcpy(&(cloud->points), static_cast<float*>(message.data()), message.size());
-    
-    return RECV_SUCCESS;
-  }
+  return RECV_SUCCESS;
 }
 
 
@@ -150,45 +404,21 @@ recv_result_t receive_disorganized_point_cloud(zmq::socket_t& subscriber, typena
  */ 
 template <typename PointT>
 bool receive_most_recent_disorganized_point_cloud(zmq::socket_t& subscriber, typename pcl::PointCloud<PointT>::Ptr& cloud, timestamp_t& timestamp) {
-  
-  zmq::message_t message;
-  int events = 0;
-  size_t events_size = sizeof(int);
-  subscriber.recv(&message);
-  subscriber.getsockopt(ZMQ_EVENTS, static_cast<void*>(&events), &events_size);
-  while (events & ZMQ_POLLIN) {
-    subscriber.recv(&message);
-    subscriber.getsockopt(ZMQ_EVENTS, static_cast<void*>(&events), &events_size);
-  }
-  float* data = NULL;
-
-  if (received_shutdown(message)) {
-    return false;
+  CloudView view;
+  recv_result_t result = view.receive_most_recent(subscriber);
 
-  } else {
-    size_t size = (message.size() - sizeof(timestamp_t) - sizeof(char)) / (4*sizeof(float));
-    void* timestamp_pos = static_cast<void*>(static_cast<char*>(message.data()) + 1);
-
-    // Get the timestamp
-    memcpy(&timestamp, timestamp_pos, sizeof(timestamp_t));
-
-    data = static_cast<float*>(static_cast<void*>(static_cast<char*>(message.data()) + sizeof(timestamp_t) + sizeof(char)));
+  if (result == RECV_SHUTDOWN) return false;
+  if (result != RECV_SUCCESS)  return true; // nothing usable this time, but carry on
 
-    std::cerr << "Received a point cloud of size " << size << " points" << std::endl;
-    // allocate the cloud with the correct size right off the bat.
-    cloud.reset(new pcl::PointCloud<PointT>(size, 1));
+  timestamp = view.timestamp();
+  std::cerr << "Received a point cloud of size " << view.size() << " points" << std::endl;
 
-    for (size_t i = 0; i < size; ++i) {
-      cloud->points[i].x = data[i*4 + 0];
-      cloud->points[i].y = data[i*4 + 1];
-      cloud->points[i].z = data[i*4 + 2];
-      //cloud.points[i].intensity = data[i*4 + 3];     
-    }
-    //memcpy(&(cloud->points), static_cast<float*>(message.data()), message.size());
-    
-    return true;
+  cloud.reset(new pcl::PointCloud<PointT>);
+  view.to_point_cloud(*cloud);
+  cloud->width  = view.size();
+  cloud->height = 1;
 
-  }
+  return true;
 }
 
 
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef SERVICE_WIRE_FORMAT_H
+# define SERVICE_WIRE_FORMAT_H
+
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+#include <zmq.hpp>
+
+/*
+ * Point cloud and pose messages start with a fixed header, wire_header_t. Its first byte is the message
+ * type ('c', 'i', 'o', 'p'), so subscribers can keep filtering by prefix; the points, if any, follow in a
+ * second message part, which the receiver can use in place.
+ *
+ * A newer sender may append fields to the header (bumping the version and header_size); older readers
+ * skip them. Anything that changes how the payload must be read gets a new field or flag bit instead,
+ * which older readers refuse rather than misread.
+ */
+const char     WIRE_MAGIC[3]    = {'G','L','D'};
+const uint16_t WIRE_VERSION     = 4;
+const uint16_t WIRE_HEADER_V1_SIZE = 176; // version 1 headers end after the pose
+const uint16_t WIRE_BYTE_ORDER  = 0x0102; // reads as 0x0201 if the sender's byte order differs
+
+/** Which fields each point has, in this order. All are 32 bits, unless the cloud is quantized. */
+enum wire_field_t {
+  WIRE_XYZ       = 1,  // three floats
+  WIRE_INTENSITY = 2,  // one float
+  WIRE_NORMAL    = 4,  // three floats
+  WIRE_INDEX     = 8   // uint32 pixel index (row times width plus column)
+};
+
+/** Header flags. */
+enum wire_flag_t {
+  WIRE_ORGANIZED   = 1,  // point_count is width*height, top row first, NaN where there's no return
+  WIRE_QUANTIZED   = 2,  // x, y, z are int16 steps of scale from origin (-32768 for no return), intensity
+                         // is a uint16 in 1/65536ths, and the index is unchanged; points are packed
+  WIRE_INTENSITY_8 = 4,  // with WIRE_QUANTIZED, intensity is a uint8 in 1/256ths instead
+  WIRE_COMPRESSED  = 8   // the payload is LZF-compressed, encoded_size bytes; point_count*point_stride once
+                         // decompressed
+};
+
+const uint16_t WIRE_KNOWN_FIELDS = WIRE_XYZ | WIRE_INTENSITY | WIRE_NORMAL | WIRE_INDEX;
+const uint32_t WIRE_KNOWN_FLAGS  = WIRE_ORGANIZED | WIRE_QUANTIZED | WIRE_INTENSITY_8 | WIRE_COMPRESSED;
+const uint32_t WIRE_ENCODINGS    = WIRE_QUANTIZED | WIRE_INTENSITY_8 | WIRE_COMPRESSED;
+
+
+/** Fixed header of a cloud or pose message. Every field is naturally aligned, so the layout is the same
+ *  on every compiler; it's sent in the sender's byte order, which byte_order records.
+ */
+struct wire_header_t {
+  char     type;
+  char     magic[3];
+  uint16_t version;
+  uint16_t header_size;  // bytes, for forward compatibility
+  uint16_t fields;       // wire_field_t bits
+  uint16_t byte_order;
+  uint32_t point_stride; // bytes per point
+  uint32_t width, height; // sensor image size (for every layout, so pixel indices can be decoded)
+  uint32_t point_count;
+  uint32_t flags;        // wire_flag_t bits
+  uint64_t frame_id;     // the timestamp
+  float    near_plane, far_plane;
+  double   pose[16];     // model-view matrix without scaling, column-major; identity if not known
+
+  // Version 2: stream encoding (see wire_flag_t).
+  float    origin[3];    // quantized coordinates are origin + q * scale
+  float    scale[3];
+  float    precision;    // largest coordinate error the encoding introduced (0 if lossless)
+  uint32_t encoded_size; // payload bytes as sent, when compressed
+
+  // Version 3: capture timing.
+  uint64_t acquisition_time; // nanoseconds on the sender's monotonic clock when the frame was rendered; 0 if
+                             // not known
+  uint64_t capture_period;   // nanoseconds between scheduled captures; 0 if not scheduled
+
+  // Version 4: load shedding, when subscribers fall behind (see --backpressure).
+  uint32_t frames_skipped;     // frames not rendered since the previous one sent, to let subscribers catch up
+  uint16_t resolution_divisor; // rendered at 1/resolution_divisor of the sensor's width and height (which
+                               // width and height above already reflect); 1 at full resolution
+  uint16_t reserved;
+  uint32_t queued_frames;      // clouds still queued for subscribers when this one was sent
+  uint32_t unacknowledged;     // clouds sent that the slowest acknowledging subscriber hadn't acknowledged
+
+  wire_header_t(char type_ = 'c', uint16_t fields_ = WIRE_XYZ | WIRE_INTENSITY)
+  : type(type_), version(WIRE_VERSION), header_size(sizeof(wire_header_t)), fields(fields_),
+    byte_order(WIRE_BYTE_ORDER), point_stride(wire_point_stride(fields_)), width(0), height(0), point_count(0),
+    flags(0), frame_id(0), near_plane(0.0f), far_plane(0.0f), precision(0.0f), encoded_size(0),
+    acquisition_time(0), capture_period(0), frames_skipped(0), resolution_divisor(1), reserved(0), queued_frames(0),
+    unacknowledged(0)
+  {
+    memcpy(magic, WIRE_MAGIC, sizeof(magic));
+    for (size_t i = 0; i < 16; ++i)
+      pose[i] = i % 5 == 0 ? 1.0 : 0.0;
+    for (size_t i = 0; i < 3; ++i) {
+      origin[i] = 0.0f;
+      scale[i]  = 1.0f;
+    }
+  }
+
+  bool has(wire_field_t field) const { return (fields & field) != 0; }
+
+  /** Bytes per point for a set of fields. */
+  static uint32_t wire_point_stride(uint16_t fields) {
+    return sizeof(float) * (((fields & WIRE_XYZ) ? 3 : 0) + ((fields & WIRE_INTENSITY) ? 1 : 0) +
+                            ((fields & WIRE_NORMAL) ? 3 : 0) + ((fields & WIRE_INDEX) ? 1 : 0));
+  }
+
+  /** Bytes of payload as sent. */
+  size_t payload_size() const {
+    return (flags & WIRE_COMPRESSED) ? encoded_size : static_cast<size_t>(point_count) * point_stride;
+  }
+
+  /** Bytes per point for a set of fields, quantized. */
+  static uint32_t quantized_point_stride(uint16_t fields, bool intensity_8) {
+    return ((fields & WIRE_XYZ) ? 3*sizeof(int16_t) : 0) + ((fields & WIRE_INTENSITY) ? (intensity_8 ? 1 : 2) : 0) +
+           ((fields & WIRE_INDEX) ? sizeof(uint32_t) : 0);
+  }
+
+  /** Offset of a field within each point, in floats (unquantized). */
+  size_t offset(wire_field_t field) const {
+    size_t o = 0;
+    for (uint16_t f = WIRE_XYZ; f < field; f <<= 1)
+      if (fields & f) o += f == WIRE_XYZ || f == WIRE_NORMAL ? 3 : 1;
+    return o;
+  }
+};
+
+// Catch accidental padding: the header is 240 bytes everywhere (a multiple of 16, so points after it in a
+// buffer stay aligned).
+typedef char wire_header_size_check[sizeof(wire_header_t) == 240 ? 1 : -1];
+
+
+/** \brief reads and checks a message header
+ *  \param[in] bytes the message (or its first part)
+ *  \param[in] size of the message in bytes
+ *  \param[out] header the header (fields a newer sender appended are ignored)
+ *  \return false if the message doesn't start with a usable header
+ */
+inline bool parse_wire_header(const char* bytes, size_t size, wire_header_t& header) {
+  if (size < WIRE_HEADER_V1_SIZE || memcmp(bytes + 1, WIRE_MAGIC, sizeof(WIRE_MAGIC)) != 0) {
+    std::cerr << "Error: message of size " << size << " has no wire header (is the publisher older than the subscriber?)" << std::endl;
+    return false;
+  }
+
+  uint16_t header_size;
+  memcpy(&header_size, bytes + offsetof(wire_header_t, header_size), sizeof(uint16_t));
+  if (size < header_size) header_size = 0; // caught below
+
+  // Older senders' headers are shorter; what they lack keeps its default.
+  header = wire_header_t();
+  memcpy(&header, bytes, std::min<size_t>(header_size, sizeof(wire_header_t)));
+  if (header.byte_order != WIRE_BYTE_ORDER) {
+    std::cerr << "Error: message was sent with a different byte order" << std::endl;
+    return false;
+  } else if (header.version < 1 || header_size < WIRE_HEADER_V1_SIZE) {
+    std::cerr << "Error: bad wire header (version " << header.version << ", size " << header.header_size << ")" << std::endl;
+    return false;
+  } else if ((header.fields & ~WIRE_KNOWN_FIELDS) || (header.flags & ~WIRE_KNOWN_FLAGS)) {
+    std::cerr << "Error: message uses a version " << header.version << " feature this subscriber doesn't support" << std::endl;
+    return false;
+  } else if (header.point_stride < ((header.flags & WIRE_QUANTIZED)
+                                    ? wire_header_t::quantized_point_stride(header.fields, header.flags & WIRE_INTENSITY_8)
+                                    : wire_header_t::wire_point_stride(header.fields))) {
+    std::cerr << "Error: wire header's point stride is too small for its fields" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+/** \brief reads and checks the header of a message's first part (see above) */
+inline bool parse_wire_header(const zmq::message_t& msg, wire_header_t& header) {
+  return parse_wire_header(static_cast<const char*>(msg.data()), msg.size(), header);
+}
+
+
+#endif // SERVICE_WIRE_FORMAT_H
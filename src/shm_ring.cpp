@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <climits>
+#include <new>
+#include <algorithm>
+#include <boost/thread/thread.hpp>
+
+#ifdef __linux__
+# include <unistd.h>
+# include <sys/syscall.h>
+# include <linux/futex.h>
+# include <time.h>
+#endif
+
+#include "service/shm_ring.h"
+
+namespace bip = boost::interprocess;
+
+static const char SHM_RING_MAGIC[8] = {'G','L','I','D','R','N','G','\0'};
+
+// The futex word has to be a plain 32-bit integer, and the ring header has to fit before the first slot.
+typedef char shm_ring_futex_check[sizeof(boost::atomic<uint32_t>) == sizeof(uint32_t) ? 1 : -1];
+typedef char shm_ring_header_check[sizeof(shm_ring_header_t) <= ShmRingWriter::SLOT_HEADER_SIZE ? 1 : -1];
+
+
+/** Wakes every reader waiting on the ring. */
+static void wake_readers(boost::atomic<uint32_t>& posted) {
+  ++posted;
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&posted), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+
+/** Waits until posted changes from value, or for timeout_ms (negative: indefinitely). Might return early. */
+static void wait_for_post(boost::atomic<uint32_t>& posted, uint32_t value, int timeout_ms) {
+#ifdef __linux__
+  timespec timeout;
+  timeout.tv_sec  = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&posted), FUTEX_WAIT, value, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+#else
+  // No futexes; poll.
+  boost::this_thread::sleep(boost::posix_time::milliseconds(timeout_ms < 0 || timeout_ms > 1 ? 1 : timeout_ms));
+#endif
+}
+
+
+std::string shm_ring_name(int port) {
+  std::ostringstream name;
+  name << "glidar-" << port;
+  return name.str();
+}
+
+
+ShmRingWriter::ShmRingWriter(const std::string& name_, size_t slots, size_t capacity)
+: name(name_), slot_size(SLOT_HEADER_SIZE + (capacity + 63) / 64 * 64)
+{
+  slots = std::max<size_t>(slots, 2); // readers need one slot the writer isn't in
+  bip::shared_memory_object::remove(name.c_str()); // left over from a run that didn't exit cleanly
+  memory = bip::shared_memory_object(bip::create_only, name.c_str(), bip::read_write);
+  memory.truncate(SLOT_HEADER_SIZE + slots * slot_size);
+  region = bip::mapped_region(memory, bip::read_write);
+
+  char* base = static_cast<char*>(region.get_address());
+  header = new (base) shm_ring_header_t;
+  if (!header->written.is_lock_free() || !header->posted.is_lock_free())
+    std::cerr << "WARNING: Shared memory ring atomics aren't lock-free here; readers in other processes may misbehave." << std::endl;
+
+  memcpy(header->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC));
+  header->version    = SHM_RING_VERSION;
+  header->slot_count = slots;
+  header->slot_size  = slot_size;
+  header->written    = 0;
+  header->posted     = 0;
+  header->shutdown   = 0;
+
+  for (size_t i = 0; i < slots; ++i) {
+    shm_slot_header_t* slot = new (base + SLOT_HEADER_SIZE + i * slot_size) shm_slot_header_t;
+    slot->sequence = 0;
+    slot->size     = 0;
+  }
+
+  std::cerr << "Writing clouds to shared memory ring " << name << " (" << slots << " slots of " << capacity << " bytes)" << std::endl;
+}
+
+
+ShmRingWriter::~ShmRingWriter() {
+  shutdown();
+  bip::shared_memory_object::remove(name.c_str());
+}
+
+
+bool ShmRingWriter::write(const char* data, size_t size) {
+  if (size > capacity()) {
+    std::cerr << "Error: message of " << size << " bytes doesn't fit in the shared memory ring's " << capacity() << "-byte slots" << std::endl;
+    return false;
+  }
+
+  memcpy(begin_write(), data, size);
+  end_write(size);
+  return true;
+}
+
+
+char* ShmRingWriter::begin_write() {
+  uint64_t n = header->written.load(boost::memory_order_relaxed);
+  char* base = static_cast<char*>(region.get_address()) + SLOT_HEADER_SIZE + (n % header->slot_count) * slot_size;
+  shm_slot_header_t* slot = reinterpret_cast<shm_slot_header_t*>(base);
+
+  // Seqlock: readers that see an odd sequence, or a different one after they've read, retry or skip.
+  slot->sequence.store(2*n + 1, boost::memory_order_relaxed);
+  boost::atomic_thread_fence(boost::memory_order_release);
+  return base + SLOT_HEADER_SIZE;
+}
+
+
+void ShmRingWriter::end_write(size_t size) {
+  uint64_t n = header->written.load(boost::memory_order_relaxed);
+  shm_slot_header_t* slot = reinterpret_cast<shm_slot_header_t*>(static_cast<char*>(region.get_address()) + SLOT_HEADER_SIZE +
+                                                                  (n % header->slot_count) * slot_size);
+  slot->size = std::min(size, capacity());
+  slot->sequence.store(2*n + 2, boost::memory_order_release);
+
+  header->written.store(n + 1, boost::memory_order_release);
+  wake_readers(header->posted);
+}
+
+
+void ShmRingWriter::shutdown() {
+  if (header->shutdown.exchange(1)) return;
+  wake_readers(header->posted);
+}
+
+
+ShmRingReader::ShmRingReader(const std::string& name)
+: memory(bip::open_only, name.c_str(), bip::read_write), region(memory, bip::read_write), drops(0), held(NULL), held_sequence(0)
+{
+  header = static_cast<shm_ring_header_t*>(region.get_address());
+  if (region.get_size() < sizeof(shm_ring_header_t) || memcmp(header->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC)) != 0 ||
+      header->version != SHM_RING_VERSION ||
+      region.get_size() < ShmRingWriter::SLOT_HEADER_SIZE + header->slot_count * header->slot_size) {
+    std::cerr << "Error: " << name << " isn't a shared memory ring this subscriber can read" << std::endl;
+    header = NULL;
+    next = 0;
+    return;
+  }
+  next = header->written.load(boost::memory_order_acquire);
+}
+
+
+recv_result_t ShmRingReader::acquire(const char*& data, size_t& size, int timeout_ms, bool latest) {
+  held = NULL;
+  if (!header) return RECV_FAILURE;
+
+  const uint64_t slots = header->slot_count;
+  const char* base = static_cast<const char*>(region.get_address()) + ShmRingWriter::SLOT_HEADER_SIZE;
+  bool waited = false;
+
+  while (true) {
+    uint32_t posted = header->posted.load(boost::memory_order_acquire);
+    uint64_t written = header->written.load(boost::memory_order_acquire);
+
+    if (written == next) {
+      if (header->shutdown.load(boost::memory_order_acquire)) return RECV_SHUTDOWN;
+      if (waited && timeout_ms >= 0) return RECV_NOUPDATE;
+      wait_for_post(header->posted, posted, timeout_ms);
+      waited = true;
+      continue;
+    }
+
+    // Anything more than a ring behind has been overwritten (and the oldest slot may be next).
+    uint64_t oldest = latest ? written - 1 : (written > slots - 1 ? written - (slots - 1) : 0);
+    if (next < oldest) {
+      drops += oldest - next;
+      next = oldest;
+    }
+
+    const shm_slot_header_t* slot = reinterpret_cast<const shm_slot_header_t*>(base + (next % slots) * header->slot_size);
+    uint64_t sequence = slot->sequence.load(boost::memory_order_acquire);
+    ++next;
+    if (sequence == 2*next) {
+      size = slot->size;
+      if (size <= header->slot_size - ShmRingWriter::SLOT_HEADER_SIZE) {
+        data          = reinterpret_cast<const char*>(slot) + ShmRingWriter::SLOT_HEADER_SIZE;
+        held          = slot;
+        held_sequence = sequence;
+        return RECV_SUCCESS;
+      }
+    }
+
+    // The writer has already lapped us here.
+    ++drops;
+  }
+}
+
+
+bool ShmRingReader::valid() {
+  if (!held) return false;
+
+  // Everything read from the slot has to be read before the sequence is checked again.
+  boost::atomic_thread_fence(boost::memory_order_acquire);
+  if (held->sequence.load(boost::memory_order_relaxed) == held_sequence) return true;
+
+  ++drops;
+  held = NULL;
+  return false;
+}
+
+
+recv_result_t ShmRingReader::read(std::vector<char>& message, int timeout_ms, bool latest) {
+  while (true) {
+    const char* data;
+    size_t size;
+    recv_result_t result = acquire(data, size, timeout_ms, latest);
+    if (result != RECV_SUCCESS) return result;
+
+    message.resize(size);
+    if (size) memcpy(&message[0], data, size);
+    if (valid()) return RECV_SUCCESS;
+  }
+}
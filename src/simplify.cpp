@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "simplify.h"
+
+const char     LOD_CACHE_MAGIC[8] = {'G','L','I','D','L','O','D','\0'};
+const uint32_t LOD_CACHE_VERSION  = 1;
+
+
+/*
+ * Per-cell accumulator: a quadric (symmetric 4x4, upper triangle only) plus the averages we fall back
+ * on and use for the attributes.
+ */
+struct Cluster {
+  double q[10]; // aa ab ac ad bb bc bd cc cd dd
+  glm::dvec3 position_sum;
+  glm::vec3  normal_sum;
+  glm::vec2  diffuse_tex_sum;
+  glm::vec2  specular_tex_sum;
+  size_t     count;
+  glm::vec3  cell_min;
+  glm::vec3  cell_max;
+  unsigned int output_index;
+
+  Cluster()
+  : position_sum(0.0), normal_sum(0.0f), diffuse_tex_sum(0.0f), specular_tex_sum(0.0f), count(0), output_index(0)
+  {
+    std::fill(q, q + 10, 0.0);
+  }
+
+  void add_plane(const glm::dvec3& n, double d, double weight) {
+    q[0] += weight * n.x * n.x; q[1] += weight * n.x * n.y; q[2] += weight * n.x * n.z; q[3] += weight * n.x * d;
+    q[4] += weight * n.y * n.y; q[5] += weight * n.y * n.z; q[6] += weight * n.y * d;
+    q[7] += weight * n.z * n.z; q[8] += weight * n.z * d;
+    q[9] += weight * d * d;
+  }
+
+  /** Find the point in the cell with the lowest quadric error. Falls back on the vertex average (which is
+   *  always inside the cell) when the quadric is singular, e.g. on flat or cylindrical patches.
+   */
+  glm::vec3 representative() const {
+    glm::dvec3 mean = position_sum / static_cast<double>(count);
+
+    // Solve A x = -b by Cramer's rule.
+    double a11 = q[0], a12 = q[1], a13 = q[2],
+           a22 = q[4], a23 = q[5],
+           a33 = q[7];
+    double b1 = -q[3], b2 = -q[6], b3 = -q[8];
+
+    double det = a11 * (a22 * a33 - a23 * a23) - a12 * (a12 * a33 - a23 * a13) + a13 * (a12 * a23 - a22 * a13);
+    double scale = a11 + a22 + a33;
+
+    if (scale <= 0.0 || std::fabs(det) < 1e-9 * scale * scale * scale)
+      return glm::vec3(mean);
+
+    glm::dvec3 x((b1 * (a22 * a33 - a23 * a23) - a12 * (b2 * a33 - a23 * b3) + a13 * (b2 * a23 - a22 * b3)) / det,
+                 (a11 * (b2 * a33 - b3 * a23) - b1 * (a12 * a33 - a23 * a13) + a13 * (a12 * b3 - b2 * a13)) / det,
+                 (a11 * (a22 * b3 - a23 * b2) - a12 * (a12 * b3 - b2 * a13) + b1 * (a12 * a23 - a22 * a13)) / det);
+
+    glm::vec3 result(x);
+    if (glm::any(glm::lessThan(result, cell_min)) || glm::any(glm::greaterThan(result, cell_max)))
+      return glm::vec3(mean);
+
+    return result;
+  }
+};
+
+
+/*
+ * A triangle of cluster indices, ordered so that duplicates sort together.
+ */
+struct ClusterTriangle {
+  unsigned int v[3];
+
+  ClusterTriangle(unsigned int a, unsigned int b, unsigned int c) {
+    // Rotate so the smallest index comes first, preserving the winding.
+    if (b < a && b < c)      { v[0] = b; v[1] = c; v[2] = a; }
+    else if (c < a && c < b) { v[0] = c; v[1] = a; v[2] = b; }
+    else                     { v[0] = a; v[1] = b; v[2] = c; }
+  }
+
+  bool operator<(const ClusterTriangle& rhs) const {
+    return std::lexicographical_compare(v, v + 3, rhs.v, rhs.v + 3);
+  }
+
+  bool operator==(const ClusterTriangle& rhs) const {
+    return v[0] == rhs.v[0] && v[1] == rhs.v[1] && v[2] == rhs.v[2];
+  }
+};
+
+
+void simplify_by_clustering(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, float cell_size, LodLevel& lod) {
+  lod.vertices.clear();
+  lod.indices.clear();
+  lod.error = 0.0f;
+
+  if (vertices.empty() || indices.empty()) return;
+
+  glm::vec3 lo(vertices[0].pos), hi(lo);
+  for (size_t i = 1; i < vertices.size(); ++i) {
+    lo = glm::min(lo, vertices[i].pos);
+    hi = glm::max(hi, vertices[i].pos);
+  }
+
+  // Assign each vertex a cell key (21 bits per axis), then sort so that vertices in the same cell are adjacent.
+  std::vector<std::pair<uint64_t, unsigned int> > keys(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    glm::vec3 c = glm::floor((vertices[i].pos - lo) / cell_size);
+    uint64_t ix = std::min<uint64_t>(static_cast<uint64_t>(c.x), 0x1fffff),
+             iy = std::min<uint64_t>(static_cast<uint64_t>(c.y), 0x1fffff),
+             iz = std::min<uint64_t>(static_cast<uint64_t>(c.z), 0x1fffff);
+    keys[i] = std::make_pair(ix | (iy << 21) | (iz << 42), static_cast<unsigned int>(i));
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<unsigned int> cluster_of(vertices.size());
+  std::vector<Cluster> clusters;
+  for (size_t k = 0; k < keys.size(); ++k) {
+    if (k == 0 || keys[k].first != keys[k-1].first) {
+      clusters.push_back(Cluster());
+      uint64_t key = keys[k].first;
+      glm::vec3 cell(static_cast<float>(key & 0x1fffff), static_cast<float>((key >> 21) & 0x1fffff), static_cast<float>(key >> 42));
+      clusters.back().cell_min = glm::max(lo, lo + cell * cell_size);
+      clusters.back().cell_max = glm::min(hi, lo + (cell + 1.0f) * cell_size);
+    }
+
+    const Vertex& v = vertices[keys[k].second];
+    Cluster& cluster = clusters.back();
+    cluster.position_sum     += glm::dvec3(v.pos);
+    cluster.normal_sum       += v.normal;
+    cluster.diffuse_tex_sum  += v.diffuse_tex;
+    cluster.specular_tex_sum += v.specular_tex;
+    cluster.count++;
+
+    cluster_of[keys[k].second] = clusters.size() - 1;
+  }
+
+  // Accumulate area-weighted plane quadrics and collect the triangles that survive clustering.
+  std::vector<ClusterTriangle> triangles;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    glm::dvec3 p0(vertices[indices[i]].pos), p1(vertices[indices[i+1]].pos), p2(vertices[indices[i+2]].pos);
+    glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+    double length = glm::length(n);
+
+    unsigned int c0 = cluster_of[indices[i]], c1 = cluster_of[indices[i+1]], c2 = cluster_of[indices[i+2]];
+
+    if (length > 0.0) {
+      n /= length;
+      double d = -glm::dot(n, p0);
+      double area = 0.5 * length;
+      clusters[c0].add_plane(n, d, area);
+      clusters[c1].add_plane(n, d, area);
+      clusters[c2].add_plane(n, d, area);
+    }
+
+    if (c0 == c1 || c1 == c2 || c0 == c2) continue;
+    triangles.push_back(ClusterTriangle(c0, c1, c2));
+  }
+
+  std::sort(triangles.begin(), triangles.end());
+  triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+  // Emit only the clusters that are still referenced by a triangle.
+  const unsigned int UNUSED = 0xFFFFFFFF;
+  for (size_t c = 0; c < clusters.size(); ++c)
+    clusters[c].output_index = UNUSED;
+
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    for (size_t k = 0; k < 3; ++k) {
+      Cluster& cluster = clusters[triangles[t].v[k]];
+      if (cluster.output_index == UNUSED) {
+        float inverse_count = 1.0f / static_cast<float>(cluster.count);
+        glm::vec3 normal = cluster.normal_sum;
+        if (glm::length(normal) > 0.0f) normal = glm::normalize(normal);
+
+        cluster.output_index = lod.vertices.size();
+        lod.vertices.push_back(Vertex(cluster.representative(),
+                                      cluster.diffuse_tex_sum * inverse_count,
+                                      cluster.specular_tex_sum * inverse_count,
+                                      normal));
+      }
+      lod.indices.push_back(cluster.output_index);
+    }
+  }
+
+  lod.error = std::sqrt(3.0f) * cell_size;
+}
+
+
+void build_lod_chain(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, lod_chain_t& chain) {
+  chain.clear();
+  if (vertices.empty()) return;
+
+  glm::vec3 lo(vertices[0].pos), hi(lo);
+  for (size_t i = 1; i < vertices.size(); ++i) {
+    lo = glm::min(lo, vertices[i].pos);
+    hi = glm::max(hi, vertices[i].pos);
+  }
+  glm::vec3 extent = hi - lo;
+  float largest = std::max(extent.x, std::max(extent.y, extent.z));
+  if (largest <= 0.0f) return;
+
+  size_t previous_triangles = indices.size() / 3;
+  if (previous_triangles <= LOD_MIN_TRIANGLES) return;
+
+  for (float cell = largest * LOD_INITIAL_CELL_RATIO; cell < largest && chain.size() < MAX_LOD_LEVELS; cell *= 2.0f) {
+    LodLevel level;
+    simplify_by_clustering(vertices, indices, cell, level);
+
+    size_t triangles = level.indices.size() / 3;
+    if (triangles == 0) break;
+
+    // Not worth the memory unless it's noticeably smaller than the last level.
+    if (triangles > previous_triangles * LOD_MIN_REDUCTION) continue;
+
+    chain.push_back(level);
+    previous_triangles = triangles;
+
+    if (triangles < LOD_MIN_TRIANGLES) break;
+  }
+}
+
+
+/*
+ * Cache file layout (native endianness; it's a cache, not an interchange format):
+ *
+ *   magic[8] version:u32 model_size:u64 model_mtime:u64 entry_count:u32
+ *   for each entry:  level_count:u32
+ *     for each level: error:f32 vertex_count:u32 index_count:u32 vertices[] indices[]
+ */
+
+static std::string lod_cache_filename(const std::string& model_filename) {
+  return model_filename + ".lod";
+}
+
+static bool model_signature(const std::string& model_filename, uint64_t& size, uint64_t& mtime) {
+  struct stat st;
+  if (stat(model_filename.c_str(), &st) != 0) return false;
+  size  = static_cast<uint64_t>(st.st_size);
+  mtime = static_cast<uint64_t>(st.st_mtime);
+  return true;
+}
+
+template <typename T>
+static bool read_value(std::istream& in, T& value) {
+  in.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return in.good();
+}
+
+template <typename T>
+static void write_value(std::ostream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+bool load_lod_cache(const std::string& model_filename, size_t entry_count, std::vector<lod_chain_t>& chains) {
+  uint64_t size, mtime;
+  if (!model_signature(model_filename, size, mtime)) return false;
+
+  std::ifstream in(lod_cache_filename(model_filename).c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open()) return false;
+
+  char magic[8];
+  uint32_t version, cached_entries;
+  uint64_t cached_size, cached_mtime;
+
+  in.read(magic, 8);
+  if (!in.good() || !std::equal(magic, magic + 8, LOD_CACHE_MAGIC)) return false;
+  if (!read_value(in, version) || version != LOD_CACHE_VERSION) return false;
+  if (!read_value(in, cached_size) || !read_value(in, cached_mtime) || cached_size != size || cached_mtime != mtime) {
+    std::cerr << "LOD cache for '" << model_filename << "' is stale; regenerating." << std::endl;
+    return false;
+  }
+  if (!read_value(in, cached_entries) || cached_entries != entry_count) return false;
+
+  chains.clear();
+  chains.resize(entry_count);
+
+  for (size_t e = 0; e < entry_count; ++e) {
+    uint32_t level_count;
+    if (!read_value(in, level_count)) return false;
+    chains[e].resize(level_count);
+
+    for (size_t l = 0; l < level_count; ++l) {
+      LodLevel& level = chains[e][l];
+      uint32_t vertex_count, index_count;
+      if (!read_value(in, level.error) || !read_value(in, vertex_count) || !read_value(in, index_count)) return false;
+
+      level.vertices.resize(vertex_count);
+      level.indices.resize(index_count);
+      if (vertex_count) in.read(reinterpret_cast<char*>(&level.vertices[0]), sizeof(Vertex) * vertex_count);
+      if (index_count)  in.read(reinterpret_cast<char*>(&level.indices[0]), sizeof(unsigned int) * index_count);
+      if (!in.good()) return false;
+    }
+  }
+
+  std::cerr << "Read levels of detail from " << lod_cache_filename(model_filename) << std::endl;
+  return true;
+}
+
+
+bool save_lod_cache(const std::string& model_filename, const std::vector<lod_chain_t>& chains) {
+  uint64_t size, mtime;
+  if (!model_signature(model_filename, size, mtime)) return false;
+
+  std::string filename = lod_cache_filename(model_filename);
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "WARNING: Unable to write LOD cache '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  out.write(LOD_CACHE_MAGIC, 8);
+  write_value(out, LOD_CACHE_VERSION);
+  write_value(out, size);
+  write_value(out, mtime);
+  write_value(out, static_cast<uint32_t>(chains.size()));
+
+  for (size_t e = 0; e < chains.size(); ++e) {
+    write_value(out, static_cast<uint32_t>(chains[e].size()));
+    for (size_t l = 0; l < chains[e].size(); ++l) {
+      const LodLevel& level = chains[e][l];
+      write_value(out, level.error);
+      write_value(out, static_cast<uint32_t>(level.vertices.size()));
+      write_value(out, static_cast<uint32_t>(level.indices.size()));
+      if (!level.vertices.empty()) out.write(reinterpret_cast<const char*>(&level.vertices[0]), sizeof(Vertex) * level.vertices.size());
+      if (!level.indices.empty())  out.write(reinterpret_cast<const char*>(&level.indices[0]), sizeof(unsigned int) * level.indices.size());
+    }
+  }
+
+  out.close();
+  std::cerr << "Wrote levels of detail to " << filename << std::endl;
+  return true;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef SIMPLIFY_H
+# define SIMPLIFY_H
+
+#include <string>
+#include <vector>
+
+#include "vertex_format.h"
+
+const size_t MAX_LOD_LEVELS         = 8;
+const size_t LOD_MIN_TRIANGLES      = 64;    // stop simplifying once a level is this small
+const float  LOD_MIN_REDUCTION      = 0.75f; // a level must have at most this fraction of the previous level's triangles
+const float  LOD_INITIAL_CELL_RATIO = 1.0f / 512.0f; // first clustering cell size, relative to the largest extent
+
+
+/** One simplified version of a mesh entry.
+ *
+ * error is a hard bound (in model units) on how far any point of the simplified surface can be from the
+ * corresponding point on the original surface.
+ */
+struct LodLevel {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  float error;
+
+  LodLevel() : error(0.0f) { }
+};
+
+typedef std::vector<LodLevel> lod_chain_t;
+
+
+/** Simplify a triangle mesh by clustering its vertices on a uniform grid.
+ *
+ * Each occupied cell is replaced by a single vertex placed where it minimizes the summed quadric error of the
+ * triangles around it (Garland and Heckbert 1997; Lindstrom 2000), restricted to the cell. Because every
+ * representative stays inside its cell, no vertex moves farther than the cell diagonal, which is the error
+ * reported in the result.
+ *
+ * @param[in] full-resolution vertices.
+ * @param[in] full-resolution triangle indices.
+ * @param[in] grid cell size (model units).
+ * @param[out] the simplified mesh.
+ */
+void simplify_by_clustering(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, float cell_size, LodLevel& lod);
+
+
+/** Produce a chain of progressively coarser levels of detail (not including the original mesh).
+ *
+ * Every level is simplified directly from the full-resolution mesh so that errors don't accumulate. Levels
+ * are ordered from finest to coarsest.
+ *
+ * @param[in] full-resolution vertices.
+ * @param[in] full-resolution triangle indices.
+ * @param[out] simplified levels.
+ */
+void build_lod_chain(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, lod_chain_t& chain);
+
+
+/** Read previously generated levels of detail for a model.
+ *
+ * The cache lives next to the model (filename + ".lod") and is only used if the model's size and
+ * modification time match those recorded when it was written.
+ *
+ * @param[in] model filename.
+ * @param[in] number of mesh entries in the model.
+ * @param[out] one chain per entry.
+ *
+ * \returns true if a valid cache was read.
+ */
+bool load_lod_cache(const std::string& model_filename, size_t entry_count, std::vector<lod_chain_t>& chains);
+
+
+/** Write levels of detail for a model so the next import can skip simplification.
+ *
+ * @param[in] model filename.
+ * @param[in] one chain per entry.
+ *
+ * \returns true if the cache was written.
+ */
+bool save_lod_cache(const std::string& model_filename, const std::vector<lod_chain_t>& chains);
+
+
+#endif // SIMPLIFY_H
@@ -32,10 +32,14 @@
 #include <iostream>
 #include <sstream>
 #include <cstdio>
+#include <limits>
+
+#include <pcl/io/lzf.h>
 
 #include "service/subscribe.h"
 
-void sync_subscribe(zmq::socket_t& subscriber, zmq::socket_t& sync_client, int port, int highwater, char type) {
+void sync_subscribe(zmq::socket_t& subscriber, zmq::socket_t& sync_client, int port, int highwater, char type,
+                    const std::string& transport) {
   subscriber.setsockopt(ZMQ_SUBSCRIBE, &type, 1); // subscribe to either 'c'louds or 'p'oses
   if (highwater == 0) {
     int conflate = 1;
@@ -43,13 +47,8 @@ void sync_subscribe(zmq::socket_t& subscriber, zmq::socket_t& sync_client, int p
   } else
     subscriber.setsockopt(ZMQ_RCVHWM, &highwater, sizeof(int));
 
-  std::ostringstream subscribe_address, sync_address;
-
-  subscribe_address << "tcp://localhost:" << port << std::flush;
-  sync_address      << "tcp://localhost:" << port+1 << std::flush;
-    
-  std::string subscribe_address_string = subscribe_address.str(),
-      sync_address_string = sync_address.str();
+  std::string subscribe_address_string = service_endpoint(transport, port, false),
+      sync_address_string = service_endpoint(transport, port+1, false);
     
   subscriber.connect(subscribe_address_string.c_str());
   sync_client.connect(sync_address_string.c_str());
@@ -69,7 +68,7 @@ void sync_subscribe(zmq::socket_t& subscriber, zmq::socket_t& sync_client, int p
 }
 
 
-void subscribe(zmq::socket_t& subscriber, int port, int highwater) {
+void subscribe(zmq::socket_t& subscriber, int port, int highwater, const std::string& transport) {
   subscriber.setsockopt(ZMQ_SUBSCRIBE, NULL, 0); // subscribe to all
   if (highwater == 0) {
     int conflate = 1;
@@ -77,9 +76,7 @@ void subscribe(zmq::socket_t& subscriber, int port, int highwater) {
   } else
     subscriber.setsockopt(ZMQ_RCVHWM, &highwater, sizeof(int));
 
-  std::ostringstream address;
-  address << "tcp://localhost:" << port << std::flush;
-  std::string address_string = address.str();
+  std::string address_string = service_endpoint(transport, port, false);
   
   std::cerr << "Subscribing to " << address_string << "..." << std::flush;
   subscriber.connect(address_string.c_str());
@@ -87,6 +84,24 @@ void subscribe(zmq::socket_t& subscriber, int port, int highwater) {
 }
 
 
+void connect_acknowledgements(zmq::socket_t& acknowledgements, int port, const std::string& transport) {
+  int linger = 0; // don't hold up exit for acknowledgements nobody will read
+  acknowledgements.setsockopt(ZMQ_LINGER, &linger, sizeof(int));
+  std::string address = service_endpoint(transport, port+2, false);
+  acknowledgements.connect(address.c_str());
+}
+
+
+void send_acknowledgement(zmq::socket_t& acknowledgements, uint32_t subscriber, const wire_header_t& header) {
+  zmq::message_t message(1 + sizeof(uint32_t) + sizeof(uint64_t));
+  char* bytes = static_cast<char*>(message.data());
+  bytes[0] = 'a';
+  memcpy(bytes + 1, &subscriber, sizeof(uint32_t));
+  memcpy(bytes + 1 + sizeof(uint32_t), &header.frame_id, sizeof(uint64_t));
+  acknowledgements.send(message, ZMQ_NOBLOCK);
+}
+
+
 bool received_shutdown(zmq::message_t& msg) {
   const char KTHXBAI[] = "KTHXBAI";
   char* str = static_cast<char*>(msg.data()) + 1;
@@ -126,6 +141,22 @@ recv_result_t receive_poses(zmq::socket_t& subscriber, pose_message_t::ptr& pose
 }
 
 
+recv_result_t receive_pose_batch(zmq::socket_t& subscriber, PoseBatchView& poses, int flags) {
+  zmq::message_t message;
+  bool result = subscriber.recv(&message, flags);
+
+  if ((flags & ZMQ_NOBLOCK) && !result)
+    return RECV_NOUPDATE;
+  else if (!result)
+    return RECV_FAILURE;
+
+  if (received_shutdown(message))
+    return RECV_SHUTDOWN;
+
+  return poses.decode(message) ? RECV_SUCCESS : RECV_FAILURE;
+}
+
+
 recv_result_t receive_pose(zmq::socket_t& subscriber, Eigen::Matrix4f& pose, unsigned long& timestamp, int flags) {
   zmq::message_t message;
   bool result = subscriber.recv(&message, flags);
@@ -138,22 +169,125 @@ recv_result_t receive_pose(zmq::socket_t& subscriber, Eigen::Matrix4f& pose, uns
   else if (!result)
     return RECV_FAILURE;
 
-  if ((message.size() - sizeof(unsigned long) - sizeof(char)) / sizeof(float) == 16) {
+  if (received_shutdown(message))
+    return RECV_SHUTDOWN;
+
+  wire_header_t header;
+  if (!parse_wire_header(message, header) || header.type != 'p') {
+    std::cerr << "Received a message of size " << message.size() << ", expected pose, don't know how to continue." << std::endl;
+    return RECV_FAILURE;
+  }
 
-    std::cerr << "Received a 4x4 matrix" << std::endl;
+  std::cerr << "Received a 4x4 matrix" << std::endl;
+  timestamp = header.frame_id;
+  for (size_t i = 0; i < 16; ++i)
+    pose.data()[i] = header.pose[i];
 
-   void* timestamp_pos = static_cast<void*>(static_cast<char*>(message.data()) + 1);
+  return RECV_SUCCESS;
+}
 
-    memcpy(&timestamp, timestamp_pos, sizeof(unsigned long));
-    memcpy(pose.data(), static_cast<void*>(static_cast<char*>(message.data()) + sizeof(unsigned long) + sizeof(char)), sizeof(Eigen::Matrix4f));
-    return RECV_SUCCESS;
 
-  } else if (received_shutdown(message)) {
+/*
+ * Throw away the rest of a multipart message.
+ */
+static void discard_remaining_parts(zmq::socket_t& subscriber) {
+  int more = 1;
+  size_t more_size = sizeof(int);
+  subscriber.getsockopt(ZMQ_RCVMORE, static_cast<void*>(&more), &more_size);
+  while (more) {
+    zmq::message_t part;
+    subscriber.recv(&part);
+    subscriber.getsockopt(ZMQ_RCVMORE, static_cast<void*>(&more), &more_size);
+  }
+}
+
+
+recv_result_t receive_cloud_message(zmq::socket_t& subscriber, wire_header_t& header, zmq::message_t& payload, int flags) {
+  zmq::message_t message;
+  bool result = subscriber.recv(&message, flags);
+
+  if ((flags & ZMQ_NOBLOCK) && !result)
+    return RECV_NOUPDATE;
+  else if (!result)
+    return RECV_FAILURE;
+
+  if (received_shutdown(message))
     return RECV_SHUTDOWN;
 
-  } else {
-    std::cerr << "Received a message of size " << message.size() << ", expected pose, don't know how to continue." << std::endl;
+  int more = 0;
+  size_t more_size = sizeof(int);
+  subscriber.getsockopt(ZMQ_RCVMORE, static_cast<void*>(&more), &more_size);
+
+  if (!parse_wire_header(message, header) || !more) {
+    if (!more) std::cerr << "Received a message of size " << message.size() << " without a point cloud part" << std::endl;
+    discard_remaining_parts(subscriber);
     return RECV_FAILURE;
   }
+
+  // The rest of a multipart message has already arrived, so this doesn't block.
+  subscriber.recv(&payload);
+  discard_remaining_parts(subscriber); // parts a newer publisher might add
+
+  if (payload.size() < header.payload_size()) {
+    std::cerr << "Point cloud part of " << payload.size() << " bytes is too short for " << header.point_count << " points" << std::endl;
+    return RECV_FAILURE;
+  }
+
+  return RECV_SUCCESS;
 }
 
+
+bool decode_point_cloud(wire_header_t& header, const char* payload, size_t size, std::vector<char>& scratch, std::vector<float>& points) {
+  size_t count = header.point_count;
+  size_t bytes = count * header.point_stride;
+
+  if (header.flags & WIRE_COMPRESSED) {
+    scratch.resize(bytes + 1);
+    if (bytes && pcl::lzfDecompress(payload, std::min<size_t>(size, header.encoded_size), &scratch[0], bytes) != bytes) {
+      std::cerr << "Error: unable to decompress a point cloud of " << count << " points" << std::endl;
+      return false;
+    }
+    payload = &scratch[0];
+  }
+
+  uint16_t fields = header.fields;
+  uint32_t stride = (header.flags & WIRE_QUANTIZED) ? wire_header_t::wire_point_stride(fields) : header.point_stride;
+  size_t floats   = stride / sizeof(float);
+  points.resize(count * floats + 1);
+
+  if (!(header.flags & WIRE_QUANTIZED)) {
+    memcpy(&points[0], payload, bytes);
+  } else {
+    bool intensity_8 = (header.flags & WIRE_INTENSITY_8) != 0;
+    const float no_return = std::numeric_limits<float>::quiet_NaN();
+
+    for (size_t i = 0; i < count; ++i) {
+      const char* q = payload + i * header.point_stride;
+      float* p = &points[i * floats];
+
+      int16_t steps[3];
+      memcpy(steps, q, sizeof(steps));
+      q += sizeof(steps);
+      for (size_t j = 0; j < 3; ++j)
+        *(p++) = steps[0] == std::numeric_limits<int16_t>::min() ? no_return : header.origin[j] + steps[j] * header.scale[j];
+
+      if (fields & WIRE_INTENSITY) {
+        if (intensity_8) {
+          *(p++) = *reinterpret_cast<const uint8_t*>(q) / 256.0f;
+          q += 1;
+        } else {
+          uint16_t value;
+          memcpy(&value, q, sizeof(uint16_t));
+          *(p++) = value / 65536.0f;
+          q += 2;
+        }
+      }
+      if (fields & WIRE_INDEX) memcpy(p, q, sizeof(uint32_t));
+    }
+  }
+
+  header.flags       &= ~WIRE_ENCODINGS;
+  header.point_stride = stride;
+  header.encoded_size = 0;
+  return true;
+}
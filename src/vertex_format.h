@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2014 - 2015, John O. Woods, Ph.D.
+ *   West Virginia University Applied Space Exploration Lab
+ *   West Virginia Robotic Technology Center
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the FreeBSD Project.
+ */
+
+#ifndef VERTEX_FORMAT_H
+# define VERTEX_FORMAT_H
+
+#include <cmath>
+#include <cstddef> // offsetof
+#include <cstring>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Use this struct to represent vertex coordinates, texture coordinates, and the normal coordinates for this vertex.
+struct Vertex
+{
+  glm::vec3 pos;
+  glm::vec2 diffuse_tex;
+  glm::vec2 specular_tex;
+  glm::vec3 normal;
+
+  Vertex() {}
+
+  Vertex(const glm::vec3& pos_, const glm::vec2& dtex_, const glm::vec2& stex_, const glm::vec3& normal_)
+  : pos(pos_), diffuse_tex(dtex_), specular_tex(stex_), normal(normal_)
+  {  }
+
+  float x() const { return pos.x; }
+  float y() const { return pos.y; }
+  float z() const { return pos.z; }
+};
+
+
+/*
+ * GPU-side vertex layouts.
+ *
+ * Meshes are uploaded as two streams: a position stream, and an attribute stream holding the texture
+ * coordinates and normals used for intensity. The lidar shader reads both, so the split alone saves no
+ * bandwidth (a shader that used only positions would skip the attribute stream); quantizing does. Either
+ * stream may optionally be quantized:
+ *
+ * * positions become 16-bit unsigned normalized values relative to the entry's bounding box (the
+ *   shader undoes this with the position_offset and position_scale uniforms);
+ * * normals are octahedrally encoded into two 16-bit signed normalized values;
+ * * texture coordinates become half floats.
+ *
+ * Quantized attributes need ARB_half_float_vertex; without it only the positions are quantized.
+ *
+ * The full interleaved Vertex is 40 bytes. The position stream is 12 bytes per vertex unquantized,
+ * or 8 bytes quantized (the fourth short is padding to keep attributes 4-byte aligned).
+ */
+
+struct PackedPosition {
+  GLushort x, y, z, pad;
+};
+
+struct PackedAttributes {
+  GLushort diffuse_tex[2];   // half floats
+  GLushort specular_tex[2];  // half floats
+  GLshort  normal[2];        // octahedral encoding
+};
+
+struct FloatAttributes {
+  glm::vec2 diffuse_tex;
+  glm::vec2 specular_tex;
+  glm::vec3 normal;
+};
+
+/*
+ * Skinned entries get a third stream: up to four bone influences per vertex, as bone indices (plain
+ * bytes, into the entry's bone palette) and weights (unsigned normalized bytes, summing to 255).
+ */
+const size_t MAX_BONE_INFLUENCES = 4;
+
+struct SkinWeights {
+  GLubyte bones[MAX_BONE_INFLUENCES];
+  GLubyte weights[MAX_BONE_INFLUENCES];
+};
+
+
+/** Convert a single-precision float to an IEEE 754 half-precision float.
+ *
+ * Rounds to nearest; values too large for a half become infinity, and values too small become zero.
+ *
+ * @param[in] value to convert.
+ *
+ * \returns The 16 bits of the half float.
+ */
+inline GLushort float_to_half(float value) {
+  unsigned int f;
+  memcpy(&f, &value, sizeof(float));
+
+  unsigned int sign     = (f >> 16) & 0x8000;
+  int          exponent = static_cast<int>((f >> 23) & 0xff) - 127 + 15;
+  unsigned int mantissa = f & 0x007fffff;
+
+  if (((f >> 23) & 0xff) == 0xff) // NaN or infinity
+    return static_cast<GLushort>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+  if (exponent >= 31) // overflow
+    return static_cast<GLushort>(sign | 0x7c00);
+
+  if (exponent <= 0) { // denormal or underflow
+    if (exponent < -10) return static_cast<GLushort>(sign);
+    mantissa |= 0x00800000;
+    unsigned int shift = static_cast<unsigned int>(14 - exponent);
+    unsigned int half_mantissa = mantissa >> shift;
+    if ((mantissa >> (shift - 1)) & 1) ++half_mantissa;
+    return static_cast<GLushort>(sign | half_mantissa);
+  }
+
+  unsigned int half = sign | (static_cast<unsigned int>(exponent) << 10) | (mantissa >> 13);
+  if (mantissa & 0x00001000) ++half; // round; may carry into the exponent, which is correct
+  return static_cast<GLushort>(half);
+}
+
+
+/** Convert a value in [-1,1] to a 16-bit signed normalized integer.
+ */
+inline GLshort float_to_snorm16(float value) {
+  if (value > 1.0f) value = 1.0f;
+  else if (value < -1.0f) value = -1.0f;
+  return static_cast<GLshort>(value >= 0.0f ? value * 32767.0f + 0.5f : value * 32767.0f - 0.5f);
+}
+
+
+/** Convert a value in [0,1] to a 16-bit unsigned normalized integer.
+ */
+inline GLushort float_to_unorm16(float value) {
+  if (value > 1.0f) value = 1.0f;
+  else if (value < 0.0f) value = 0.0f;
+  return static_cast<GLushort>(value * 65535.0f + 0.5f);
+}
+
+
+/** Encode a unit normal as a point on an octahedron folded into the unit square.
+ *
+ * See Cigolle et al. (2014), "A Survey of Efficient Representations for Independent Unit Vectors."
+ * spotv.glsl has the matching decoder.
+ *
+ * @param[in] normal (need not be normalized, but must be non-zero).
+ * @param[out] two 16-bit signed normalized components.
+ */
+inline void octahedral_encode(const glm::vec3& n, GLshort out[2]) {
+  float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+  if (l1 == 0.0f) {
+    out[0] = out[1] = 0;
+    return;
+  }
+
+  float x = n.x / l1, y = n.y / l1;
+  if (n.z < 0.0f) {
+    float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+
+  out[0] = float_to_snorm16(x);
+  out[1] = float_to_snorm16(y);
+}
+
+
+#endif // VERTEX_FORMAT_H